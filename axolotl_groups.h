@@ -22,20 +22,27 @@ public:
 
 
 	std::string unpad(std::string s) {
-		unsigned int pl = *(unsigned char*)&s[s.size() - 1];
+		unsigned int pl = s.size() ? *(unsigned char*)&s[s.size() - 1] : 0;
+		if (pl == 0 or pl > 16 or pl > s.size())
+			throw InvalidMessageException("Bad padding");
+		for (unsigned i = s.size() - pl; i < s.size(); i++)
+			if ((unsigned char)s[i] != pl)
+				throw InvalidMessageException("Bad padding");
 		return std::string(s.c_str(), s.size() - pl);
 	}
 
     std::string getPlainText(std::string iv, std::string key, std::string ciphertext) {
+		if (ciphertext.size() == 0 or ciphertext.size() % 16 != 0)
+			throw InvalidMessageException("Bad ciphertext size");
+
 		AES_KEY dec_key;
-		char outb[ciphertext.size()];
+		std::string out(ciphertext.size(), 0);
 		AES_set_decrypt_key((const unsigned char*)key.c_str(), key.size() * 8, &dec_key);
         AES_cbc_encrypt((const unsigned char*)ciphertext.c_str(),
-                        (unsigned char*)outb,
+                        (unsigned char*)&out[0],
                         ciphertext.size(), &dec_key,
                         (unsigned char*)iv.data(), AES_DECRYPT);
 
-		std::string out(outb, ciphertext.size());
 		return unpad(unpad(out));
     }
 
@@ -59,8 +66,8 @@ public:
     }
 
 	std::string encrypt(std::string paddedPlaintext) {
-		SenderKeyRecord record = senderKeyStore->loadSenderKey(this->senderKeyId);
-		SenderKeyState * senderKeyState = record.getSenderKeyState();
+		SenderKeyRecord * record = senderKeyStore->loadSenderKey(this->senderKeyId);
+		SenderKeyState * senderKeyState = record->getSenderKeyState();
 		SenderMessageKey senderKey = senderKeyState->getSenderChainKey().getSenderMessageKey();
 
 		std::string ciphertext = getCipherText(
@@ -70,49 +77,55 @@ public:
 
 
 		senderKeyState->setSenderChainKey(senderKeyState->getSenderChainKey().getNext());
-		senderKeyStore->storeSenderKey(this->senderKeyId, &record);
+		senderKeyStore->storeSenderKey(this->senderKeyId, record);
 
 		return senderKeyMessage.serialize();
 	}
 
+	// The record is the store's live one: the state only changes (and is
+	// stored) once the message decrypts
 	std::string decrypt(const std::string senderKeyMessageBytes) {
-		SenderKeyRecord record = senderKeyStore->loadSenderKey(this->senderKeyId);
-		SenderKeyMessage * senderKeyMessage = new SenderKeyMessage(senderKeyMessageBytes);
-
-		SenderKeyState * senderKeyState = record.getSenderKeyState(senderKeyMessage->getKeyId());
-
-		senderKeyMessage->verifySignature(senderKeyState->getSigningKeyPublic());
-		SenderMessageKey senderKey = this->getSenderKey(senderKeyState, senderKeyMessage->getIteration());
-
-		std::string plaintext = getPlainText(
-			senderKey.getIv(), senderKey.getCipherKey(), senderKeyMessage->getCipherText());
-
-		this->senderKeyStore->storeSenderKey(this->senderKeyId, &record);
+		SenderKeyRecord * record = senderKeyStore->loadSenderKey(this->senderKeyId);
+		SenderKeyMessage senderKeyMessage(senderKeyMessageBytes);
+
+		SenderKeyState * senderKeyState = record->getSenderKeyState(senderKeyMessage.getKeyId());
+
+		senderKeyMessage.verifySignature(senderKeyState->getSigningKeyPublic());
+
+		int iteration = senderKeyMessage.getIteration();
+		SenderChainKey senderChainKey = senderKeyState->getSenderChainKey();
+		std::string plaintext;
+
+		if (senderChainKey.getIteration() > iteration) {
+			if (!senderKeyState->hasSenderMessageKey(iteration))
+				throw DuplicateMessageException ("Received message with old counter: ");
+
+			SenderMessageKey senderKey = senderKeyState->getSenderMessageKey(iteration);
+			plaintext = getPlainText(
+				senderKey.getIv(), senderKey.getCipherKey(), senderKeyMessage.getCipherText());
+			senderKeyState->removeSenderMessageKey(iteration);
+		}
+		else {
+			if (iteration - senderChainKey.getIteration() > (int)SenderKeyState::MAX_MESSAGE_KEYS)
+				throw InvalidMessageException ("Over 2000 messages into the future!");
+
+			std::vector<SenderMessageKey> skipped;
+			while (senderChainKey.getIteration() < iteration) {
+				skipped.push_back(senderChainKey.getSenderMessageKey());
+				senderChainKey = senderChainKey.getNext();
+			}
+
+			SenderMessageKey senderKey = senderChainKey.getSenderMessageKey();
+			plaintext = getPlainText(
+				senderKey.getIv(), senderKey.getCipherKey(), senderKeyMessage.getCipherText());
+			for (auto & key: skipped)
+				senderKeyState->addSenderMessageKey(key);
+			senderKeyState->setSenderChainKey(senderChainKey.getNext());
+		}
+
+		this->senderKeyStore->storeSenderKey(this->senderKeyId, record);
 		return plaintext;
-    }
-
-    SenderMessageKey getSenderKey(SenderKeyState * senderKeyState, int iteration) {
-        SenderChainKey senderChainKey = senderKeyState->getSenderChainKey();
-
-        if (senderChainKey.getIteration() > iteration) {
-            if (senderKeyState->hasSenderMessageKey(iteration))
-                return senderKeyState->removeSenderMessageKey(iteration);
-            else
-                throw DuplicateMessageException ("Received message with old counter: ");
-        }
-
-        if (senderChainKey.getIteration() - iteration > 2000)
-            throw InvalidMessageException ("Over 2000 messages into the future!");
-
-        while (senderChainKey.getIteration() < iteration) {
-            senderKeyState->addSenderMessageKey(senderChainKey.getSenderMessageKey());
-            senderChainKey = senderChainKey.getNext();
-        }
-
-        senderKeyState->setSenderChainKey(senderChainKey.getNext());
-        return senderChainKey.getSenderMessageKey();
-    }
-
+	}
 };
 
 #endif
@@ -0,0 +1,244 @@
+
+#include "cryptopool.h"
+
+CryptoPool::CryptoPool(unsigned int nthreads)
+	: stopping(false)
+{
+	if (nthreads == 0)
+		nthreads = std::thread::hardware_concurrency();
+	if (nthreads == 0)
+		nthreads = 1;
+
+	for (unsigned int i = 0; i < nthreads; i++) {
+		Shard *s = new Shard();
+		s->posted = 0;
+		s->completed = 0;
+		shards.push_back(s);
+	}
+	for (auto s : shards)
+		s->thread = std::thread(&CryptoPool::work, this, s);
+}
+
+CryptoPool::~CryptoPool()
+{
+	stopping = true;
+	for (auto s : shards) {
+		std::lock_guard < std::mutex > l(s->lock);
+		s->cond.notify_one();
+	}
+	// Fenced jobs read the other shards until the last one is done
+	for (auto s : shards)
+		s->thread.join();
+	for (auto s : shards)
+		delete s;
+}
+
+void CryptoPool::post(uint64_t key, Job job, bool fenced)
+{
+	Entry e;
+	e.job = job;
+	if (fenced) {
+		for (auto s : shards) {
+			std::lock_guard < std::mutex > l(s->lock);
+			e.fence.push_back(s->posted);
+		}
+	}
+
+	Shard *s = shards[key % shards.size()];
+	std::lock_guard < std::mutex > l(s->lock);
+	s->jobs.push_back(std::move(e));
+	s->posted++;
+	s->cond.notify_one();
+}
+
+void CryptoPool::work(Shard * s)
+{
+	while (1) {
+		Entry e;
+		{
+			std::unique_lock < std::mutex > l(s->lock);
+			s->cond.wait(l, [this, s] () { return stopping or !s->jobs.empty(); });
+			if (s->jobs.empty())
+				return;
+			e = std::move(s->jobs.front());
+			s->jobs.pop_front();
+		}
+
+		// Earlier jobs only wait for even earlier ones, no cycles
+		if (!e.fence.empty()) {
+			std::unique_lock < std::mutex > l(done_lock);
+			done_cond.wait(l, [this, &e] () {
+				for (unsigned int i = 0; i < shards.size(); i++)
+					if (shards[i]->completed < e.fence[i])
+						return false;
+				return true;
+			});
+		}
+
+		e.job();
+
+		{
+			std::lock_guard < std::mutex > l(done_lock);
+			s->completed++;
+		}
+		done_cond.notify_all();
+	}
+}
+
+/* LockedAxolotlStore, forwards everything under the lock */
+
+IdentityKeyPair LockedAxolotlStore::getIdentityKeyPair()
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->getIdentityKeyPair();
+}
+
+unsigned int LockedAxolotlStore::getLocalRegistrationId()
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->getLocalRegistrationId();
+}
+
+void LockedAxolotlStore::storeLocalData(uint64_t registrationId, const IdentityKeyPair identityKeyPair)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->storeLocalData(registrationId, identityKeyPair);
+}
+
+void LockedAxolotlStore::saveIdentity(uint64_t recipientId, const IdentityKey & identityKey)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->saveIdentity(recipientId, identityKey);
+}
+
+bool LockedAxolotlStore::isTrustedIdentity(uint64_t recipientId, const IdentityKey & identityKey)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->isTrustedIdentity(recipientId, identityKey);
+}
+
+void LockedAxolotlStore::removeIdentity(uint64_t recipientId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->removeIdentity(recipientId);
+}
+
+PreKeyRecord LockedAxolotlStore::loadPreKey(uint64_t preKeyId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->loadPreKey(preKeyId);
+}
+
+void LockedAxolotlStore::storePreKey(uint64_t preKeyId, const PreKeyRecord & record)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->storePreKey(preKeyId, record);
+}
+
+bool LockedAxolotlStore::containsPreKey(uint64_t preKeyId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->containsPreKey(preKeyId);
+}
+
+void LockedAxolotlStore::removePreKey(uint64_t preKeyId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->removePreKey(preKeyId);
+}
+
+int LockedAxolotlStore::countPreKeys()
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->countPreKeys();
+}
+
+SessionRecord *LockedAxolotlStore::loadSession(uint64_t recipientId, int deviceId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->loadSession(recipientId, deviceId);
+}
+
+std::vector < int > LockedAxolotlStore::getSubDeviceSessions(uint64_t recipientId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->getSubDeviceSessions(recipientId);
+}
+
+void LockedAxolotlStore::storeSession(uint64_t recipientId, int deviceId, SessionRecord * record)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->storeSession(recipientId, deviceId, record);
+}
+
+bool LockedAxolotlStore::containsSession(uint64_t recipientId, int deviceId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->containsSession(recipientId, deviceId);
+}
+
+void LockedAxolotlStore::deleteSession(uint64_t recipientId, int deviceId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->deleteSession(recipientId, deviceId);
+}
+
+void LockedAxolotlStore::deleteAllSessions(uint64_t recipientId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->deleteAllSessions(recipientId);
+}
+
+SignedPreKeyRecord LockedAxolotlStore::loadSignedPreKey(uint64_t signedPreKeyId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->loadSignedPreKey(signedPreKeyId);
+}
+
+std::vector < SignedPreKeyRecord > LockedAxolotlStore::loadSignedPreKeys()
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->loadSignedPreKeys();
+}
+
+void LockedAxolotlStore::storeSignedPreKey(uint64_t signedPreKeyId, const SignedPreKeyRecord & record)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->storeSignedPreKey(signedPreKeyId, record);
+}
+
+bool LockedAxolotlStore::containsSignedPreKey(uint64_t signedPreKeyId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->containsSignedPreKey(signedPreKeyId);
+}
+
+void LockedAxolotlStore::removeSignedPreKey(uint64_t signedPreKeyId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->removeSignedPreKey(signedPreKeyId);
+}
+
+void LockedAxolotlStore::storeSenderKey(const ByteArray & senderKeyId, SenderKeyRecord * record)
+{
+	std::lock_guard < std::mutex > l(lock);
+	store->storeSenderKey(senderKeyId, record);
+}
+
+SenderKeyRecord *LockedAxolotlStore::loadSenderKey(const ByteArray & senderKeyId)
+{
+	std::lock_guard < std::mutex > l(lock);
+	return store->loadSenderKey(senderKeyId);
+}
+
+void LockedAxolotlStore::commit()
+{
+	// Always in index order, workers hold at most one
+	std::unique_lock < std::mutex > held[RECORD_LOCKS];
+	for (unsigned int i = 0; i < RECORD_LOCKS; i++)
+		held[i] = std::unique_lock < std::mutex > (records[i]);
+
+	std::lock_guard < std::mutex > l(lock);
+	store->commit();
+}
+
@@ -0,0 +1,109 @@
+
+#ifndef __CRYPTOPOOL__H__
+#define __CRYPTOPOOL__H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "state/axolotlstore.h"
+
+// Worker threads for the Axolotl decryption. Jobs are sharded by a key
+// (the chat, see JidAsInt) and run in order within their shard, so
+// different chats decrypt in parallel while each chat stays ordered.
+// One pool can serve many connections.
+class CryptoPool {
+public:
+	typedef std::function < void () > Job;
+private:
+	struct Entry {
+		Job job;
+		std::vector < unsigned long long > fence;   // Empty if not fenced
+	};
+	struct Shard {
+		std::mutex lock;
+		std::condition_variable cond;
+		std::deque < Entry > jobs;
+		unsigned long long posted;
+		std::atomic < unsigned long long > completed;
+		std::thread thread;
+	};
+	std::vector < Shard * > shards;
+	std::mutex done_lock;
+	std::condition_variable done_cond;
+	std::atomic < bool > stopping;
+
+	CryptoPool(const CryptoPool &);
+	CryptoPool & operator=(const CryptoPool &);
+
+	void work(Shard * s);
+	void post(uint64_t key, Job job, bool fenced);
+public:
+	// One worker per core by default
+	CryptoPool(unsigned int nthreads = 0);
+	// Runs the jobs already posted before returning
+	~CryptoPool();
+
+	// Any thread
+	void post(uint64_t key, Job job) { post(key, job, false); }
+	// Also waits for every job posted before it, in any shard
+	void postFenced(uint64_t key, Job job) { post(key, job, true); }
+
+	unsigned int size() const { return shards.size(); }
+};
+
+// Store shared by the connection and the workers: every call is
+// serialized, and the load, update and store cycle of a session or
+// sender key record holds the record lock for its key meanwhile.
+class LockedAxolotlStore : public AxolotlStore {
+private:
+	enum { RECORD_LOCKS = 64 };
+	std::shared_ptr < AxolotlStore > store;
+	mutable std::mutex lock;
+	std::mutex records[RECORD_LOCKS];
+public:
+	LockedAxolotlStore(std::shared_ptr < AxolotlStore > store) : store(store) {}
+
+	std::mutex & recordLock(uint64_t key) { return records[key % RECORD_LOCKS]; }
+
+	IdentityKeyPair getIdentityKeyPair();
+	unsigned int getLocalRegistrationId();
+	void storeLocalData(uint64_t registrationId, const IdentityKeyPair identityKeyPair);
+	void saveIdentity(uint64_t recipientId, const IdentityKey & identityKey);
+	bool isTrustedIdentity(uint64_t recipientId, const IdentityKey & identityKey);
+	void removeIdentity(uint64_t recipientId);
+
+	PreKeyRecord loadPreKey(uint64_t preKeyId);
+	void storePreKey(uint64_t preKeyId, const PreKeyRecord & record);
+	bool containsPreKey(uint64_t preKeyId);
+	void removePreKey(uint64_t preKeyId);
+	int countPreKeys();
+
+	SessionRecord *loadSession(uint64_t recipientId, int deviceId);
+	std::vector < int > getSubDeviceSessions(uint64_t recipientId);
+	void storeSession(uint64_t recipientId, int deviceId, SessionRecord * record);
+	bool containsSession(uint64_t recipientId, int deviceId);
+	void deleteSession(uint64_t recipientId, int deviceId);
+	void deleteAllSessions(uint64_t recipientId);
+
+	SignedPreKeyRecord loadSignedPreKey(uint64_t signedPreKeyId);
+	std::vector < SignedPreKeyRecord > loadSignedPreKeys();
+	void storeSignedPreKey(uint64_t signedPreKeyId, const SignedPreKeyRecord & record);
+	bool containsSignedPreKey(uint64_t signedPreKeyId);
+	void removeSignedPreKey(uint64_t signedPreKeyId);
+
+	void storeSenderKey(const ByteArray & senderKeyId, SenderKeyRecord * record);
+	SenderKeyRecord *loadSenderKey(const ByteArray & senderKeyId);
+
+	// Waits for the record updates in flight, so none is half written
+	void commit();
+};
+
+#endif
+
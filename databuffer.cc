@@ -1,46 +1,85 @@
 
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
 
 #include "databuffer.h"
-#include "keygen.h"
 #include "wadict.h"
 #include "tree.h"
-#include "wa_connection.h"
 
+#define TINFL_HEADER_FILE_ONLY
 extern "C" {
-	size_t tinfl_decompress_mem_to_mem(void *pOut_buf, size_t out_buf_len, const void *pSrc_buf, size_t src_buf_len, int flags);
+#include "tinfl.c"
 }
 
 // This changed to a huffman-like encoding. Therefore we can use one or two bytes...
 static std::string getDecoded(int n)
 {
-	return std::string(main_dict[n]);
+	return std::string(&dict_pool[main_dict_offset[n]]);
 }
 
 static std::string getDecodedExtended(int n, int n2)
 {
 	unsigned index = n * 256 + n2;
-	if (index < sizeof(sec_dict)/sizeof(sec_dict[0]))
-		return std::string(sec_dict[index]);
+	if (index < WADICT_SEC_SIZE)
+		return std::string(&dict_pool[sec_dict_offset[index]]);
 	return "";
 }
 
-// Return a token (or extended token) for a given value
+#ifdef DICTBENCH
+// For misc/dictbench.cc only: the linear scan over the padded tables that
+// the hash replaced, used instead of it when dict_linear_lookup is set
+bool dict_linear_lookup = false;
+static char main_dict[WADICT_MAIN_SIZE][37+1];
+static char sec_dict[WADICT_SEC_SIZE][28+1];
+
 static unsigned short lookupDecoded(std::string value)
 {
+	if (main_dict[3][0] == 0) {
+		for (int i = 0; i < WADICT_MAIN_SIZE; i++)
+			strcpy(main_dict[i], &dict_pool[main_dict_offset[i]]);
+		for (int i = 0; i < WADICT_SEC_SIZE; i++)
+			strcpy(sec_dict[i], &dict_pool[sec_dict_offset[i]]);
+	}
 	for (unsigned int i = 3; i < sizeof(main_dict)/sizeof(main_dict[0]); i++) {
 		if (strcmp(main_dict[i], value.c_str()) == 0)
 			return i;
 	}
-	// Not found in the main dict, search the secondary
 	for (unsigned int i = 0; i < sizeof(sec_dict)/sizeof(sec_dict[0]); i++) {
 		if (strcmp(sec_dict[i], value.c_str()) == 0)
 			return i + 0x0100;
 	}
-	
 	return 0;
 }
+#endif
+
+// Return a token (or extended token) for a given value
+unsigned short lookupToken(const char *s, int len)
+{
+#ifdef DICTBENCH
+	if (dict_linear_lookup)
+		return lookupDecoded(std::string(s, len));
+#endif
+	unsigned int h = dict_hash(s, len);
+	unsigned int seed = dict_hash_seed[h & (WADICT_BUCKETS - 1)];
+	unsigned short tok = dict_hash_table[dict_mix(h ^ seed) & (WADICT_HASH_SIZE - 1)];
+	if (tok == 0)
+		return 0;
+
+	// Most values aren't tokens, make sure we got the right one
+	const char *ts = tokenString(tok);
+	if (strlen(ts) == (size_t)len and memcmp(ts, s, len) == 0)
+		return tok;
+
+	return 0;
+}
+
+const char *tokenString(unsigned short token)
+{
+	if (token < 0x100)
+		return &dict_pool[main_dict_offset[token]];
+	return &dict_pool[sec_dict_offset[token - 0x100]];
+}
 
 DataBuffer::DataBuffer(const void *ptr, int size)
 {
@@ -66,6 +105,14 @@ DataBuffer::DataBuffer(const DataBuffer & other)
 	memcpy(buffer, other.buffer, blen);
 }
 
+DataBuffer::DataBuffer(DataBuffer && other)
+{
+	blen = other.blen;
+	buffer = other.buffer;
+	other.blen = 0;
+	other.buffer = NULL;
+}
+
 DataBuffer DataBuffer::operator+(const DataBuffer & other) const
 {
 	DataBuffer result = *this;
@@ -85,6 +132,18 @@ DataBuffer & DataBuffer::operator =(const DataBuffer & other)
 	return *this;
 }
 
+DataBuffer & DataBuffer::operator =(DataBuffer && other)
+{
+	if (this != &other) {
+		free(buffer);
+		blen = other.blen;
+		buffer = other.buffer;
+		other.blen = 0;
+		other.buffer = NULL;
+	}
+	return *this;
+}
+
 DataBuffer::DataBuffer(const DataBuffer * d)
 {
 	blen = d->blen;
@@ -92,42 +151,6 @@ DataBuffer::DataBuffer(const DataBuffer * d)
 	memcpy(buffer, d->buffer, blen);
 }
 
-DataBuffer *DataBuffer::decodedBuffer(RC4Decoder * decoder, int clength, bool dout)
-{
-	DataBuffer *deco = new DataBuffer(this->buffer, clength);
-	decoder->cipher(&deco->buffer[0], clength - 4);
-	return deco;
-}
-
-DataBuffer *DataBuffer::decompressedBuffer()
-{
-	int ressize = this->size()*2;
-	char dbuf[ressize];
-	size_t outsize = tinfl_decompress_mem_to_mem(dbuf, ressize, this->buffer, this->size(), 1);
-
-	if (outsize >= 0)
-		return new DataBuffer(dbuf, outsize);
-	
-	return NULL;
-}
-
-DataBuffer DataBuffer::encodedBuffer(RC4Decoder * decoder, unsigned char *key, bool dout, unsigned int seq)
-{
-	DataBuffer deco = *this;
-	decoder->cipher(&deco.buffer[0], blen);
-	unsigned char hmacint[4];
-	DataBuffer hmac;
-	KeyGenerator::calc_hmac(deco.buffer, blen, key, (unsigned char *)&hmacint, seq);
-	hmac.addData(hmacint, 4);
-
-	if (dout)
-		deco = deco + hmac;
-	else
-		deco = hmac + deco;
-
-	return deco;
-}
-
 void DataBuffer::clear()
 {
 	blen = 0;
@@ -140,6 +163,14 @@ void *DataBuffer::getPtr()
 	return buffer;
 }
 
+// Grows the buffer by size bytes, returns where they start
+unsigned char *DataBuffer::reserveData(int size)
+{
+	buffer = (unsigned char *)realloc(buffer, blen + size + 1);
+	blen += size;
+	return &buffer[blen - size];
+}
+
 void DataBuffer::addData(const void *ptr, int size)
 {
 	if (ptr != NULL and size > 0) {
@@ -195,27 +226,137 @@ void DataBuffer::putInt(int value, int nbytes)
 
 int DataBuffer::readInt(int nbytes)
 {
-	if (nbytes > blen)
+	DataReader r(buffer, blen);
+	int ret = r.readInt(nbytes);
+	popData(r.consumed());
+	return ret;
+}
+
+int DataBuffer::readListSize()
+{
+	DataReader r(buffer, blen);
+	int ret = r.readListSize();
+	popData(r.consumed());
+	return ret;
+}
+
+void DataBuffer::writeListSize(int size)
+{
+	int n = DataWriter::listSizeSize(size);
+	DataWriter(reserveData(n), n).writeListSize(size);
+}
+
+std::string DataBuffer::readRawString(int size)
+{
+	DataReader r(buffer, blen);
+	std::string ret = r.readRawString(size);
+	popData(r.consumed());
+	return ret;
+}
+
+std::string DataBuffer::readNibbleHex(char bchar)
+{
+	DataReader r(buffer, blen);
+	std::string ret = r.readNibbleHex(bchar);
+	popData(r.consumed());
+	return ret;
+}
+
+std::string DataBuffer::readString()
+{
+	DataReader r(buffer, blen);
+	std::string ret = r.readString();
+	popData(r.consumed());
+	return ret;
+}
+
+void DataBuffer::putRawString(std::string s)
+{
+	int n = DataWriter::rawStringSize(s.size());
+	DataWriter(reserveData(n), n).putRawString(s.c_str(), s.size());
+}
+
+bool DataBuffer::canbeNibbled(const std::string & s) const {
+	return DataWriter::canbeNibbled(s.c_str(), s.size());
+}
+
+bool DataBuffer::canbeHexed(const std::string & s) const {
+	return DataWriter::canbeHexed(s.c_str(), s.size());
+}
+
+void DataBuffer::putString(std::string s)
+{
+	int n = DataWriter::stringSize(s.c_str(), s.size());
+	DataWriter(reserveData(n), n).putString(s.c_str(), s.size());
+}
+
+void DataBuffer::putToken(unsigned short token)
+{
+	int n = DataWriter::tokenSize(token);
+	DataWriter(reserveData(n), n).putToken(token);
+}
+
+bool DataBuffer::isList()
+{
+	return DataReader(buffer, blen).isList();
+}
+
+std::string DataBuffer::toString()
+{
+	std::string r(blen, ' ');
+	memcpy(&r[0], buffer, blen);
+	return r;
+}
+
+
+DataReader::DataReader(const void *ptr, int size, bool borrow)
+{
+	buffer = (const unsigned char *)ptr;
+	blen = size;
+	offset = 0;
+	this->borrow = borrow;
+}
+
+int DataReader::getInt(int nbytes, int offset) const
+{
+	if (nbytes + offset > size())
+		throw 0;
+	int ret = 0;
+	for (int i = 0; i < nbytes; i++) {
+		ret <<= 8;
+		ret |= buffer[this->offset + i + offset];
+	}
+	return ret;
+}
+
+void DataReader::skip(int size)
+{
+	if (size < 0 or size > this->size())
 		throw 0;
+	offset += size;
+}
+
+int DataReader::readInt(int nbytes)
+{
 	int ret = getInt(nbytes);
-	popData(nbytes);
+	offset += nbytes;
 	return ret;
 }
 
-int DataBuffer::readListSize()
+int DataReader::readListSize()
 {
-	if (blen == 0)
+	if (size() == 0)
 		throw 0;
 	int ret;
-	if (buffer[0] == 0) {
-		popData(1);
+	if (buffer[offset] == 0) {
+		skip(1);
 		ret = 0;
-	} else if (buffer[0] == 0xf8) {
-		ret = buffer[1];
-		popData(2);
-	} else if (buffer[0] == 0xf9) {
+	} else if (buffer[offset] == 0xf8) {
+		ret = getInt(1, 1);
+		skip(2);
+	} else if (buffer[offset] == 0xf9) {
 		ret = getInt(2, 1);
-		popData(3);
+		skip(3);
 	} else {
 		/* FIXME throw 0 error */
 		ret = -1;
@@ -224,48 +365,41 @@ int DataBuffer::readListSize()
 	return ret;
 }
 
-void DataBuffer::writeListSize(int size)
-{
-	if (size == 0) {
-		putInt(0, 1);
-	} else if (size < 256) {
-		putInt(0xf8, 1);
-		putInt(size, 1);
-	} else {
-		putInt(0xf9, 1);
-		putInt(size, 2);
-	}
-}
-
-std::string DataBuffer::readRawString(int size)
+std::string DataReader::readRawString(int size)
 {
-	if (size < 0 or size > blen)
+	if (size < 0 or size > this->size())
 		throw 0;
-	std::string st(size, ' ');
-	memcpy(&st[0], buffer, size);
-	popData(size);
+	std::string st((const char *)&buffer[offset], size);
+	offset += size;
 	return st;
 }
 
-std::string DataBuffer::readNibbleHex(char bchar) {
+std::string DataReader::readNibbleHex(char bchar)
+{
 	// read packed nibble or packed hex!
 	int nbyte = readInt(1);
 	int size = nbyte & 0x7f;
 	int numnibbles = size*2 - ((nbyte&0x80) ? 1 : 0);
 
-	std::string rawd = readRawString(size);
+	if (size > this->size())
+		throw 0;
+	if (numnibbles <= 0)	/* Odd flag with no bytes */
+		return "";
+	const unsigned char *rawd = &buffer[offset];
 	std::string s;
+	s.reserve(numnibbles);
 	for (int i = 0; i < numnibbles; i++) {
 		char c = (rawd[i/2] >> (4-((i&1)<<2))) & 0xF;
 		if (c < 10) s += (c+'0');
 		else s += (c-10+bchar);
 	}
+	offset += size;
 	return s;
 }
 
-std::string DataBuffer::readString()
+std::string DataReader::readString()
 {
-	if (blen == 0)
+	if (size() == 0)
 		throw 0;
 	int type = readInt(1);
 	switch (type) {
@@ -309,21 +443,253 @@ std::string DataBuffer::readString()
 	return "";
 }
 
-void DataBuffer::putRawString(std::string s)
+// Same as above, but the result lives in the arena (or the dictionary)
+// and no temporary strings are built. Returns the token, if any.
+unsigned short DataReader::readString(TreeArena * arena, TreeString & s)
+{
+	if (size() == 0)
+		throw 0;
+	int type = readInt(1);
+	int slen = -1;
+	switch (type) {
+	case 236:
+	case 237:
+	case 238:
+	case 239: {
+		unsigned index = (type - 236) * 256 + readInt(1);
+		if (index < WADICT_SEC_SIZE) {
+			s.ptr = tokenString(index + 0x100);
+			s.len = strlen(s.ptr);
+			return index + 0x100;
+		}
+		s = TreeString();
+		return 0;
+	};
+	case 250: {
+		TreeString u, srv;
+		readString(arena, u);
+		readString(arena, srv);
+
+		if (u.len > 0 and srv.len > 0) {
+			char *p = (char *)arena->alloc(u.len + srv.len + 2);
+			memcpy(p, u.ptr, u.len);
+			p[u.len] = '@';
+			memcpy(&p[u.len + 1], srv.ptr, srv.len);
+			p[u.len + srv.len + 1] = 0;
+			s = TreeString(p, u.len + srv.len + 1);
+		}
+		else if (srv.len > 0)
+			s = srv;
+		else
+			s = TreeString();
+		return 0;
+	};
+	case 252:
+		slen = readInt(1);
+		break;
+	case 253:
+		slen = readInt(3) & 0xFFFFF;
+		break;
+	case 254:
+		slen = readInt(4) & 0x7FFFFFFF;
+		break;
+	case 251:
+	case 255: {
+		int nbyte = readInt(1);
+		int bsize = nbyte & 0x7f;
+		int numnibbles = bsize*2 - ((nbyte&0x80) ? 1 : 0);
+		char bchar = (type == 255 ? '-' : 'A');
+
+		if (bsize > this->size())
+			throw 0;
+		if (numnibbles <= 0) {	/* Odd flag with no bytes */
+			s = TreeString();
+			return 0;
+		}
+		const unsigned char *rawd = &buffer[offset];
+		char *p = (char *)arena->alloc(numnibbles + 1);
+		for (int i = 0; i < numnibbles; i++) {
+			char c = (rawd[i/2] >> (4-((i&1)<<2))) & 0xF;
+			p[i] = (c < 10) ? (c+'0') : (c-10+bchar);
+		}
+		p[numnibbles] = 0;
+		offset += bsize;
+		s = TreeString(p, numnibbles);
+		return 0;
+	};
+	default:
+		if (type < 236) {
+			s.ptr = tokenString(type);
+			s.len = strlen(s.ptr);
+			return (s.len > 0) ? type : 0;
+		}
+	};
+
+	if (slen < 0) {
+		s = TreeString();
+		return 0;
+	}
+	if (slen > this->size())
+		throw 0;
+	if (borrow)
+		s = TreeString((const char *)&buffer[offset], slen);
+	else
+		s = TreeString(arena->copy((const char *)&buffer[offset], slen), slen);
+	offset += slen;
+	return 0;
+}
+
+/* Skipping consumes exactly what reading would, without decoding or
+   allocating anything, and throws on the same malformed input */
+void DataReader::skipString()
 {
-	if (s.size() < 256) {
+	int type = readInt(1);
+	switch (type) {
+	case 236:
+	case 237:
+	case 238:
+	case 239:
+		skip(1);
+		break;
+	case 250:
+		skipString();
+		skipString();
+		break;
+	case 252:
+		skip(readInt(1));
+		break;
+	case 253:
+		skip(readInt(3) & 0xFFFFF);
+		break;
+	case 254:
+		skip(readInt(4) & 0x7FFFFFFF);
+		break;
+	case 251:
+	case 255:
+		skip(readInt(1) & 0x7f);
+		break;
+	default:
+		break;
+	};
+}
+
+void DataReader::skipContent()
+{
+	if (isList()) {
+		int size = readListSize();
+		while (size--)
+			skipTree();
+	} else {
+		skipString();
+	}
+}
+
+void DataReader::skipTree()
+{
+	int lsize = readListSize();
+	int type = getInt(1);
+	if (type == 2) {
+		skip(1);
+		return;
+	}
+	if (type == 1)
+		skip(1);
+	else
+		skipString();
+
+	for (int count = (lsize - 2 + (lsize % 2)) / 2; count > 0; count--) {
+		skipString();
+		skipString();
+	}
+	if (type != 1 and (lsize & 1) == 0)
+		skipContent();
+}
+
+bool DataReader::isList() const
+{
+	if (size() == 0)
+		throw 0;
+	return (buffer[offset] == 248 or buffer[offset] == 0 or buffer[offset] == 249);
+}
+
+
+DataWriter::DataWriter(void *ptr, int size)
+{
+	buffer = (unsigned char *)ptr;
+	blen = size;
+	offset = 0;
+}
+
+void DataWriter::putInt(int value, int nbytes)
+{
+	if (nbytes > size())
+		throw 0;
+	for (int i = 0; i < nbytes; i++)
+		buffer[offset + nbytes - i - 1] = (value >> (i << 3)) & 0xFF;
+	offset += nbytes;
+}
+
+void DataWriter::putData(const void *ptr, int size)
+{
+	if (size > this->size())
+		throw 0;
+	memcpy(&buffer[offset], ptr, size);
+	offset += size;
+}
+
+int DataWriter::listSizeSize(int size)
+{
+	if (size == 0)
+		return 1;
+	return (size < 256) ? 2 : 3;
+}
+
+void DataWriter::writeListSize(int size)
+{
+	if (size == 0) {
+		putInt(0, 1);
+	} else if (size < 256) {
+		putInt(0xf8, 1);
+		putInt(size, 1);
+	} else {
+		putInt(0xf9, 1);
+		putInt(size, 2);
+	}
+}
+
+int DataWriter::tokenSize(unsigned short token)
+{
+	return (token >> 8) ? 2 : 1;
+}
+
+void DataWriter::putToken(unsigned short token)
+{
+	int sub_dict = (token >> 8);
+
+	if (sub_dict != 0)
+		putInt(sub_dict + 236 - 1, 1);   // Put dict byte first!
+	putInt(token & 0xFF, 1); // Now put second byte
+}
+
+int DataWriter::rawStringSize(int len)
+{
+	return (len < 256) ? 2 + len : 4 + len;
+}
+
+void DataWriter::putRawString(const char *s, int len)
+{
+	if (len < 256) {
 		putInt(0xfc, 1);
-		putInt(s.size(), 1);
-		addData(s.c_str(), s.size());
+		putInt(len, 1);
 	} else {
 		putInt(0xfd, 1);
-		putInt(s.size(), 3);
-		addData(s.c_str(), s.size());
+		putInt(len, 3);
 	}
+	putData(s, len);
 }
 
-bool DataBuffer::canbeNibbled(const std::string & s) const {
-	for (unsigned i = 0; i < s.size(); i++) {
+bool DataWriter::canbeNibbled(const char *s, int len) {
+	for (int i = 0; i < len; i++) {
 		if (!(
 			(s[i] >= '0' && s[i] <= '9') ||
 			(s[i] == '-') ||
@@ -334,8 +700,8 @@ bool DataBuffer::canbeNibbled(const std::string & s) const {
 	return true;
 }
 
-bool DataBuffer::canbeHexed(const std::string & s) const {
-	for (unsigned i = 0; i < s.size(); i++) {
+bool DataWriter::canbeHexed(const char *s, int len) {
+	for (int i = 0; i < len; i++) {
 		if (!(
 			(s[i] >= '0' && s[i] <= '9') ||
 			(s[i] >= 'A' && s[i] <= 'F')
@@ -345,27 +711,47 @@ bool DataBuffer::canbeHexed(const std::string & s) const {
 	return true;
 }
 
-void DataBuffer::putString(std::string s)
+// Packed strings carry the nibble count in 7 bits
+#define MAX_NIBBLES  254
+
+int DataWriter::stringSize(const char *s, int len)
 {
-	unsigned short lu = lookupDecoded(s);
-	int sub_dict = (lu >> 8);
-	
-	if (sub_dict != 0)
-		putInt(sub_dict + 236 - 1, 1);   // Put dict byte first!
-	
+	unsigned short lu = lookupToken(s, len);
+	const char *at = (const char *)memchr(s, '@', len);
+
+	if (lu != 0)
+		return tokenSize(lu);
+	else if (at != NULL)
+		return 1 + stringSize(s, at - s) + stringSize(at + 1, len - (at - s) - 1);
+	else if (len <= MAX_NIBBLES and (canbeNibbled(s, len) || canbeHexed(s, len)))
+		return 2 + (len + 1) / 2;
+	else if (len < 256)
+		return 2 + len;
+	return 4 + len;
+}
+
+void DataWriter::putString(const char *s, int len)
+{
+	unsigned short lu = lookupToken(s, len);
+	const char *at = (const char *)memchr(s, '@', len);
+
 	if (lu != 0) {
-		putInt(lu & 0xFF, 1); // Now put second byte
-	} else if (s.find('@') != std::string::npos) {
-		std::string p1 = s.substr(0, s.find('@'));
-		std::string p2 = s.substr(s.find('@') + 1);
+		putToken(lu);
+	} else if (at != NULL) {
 		putInt(250, 1);
-		putString(p1);
-		putString(p2);
-	} else if (canbeNibbled(s) || canbeHexed(s)) {
+		putString(s, at - s);
+		putString(at + 1, len - (at - s) - 1);
+	} else if (len <= MAX_NIBBLES and (canbeNibbled(s, len) || canbeHexed(s, len))) {
 		// Encode it in nibbles
-		int numn = (s.size()+1)/2;
-		std::string out(numn, 0);
-		for (unsigned i = 0; i < s.size(); i++) {
+		int numn = (len+1)/2;
+		if (numn > size() - 2)
+			throw 0;
+		putInt(canbeHexed(s, len) ? 251 : 255, 1);
+		putInt(numn | ((len % 2 != 0) ? 0x80 : 0), 1);
+
+		unsigned char *out = &buffer[offset];
+		memset(out, 0, numn);
+		for (int i = 0; i < len; i++) {
 			unsigned char c;
 			if (s[i] >= '0' && s[i] <= '9') c = s[i]-'0';
 			else if (s[i] >= 'A' && s[i] <= 'F') c = s[i]-'A'+10;
@@ -373,48 +759,63 @@ void DataBuffer::putString(std::string s)
 
 			out[i/2] |= c << (4-4*(i&1));
 		}
-
-		if (s.size() % 2 != 0) {
-			numn |= 0x80;
-			out[out.size()-1] |= 0xf;
-		}
-		putInt(canbeHexed(s) ? 251 : 255,1);
-		putInt(numn,1);
-		addData(out.c_str(), out.size());
-	} else if (s.size() < 256) {
+		if (len % 2 != 0)
+			out[numn-1] |= 0xf;
+		offset += numn;
+	} else if (len < 256) {
 		putInt(252, 1);
-		putInt(s.size(), 1);
-		addData(s.c_str(), s.size());
+		putInt(len, 1);
+		putData(s, len);
 	} else {
 		putInt(253, 1);
-		putInt(s.size(), 3);
-		addData(s.c_str(), s.size());
+		putInt(len, 3);
+		putData(s, len);
 	}
 }
 
-bool DataBuffer::isList()
+InflateBuffer::InflateBuffer()
 {
-	if (blen == 0)
-		throw 0;
-	return (buffer[0] == 248 or buffer[0] == 0 or buffer[0] == 249);
+	state = malloc(sizeof(tinfl_decompressor));
+	buffer = NULL;
+	capacity = 0;
 }
 
-std::vector < Tree > DataBuffer::readList(WhatsappConnection * c)
+InflateBuffer::~InflateBuffer()
 {
-	std::vector < Tree > l;
-	int size = readListSize();
-	while (size--) {
-		Tree t;
-		if (c->read_tree(this, t))
-			l.push_back(t);
-	}
-	return l;
+	free(state);
+	free(buffer);
 }
 
-std::string DataBuffer::toString()
+int InflateBuffer::inflate(const void *ptr, int size)
 {
-	std::string r(blen, ' ');
-	memcpy(&r[0], buffer, blen);
-	return r;
-}
+	tinfl_decompressor *decomp = (tinfl_decompressor *)state;
+	tinfl_init(decomp);
+
+	const unsigned char *in = (const unsigned char *)ptr;
+	size_t inpos = 0, outpos = 0;
+	while (1) {
+		if (capacity == 0 or outpos == (size_t)capacity) {
+			// No frame inflates past the largest one, a bigger output is a bomb
+			if (capacity >= MAX_FRAME_SIZE)
+				return -1;
+			int ncap = capacity ? std::min(capacity * 2, MAX_FRAME_SIZE) : 16*1024;
+			unsigned char *nbuf = (unsigned char *)realloc(buffer, ncap);
+			if (nbuf == NULL)
+				return -1;
+			buffer = nbuf;
+			capacity = ncap;
+		}
 
+		// Inflate as much as fits, the decompressor resumes where it left
+		size_t insize = size - inpos, outsize = capacity - outpos;
+		tinfl_status status = tinfl_decompress(decomp, &in[inpos], &insize, buffer, &buffer[outpos], &outsize,
+			TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+		inpos += insize;
+		outpos += outsize;
+
+		if (status == TINFL_STATUS_DONE)
+			return outpos;
+		if (status != TINFL_STATUS_HAS_MORE_OUTPUT)
+			return -1;
+	}
+}
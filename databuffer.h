@@ -6,8 +6,96 @@
 #include <vector>
 #include "rc4.h"
 
-class WhatsappConnection;
-class Tree;
+class TreeArena;
+struct TreeString;
+
+// Frame lengths are 20 bits, the rest of the 3 byte header are flags
+#define MAX_FRAME_SIZE 0xFFFFF
+
+// FunXMPP dictionary, tokens are the main index or 0x100 + extended index
+unsigned short lookupToken(const char *s, int len);
+const char *tokenString(unsigned short token);
+
+// Read-only cursor over a range of bytes. Reads advance the offset instead
+// of moving the remaining data, the owner drops the consumed prefix at once.
+class DataReader {
+private:
+	const unsigned char *buffer;
+	int blen, offset;
+	bool borrow;
+public:
+	// A borrowing reader points raw strings into its buffer instead of
+	// copying them to the arena, the buffer must outlive the trees
+	DataReader(const void *ptr, int size, bool borrow = false);
+
+	int size() const { return blen - offset; }
+	int consumed() const { return offset; }
+	const unsigned char *getPtr() const { return &buffer[offset]; }
+
+	int getInt(int nbytes, int offset = 0) const;
+	void skip(int size);
+
+	int readInt(int nbytes);
+	int readListSize();
+	std::string readRawString(int size);
+	std::string readString();
+	unsigned short readString(TreeArena * arena, TreeString & s);
+	std::string readNibbleHex(char bchar);
+
+	void skipString();
+	void skipContent();
+	void skipTree();
+	bool borrows() const { return borrow; }
+
+	bool isList() const;
+};
+
+// Write cursor over a preallocated range of bytes. The *Size helpers give
+// the exact encoded length, so callers allocate once and then write.
+class DataWriter {
+private:
+	unsigned char *buffer;
+	int blen, offset;
+public:
+	DataWriter(void *ptr, int size);
+
+	int size() const { return blen - offset; }
+	int written() const { return offset; }
+
+	void putInt(int value, int nbytes);
+	void putData(const void *ptr, int size);
+	void writeListSize(int size);
+	void putToken(unsigned short token);
+	void putRawString(const char *s, int len);
+	void putString(const char *s, int len);
+
+	static int listSizeSize(int size);
+	static int tokenSize(unsigned short token);
+	static int rawStringSize(int len);
+	static int stringSize(const char *s, int len);
+	static bool canbeNibbled(const char *s, int len);
+	static bool canbeHexed(const char *s, int len);
+};
+
+// Zlib inflater that keeps its state and output buffer between frames,
+// the buffer only grows, so steady state decompression doesn't allocate.
+class InflateBuffer {
+private:
+	void *state;
+	unsigned char *buffer;
+	int capacity;
+
+	InflateBuffer(const InflateBuffer &);
+	InflateBuffer & operator=(const InflateBuffer &);
+public:
+	InflateBuffer();
+	~InflateBuffer();
+
+	// Returns the inflated size (data at getPtr() until the next call), -1 on
+	// error or past MAX_FRAME_SIZE
+	int inflate(const void *ptr, int size);
+	const unsigned char *getPtr() const { return buffer; }
+};
 
 class DataBuffer {
 private:
@@ -17,15 +105,15 @@ public:
 	DataBuffer(const void *ptr = 0, int size = 0);
 	~DataBuffer();
 	DataBuffer(const DataBuffer & other);
+	DataBuffer(DataBuffer && other);
 	DataBuffer operator+(const DataBuffer & other) const;
 	DataBuffer & operator =(const DataBuffer & other);
+	DataBuffer & operator =(DataBuffer && other);
 	DataBuffer(const DataBuffer * d);
 
-	DataBuffer *decodedBuffer(RC4Decoder * decoder, int clength, bool dout);
-	DataBuffer encodedBuffer(RC4Decoder * decoder, unsigned char *key, bool dout, unsigned int seq);
-	DataBuffer *decompressedBuffer();
 
 	void *getPtr();
+	unsigned char *reserveData(int size);
 	int getInt(int nbytes, int offset = 0);
 	int size() { return blen; }
 
@@ -33,12 +121,12 @@ public:
 	int readListSize();
 	std::string readRawString(int size);
 	std::string readString();
-	std::vector < Tree > readList(WhatsappConnection * c);
 
 	void putInt(int value, int nbytes);
 	void writeListSize(int size);
 	void putRawString(std::string s);
 	void putString(std::string s);
+	void putToken(unsigned short token);
 	bool canbeNibbled(const std::string & s) const;
 	bool canbeHexed(const std::string & s) const;
 	std::string readNibbleHex(char bchar);
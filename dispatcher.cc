@@ -0,0 +1,168 @@
+
+#include <time.h>
+
+#include "dispatcher.h"
+#include "databuffer.h"
+#include "wadict.h"
+
+HandlerTable::HandlerTable()
+	: tokens(0x100 + WADICT_SEC_SIZE, -1)
+{
+}
+
+int & HandlerTable::slot(const std::string & key)
+{
+	unsigned short token = lookupToken(key.c_str(), key.size());
+	if (token)
+		return tokens[token];
+	return others.insert(std::make_pair(key, -1)).first->second;
+}
+
+int HandlerTable::find(const std::string & key) const
+{
+	if (others.empty())
+		return -1;
+	auto it = others.find(key);
+	return (it != others.end()) ? it->second : -1;
+}
+
+void StanzaDispatcher::add(int & first, const std::string & name, StanzaHandler h)
+{
+	int e = entries.size();
+	entries.push_back({h, {name, 0, 0}, -1});
+
+	int *last = &first;
+	while (*last >= 0)
+		last = &entries[*last].next;
+	*last = e;
+}
+
+void StanzaDispatcher::addTagHandler(const std::string & tag, StanzaHandler h)
+{
+	add(tags.slot(tag), tag, h);
+}
+
+void StanzaDispatcher::addIqHandler(const std::string & child, StanzaHandler h)
+{
+	add(iq_children.slot(child), "iq/" + child, h);
+}
+
+void StanzaDispatcher::addXmlnsHandler(const std::string & xmlns, StanzaHandler h)
+{
+	add(iq_xmlns.slot(xmlns), "xmlns/" + xmlns, h);
+}
+
+static unsigned long long nowNsecs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void StanzaDispatcher::run(int e, Tree & stanza, Tree & node)
+{
+	while (e >= 0) {
+		// Copy the handler, it might register more and grow the vector
+		StanzaHandler h = entries[e].handler;
+		unsigned long long t0 = nowNsecs();
+		h(stanza, node);
+		entries[e].stats.calls++;
+		entries[e].stats.nsecs += nowNsecs() - t0;
+		e = entries[e].next;
+	}
+}
+
+bool StanzaDispatcher::dispatch(Tree & stanza)
+{
+	unsigned short token = stanza.getTagToken();
+	int e = token ? tags.find(token) : tags.find(stanza.getTag());
+	if (e < 0)
+		return false;
+	run(e, stanza, stanza);
+	return true;
+}
+
+void StanzaDispatcher::dispatchIq(Tree & iq)
+{
+	for (auto & child : iq.getChildren()) {
+		unsigned short token = child.getTagToken();
+		int e = token ? iq_children.find(token) : iq_children.find(child.getTag());
+		if (e >= 0)
+			run(e, iq, child);
+	}
+
+	const TreeAttribute *a = iq.getAttributeList();
+	for (unsigned i = 0; i < iq.numAttributes(); i++) {
+		if (a[i].key == "xmlns") {
+			unsigned short token = lookupToken(a[i].value.ptr, a[i].value.len);
+			int e = token ? iq_xmlns.find(token) : iq_xmlns.find(a[i].value.str());
+			if (e >= 0)
+				run(e, iq, iq);
+			break;
+		}
+	}
+}
+
+std::vector < HandlerStats > StanzaDispatcher::getStats() const
+{
+	std::vector < HandlerStats > ret;
+	for (auto & e : entries)
+		ret.push_back(e.stats);
+	return ret;
+}
+
+void StanzaDispatcher::resetStats()
+{
+	for (auto & e : entries)
+		e.stats.calls = e.stats.nsecs = 0;
+}
+
+void IqTable::add(const std::string & id, time_t deadline, IqCallback cb)
+{
+	auto it = pending.find(id);
+	if (it != pending.end()) {
+		timers.cancel(it->second.timer);
+		pending.erase(it);
+	}
+	TimerWheel::TimerId timer = timers.add(deadline, [this, id] () { this->expire(id); });
+	pending[id] = {cb, timer};
+}
+
+bool IqTable::complete(Tree & iq)
+{
+	if (pending.empty())
+		return false;
+
+	IqStatus status;
+	if (iq.hasAttributeValue("type", "result"))
+		status = IqResult;
+	else if (iq.hasAttributeValue("type", "error"))
+		status = IqError;
+	else
+		return false;
+
+	auto it = pending.find(iq["id"]);
+	if (it == pending.end())
+		return false;
+
+	// Out of the table first, the callback may send more requests
+	IqCallback cb = std::move(it->second.callback);
+	timers.cancel(it->second.timer);
+	pending.erase(it);
+	cb(status, iq);
+	return true;
+}
+
+void IqTable::expire(const std::string & id)
+{
+	auto it = pending.find(id);
+	if (it == pending.end())
+		return;
+
+	IqCallback cb = std::move(it->second.callback);
+	pending.erase(it);
+
+	Tree none;
+	cb(IqTimeout, none);
+}
+
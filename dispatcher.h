@@ -0,0 +1,95 @@
+
+#ifndef __DISPATCHER__H__
+#define __DISPATCHER__H__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <time.h>
+
+#include "tree.h"
+#include "timerwheel.h"
+
+// Handler for a received stanza. For tag and xmlns handlers node is the
+// stanza itself, for iq child handlers it's the matching child.
+typedef std::function < void (Tree & stanza, Tree & node) > StanzaHandler;
+
+struct HandlerStats {
+	std::string name;         // "tag", "iq/child" or "xmlns/value"
+	unsigned long long calls;
+	unsigned long long nsecs; // Wall time, including nested handlers
+};
+
+// Maps dictionary tokens to handlers with a direct lookup, and any other
+// string with a hash table.
+class HandlerTable {
+private:
+	std::vector < int > tokens;
+	std::unordered_map < std::string, int > others;
+public:
+	HandlerTable();
+
+	int & slot(const std::string & key);
+	int find(unsigned short token) const { return tokens[token]; }
+	int find(const std::string & key) const;
+};
+
+// Registry of stanza handlers, keyed by stanza tag, by the tag of the
+// direct children of an iq and by the xmlns of an iq. Several handlers
+// for the same key run in registration order.
+class StanzaDispatcher {
+private:
+	struct Entry {
+		StanzaHandler handler;
+		HandlerStats stats;
+		int next;
+	};
+	std::vector < Entry > entries;
+	HandlerTable tags, iq_children, iq_xmlns;
+
+	void add(int & first, const std::string & name, StanzaHandler h);
+	void run(int e, Tree & stanza, Tree & node);
+public:
+	void addTagHandler(const std::string & tag, StanzaHandler h);
+	void addIqHandler(const std::string & child, StanzaHandler h);
+	void addXmlnsHandler(const std::string & xmlns, StanzaHandler h);
+
+	// False if nobody handles the tag
+	bool dispatch(Tree & stanza);
+	// Runs the child and xmlns handlers of an iq
+	void dispatchIq(Tree & iq);
+
+	std::vector < HandlerStats > getStats() const;
+	void resetStats();
+};
+
+enum IqStatus { IqResult, IqError, IqTimeout };
+
+// Completion of an iq request, reply is an empty tree on timeout
+typedef std::function < void (IqStatus status, Tree & reply) > IqCallback;
+
+// Requests waiting for their reply, by iq id. Replies are matched with a
+// hash lookup, each request has a timer to fail it if nobody answers.
+class IqTable {
+private:
+	struct Pending {
+		IqCallback callback;
+		TimerWheel::TimerId timer;
+	};
+	std::unordered_map < std::string, Pending > pending;
+	TimerWheel & timers;
+
+	void expire(const std::string & id);
+public:
+	IqTable(TimerWheel & timers) : timers(timers) {}
+
+	void add(const std::string & id, time_t deadline, IqCallback cb);
+	// Runs the callback for a result or error iq, false if nobody waits for it
+	bool complete(Tree & iq);
+
+	unsigned int size() const { return pending.size(); }
+};
+
+#endif
+
@@ -117,20 +117,6 @@ void KeyGenerator::calc_hmac_v12(const unsigned char *data, int l, const unsigne
 	memcpy(hmac, temp, 4);
 }
 
-void KeyGenerator::calc_hmac(const unsigned char *data, int l, const unsigned char *key, unsigned char * hmac, unsigned int seq){
-	unsigned char temp[20];
-	unsigned char data_temp[l+4];
-	memcpy(data_temp, data, l);
-	data_temp[l  ] = (seq >> 24);
-	data_temp[l+1] = (seq >> 16);
-	data_temp[l+2] = (seq >>  8);
-	data_temp[l+3] = (seq      );
-
-	HMAC_SHA1 (data_temp,l+4,key,20,temp);
-	
-	memcpy(hmac,temp,4);
-}
-
 void KeyGenerator::HMAC_SHA1(const unsigned char *text, int text_len, const unsigned char *key, int key_len, unsigned char *digest)
 {
 	unsigned char SHA1_Key[4096], AppendBuf2[4096], szReport[4096];
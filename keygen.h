@@ -16,7 +16,6 @@ public:
 
 	// HMAC generation for CRC checking
 	static void calc_hmac_v12(const unsigned char *data, int l, const unsigned char *key, unsigned char *hmac);
-	static void calc_hmac(const unsigned char *data, int l, const unsigned char *key, unsigned char * hmac, unsigned int seq);
 
 	// HKDFv3 key gen
 	static std::string HKDFv3(std::string key, std::string info, unsigned outlen);
@@ -14,10 +14,10 @@ void GroupSessionBuilder::process(std::string groupId, std::string senderKeyDist
 	textsecure::SenderKeyDistributionMessage skdm;
 	skdm.ParseFromString(senderKeyDistMsg.substr(1));
 
-	SenderKeyRecord skr = senderKeyStore->loadSenderKey(groupId);
-	skr.addSenderKeyState(skdm.id(), skdm.iteration(),
+	SenderKeyRecord *skr = senderKeyStore->loadSenderKey(groupId);
+	skr->addSenderKeyState(skdm.id(), skdm.iteration(),
 		skdm.chainkey(), skdm.signingkey());
-	senderKeyStore->storeSenderKey(groupId, &skr);
+	senderKeyStore->storeSenderKey(groupId, skr);
 }
 
 
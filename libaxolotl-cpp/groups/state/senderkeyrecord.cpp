@@ -23,6 +23,13 @@ SenderKeyRecord::SenderKeyRecord(const ByteArray &serialized)
     }
 }
 
+SenderKeyRecord::~SenderKeyRecord()
+{
+    for (SenderKeyState *state: senderKeyStates) {
+        delete state;
+    }
+}
+
 SenderKeyState *SenderKeyRecord::getSenderKeyState(int keyId)
 {
 	for (auto keys: senderKeyStates)
@@ -35,10 +42,18 @@ SenderKeyState *SenderKeyRecord::getSenderKeyState(int keyId)
 void SenderKeyRecord::addSenderKeyState(int id, int iteration, const ByteArray &chainKey, const DjbECPublicKey &signatureKey)
 {
     senderKeyStates.push_back(new SenderKeyState(id, iteration, chainKey, signatureKey));
+
+    if (senderKeyStates.size() > MAX_STATES) {
+        delete senderKeyStates.front();
+        senderKeyStates.erase(senderKeyStates.begin());
+    }
 }
 
 void SenderKeyRecord::setSenderKeyState(int id, int iteration, const ByteArray &chainKey, const ECKeyPair &signatureKey)
 {
+    for (SenderKeyState *state: senderKeyStates) {
+        delete state;
+    }
     senderKeyStates.clear();
     senderKeyStates.push_back(new SenderKeyState(id, iteration, chainKey, signatureKey));
 }
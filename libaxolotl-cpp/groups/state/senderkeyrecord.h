@@ -13,12 +13,18 @@ class SenderKeyRecord
 public:
     SenderKeyRecord();
     SenderKeyRecord(const ByteArray &serialized);
+    ~SenderKeyRecord();
     SenderKeyState *getSenderKeyState(int keyId = 0);
     void addSenderKeyState(int id, int iteration, const ByteArray &chainKey, const DjbECPublicKey &signatureKey);
     void setSenderKeyState(int id, int iteration, const ByteArray &chainKey, const ECKeyPair &signatureKey);
     ByteArray serialize() const;
 
 private:
+    // Owns its states, and stores keep it alive across messages
+    SenderKeyRecord(const SenderKeyRecord &);
+    SenderKeyRecord &operator=(const SenderKeyRecord &);
+
+    static const unsigned MAX_STATES = 5;
     std::vector<SenderKeyState*> senderKeyStates;
 };
 
@@ -65,6 +65,23 @@ SenderKeyState::SenderKeyState(int id, int iteration, const ByteArray &chainKey,
 SenderKeyState::SenderKeyState(const textsecure::SenderKeyStateStructure &senderKeyStateStructure)
 {
     this->senderKeyStateStructure = senderKeyStateStructure;
+    loadSenderMessageKeys();
+}
+
+void SenderKeyState::loadSenderMessageKeys()
+{
+    const auto &keys = senderKeyStateStructure.sendermessagekeys();
+    for (int i = 0; i < keys.size(); i++) {
+        if (keys.Get(i).has_seed()) {
+            addSenderMessageSeed(keys.Get(i).iteration(), keys.Get(i).seed());
+        }
+        // Older records split every key in two entries, iteration then seed
+        else if (i + 1 < keys.size() && !keys.Get(i + 1).has_iteration() && keys.Get(i + 1).has_seed()) {
+            addSenderMessageSeed(keys.Get(i).iteration(), keys.Get(i + 1).seed());
+            i++;
+        }
+    }
+    senderKeyStateStructure.clear_sendermessagekeys();
 }
 
 int SenderKeyState::getKeyId() const
@@ -106,46 +123,71 @@ DjbECPrivateKey SenderKeyState::getSigningKeyPrivate() const
 
 bool SenderKeyState::hasSenderMessageKey(uint32_t iteration) const
 {
-    for (int i = 0; i < senderKeyStateStructure.sendermessagekeys_size(); i++) {
-        textsecure::SenderKeyStateStructure::SenderMessageKey senderMessageKey = senderKeyStateStructure.sendermessagekeys(i);
-        if (senderMessageKey.iteration() == iteration) {
-            return true;
-        }
-    }
-
-    return false;
+    return senderMessageKeys.find(iteration) != senderMessageKeys.end();
 }
 
 void SenderKeyState::addSenderMessageKey(const SenderMessageKey &senderMessageKey)
 {
-    senderKeyStateStructure.add_sendermessagekeys()->set_iteration(senderMessageKey.getIteration());
-    senderKeyStateStructure.add_sendermessagekeys()->set_seed(senderMessageKey.getSeed().c_str(),
-                                                              senderMessageKey.getSeed().size());
+    addSenderMessageSeed(senderMessageKey.getIteration(), senderMessageKey.getSeed());
+}
+
+void SenderKeyState::addSenderMessageSeed(uint32_t iteration, const ByteArray &seed)
+{
+    auto added = senderMessageKeys.emplace(iteration, seed);
+    if (!added.second) {
+        added.first->second = seed;
+        return;
+    }
+    senderMessageKeyOrder.push_back(iteration);
 
-    /*textsecure::SenderKeyStateStructure::SenderMessageKey senderMessageKeyStructure;
-    senderMessageKeyStructure.set_iteration(senderMessageKey.getIteration());
-    senderMessageKeyStructure.set_seed(senderMessageKey.getSeed().c_str());
+    // Iterations only grow, so the front is the oldest. Removed keys leave
+    // stale entries behind, dropped here or once they outnumber the rest.
+    while (senderMessageKeys.size() > MAX_MESSAGE_KEYS) {
+        senderMessageKeys.erase(senderMessageKeyOrder.front());
+        senderMessageKeyOrder.pop_front();
+    }
+    if (senderMessageKeyOrder.size() > 2 * senderMessageKeys.size() + 64) {
+        std::deque<uint32_t> order;
+        for (uint32_t i: senderMessageKeyOrder) {
+            if (senderMessageKeys.count(i)) {
+                order.push_back(i);
+            }
+        }
+        senderMessageKeyOrder.swap(order);
+    }
+}
 
-    senderKeyStateStructure.add_sendermessagekeys()->CopyFrom(senderMessageKeyStructure);*/
+SenderMessageKey SenderKeyState::getSenderMessageKey(uint32_t iteration) const
+{
+    auto it = senderMessageKeys.find(iteration);
+    if (it == senderMessageKeys.end()) {
+        return SenderMessageKey();
+    }
+    return SenderMessageKey(iteration, it->second);
 }
 
 SenderMessageKey SenderKeyState::removeSenderMessageKey(uint32_t iteration)
 {
-    SenderMessageKey result;
-    for (int i = 0; i < senderKeyStateStructure.sendermessagekeys_size(); i++) {
-        textsecure::SenderKeyStateStructure::SenderMessageKey *senderMessageKey = senderKeyStateStructure.mutable_sendermessagekeys(i);
-        if (senderMessageKey->iteration() == iteration) {
-            ::std::string senderMessageKeySeed = senderMessageKey->seed();
-            result = SenderMessageKey(iteration, ByteArray(senderMessageKeySeed.data(), senderMessageKeySeed.length()));
-            delete senderMessageKey;
-            break;
-        }
+    auto it = senderMessageKeys.find(iteration);
+    if (it == senderMessageKeys.end()) {
+        return SenderMessageKey();
     }
 
+    SenderMessageKey result(iteration, it->second);
+    senderMessageKeys.erase(it);
     return result;
 }
 
 textsecure::SenderKeyStateStructure SenderKeyState::getStructure() const
 {
-    return senderKeyStateStructure;
+    textsecure::SenderKeyStateStructure structure(senderKeyStateStructure);
+    for (uint32_t iteration: senderMessageKeyOrder) {
+        auto it = senderMessageKeys.find(iteration);
+        if (it != senderMessageKeys.end()) {
+            textsecure::SenderKeyStateStructure::SenderMessageKey *key = structure.add_sendermessagekeys();
+            key->set_iteration(iteration);
+            key->set_seed(it->second.c_str(), it->second.size());
+        }
+    }
+    return structure;
 }
@@ -6,6 +6,10 @@
 #include "senderchainkey.h"
 #include "byteutil.h"
 
+#include <deque>
+#include <unordered_map>
+#include <stdint.h>
+
 class SenderKeyState
 {
 public:
@@ -23,11 +27,21 @@ public:
     DjbECPrivateKey getSigningKeyPrivate() const;
     bool hasSenderMessageKey(uint32_t iteration) const;
     void addSenderMessageKey(const SenderMessageKey &senderMessageKey);
+    SenderMessageKey getSenderMessageKey(uint32_t iteration) const;
     SenderMessageKey removeSenderMessageKey(uint32_t iteration);
     textsecure::SenderKeyStateStructure getStructure() const;
 
+    static const unsigned MAX_MESSAGE_KEYS = 2000;
+
 private:
+    void loadSenderMessageKeys();
+    void addSenderMessageSeed(uint32_t iteration, const ByteArray &seed);
+
     textsecure::SenderKeyStateStructure senderKeyStateStructure;
+    // Seeds of the skipped messages by iteration, out of the structure
+    // while live. The oldest go first past MAX_MESSAGE_KEYS.
+    std::unordered_map<uint32_t, ByteArray> senderMessageKeys;
+    std::deque<uint32_t> senderMessageKeyOrder;
 };
 
 #endif // SENDERKEYSTATE_H
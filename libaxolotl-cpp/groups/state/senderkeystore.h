@@ -8,7 +8,8 @@ class SenderKeyStore
 {
 public:
     virtual void storeSenderKey(const ByteArray &senderKeyId, SenderKeyRecord *record) = 0;
-    virtual SenderKeyRecord loadSenderKey(const ByteArray &senderKeyId) const = 0;
+    // The store's own record, live until it's deleted (not by the caller)
+    virtual SenderKeyRecord *loadSenderKey(const ByteArray &senderKeyId) = 0;
 };
 
 #endif // SENDERKEYSTORE_H
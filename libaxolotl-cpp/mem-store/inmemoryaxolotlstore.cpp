@@ -142,7 +142,7 @@ void InMemoryAxolotlStore::storeSenderKey(const ByteArray &senderKeyId, SenderKe
 	senderKeyStore.storeSenderKey(senderKeyId, record);
 }
 
-SenderKeyRecord InMemoryAxolotlStore::loadSenderKey(const ByteArray &senderKeyId) const {
+SenderKeyRecord *InMemoryAxolotlStore::loadSenderKey(const ByteArray &senderKeyId) {
 	return senderKeyStore.loadSenderKey(senderKeyId);
 }
 
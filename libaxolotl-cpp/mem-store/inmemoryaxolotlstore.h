@@ -53,11 +53,13 @@ public:
 	void removeSignedPreKey(uint64_t signedPreKeyId);
 
     void storeSenderKey(const ByteArray &senderKeyId, SenderKeyRecord *record);
-    SenderKeyRecord loadSenderKey(const ByteArray &senderKeyId) const;
+    SenderKeyRecord *loadSenderKey(const ByteArray &senderKeyId);
 
+	// Serializes the sessions and sender keys changed since the last flush
+	void flush() { sessionStore.flush(); senderKeyStore.flush(); }
 	std::string serialize() const;
 
-private:
+protected:
 	InMemoryIdentityKeyStore  identityKeyStore;
 	InMemoryPreKeyStore	   preKeyStore;
 	InMemorySessionStore	  sessionStore;
@@ -6,7 +6,7 @@
 
 #include <iostream>
 
-InMemoryIdentityKeyStore::InMemoryIdentityKeyStore(Unserializer uns)
+InMemoryIdentityKeyStore::InMemoryIdentityKeyStore(Unserializer &uns)
 {
 	unsigned int n = uns.readInt32();
 	while (n--) {
@@ -2,7 +2,7 @@
 #include "serializer.h"
 #include "whisperexception.h"
 
-InMemoryPreKeyStore::InMemoryPreKeyStore(Unserializer uns)
+InMemoryPreKeyStore::InMemoryPreKeyStore(Unserializer &uns)
 {
 	unsigned int n = uns.readInt32();
 	while (n--) {
@@ -4,26 +4,46 @@ InMemorySenderKeyStore::InMemorySenderKeyStore()
 {
 }
 
-InMemorySenderKeyStore::InMemorySenderKeyStore(Unserializer uns)
+InMemorySenderKeyStore::InMemorySenderKeyStore(Unserializer &uns)
 {
 	unsigned int n = uns.readInt32();
 	while (n--) {
 		std::string key = uns.readString();
-		store[key] = SenderKeyRecord(uns.readString());
+		store[key] = uns.readString();
 	}
 }
 
 void InMemorySenderKeyStore::storeSenderKey(const ByteArray &senderKeyId, SenderKeyRecord *record)
 {
-    store[senderKeyId] = *record;
+	live.store(senderKeyId, record);
+	store.emplace(senderKeyId, ByteArray());
 }
 
-SenderKeyRecord InMemorySenderKeyStore::loadSenderKey(const ByteArray &senderKeyId) const
+SenderKeyRecord *InMemorySenderKeyStore::loadSenderKey(const ByteArray &senderKeyId)
 {
-    if (store.find(senderKeyId) != store.end())
-        return store.at(senderKeyId);
+	SenderKeyRecord *record = live.find(senderKeyId);
+	if (record)
+		return record;
 
-    return SenderKeyRecord();
+	auto st = store.find(senderKeyId);
+	bool stored = st != store.end();
+	return live.insert(senderKeyId, stored ? new SenderKeyRecord(st->second) : new SenderKeyRecord(), stored);
+}
+
+void InMemorySenderKeyStore::flush(std::function<void (const ByteArray &, const ByteArray &)> written)
+{
+	live.flush([&] (const ByteArray &key, SenderKeyRecord &record) {
+		ByteArray & serialized = store[key];
+		serialized = record.serialize();
+		if (written)
+			written(key, serialized);
+	});
+}
+
+void InMemorySenderKeyStore::storeSerialized(const ByteArray &senderKeyId, const ByteArray &serialized)
+{
+	store[senderKeyId] = serialized;
+	live.erase(senderKeyId);
 }
 
 std::string InMemorySenderKeyStore::serialize() const
@@ -33,10 +53,13 @@ std::string InMemorySenderKeyStore::serialize() const
 
 	for (auto & key: store) {
 		ser.putString(key.first);
-		ser.putString(key.second.serialize());
+		const SenderKeyRecord *record = live.dirtyRecord(key.first);
+		if (record)
+			ser.putString(record->serialize());
+		else
+			ser.putString(key.second);
 	}
 
 	return ser.getBuffer();	
 }
 
-
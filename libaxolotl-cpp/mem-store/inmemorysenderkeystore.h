@@ -1,24 +1,36 @@
 #ifndef INMEMORYSENDERKEYSTORE_H
 #define INMEMORYSENDERKEYSTORE_H
 
+#include <functional>
 #include <map>
 #include "groups/state/senderkeystore.h"
+#include "state/liverecordcache.h"
 #include "byteutil.h"
 #include "serializer.h"
 
+// Sender keys are kept live like the sessions in InMemorySessionStore:
+// loadSenderKey returns the store's own record, storeSenderKey marks it
+// dirty and flush serializes the dirty ones.
 class InMemorySenderKeyStore : public SenderKeyStore
 {
 public:
     InMemorySenderKeyStore();
-	InMemorySenderKeyStore(Unserializer uns);
+	InMemorySenderKeyStore(Unserializer &uns);
 
     void storeSenderKey(const ByteArray &senderKeyId, SenderKeyRecord *record);
-    SenderKeyRecord loadSenderKey(const ByteArray &senderKeyId) const;
+    SenderKeyRecord *loadSenderKey(const ByteArray &senderKeyId);
 
+	// Calls written (if any) for every record it serializes
+	void flush(std::function<void (const ByteArray &, const ByteArray &)> written = nullptr);
 	std::string serialize() const;
 
+	// Replaces a record with its serialized form, for replays
+	void storeSerialized(const ByteArray &senderKeyId, const ByteArray &serialized);
+
 private:
-    std::map<ByteArray, SenderKeyRecord> store;
+	// Stored records, as of the last flush (empty until the first one)
+    std::map<ByteArray, ByteArray> store;
+	LiveRecordCache<ByteArray, SenderKeyRecord> live;
 };
 
 #endif // INMEMORYSENDERKEYSTORE_H
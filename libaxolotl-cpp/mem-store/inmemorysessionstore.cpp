@@ -5,7 +5,7 @@
 #include <iostream>
 #include <vector>
 
-InMemorySessionStore::InMemorySessionStore(Unserializer uns)
+InMemorySessionStore::InMemorySessionStore(Unserializer &uns)
 {
 	unsigned int n = uns.readInt32();
 	while (n--) {
@@ -20,19 +20,20 @@ InMemorySessionStore::InMemorySessionStore(Unserializer uns)
 SessionRecord *InMemorySessionStore::loadSession(uint64_t recipientId, int deviceId)
 {
 	SessionsKeyPair key(recipientId, deviceId);
-	if (sessions.find(key) != sessions.end()) {
-		return new SessionRecord(sessions.at(key));
-	}
-	else {
-		return new SessionRecord();
-	}
+	SessionRecord *record = live.find(key);
+	if (record)
+		return record;
+
+	auto st = sessions.find(key);
+	bool stored = st != sessions.end();
+	return live.insert(key, stored ? new SessionRecord(st->second) : new SessionRecord(), stored);
 }
 
 std::vector<int> InMemorySessionStore::getSubDeviceSessions(uint64_t recipientId)
 {
 	std::vector<int> deviceIds;
 
-	for (auto it: sessions) {
+	for (auto & it: sessions) {
 		if (it.first.first == recipientId) {
 			deviceIds.push_back(it.first.second);
 		}
@@ -44,8 +45,8 @@ std::vector<int> InMemorySessionStore::getSubDeviceSessions(uint64_t recipientId
 void InMemorySessionStore::storeSession(uint64_t recipientId, int deviceId, SessionRecord *record)
 {
 	SessionsKeyPair key(recipientId, deviceId);
-	ByteArray serialized = record->serialize();
-	sessions.emplace(key, serialized);
+	live.store(key, record)->setFresh(false);
+	sessions.emplace(key, ByteArray());
 }
 
 bool InMemorySessionStore::containsSession(uint64_t recipientId, int deviceId)
@@ -58,21 +59,35 @@ void InMemorySessionStore::deleteSession(uint64_t recipientId, int deviceId)
 {
 	SessionsKeyPair key(recipientId, deviceId);
 	sessions.erase(key);
+	live.erase(key);
 }
 
 void InMemorySessionStore::deleteAllSessions(uint64_t recipientId)
 {
-	bool modified;
-	do {
-		modified = false;
-		for (auto & key: sessions) {
-			if (key.first.first == recipientId) {
-				sessions.erase(key.first);
-				modified = true;
-				break;
-			}
-		}
-	} while (modified);
+	for (auto it = sessions.begin(); it != sessions.end(); ) {
+		if (it->first.first == recipientId)
+			it = sessions.erase(it);
+		else
+			++it;
+	}
+	live.eraseIf([recipientId] (const SessionsKeyPair &key) { return key.first == recipientId; });
+}
+
+void InMemorySessionStore::flush(std::function<void (const SessionsKeyPair &, const ByteArray &)> written)
+{
+	live.flush([&] (const SessionsKeyPair &key, SessionRecord &record) {
+		ByteArray & serialized = sessions[key];
+		serialized = record.serialize();
+		if (written)
+			written(key, serialized);
+	});
+}
+
+void InMemorySessionStore::storeSerialized(uint64_t recipientId, int deviceId, const ByteArray &serialized)
+{
+	SessionsKeyPair key(recipientId, deviceId);
+	sessions[key] = serialized;
+	live.erase(key);
 }
 
 std::string InMemorySessionStore::serialize() const {
@@ -82,11 +97,13 @@ std::string InMemorySessionStore::serialize() const {
 	for (auto & key: sessions) {
 		ser.putInt64(key.first.first);
 		ser.putInt32(key.first.second);
-		ser.putString(key.second);
+		const SessionRecord *record = live.dirtyRecord(key.first);
+		if (record)
+			ser.putString(record->serialize());
+		else
+			ser.putString(key.second);
 	}
 
 	return ser.getBuffer();
 }
 
-
-
@@ -3,8 +3,10 @@
 
 #include "state/sessionstore.h"
 #include "state/sessionrecord.h"
+#include "state/liverecordcache.h"
 #include "serializer.h"
 
+#include <functional>
 #include <utility>
 #include <map>
 #include <vector>
@@ -12,11 +14,14 @@
 
 typedef std::pair<uint64_t, int> SessionsKeyPair;
 
+// Sessions are parsed once and kept live: loadSession returns the store's
+// own record (the caller must not delete it) and storeSession just marks
+// it dirty. Dirty records are serialized on flush (or serialize).
 class InMemorySessionStore : public SessionStore
 {
 public:
 	InMemorySessionStore() {}
-	InMemorySessionStore(Unserializer uns);
+	InMemorySessionStore(Unserializer &uns);
 
 	SessionRecord *loadSession(uint64_t recipientId, int deviceId);
 	std::vector<int> getSubDeviceSessions(uint64_t recipientId);
@@ -25,10 +30,17 @@ public:
 	void deleteSession(uint64_t recipientId, int deviceId);
 	void deleteAllSessions(uint64_t recipientId);
 
+	// Calls written (if any) for every session it serializes
+	void flush(std::function<void (const SessionsKeyPair &, const ByteArray &)> written = nullptr);
 	std::string serialize() const;
 
+	// Replaces a session with its serialized form, for replays
+	void storeSerialized(uint64_t recipientId, int deviceId, const ByteArray &serialized);
+
 private:
+	// Stored sessions, as of the last flush (empty until the first one)
 	std::map<SessionsKeyPair, ByteArray> sessions;
+	LiveRecordCache<SessionsKeyPair, SessionRecord> live;
 };
 
 #endif // INMEMORYSESSIONSTORE_H
@@ -5,7 +5,7 @@
 #include "byteutil.h"
 #include <vector>
 
-InMemorySignedPreKeyStore::InMemorySignedPreKeyStore(Unserializer uns)
+InMemorySignedPreKeyStore::InMemorySignedPreKeyStore(Unserializer &uns)
 {
 	unsigned int n = uns.readInt32();
 	while (n--) {
@@ -0,0 +1,383 @@
+#include "loggedaxolotlstore.h"
+#include "whisperexception.h"
+
+#include "ecc/curve.h"
+#include "ecc/eckeypair.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+	#include <io.h>
+	#define LOG_OPEN_FLAGS O_BINARY
+	#define fdatasync _commit
+	#define ftruncate _chsize
+#else
+	#include <sys/mman.h>
+	#define LOG_OPEN_FLAGS O_CLOEXEC
+#endif
+
+// Below this the log is never compacted
+#define MIN_COMPACT_SIZE (64*1024)
+
+static uint32_t crc32(const char *data, size_t len)
+{
+	static uint32_t table[256];
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < len; i++)
+		crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+static uint32_t get32(const char *p)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+// Length, CRC and payload
+static std::string frame(const std::string &payload)
+{
+	Serializer ser;
+	ser.putInt32(payload.size());
+	ser.putInt32(crc32(payload.data(), payload.size()));
+	return ser.getBuffer() + payload;
+}
+
+LoggedAxolotlStore::LoggedAxolotlStore(const std::string &path, unsigned int compactFactor)
+ : path(path), compactFactor(compactFactor > 1 ? compactFactor : 2), size(0), liveSize(0),
+   compacted(false), compactOk(false), compacting(false), compactFd(-1), compactSize(0)
+{
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | LOG_OPEN_FLAGS, 0600);
+	if (fd < 0)
+		throw WhisperException("StoreLogException", "Can't open " + path + ": " + strerror(errno));
+
+	try {
+		size = replay();
+	} catch (WhisperException &e) {
+		close(fd);
+		throw;
+	}
+}
+
+LoggedAxolotlStore::~LoggedAxolotlStore()
+{
+	try {
+		commit();
+	} catch (WhisperException &e) {
+	}
+	if (compacting)
+		finishCompaction();
+	close(fd);
+}
+
+// Applies the complete records, a torn one at the end is cut off
+uint64_t LoggedAxolotlStore::replay()
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		throw WhisperException("StoreLogException", "Can't stat " + path);
+	uint64_t length = st.st_size;
+	if (length == 0)
+		return 0;
+
+#ifdef _WIN32
+	std::string file(length, 0);
+	if (read(fd, &file[0], length) != (int)length)
+		throw WhisperException("StoreLogException", "Can't read " + path);
+	const char *data = file.data();
+#else
+	void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		throw WhisperException("StoreLogException", "Can't map " + path);
+	const char *data = (const char *)map;
+#endif
+
+	uint64_t good = 0;
+	while (good + 8 <= length) {
+		uint32_t len = get32(data + good);
+		if (len > length - good - 8 || crc32(data + good + 8, len) != get32(data + good + 4))
+			break;
+		Unserializer uns(std::string(data + good + 8, len));
+		apply(uns);
+		good += 8 + len;
+	}
+
+#ifndef _WIN32
+	munmap(map, length);
+#endif
+	if (good < length && ftruncate(fd, good) < 0)
+		throw WhisperException("StoreLogException", "Can't truncate " + path);
+	return good;
+}
+
+void LoggedAxolotlStore::apply(Unserializer &uns)
+{
+	switch (uns.readInt(1)) {
+	case Snapshot: {
+		std::string data = uns.readString();
+		liveSize = data.size();
+		InMemoryAxolotlStore::operator=(InMemoryAxolotlStore(data));
+		} break;
+	case LocalData: {
+		uint64_t registrationId = uns.readInt64();
+		IdentityKey publicKey(uns.readString());
+		DjbECPrivateKey privateKey(uns.readString());
+		InMemoryAxolotlStore::storeLocalData(registrationId, IdentityKeyPair(publicKey, privateKey));
+		} break;
+	case Identity: {
+		uint64_t recipientId = uns.readInt64();
+		InMemoryAxolotlStore::saveIdentity(recipientId, IdentityKey(uns.readString()));
+		} break;
+	case IdentityRemoved:
+		InMemoryAxolotlStore::removeIdentity(uns.readInt64());
+		break;
+	case PreKey: {
+		uint64_t preKeyId = uns.readInt64();
+		InMemoryAxolotlStore::storePreKey(preKeyId, PreKeyRecord(uns.readString()));
+		} break;
+	case PreKeyRemoved:
+		InMemoryAxolotlStore::removePreKey(uns.readInt64());
+		break;
+	case Session: {
+		uint64_t recipientId = uns.readInt64();
+		int deviceId = uns.readInt32();
+		sessionStore.storeSerialized(recipientId, deviceId, uns.readString());
+		} break;
+	case SessionRemoved: {
+		uint64_t recipientId = uns.readInt64();
+		int deviceId = uns.readInt32();
+		InMemoryAxolotlStore::deleteSession(recipientId, deviceId);
+		} break;
+	case SignedPreKey: {
+		uint64_t signedPreKeyId = uns.readInt64();
+		InMemoryAxolotlStore::storeSignedPreKey(signedPreKeyId, SignedPreKeyRecord(uns.readString()));
+		} break;
+	case SignedPreKeyRemoved:
+		InMemoryAxolotlStore::removeSignedPreKey(uns.readInt64());
+		break;
+	case SenderKey: {
+		ByteArray senderKeyId = uns.readString();
+		senderKeyStore.storeSerialized(senderKeyId, uns.readString());
+		} break;
+	}
+}
+
+void LoggedAxolotlStore::append(const std::string &payload)
+{
+	pending += frame(payload);
+}
+
+void LoggedAxolotlStore::writeOut(int fd, const std::string &data)
+{
+	size_t done = 0;
+	while (done < data.size()) {
+		int ret = write(fd, data.data() + done, data.size() - done);
+		if (ret > 0)
+			done += ret;
+		else if (ret < 0 && errno != EINTR)
+			throw WhisperException("StoreLogException", std::string("Can't write the log: ") + strerror(errno));
+	}
+}
+
+void LoggedAxolotlStore::commit()
+{
+	sessionStore.flush([this] (const SessionsKeyPair &key, const ByteArray &serialized) {
+		Serializer ser;
+		ser.putInt(Session, 1);
+		ser.putInt64(key.first);
+		ser.putInt32(key.second);
+		ser.putString(serialized);
+		append(ser.getBuffer());
+	});
+	senderKeyStore.flush([this] (const ByteArray &senderKeyId, const ByteArray &serialized) {
+		Serializer ser;
+		ser.putInt(SenderKey, 1);
+		ser.putString(senderKeyId);
+		ser.putString(serialized);
+		append(ser.getBuffer());
+	});
+
+	if (compacting && compacted)
+		finishCompaction();
+
+	if (pending.size()) {
+		try {
+			writeOut(fd, pending);
+			if (fdatasync(fd) < 0)
+				throw WhisperException("StoreLogException", std::string("Can't sync the log: ") + strerror(errno));
+		} catch (WhisperException &e) {
+			// Cut off what made it, the next commit writes it all again
+			if (ftruncate(fd, size) < 0)
+				throw WhisperException("StoreLogException", "Can't truncate " + path + " after: " + e.errorMessage());
+			throw;
+		}
+		size += pending.size();
+		if (compacting)
+			tail += pending;
+		pending.clear();
+	}
+
+	if (!compacting && size > compactFactor * std::max<uint64_t>(liveSize, MIN_COMPACT_SIZE))
+		startCompaction();
+}
+
+void LoggedAxolotlStore::startCompaction()
+{
+	Serializer ser;
+	ser.putInt(Snapshot, 1);
+	ser.putString(serialize());
+	std::string record = frame(ser.getBuffer());
+
+	// Not again until the log grows as much
+	liveSize = record.size();
+	compactFd = open((path + ".new").c_str(), O_WRONLY | O_CREAT | O_TRUNC | LOG_OPEN_FLAGS, 0600);
+	if (compactFd < 0)
+		return;
+
+	compactSize = record.size();
+	compacting = true;
+	compacted = false;
+	compactor = std::thread([this, record] () {
+		bool ok = true;
+		try {
+			writeOut(compactFd, record);
+		} catch (WhisperException &e) {
+			ok = false;
+		}
+		compactOk = ok && fdatasync(compactFd) == 0;
+		compacted = true;
+	});
+}
+
+void LoggedAxolotlStore::finishCompaction()
+{
+	compactor.join();
+	compacting = false;
+
+	std::string newPath = path + ".new";
+	bool ok = compactOk;
+	if (ok) {
+		try {
+			writeOut(compactFd, tail);
+			ok = fdatasync(compactFd) == 0;
+		} catch (WhisperException &e) {
+			ok = false;
+		}
+	}
+#ifdef _WIN32
+	if (ok)
+		remove(path.c_str());
+#endif
+	// The old log stays complete until the new one replaces it
+	if (ok && rename(newPath.c_str(), path.c_str()) == 0) {
+		close(fd);
+		fd = compactFd;
+		size = compactSize + tail.size();
+	}
+	else {
+		close(compactFd);
+		unlink(newPath.c_str());
+	}
+	compactFd = -1;
+	tail.clear();
+}
+
+void LoggedAxolotlStore::storeLocalData(uint64_t registrationId, const IdentityKeyPair identityKeyPair)
+{
+	InMemoryAxolotlStore::storeLocalData(registrationId, identityKeyPair);
+	Serializer ser;
+	ser.putInt(LocalData, 1);
+	ser.putInt64(registrationId);
+	ser.putString(identityKeyPair.getPublicKey().serialize());
+	ser.putString(identityKeyPair.getPrivateKey().serialize());
+	append(ser.getBuffer());
+}
+
+void LoggedAxolotlStore::saveIdentity(uint64_t recipientId, const IdentityKey &identityKey)
+{
+	InMemoryAxolotlStore::saveIdentity(recipientId, identityKey);
+	Serializer ser;
+	ser.putInt(Identity, 1);
+	ser.putInt64(recipientId);
+	ser.putString(identityKey.serialize());
+	append(ser.getBuffer());
+}
+
+void LoggedAxolotlStore::removeIdentity(uint64_t recipientId)
+{
+	InMemoryAxolotlStore::removeIdentity(recipientId);
+	Serializer ser;
+	ser.putInt(IdentityRemoved, 1);
+	ser.putInt64(recipientId);
+	append(ser.getBuffer());
+}
+
+void LoggedAxolotlStore::storePreKey(uint64_t preKeyId, const PreKeyRecord &record)
+{
+	InMemoryAxolotlStore::storePreKey(preKeyId, record);
+	Serializer ser;
+	ser.putInt(PreKey, 1);
+	ser.putInt64(preKeyId);
+	ser.putString(record.serialize());
+	append(ser.getBuffer());
+}
+
+void LoggedAxolotlStore::removePreKey(uint64_t preKeyId)
+{
+	InMemoryAxolotlStore::removePreKey(preKeyId);
+	Serializer ser;
+	ser.putInt(PreKeyRemoved, 1);
+	ser.putInt64(preKeyId);
+	append(ser.getBuffer());
+}
+
+void LoggedAxolotlStore::deleteSession(uint64_t recipientId, int deviceId)
+{
+	InMemoryAxolotlStore::deleteSession(recipientId, deviceId);
+	Serializer ser;
+	ser.putInt(SessionRemoved, 1);
+	ser.putInt64(recipientId);
+	ser.putInt32(deviceId);
+	append(ser.getBuffer());
+}
+
+void LoggedAxolotlStore::deleteAllSessions(uint64_t recipientId)
+{
+	for (int deviceId: getSubDeviceSessions(recipientId))
+		deleteSession(recipientId, deviceId);
+	InMemoryAxolotlStore::deleteAllSessions(recipientId);
+}
+
+void LoggedAxolotlStore::storeSignedPreKey(uint64_t signedPreKeyId, const SignedPreKeyRecord &record)
+{
+	InMemoryAxolotlStore::storeSignedPreKey(signedPreKeyId, record);
+	Serializer ser;
+	ser.putInt(SignedPreKey, 1);
+	ser.putInt64(signedPreKeyId);
+	ser.putString(record.serialize());
+	append(ser.getBuffer());
+}
+
+void LoggedAxolotlStore::removeSignedPreKey(uint64_t signedPreKeyId)
+{
+	InMemoryAxolotlStore::removeSignedPreKey(signedPreKeyId);
+	Serializer ser;
+	ser.putInt(SignedPreKeyRemoved, 1);
+	ser.putInt64(signedPreKeyId);
+	append(ser.getBuffer());
+}
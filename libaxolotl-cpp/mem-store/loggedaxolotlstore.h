@@ -0,0 +1,73 @@
+#ifndef LOGGEDAXOLOTLSTORE_H
+#define LOGGEDAXOLOTLSTORE_H
+
+#include "inmemoryaxolotlstore.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+// In-memory store persisted to an append-only log of its changes. Every
+// record carries a CRC, so a torn write at the end is dropped on replay.
+// The changes are written and synced on commit(). Once the log grows past
+// a multiple of the live data, a snapshot (serialize()) is written to a
+// new log in the background and replaces the old one when it's ready.
+class LoggedAxolotlStore : public InMemoryAxolotlStore
+{
+public:
+	LoggedAxolotlStore(const std::string &path, unsigned int compactFactor = 4);
+	~LoggedAxolotlStore();
+
+	void storeLocalData(uint64_t registrationId, const IdentityKeyPair identityKeyPair);
+	void saveIdentity(uint64_t recipientId, const IdentityKey &identityKey);
+	void removeIdentity(uint64_t recipientId);
+
+	void storePreKey(uint64_t preKeyId, const PreKeyRecord &record);
+	void removePreKey(uint64_t preKeyId);
+
+	void deleteSession(uint64_t recipientId, int deviceId);
+	void deleteAllSessions(uint64_t recipientId);
+
+	void storeSignedPreKey(uint64_t signedPreKeyId, const SignedPreKeyRecord &record);
+	void removeSignedPreKey(uint64_t signedPreKeyId);
+
+	void commit();
+	// Sessions and sender keys only reach the log on commit
+	void flush() { commit(); }
+
+	uint64_t logSize() const { return size; }
+
+private:
+	enum RecordType {
+		Snapshot = 1, LocalData, Identity, IdentityRemoved, PreKey, PreKeyRemoved,
+		Session, SessionRemoved, SignedPreKey, SignedPreKeyRemoved, SenderKey
+	};
+
+	LoggedAxolotlStore(const LoggedAxolotlStore &);
+	LoggedAxolotlStore &operator=(const LoggedAxolotlStore &);
+
+	uint64_t replay();
+	void apply(Unserializer &uns);
+	void append(const std::string &payload);
+	void writeOut(int fd, const std::string &data);
+	void startCompaction();
+	void finishCompaction();
+
+	std::string path;
+	unsigned int compactFactor;
+	int fd;
+	uint64_t size, liveSize;
+	std::string pending;
+
+	// Compaction in progress: the records written meanwhile are kept in
+	// tail, to be appended to the new log before it replaces the old one
+	std::thread compactor;
+	std::atomic<bool> compacted, compactOk;
+	bool compacting;
+	int compactFd;
+	uint64_t compactSize;
+	std::string tail;
+};
+
+#endif // LOGGEDAXOLOTLSTORE_H
@@ -18,19 +18,16 @@ void Serializer::putString(std::string s) {
 
 uint64_t Unserializer::readInt(int size) {
 	uint64_t ret = 0;
-	for (uint64_t i = 0; i < size; i++) {
-		ret |= (buffer[i] << (i*8));
+	for (int i = 0; i < size && pos < buffer.size(); i++) {
+		ret |= (uint64_t)(unsigned char)buffer[pos++] << (i*8);
 	}
-	buffer = buffer.substr(4);
 	return ret;
 }
 
 std::string Unserializer::readString() {
 	unsigned int length = readInt32();
-	std::string ret(buffer.c_str(), length);
+	std::string ret = buffer.substr(pos < buffer.size() ? pos : buffer.size(), length);
 
-	buffer = buffer.substr(length);
+	pos += ret.size();
 	return ret;
 }
-
-
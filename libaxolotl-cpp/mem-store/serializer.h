@@ -21,7 +21,8 @@ private:
 
 class Unserializer {
 public:
-	Unserializer(std::string s) : buffer(s) {}
+	// Each read moves past what it read
+	Unserializer(std::string s) : buffer(s), pos(0) {}
 
 	unsigned int readInt32() { return readInt(4); }
 	uint64_t readInt64() { return readInt(8); }
@@ -31,6 +32,7 @@ public:
 
 private:
 	std::string buffer;
+	size_t pos;
 };
 
 
@@ -108,8 +108,25 @@ std::shared_ptr<CiphertextMessage> SessionCipher::encrypt(const ByteArray &padde
 ByteArray SessionCipher::decrypt(std::shared_ptr<PreKeyWhisperMessage> ciphertext)
 {
     SessionRecord    *sessionRecord    = sessionStore->loadSession(recipientId, deviceId);
-    uint64_t         unsignedPreKeyId  = sessionBuilder.process(sessionRecord, ciphertext);
-    ByteArray        plaintext         = decrypt(sessionRecord, ciphertext->getWhisperMessage());
+    bool             existed           = sessionStore->containsSession(recipientId, deviceId);
+    uint64_t         unsignedPreKeyId;
+    ByteArray        plaintext;
+
+    // The store may hand out its live record, which the builder changes
+    // before the message is known to be good: put the old one back
+    ByteArray        backup            = existed ? sessionRecord->serialize() : ByteArray();
+    try {
+        unsignedPreKeyId = sessionBuilder.process(sessionRecord, ciphertext);
+        plaintext        = decrypt(sessionRecord, ciphertext->getWhisperMessage());
+    } catch (...) {
+        if (existed) {
+            SessionRecord previous(backup);
+            sessionStore->storeSession(recipientId, deviceId, &previous);
+        } else {
+            sessionStore->deleteSession(recipientId, deviceId);
+        }
+        throw;
+    }
 
     sessionStore->storeSession(recipientId, deviceId, sessionRecord);
 
@@ -139,23 +156,25 @@ ByteArray SessionCipher::decrypt(SessionRecord *sessionRecord, std::shared_ptr<W
     std::vector<SessionState*> previousStatesList = sessionRecord->getPreviousSessionStates();
     std::vector<WhisperException> exceptions;
 
+    // Decrypting advances the state, so it works on a copy and only
+    // keeps it if the message is good (the copy goes on any exception)
+    std::unique_ptr<SessionState> sessionState(new SessionState(*sessionRecord->getSessionState()));
     try {
-        SessionState *sessionState = sessionRecord->getSessionState();
-        ByteArray    plaintext    = decrypt(sessionState, ciphertext);
+        ByteArray    plaintext    = decrypt(sessionState.get(), ciphertext);
 
-        sessionRecord->setState(sessionState);
+        sessionRecord->setState(sessionState.release());
         return plaintext;
     } catch (const InvalidMessageException &e) {
         exceptions.push_back(e);
     }
 
 	for (unsigned i = 0; i < previousStatesList.size(); i++) {
+        std::unique_ptr<SessionState> promotedState(new SessionState(*previousStatesList[i]));
         try {
-            SessionState *promotedState = previousStatesList[i];
-            ByteArray    plaintext     = decrypt(promotedState, ciphertext);
+            ByteArray    plaintext     = decrypt(promotedState.get(), ciphertext);
 
-            previousStatesList.erase(previousStatesList.begin() + i);
-            sessionRecord->promoteState(promotedState);
+            sessionRecord->removePreviousState(previousStatesList[i]);
+            sessionRecord->promoteState(promotedState.release());
 
             return plaintext;
         } catch (const InvalidMessageException &e) {
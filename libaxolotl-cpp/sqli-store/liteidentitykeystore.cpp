@@ -1,97 +1,98 @@
-
 #include "liteidentitykeystore.h"
 #include "whisperexception.h"
-#include "sqliutil.h"
 
-LiteIdentityKeyStore::LiteIdentityKeyStore(sqlite::connection &db)
- : _db(db)
+#include "ecc/curve.h"
+#include "ecc/eckeypair.h"
+
+LiteIdentityKeyStore::LiteIdentityKeyStore(LiteDatabase &db)
+ : db(db), localLoaded(false), hasLocal(false), localRegistrationId(0)
 {
-    sqlite::execute(_db, "CREATE TABLE IF NOT EXISTS identities (_id INTEGER PRIMARY KEY AUTOINCREMENT, recipient_id INTEGER UNIQUE, registration_id INTEGER, public_key BLOB, private_key BLOB, next_prekey_id INTEGER, timestamp INTEGER);", true);
+	db.execute("CREATE TABLE IF NOT EXISTS identities (recipient_id INTEGER PRIMARY KEY, public_key BLOB);");
+	db.execute("CREATE TABLE IF NOT EXISTS local_identity (id INTEGER PRIMARY KEY, registration_id INTEGER, public_key BLOB, private_key BLOB);");
 }
 
 void LiteIdentityKeyStore::clear()
 {
-    sqlite::execute(_db, "DELETE FROM identities;", true);
+	db.beginWrite();
+	LiteQuery(db, "DELETE FROM identities;").step();
+	LiteQuery(db, "DELETE FROM local_identity;").step();
+	trustedKeys.clear();
+	localLoaded = false;
 }
 
-IdentityKeyPair LiteIdentityKeyStore::getIdentityKeyPair()
+void LiteIdentityKeyStore::loadLocalData()
 {
-    sqlite::query q(_db, "SELECT public_key, private_key FROM identities WHERE recipient_id = -1;");
-
-    boost::shared_ptr<sqlite::result> result = q.get_result();
+	if (localLoaded)
+		return;
 
-    if (result->next_row()) {
-        std::vector<unsigned char> res, res2;
-        result->get_binary(0, res);
-        std::string publicBytes = barray_to_string(res).substr(1);
-        DjbECPublicKey publicKey(publicBytes);
-        IdentityKey publicIdentity(publicKey);
-        result->get_binary(1, res2);
-        std::string privateBytes = barray_to_string(res2);
-        DjbECPrivateKey privateKey(privateBytes);
-        IdentityKeyPair keypair(publicIdentity, privateKey);
-        return keypair;
-    }
-    else {
-        throw WhisperException("Can't get IdentityKeyPair!");
-    }
+	LiteQuery q(db, "SELECT registration_id, public_key, private_key FROM local_identity WHERE id = 0;");
+	if (q.step()) {
+		localRegistrationId = q.getInt(0);
+		identityKeyPair = IdentityKeyPair(IdentityKey(q.getBlob(1)), DjbECPrivateKey(q.getBlob(2)));
+		hasLocal = true;
+	}
+	localLoaded = true;
 }
 
-unsigned int LiteIdentityKeyStore::getLocalRegistrationId()
+IdentityKeyPair LiteIdentityKeyStore::getIdentityKeyPair()
 {
-    sqlite::query q(_db, "SELECT registration_id FROM identities WHERE recipient_id = -1;");
-
-    boost::shared_ptr<sqlite::result> result = q.get_result();
-
-    if (result->next_row()) {
-        return result->get_int(0);
-    }
-    else {
-        throw WhisperException("Can't get LocalRegistrationId!");
-    }
+	loadLocalData();
+	if (!hasLocal)
+		throw WhisperException("Can't get IdentityKeyPair!");
+	return identityKeyPair;
 }
 
-void LiteIdentityKeyStore::removeIdentity(uint64_t recipientId)
+unsigned int LiteIdentityKeyStore::getLocalRegistrationId()
 {
-    sqlite::query q(_db, "DELETE FROM identities WHERE recipient_id=?;");
-    q % (int64_t)recipientId;
-    q();
+	loadLocalData();
+	if (!hasLocal)
+		throw WhisperException("Can't get LocalRegistrationId!");
+	return localRegistrationId;
 }
 
 void LiteIdentityKeyStore::storeLocalData(uint64_t registrationId, const IdentityKeyPair identityKeyPair)
 {
-    sqlite::query q(_db, "INSERT INTO identities (recipient_id, registration_id, public_key, private_key) VALUES(-1, ?, ?, ?);");
-    q % (int64_t)registrationId
-        % string_to_barray(identityKeyPair.getPublicKey().getPublicKey().serialize())
-        % string_to_barray(identityKeyPair.getPrivateKey().serialize());
-    q();
+	db.beginWrite();
+	LiteQuery(db, "INSERT OR REPLACE INTO local_identity (id, registration_id, public_key, private_key) VALUES (0, ?, ?, ?);")
+		.bind(registrationId)
+		.bind(identityKeyPair.getPublicKey().serialize())
+		.bind(identityKeyPair.getPrivateKey().serialize())
+		.step();
+
+	this->localRegistrationId = registrationId;
+	this->identityKeyPair = identityKeyPair;
+	localLoaded = hasLocal = true;
 }
 
 void LiteIdentityKeyStore::saveIdentity(uint64_t recipientId, const IdentityKey &identityKey)
 {
-    sqlite::query q(_db, "DELETE FROM identities WHERE recipient_id=?;");
-    q % (int64_t)recipientId;
-    q();
+	std::string key = identityKey.serialize();
+	auto it = trustedKeys.find(recipientId);
+	if (it != trustedKeys.end() && it->second == key)
+		return;
 
-    sqlite::query q2(_db, "INSERT INTO identities (recipient_id, public_key) VALUES(?, ?);");
-    q2 % (int64_t)recipientId % string_to_barray(identityKey.getPublicKey().serialize());
-    q2();
+	db.beginWrite();
+	LiteQuery(db, "INSERT OR REPLACE INTO identities (recipient_id, public_key) VALUES (?, ?);")
+		.bind(recipientId).bind(key).step();
+	trustedKeys[recipientId] = key;
 }
 
 bool LiteIdentityKeyStore::isTrustedIdentity(uint64_t recipientId, const IdentityKey &identityKey)
 {
-    sqlite::query q(_db, "SELECT public_key from identities WHERE recipient_id=?;");
-    q % (int64_t)recipientId;
-    q();
-    boost::shared_ptr<sqlite::result> result = q.get_result();
+	auto it = trustedKeys.find(recipientId);
+	if (it == trustedKeys.end()) {
+		LiteQuery q(db, "SELECT public_key FROM identities WHERE recipient_id = ?;");
+		q.bind(recipientId);
+		it = trustedKeys.emplace(recipientId, q.step() ? q.getBlob(0) : std::string()).first;
+	}
 
-    if (result->next_row()) {
-        std::vector<unsigned char> res;
-        result->get_binary(0, res);
-        std::string publicKey = barray_to_string(res);
-        return publicKey == identityKey.getPublicKey().serialize();
-    }
-    else {
-        return true;
-    }
+	// Unknown ones are trusted on first use
+	return it->second.empty() || it->second == identityKey.serialize();
+}
+
+void LiteIdentityKeyStore::removeIdentity(uint64_t recipientId)
+{
+	db.beginWrite();
+	LiteQuery(db, "DELETE FROM identities WHERE recipient_id = ?;").bind(recipientId).step();
+	trustedKeys[recipientId] = std::string();
 }
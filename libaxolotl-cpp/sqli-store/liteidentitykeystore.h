@@ -2,29 +2,34 @@
 #define LITEIDENTITYKEYSTORE_H
 
 #include "state/identitykeystore.h"
+#include "sqliutil.h"
 
-#include <vector>
+#include <string>
+#include <unordered_map>
 #include <stdint.h>
 
-#include <sqlite/connection.hpp>
-#include <sqlite/execute.hpp>
-#include <sqlite/query.hpp>
-
 class LiteIdentityKeyStore : public IdentityKeyStore
 {
 public:
-    LiteIdentityKeyStore(sqlite::connection &db);
-    void clear();
+	LiteIdentityKeyStore(LiteDatabase &db);
+	void clear();
 
-    IdentityKeyPair getIdentityKeyPair();
-    unsigned int getLocalRegistrationId();
-    void            storeLocalData(uint64_t registrationId, const IdentityKeyPair identityKeyPair);
-    void            saveIdentity(uint64_t recipientId, const IdentityKey &identityKey);
-    bool            isTrustedIdentity(uint64_t recipientId, const IdentityKey &identityKey);
-    void            removeIdentity(uint64_t recipientId);
+	IdentityKeyPair getIdentityKeyPair();
+	unsigned int    getLocalRegistrationId();
+	void            storeLocalData(uint64_t registrationId, const IdentityKeyPair identityKeyPair);
+	void            saveIdentity(uint64_t recipientId, const IdentityKey &identityKey);
+	bool            isTrustedIdentity(uint64_t recipientId, const IdentityKey &identityKey);
+	void            removeIdentity(uint64_t recipientId);
 
 private:
-    sqlite::connection &_db;
+	void loadLocalData();
+
+	LiteDatabase &db;
+	bool localLoaded, hasLocal;
+	uint64_t localRegistrationId;
+	IdentityKeyPair identityKeyPair;
+	// Serialized keys read so far, empty for the unknown ones
+	std::unordered_map<uint64_t, std::string> trustedKeys;
 };
 
 #endif // LITEIDENTITYKEYSTORE_H
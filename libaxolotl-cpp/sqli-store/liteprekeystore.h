@@ -2,26 +2,30 @@
 #define LITEPREKEYSTORE_H
 
 #include "state/prekeystore.h"
-#include "state/prekeyrecord.h"
+#include "sqliutil.h"
 
-#include <sqlite/connection.hpp>
-#include <sqlite/execute.hpp>
-#include <sqlite/query.hpp>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
 
 class LitePreKeyStore : public PreKeyStore
 {
 public:
-    LitePreKeyStore(sqlite::connection &db);
-    void clear();
+	LitePreKeyStore(LiteDatabase &db);
+	void clear();
 
-    PreKeyRecord loadPreKey(uint64_t preKeyId);
-    void         storePreKey(uint64_t preKeyId, const PreKeyRecord &record);
-    bool         containsPreKey(uint64_t preKeyId);
-    void         removePreKey(uint64_t preKeyId);
-    int          countPreKeys();
+	PreKeyRecord loadPreKey(uint64_t preKeyId);
+	void         storePreKey(uint64_t preKeyId, const PreKeyRecord &record);
+	bool         containsPreKey(uint64_t preKeyId);
+	void         removePreKey(uint64_t preKeyId);
+	int          countPreKeys();
 
 private:
-    sqlite::connection &_db;
+	const std::string &find(uint64_t preKeyId);
+
+	LiteDatabase &db;
+	// Serialized records read so far, empty for the missing ones
+	std::unordered_map<uint64_t, std::string> records;
 };
 
 #endif // LITEPREKEYSTORE_H
@@ -0,0 +1,40 @@
+#include "litesenderkeystore.h"
+
+LiteSenderKeyStore::LiteSenderKeyStore(LiteDatabase &db)
+ : db(db)
+{
+	db.execute("CREATE TABLE IF NOT EXISTS sender_keys (sender_key_id BLOB PRIMARY KEY, record BLOB);");
+}
+
+void LiteSenderKeyStore::clear()
+{
+	db.beginWrite();
+	LiteQuery(db, "DELETE FROM sender_keys;").step();
+	live.clear();
+}
+
+void LiteSenderKeyStore::storeSenderKey(const ByteArray &senderKeyId, SenderKeyRecord *record)
+{
+	live.store(senderKeyId, record);
+}
+
+SenderKeyRecord *LiteSenderKeyStore::loadSenderKey(const ByteArray &senderKeyId)
+{
+	SenderKeyRecord *record = live.find(senderKeyId);
+	if (record)
+		return record;
+
+	LiteQuery q(db, "SELECT record FROM sender_keys WHERE sender_key_id = ?;");
+	q.bind(senderKeyId);
+	bool stored = q.step();
+	return live.insert(senderKeyId, stored ? new SenderKeyRecord(q.getBlob(0)) : new SenderKeyRecord(), stored);
+}
+
+void LiteSenderKeyStore::flush()
+{
+	live.flush([this] (const ByteArray &key, SenderKeyRecord &record) {
+		db.beginWrite();
+		LiteQuery(db, "INSERT OR REPLACE INTO sender_keys (sender_key_id, record) VALUES (?, ?);")
+			.bind(key).bind(record.serialize()).step();
+	});
+}
@@ -0,0 +1,26 @@
+#ifndef LITESENDERKEYSTORE_H
+#define LITESENDERKEYSTORE_H
+
+#include "groups/state/senderkeystore.h"
+#include "byteutil.h"
+#include "state/liverecordcache.h"
+#include "sqliutil.h"
+
+// Read-through cache of live sender keys, like LiteSessionStore
+class LiteSenderKeyStore : public SenderKeyStore
+{
+public:
+	LiteSenderKeyStore(LiteDatabase &db);
+	void clear();
+
+	void storeSenderKey(const ByteArray &senderKeyId, SenderKeyRecord *record);
+	SenderKeyRecord *loadSenderKey(const ByteArray &senderKeyId);
+
+	void flush();
+
+private:
+	LiteDatabase &db;
+	LiveRecordCache<ByteArray, SenderKeyRecord> live;
+};
+
+#endif // LITESENDERKEYSTORE_H
@@ -1,83 +1,80 @@
 #include "litesessionstore.h"
-#include "sqliutil.h"
-#include <iostream>
 
-
-LiteSessionStore::LiteSessionStore(sqlite::connection &db)
- : _db(db)
+LiteSessionStore::LiteSessionStore(LiteDatabase &db)
+ : db(db)
 {
-	sqlite::execute(_db, "CREATE TABLE IF NOT EXISTS sessions (_id INTEGER PRIMARY KEY AUTOINCREMENT, recipient_id INTEGER UNIQUE, device_id INTEGER, record BLOB, timestamp INTEGER);", true);
+	db.execute("CREATE TABLE IF NOT EXISTS sessions (recipient_id INTEGER, device_id INTEGER, record BLOB, PRIMARY KEY (recipient_id, device_id));");
 }
 
 void LiteSessionStore::clear()
 {
-	sqlite::execute(_db, "DELETE FROM sessions;", true);
+	db.beginWrite();
+	LiteQuery(db, "DELETE FROM sessions;").step();
+	live.clear();
 }
 
-SessionRecord *LiteSessionStore::loadSession(uint64_t recipientId, int deviceId)
+SessionRecord *LiteSessionStore::find(const SessionKey &key)
 {
-	sqlite::query q(_db, "SELECT record FROM sessions WHERE recipient_id=" + 
-		std::to_string(recipientId) + " AND device_id=" + std::to_string(deviceId) + ";");
-
-	boost::shared_ptr<sqlite::result> result = q.get_result();
+	SessionRecord *record = live.find(key);
+	if (record)
+		return record;
+
+	LiteQuery q(db, "SELECT record FROM sessions WHERE recipient_id = ? AND device_id = ?;");
+	q.bind(key.first).bind(key.second);
+	bool stored = q.step();
+	return live.insert(key, stored ? new SessionRecord(q.getBlob(0)) : new SessionRecord(), stored);
+}
 
-	if (result->next_row()) {
-		std::cerr << "Loaded session" << recipientId << deviceId << std::endl;
-		std::vector<unsigned char> res;
-		result->get_binary(0, res);
-		std::string serialized = barray_to_string(res);
-		return new SessionRecord(serialized);
-	}
-	else {
-		std::cerr << "New session " << recipientId << " " << deviceId << std::endl;
-		return new SessionRecord();
-	}
+SessionRecord *LiteSessionStore::loadSession(uint64_t recipientId, int deviceId)
+{
+	return find(SessionKey(recipientId, deviceId));
 }
 
 std::vector<int> LiteSessionStore::getSubDeviceSessions(uint64_t recipientId)
 {
-	std::vector<int> deviceIds;
-	sqlite::query q(_db, "SELECT device_id from sessions WHERE recipient_id=?;");
-	q % (int64_t)recipientId;
-	q();
+	flush();
 
-	boost::shared_ptr<sqlite::result> result = q.get_result();
-
-	while (result->next_row()) {
-		int deviceId = result->get_int(0);
-		deviceIds.push_back(deviceId);
-	}
+	std::vector<int> deviceIds;
+	LiteQuery q(db, "SELECT device_id FROM sessions WHERE recipient_id = ?;");
+	q.bind(recipientId);
+	while (q.step())
+		deviceIds.push_back(q.getInt(0));
 	return deviceIds;
 }
 
 void LiteSessionStore::storeSession(uint64_t recipientId, int deviceId, SessionRecord *record)
 {
-	sqlite::query q(_db, "INSERT OR REPLACE INTO sessions (`recipient_id`, `device_id`, `record`, `timestamp`) VALUES (?, ?, ?, ?);");
-	q % (int64_t)recipientId % deviceId
-		% string_to_barray(record->serialize()) % 0;
-	q();
+	live.store(SessionKey(recipientId, deviceId), record)->setFresh(false);
 }
 
 bool LiteSessionStore::containsSession(uint64_t recipientId, int deviceId)
 {
-	sqlite::query q(_db, "SELECT record FROM sessions WHERE recipient_id=" + 
-		std::to_string(recipientId) + " AND device_id=" + std::to_string(deviceId) + ";");
-
-	return q.get_result()->next_row();
+	SessionKey key(recipientId, deviceId);
+	find(key);
+	return live.stored(key);
 }
 
 void LiteSessionStore::deleteSession(uint64_t recipientId, int deviceId)
 {
-	sqlite::query q(_db, "DELETE FROM sessions WHERE recipient_id=? AND device_id=?;");
-	q % (int64_t)recipientId % deviceId;
-	q();
+	db.beginWrite();
+	LiteQuery(db, "DELETE FROM sessions WHERE recipient_id = ? AND device_id = ?;")
+		.bind(recipientId).bind(deviceId).step();
+	live.erase(SessionKey(recipientId, deviceId));
 }
 
 void LiteSessionStore::deleteAllSessions(uint64_t recipientId)
 {
-	sqlite::query q(_db, "DELETE FROM sessions WHERE recipient_id=?;");
-	q % (int64_t)recipientId;
-	q();
+	db.beginWrite();
+	LiteQuery(db, "DELETE FROM sessions WHERE recipient_id = ?;").bind(recipientId).step();
+	live.eraseIf([recipientId] (const SessionKey &key) { return key.first == recipientId; });
 }
 
-
+void LiteSessionStore::flush()
+{
+	live.flush([this] (const SessionKey &key, SessionRecord &record) {
+		db.beginWrite();
+		LiteQuery(db, "INSERT OR REPLACE INTO sessions (recipient_id, device_id, record) VALUES (?, ?, ?);")
+			.bind(key.first).bind(key.second)
+			.bind(record.serialize()).step();
+	});
+}
@@ -2,29 +2,39 @@
 #define LITESESSIONSTORE_H
 
 #include "state/sessionstore.h"
+#include "state/sessionrecord.h"
+#include "state/liverecordcache.h"
+#include "sqliutil.h"
 
+#include <utility>
 #include <vector>
 #include <stdint.h>
 
-#include <sqlite/connection.hpp>
-#include <sqlite/execute.hpp>
-#include <sqlite/query.hpp>
-
+// Read-through cache of live sessions, like InMemorySessionStore: the
+// records loaded stay parsed, storeSession marks them dirty and flush
+// writes the dirty ones to the database.
 class LiteSessionStore : public SessionStore
 {
 public:
-    LiteSessionStore(sqlite::connection &db);
-    void clear();
+	LiteSessionStore(LiteDatabase &db);
+	void clear();
+
+	SessionRecord *loadSession(uint64_t recipientId, int deviceId);
+	std::vector<int> getSubDeviceSessions(uint64_t recipientId);
+	void storeSession(uint64_t recipientId, int deviceId, SessionRecord *record);
+	bool containsSession(uint64_t recipientId, int deviceId);
+	void deleteSession(uint64_t recipientId, int deviceId);
+	void deleteAllSessions(uint64_t recipientId);
 
-    SessionRecord *loadSession(uint64_t recipientId, int deviceId);
-    std::vector<int> getSubDeviceSessions(uint64_t recipientId);
-    void storeSession(uint64_t recipientId, int deviceId, SessionRecord *record);
-    bool containsSession(uint64_t recipientId, int deviceId);
-    void deleteSession(uint64_t recipientId, int deviceId);
-    void deleteAllSessions(uint64_t recipientId);
+	void flush();
 
 private:
-    sqlite::connection &_db;
+	typedef std::pair<uint64_t, int> SessionKey;
+
+	SessionRecord *find(const SessionKey &key);
+
+	LiteDatabase &db;
+	LiveRecordCache<SessionKey, SessionRecord> live;
 };
 
 #endif // LITESESSIONSTORE_H
@@ -1,78 +1,64 @@
 #include "litesignedprekeystore.h"
 #include "whisperexception.h"
-#include "sqliutil.h"
-#include <iostream>
 
-LiteSignedPreKeyStore::LiteSignedPreKeyStore(sqlite::connection &db)
- : _db(db)
+LiteSignedPreKeyStore::LiteSignedPreKeyStore(LiteDatabase &db)
+ : db(db)
 {
-	sqlite::execute(_db, "CREATE TABLE IF NOT EXISTS signed_prekeys (_id INTEGER PRIMARY KEY AUTOINCREMENT, prekey_id INTEGER UNIQUE, timestamp INTEGER, record BLOB);", true);
+	db.execute("CREATE TABLE IF NOT EXISTS signed_prekeys (prekey_id INTEGER PRIMARY KEY, record BLOB);");
 }
 
 void LiteSignedPreKeyStore::clear()
 {
-	sqlite::execute(_db, "DELETE FROM signed_prekeys;", true);
+	db.beginWrite();
+	LiteQuery(db, "DELETE FROM signed_prekeys;").step();
+	records.clear();
 }
 
-SignedPreKeyRecord LiteSignedPreKeyStore::loadSignedPreKey(uint64_t signedPreKeyId)
+const std::string &LiteSignedPreKeyStore::find(uint64_t signedPreKeyId)
 {
-	sqlite::query q(_db, "SELECT record FROM signed_prekeys WHERE prekey_id = " + std::to_string(signedPreKeyId) + " ;");
-	std::cerr << "Querying signed pre key id " << signedPreKeyId << std::endl;
-
-	boost::shared_ptr<sqlite::result> result = q.get_result();
-
-	if (result->next_row()) {
-		std::vector<unsigned char> res;
-		result->get_binary(0, res);
-		std::string serialized = barray_to_string(res);
-
-		SignedPreKeyRecord record(serialized);
-		return record;
+	auto it = records.find(signedPreKeyId);
+	if (it == records.end()) {
+		LiteQuery q(db, "SELECT record FROM signed_prekeys WHERE prekey_id = ?;");
+		q.bind(signedPreKeyId);
+		it = records.emplace(signedPreKeyId, q.step() ? q.getBlob(0) : std::string()).first;
 	}
-	else {
+	return it->second;
+}
+
+SignedPreKeyRecord LiteSignedPreKeyStore::loadSignedPreKey(uint64_t signedPreKeyId)
+{
+	const std::string &record = find(signedPreKeyId);
+	if (record.empty())
 		throw WhisperException("No such signedprekeyrecord! " + std::to_string(signedPreKeyId));
-	}
+	return SignedPreKeyRecord(record);
 }
 
 std::vector<SignedPreKeyRecord> LiteSignedPreKeyStore::loadSignedPreKeys()
 {
-	std::vector<SignedPreKeyRecord> recordsList;
-
-	sqlite::query q(_db, "SELECT record FROM signed_prekeys;");
-	boost::shared_ptr<sqlite::result> result = q.get_result();
-
-	while (result->next_row()) {
-		std::vector<unsigned char> res;
-		result->get_binary(0, res);
-		std::string serialized = barray_to_string(res);
-		SignedPreKeyRecord record(serialized);
-		recordsList.push_back(record);
-	}
-	return recordsList;
+	std::vector<SignedPreKeyRecord> results;
+	LiteQuery q(db, "SELECT record FROM signed_prekeys;");
+	while (q.step())
+		results.push_back(SignedPreKeyRecord(q.getBlob(0)));
+	return results;
 }
 
 void LiteSignedPreKeyStore::storeSignedPreKey(uint64_t signedPreKeyId, const SignedPreKeyRecord &record)
 {
-	sqlite::query q(_db, "INSERT INTO signed_prekeys VALUES (NULL, ?, ?, ?);");
-	q % (int64_t)signedPreKeyId % 0
-		% string_to_barray(record.serialize());
-	q();
+	std::string serialized = record.serialize();
+	db.beginWrite();
+	LiteQuery(db, "INSERT OR REPLACE INTO signed_prekeys (prekey_id, record) VALUES (?, ?);")
+		.bind(signedPreKeyId).bind(serialized).step();
+	records[signedPreKeyId] = serialized;
 }
 
 bool LiteSignedPreKeyStore::containsSignedPreKey(uint64_t signedPreKeyId)
 {
-	sqlite::query q(_db, "SELECT record FROM signed_prekeys WHERE prekey_id=?;");
-	q % (int64_t)signedPreKeyId;
-	q();
-
-	return q.get_result()->next_row();
+	return !find(signedPreKeyId).empty();
 }
 
 void LiteSignedPreKeyStore::removeSignedPreKey(uint64_t signedPreKeyId)
 {
-	std::cerr << "Deleting signed pre key id " << signedPreKeyId << std::endl;
-	sqlite::query q(_db, "DELETE FROM signed_prekeys WHERE prekey_id=?;");
-	q % (int64_t)signedPreKeyId;
-	q();
+	db.beginWrite();
+	LiteQuery(db, "DELETE FROM signed_prekeys WHERE prekey_id = ?;").bind(signedPreKeyId).step();
+	records[signedPreKeyId] = std::string();
 }
-
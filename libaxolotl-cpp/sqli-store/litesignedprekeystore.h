@@ -3,28 +3,31 @@
 
 #include "state/signedprekeystore.h"
 #include "state/signedprekeyrecord.h"
+#include "sqliutil.h"
 
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <stdint.h>
 
-#include <sqlite/connection.hpp>
-#include <sqlite/execute.hpp>
-#include <sqlite/query.hpp>
-
 class LiteSignedPreKeyStore : public SignedPreKeyStore
 {
 public:
-    LiteSignedPreKeyStore(sqlite::connection &db);
-    void clear();
+	LiteSignedPreKeyStore(LiteDatabase &db);
+	void clear();
 
-    SignedPreKeyRecord loadSignedPreKey(uint64_t signedPreKeyId) ;
-    std::vector<SignedPreKeyRecord> loadSignedPreKeys();
-    void storeSignedPreKey(uint64_t signedPreKeyId, const SignedPreKeyRecord &record);
-    bool containsSignedPreKey(uint64_t signedPreKeyId);
-    void removeSignedPreKey(uint64_t signedPreKeyId);
+	SignedPreKeyRecord loadSignedPreKey(uint64_t signedPreKeyId);
+	std::vector<SignedPreKeyRecord> loadSignedPreKeys();
+	void storeSignedPreKey(uint64_t signedPreKeyId, const SignedPreKeyRecord &record);
+	bool containsSignedPreKey(uint64_t signedPreKeyId);
+	void removeSignedPreKey(uint64_t signedPreKeyId);
 
 private:
-    sqlite::connection &_db;
+	const std::string &find(uint64_t signedPreKeyId);
+
+	LiteDatabase &db;
+	// Serialized records read so far, empty for the missing ones
+	std::unordered_map<uint64_t, std::string> records;
 };
 
 #endif // LITESIGNEDPREKEYSTORE_H
@@ -1,20 +1,106 @@
 
 #include "sqliutil.h"
+#include "whisperexception.h"
 
-#include <algorithm>    // std::copy
-#include <vector>       // std::vector
-#include <string>
+LiteDatabase::LiteDatabase(const std::string &path)
+	: db(NULL), writing(false)
+{
+	if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+		std::string error = db ? sqlite3_errmsg(db) : "out of memory";
+		sqlite3_close(db);
+		throw WhisperException("SQLiteException", error);
+	}
+	sqlite3_busy_timeout(db, 5000);
+	execute("PRAGMA journal_mode=WAL;");
+	execute("PRAGMA synchronous=NORMAL;");
+}
+
+LiteDatabase::~LiteDatabase()
+{
+	if (writing)
+		sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+	for (auto & it: statements)
+		sqlite3_finalize(it.second);
+	sqlite3_close(db);
+}
+
+void LiteDatabase::check(int ret)
+{
+	if (ret != SQLITE_OK && ret != SQLITE_ROW && ret != SQLITE_DONE)
+		throw WhisperException("SQLiteException", sqlite3_errmsg(db));
+}
+
+sqlite3_stmt *LiteDatabase::prepare(const char *sql)
+{
+	auto it = statements.find(sql);
+	if (it != statements.end())
+		return it->second;
+
+	sqlite3_stmt *stmt;
+	check(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL));
+	statements[sql] = stmt;
+	return stmt;
+}
+
+void LiteDatabase::execute(const char *sql)
+{
+	check(sqlite3_exec(db, sql, NULL, NULL, NULL));
+}
+
+void LiteDatabase::beginWrite()
+{
+	if (!writing) {
+		LiteQuery(*this, "BEGIN IMMEDIATE;").step();
+		writing = true;
+	}
+}
+
+void LiteDatabase::commit()
+{
+	if (writing) {
+		LiteQuery(*this, "COMMIT;").step();
+		writing = false;
+	}
+}
+
+LiteQuery::LiteQuery(LiteDatabase &db, const char *sql)
+	: db(db), stmt(db.prepare(sql)), param(0)
+{
+}
+
+LiteQuery::~LiteQuery()
+{
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
+LiteQuery &LiteQuery::bind(int64_t value)
+{
+	db.check(sqlite3_bind_int64(stmt, ++param, value));
+	return *this;
+}
+
+LiteQuery &LiteQuery::bind(const std::string &blob)
+{
+	db.check(sqlite3_bind_blob(stmt, ++param, blob.data(), blob.size(), SQLITE_TRANSIENT));
+	return *this;
+}
+
+bool LiteQuery::step()
+{
+	int ret = sqlite3_step(stmt);
+	db.check(ret);
+	return ret == SQLITE_ROW;
+}
 
-std::vector <unsigned char> string_to_barray(std::string s) {
-	std::vector <unsigned char> v;
-	std::copy( s.begin(), s.end(), std::back_inserter(v));
-	return v;
+int64_t LiteQuery::getInt(int column)
+{
+	return sqlite3_column_int64(stmt, column);
 }
 
-std::string barray_to_string(std::vector <unsigned char> v) {
-	std::string ret;
-	for (auto c: v)
-		ret += (char)c;
-	return ret;
+std::string LiteQuery::getBlob(int column)
+{
+	const char *data = (const char *)sqlite3_column_blob(stmt, column);
+	return std::string(data ? data : "", sqlite3_column_bytes(stmt, column));
 }
 
@@ -1,12 +1,58 @@
-
 #ifndef SQLIUTIL_H__
 #define SQLIUTIL_H__
 
 #include <string>
-#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <sqlite3.h>
+
+// A SQLite database in WAL mode with its statements prepared once. The
+// first write opens a transaction that stays open until commit(), so a
+// batch of changes costs a single sync. Errors throw WhisperException.
+class LiteDatabase
+{
+public:
+	LiteDatabase(const std::string &path);
+	~LiteDatabase();
+
+	// Statements are cached by the address of their SQL, use literals
+	sqlite3_stmt *prepare(const char *sql);
+	void execute(const char *sql);
+
+	void beginWrite();
+	void commit();
+
+	void check(int ret);
+
+private:
+	LiteDatabase(const LiteDatabase &);
+	LiteDatabase &operator=(const LiteDatabase &);
+
+	sqlite3 *db;
+	std::unordered_map<const char *, sqlite3_stmt *> statements;
+	bool writing;
+};
+
+// One use of a cached statement, reset when it goes out of scope
+class LiteQuery
+{
+public:
+	LiteQuery(LiteDatabase &db, const char *sql);
+	~LiteQuery();
+
+	LiteQuery &bind(int64_t value);
+	LiteQuery &bind(const std::string &blob);
+
+	// True while there are rows
+	bool step();
+	int64_t getInt(int column);
+	std::string getBlob(int column);
 
-std::vector <unsigned char> string_to_barray(std::string s);
-std::string barray_to_string(std::vector <unsigned char> v);
+private:
+	LiteDatabase &db;
+	sqlite3_stmt *stmt;
+	int param;
+};
 
 #endif
 
@@ -8,7 +8,10 @@
 #include "senderkeystore.h"
 
 class AxolotlStore: public IdentityKeyStore, public PreKeyStore, public SessionStore, public SignedPreKeyStore, public SenderKeyStore {
-
+public:
+	virtual ~AxolotlStore() {}
+	// Makes the changes so far durable, for the stores that batch them
+	virtual void commit() {}
 };
 
 #endif // AXOLOTLSTORE_H
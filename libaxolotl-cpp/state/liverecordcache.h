@@ -0,0 +1,105 @@
+#ifndef LIVERECORDCACHE_H
+#define LIVERECORDCACHE_H
+
+#include <map>
+#include <memory>
+#include <vector>
+
+// Parsed records of a store, kept live between loads. The store hands out
+// the cache's own records (callers must not delete them), storing marks a
+// record dirty and flush passes the dirty ones to the store to write out.
+template <typename Key, typename Record>
+class LiveRecordCache
+{
+public:
+    // The cached record, null if it isn't loaded
+    Record *find(const Key &key) const
+    {
+        auto it = live.find(key);
+        return it != live.end() ? it->second.record.get() : nullptr;
+    }
+
+    // Caches a record just loaded, stored tells whether the store had it
+    Record *insert(const Key &key, Record *record, bool stored)
+    {
+        Entry &e = live[key];
+        e.record.reset(record);
+        e.stored = stored;
+        e.dirty = false;
+        return record;
+    }
+
+    // Only for cached keys: whether the store has the record, or will
+    bool stored(const Key &key) const
+    {
+        return live.at(key).stored;
+    }
+
+    // Marks the record dirty and returns the cached one. Somebody else's
+    // record is copied, ours is already up to date.
+    Record *store(const Key &key, Record *record)
+    {
+        Entry &e = live[key];
+        if (e.record.get() != record)
+            e.record.reset(new Record(record->serialize()));
+        if (!e.dirty)
+            dirty.push_back(key);
+        e.stored = e.dirty = true;
+        return e.record.get();
+    }
+
+    // The record if it changed since the last flush, else null
+    const Record *dirtyRecord(const Key &key) const
+    {
+        auto it = live.find(key);
+        return it != live.end() && it->second.dirty ? it->second.record.get() : nullptr;
+    }
+
+    void erase(const Key &key)
+    {
+        live.erase(key);
+    }
+
+    template <typename Pred>
+    void eraseIf(Pred pred)
+    {
+        for (auto it = live.begin(); it != live.end(); ) {
+            if (pred(it->first))
+                it = live.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    void clear()
+    {
+        live.clear();
+        dirty.clear();
+    }
+
+    // Calls write(key, record) for every record stored since the last
+    // flush, in the order they were first stored. Records erased since
+    // are skipped.
+    template <typename Write>
+    void flush(Write write)
+    {
+        for (auto &key: dirty) {
+            auto it = live.find(key);
+            if (it == live.end() || !it->second.dirty)
+                continue;
+            write(key, *it->second.record);
+            it->second.dirty = false;
+        }
+        dirty.clear();
+    }
+
+private:
+    struct Entry {
+        std::unique_ptr<Record> record;
+        bool stored, dirty;
+    };
+    std::map<Key, Entry> live;
+    std::vector<Key> dirty;
+};
+
+#endif // LIVERECORDCACHE_H
@@ -26,6 +26,14 @@ SessionRecord::SessionRecord(const ByteArray &serialized)
     }
 }
 
+SessionRecord::~SessionRecord()
+{
+    delete sessionState;
+    for (SessionState *state: previousStates) {
+        delete state;
+    }
+}
+
 bool SessionRecord::hasSessionState(int version, const ByteArray &aliceBaseKey)
 {
     if (sessionState->getSessionVersion() == version
@@ -62,13 +70,25 @@ bool SessionRecord::isFresh() const
 
 void SessionRecord::promoteState(SessionState *promotedState)
 {
-    previousStates.insert(previousStates.begin(), promotedState);
+    previousStates.insert(previousStates.begin(), sessionState);
     sessionState = promotedState;
     if (previousStates.size() > ARCHIVED_STATES_MAX_LENGTH) {
+        delete previousStates.back();
         previousStates.pop_back();
     }
 }
 
+void SessionRecord::removePreviousState(SessionState *previousState)
+{
+    for (auto it = previousStates.begin(); it != previousStates.end(); ++it) {
+        if (*it == previousState) {
+            previousStates.erase(it);
+            delete previousState;
+            return;
+        }
+    }
+}
+
 void SessionRecord::archiveCurrentState()
 {
     promoteState(new SessionState());
@@ -76,16 +96,26 @@ void SessionRecord::archiveCurrentState()
 
 void SessionRecord::setState(SessionState *sessionState)
 {
-    this->sessionState = sessionState;
+    if (sessionState != this->sessionState) {
+        delete this->sessionState;
+        this->sessionState = sessionState;
+    }
+}
+
+void SessionRecord::setFresh(bool fresh)
+{
+    this->fresh = fresh;
 }
 
 ByteArray SessionRecord::serialize() const
 {
     textsecure::RecordStructure record;
-    record.mutable_currentsession()->CopyFrom(sessionState->getStructure());
+    textsecure::SessionStructure structure = sessionState->getStructure();
+    record.mutable_currentsession()->Swap(&structure);
 
     for (SessionState *previousState: previousStates) {
-        record.add_previoussessions()->CopyFrom(previousState->getStructure());
+        structure = previousState->getStructure();
+        record.add_previoussessions()->Swap(&structure);
     }
 
     ::std::string serialized = record.SerializeAsString();
@@ -12,17 +12,24 @@ public:
     SessionRecord();
     SessionRecord(SessionState *sessionState);
     SessionRecord(const ByteArray &serialized);
+    ~SessionRecord();
 
     bool hasSessionState(int version, const ByteArray &aliceBaseKey);
     SessionState *getSessionState();
     std::vector<SessionState*> getPreviousSessionStates();
     bool isFresh() const;
     void promoteState(SessionState *promotedState);
+    void removePreviousState(SessionState *previousState);
     void archiveCurrentState();
     void setState(SessionState *sessionState);
+    void setFresh(bool fresh);
     ByteArray serialize() const;
 
 private:
+    // Owns its states, and stores may keep it alive across messages
+    SessionRecord(const SessionRecord &);
+    SessionRecord &operator=(const SessionRecord &);
+
     static const int ARCHIVED_STATES_MAX_LENGTH;
     SessionState *sessionState;
     std::vector<SessionState*> previousStates;
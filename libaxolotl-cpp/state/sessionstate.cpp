@@ -34,16 +34,20 @@ SessionState::SessionState()
 SessionState::SessionState(const textsecure::SessionStructure &sessionSctucture)
 {
     this->sessionStructure.CopyFrom(sessionSctucture);
+    skippedKeys.load(&sessionStructure);
 }
 
 SessionState::SessionState(const SessionState &copy)
+    : skippedKeys(copy.skippedKeys)
 {
-    this->sessionStructure.CopyFrom(copy.getStructure());
+    this->sessionStructure.CopyFrom(copy.sessionStructure);
 }
 
 textsecure::SessionStructure SessionState::getStructure() const
 {
-    return sessionStructure;
+    textsecure::SessionStructure structure(sessionStructure);
+    skippedKeys.store(&structure);
+    return structure;
 }
 
 ByteArray SessionState::getAliceBaseKey() const
@@ -179,7 +183,7 @@ ChainKey SessionState::getReceiverChainKey(const DjbECPublicKey &senderEphemeral
     if (receiverChainIndex == -1) {
         throw InvalidKeyException("ReceiverChain empty");
     } else {
-        textsecure::SessionStructure::Chain receiverChain = sessionStructure.receiverchains(receiverChainIndex);
+        const textsecure::SessionStructure::Chain &receiverChain = sessionStructure.receiverchains(receiverChainIndex);
         ::std::string keyfromchain = receiverChain.chainkey().key();
         return ChainKey(HKDF(getSessionVersion()),
                         ByteArray(keyfromchain.data(), keyfromchain.length()),
@@ -202,7 +206,9 @@ void SessionState::addReceiverChain(const DjbECPublicKey &senderRatchetKey, cons
     sessionStructure.add_receiverchains()->CopyFrom(chain);
 
     if (sessionStructure.receiverchains_size() > 5) {
-        delete sessionStructure.mutable_receiverchains(0);
+        const ::std::string &dropped = sessionStructure.receiverchains(0).senderratchetkey();
+        skippedKeys.removeChain(ByteArray(dropped.data(), dropped.length()));
+        sessionStructure.mutable_receiverchains()->DeleteSubrange(0, 1);
     }
 }
 
@@ -257,69 +263,37 @@ void SessionState::setSenderChainKey(const ChainKey &nextChainKey)
 
 bool SessionState::hasMessageKeys(const DjbECPublicKey &senderEphemeral, unsigned counter)
 {
-    int chainIndex = getReceiverChain(senderEphemeral);
-
-    if (chainIndex == -1) {
-        return false;
-    }
-
-    textsecure::SessionStructure::Chain receiverChain = sessionStructure.receiverchains(chainIndex);
-    for (int i = 0; i < receiverChain.messagekeys_size(); i++) {
-        textsecure::SessionStructure::Chain::MessageKey messageKey = receiverChain.messagekeys(i);
-        if (messageKey.index() == counter) {
-            return true;
-        }
-    }
-
-    return false;
+    return skippedKeys.contains(senderEphemeral.serialize(), counter);
 }
 
 MessageKeys SessionState::removeMessageKeys(const DjbECPublicKey &senderEphemeral, unsigned counter)
 {
-    int chainIndex = getReceiverChain(senderEphemeral);
-
-    if (chainIndex == -1) {
-        throw InvalidKeyException("ReceiverChain empty");
-    }
-
-    textsecure::SessionStructure::Chain chain = sessionStructure.receiverchains(chainIndex);
-    MessageKeys result;
-
-    for (int i = 0; i < chain.messagekeys_size(); i++) {
-        textsecure::SessionStructure::Chain::MessageKey *messageKey = chain.mutable_messagekeys(i);
-        if (messageKey->index() == counter) {
-            ::std::string cipherkey = messageKey->cipherkey();
-            ::std::string mackey = messageKey->mackey();
-            ::std::string iv = messageKey->iv();
-            result = MessageKeys(ByteArray(cipherkey.data(), cipherkey.length()),
-                                 ByteArray(mackey.data(), mackey.length()),
-                                 ByteArray(iv.data(), iv.length()),
-                                 messageKey->index());
-            delete messageKey;
-            break;
-        }
+    textsecure::SessionStructure::Chain::MessageKey messageKey;
+    if (!skippedKeys.remove(senderEphemeral.serialize(), counter, &messageKey)) {
+        return MessageKeys();
     }
 
-    textsecure::SessionStructure::Chain *updatedChain = sessionStructure.mutable_receiverchains(chainIndex);
-    updatedChain->clear_messagekeys();
-    updatedChain->CopyFrom(chain);
-
-    return result;
+    ::std::string cipherkey = messageKey.cipherkey();
+    ::std::string mackey = messageKey.mackey();
+    ::std::string iv = messageKey.iv();
+    return MessageKeys(ByteArray(cipherkey.data(), cipherkey.length()),
+                       ByteArray(mackey.data(), mackey.length()),
+                       ByteArray(iv.data(), iv.length()),
+                       messageKey.index());
 }
 
 void SessionState::setMessageKeys(const DjbECPublicKey &senderEphemeral, const MessageKeys &messageKeys)
 {
-    int chainIndex = getReceiverChain(senderEphemeral);
-
-    textsecure::SessionStructure::Chain *chain = (chainIndex == -1) ? sessionStructure.add_receiverchains() : sessionStructure.mutable_receiverchains(chainIndex);
-    textsecure::SessionStructure::Chain::MessageKey *messageKeyStructure = chain->add_messagekeys();
+    textsecure::SessionStructure::Chain::MessageKey messageKeyStructure;
     ByteArray byteCipher = messageKeys.getCipherKey();
-    messageKeyStructure->set_cipherkey(byteCipher.c_str(), byteCipher.size());
+    messageKeyStructure.set_cipherkey(byteCipher.c_str(), byteCipher.size());
     ByteArray byteMac = messageKeys.getMacKey();
-    messageKeyStructure->set_mackey(byteMac.c_str(), byteMac.size());
-    messageKeyStructure->set_index(messageKeys.getCounter());
+    messageKeyStructure.set_mackey(byteMac.c_str(), byteMac.size());
+    messageKeyStructure.set_index(messageKeys.getCounter());
     ByteArray byteIv = messageKeys.getIv();
-    messageKeyStructure->set_iv(byteIv.c_str(), byteIv.size());
+    messageKeyStructure.set_iv(byteIv.c_str(), byteIv.size());
+
+    skippedKeys.add(senderEphemeral.serialize(), &messageKeyStructure);
 }
 
 void SessionState::setReceiverChainKey(const DjbECPublicKey &senderEphemeral, const ChainKey &chainKey)
@@ -466,6 +440,6 @@ int SessionState::getLocalRegistrationId() const
 
 ByteArray SessionState::serialize() const
 {
-    ::std::string serialized = sessionStructure.SerializeAsString();
+    ::std::string serialized = getStructure().SerializeAsString();
     return ByteArray(serialized.data(), serialized.length());
 }
@@ -7,6 +7,7 @@
 #include "chainkey.h"
 #include "identitykeypair.h"
 #include "djbec.h"
+#include "skippedmessagekeys.h"
 
 class UnacknowledgedPreKeyMessageItems
 {
@@ -78,6 +79,8 @@ public:
 
 private:
     textsecure::SessionStructure sessionStructure;
+    // The receiver chains' message keys, out of sessionStructure
+    SkippedMessageKeys skippedKeys;
 
 };
 
@@ -0,0 +1,216 @@
+#include "skippedmessagekeys.h"
+
+#include <algorithm>
+
+SkippedMessageKeys::SkippedMessageKeys()
+    : keys(new Keys())
+{
+    keys->seq = 0;
+}
+
+SkippedMessageKeys::SkippedMessageKeys(const SkippedMessageKeys &copy)
+{
+    copy.settle();
+    keys = copy.keys;
+    added = copy.added;
+    removed = copy.removed;
+    removedChains = copy.removedChains;
+}
+
+bool SkippedMessageKeys::removedFromKeys(const Id &id) const
+{
+    return std::find(removed.begin(), removed.end(), id) != removed.end() ||
+           std::find(removedChains.begin(), removedChains.end(), id.ratchetKey) != removedChains.end();
+}
+
+std::vector<std::pair<SkippedMessageKeys::Id, SkippedMessageKeys::MessageKey> >::iterator
+SkippedMessageKeys::findAdded(const Id &id) const
+{
+    for (auto it = added.begin(); it != added.end(); ++it) {
+        if (it->first == id) {
+            return it;
+        }
+    }
+    return added.end();
+}
+
+bool SkippedMessageKeys::contains(const ByteArray &ratchetKey, unsigned counter) const
+{
+    Id id = { ratchetKey, counter };
+    if (findAdded(id) != added.end()) {
+        return true;
+    }
+    return keys->entries.find(id) != keys->entries.end() && !removedFromKeys(id);
+}
+
+bool SkippedMessageKeys::remove(const ByteArray &ratchetKey, unsigned counter, MessageKey *key)
+{
+    settle();
+    Id id = { ratchetKey, counter };
+
+    auto a = findAdded(id);
+    if (a != added.end()) {
+        key->Swap(&a->second);
+        added.erase(a);
+        return true;
+    }
+
+    auto it = keys->entries.find(id);
+    if (it == keys->entries.end() || removedFromKeys(id)) {
+        return false;
+    }
+    if (shared()) {
+        key->CopyFrom(it->second.key);
+        removed.push_back(id);
+    } else {
+        key->Swap(&it->second.key);
+        keys->entries.erase(it);
+    }
+    return true;
+}
+
+void SkippedMessageKeys::add(const ByteArray &ratchetKey, MessageKey *key)
+{
+    settle();
+    Id id = { ratchetKey, key->index() };
+
+    if (shared()) {
+        auto a = findAdded(id);
+        if (a == added.end()) {
+            added.push_back(std::make_pair(id, MessageKey()));
+            a = added.end() - 1;
+        }
+        a->second.Swap(key);
+    } else {
+        insert(id, key);
+        evict();
+    }
+}
+
+void SkippedMessageKeys::removeChain(const ByteArray &ratchetKey)
+{
+    settle();
+    if (shared()) {
+        for (auto it = added.begin(); it != added.end(); ) {
+            if (it->first.ratchetKey == ratchetKey) {
+                it = added.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        removedChains.push_back(ratchetKey);
+        return;
+    }
+
+    for (auto it = keys->entries.begin(); it != keys->entries.end(); ) {
+        if (it->first.ratchetKey == ratchetKey) {
+            it = keys->entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    evict();
+}
+
+void SkippedMessageKeys::insert(const Id &id, MessageKey *key) const
+{
+    Entry &entry = keys->entries[id];
+    entry.key.Swap(key);
+    entry.seq = ++keys->seq;
+    keys->order.push_back(std::make_pair(id, entry.seq));
+}
+
+// Drops the oldest keys past the limit, and the stale order entries once
+// they are as many as the live ones
+void SkippedMessageKeys::evict() const
+{
+    Keys *k = keys.get();
+    while (!k->order.empty()) {
+        auto it = k->entries.find(k->order.front().first);
+        bool live = it != k->entries.end() && it->second.seq == k->order.front().second;
+        if (live && k->entries.size() <= MAX_KEYS) {
+            break;
+        }
+        if (live) {
+            k->entries.erase(it);
+        }
+        k->order.pop_front();
+    }
+
+    if (k->order.size() > 2 * k->entries.size() + 64) {
+        std::deque<std::pair<Id, uint64_t> > order;
+        for (auto &o: k->order) {
+            auto it = k->entries.find(o.first);
+            if (it != k->entries.end() && it->second.seq == o.second) {
+                order.push_back(o);
+            }
+        }
+        k->order.swap(order);
+    }
+}
+
+// Applies the changes kept aside once nobody else sees the index
+void SkippedMessageKeys::settle() const
+{
+    if (shared() || (added.empty() && removed.empty() && removedChains.empty())) {
+        return;
+    }
+
+    for (auto it = keys->entries.begin(); it != keys->entries.end(); ) {
+        if (removedFromKeys(it->first)) {
+            it = keys->entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto &a: added) {
+        insert(a.first, &a.second);
+    }
+    added.clear();
+    removed.clear();
+    removedChains.clear();
+    evict();
+}
+
+void SkippedMessageKeys::load(textsecure::SessionStructure *structure)
+{
+    for (int i = 0; i < structure->receiverchains_size(); i++) {
+        textsecure::SessionStructure::Chain *chain = structure->mutable_receiverchains(i);
+        ByteArray ratchetKey(chain->senderratchetkey().data(), chain->senderratchetkey().length());
+        for (int j = 0; j < chain->messagekeys_size(); j++) {
+            add(ratchetKey, chain->mutable_messagekeys(j));
+        }
+        chain->clear_messagekeys();
+    }
+}
+
+void SkippedMessageKeys::store(textsecure::SessionStructure *structure) const
+{
+    settle();
+
+    std::vector<std::pair<ByteArray, textsecure::SessionStructure::Chain*> > chains;
+    for (int i = 0; i < structure->receiverchains_size(); i++) {
+        textsecure::SessionStructure::Chain *chain = structure->mutable_receiverchains(i);
+        chain->clear_messagekeys();
+        chains.push_back(std::make_pair(ByteArray(chain->senderratchetkey().data(),
+                                                  chain->senderratchetkey().length()), chain));
+    }
+
+    auto addTo = [&chains] (const Id &id, const MessageKey &key) {
+        for (auto &chain: chains) {
+            if (chain.first == id.ratchetKey) {
+                chain.second->add_messagekeys()->CopyFrom(key);
+                break;
+            }
+        }
+    };
+    for (auto &o: keys->order) {
+        auto it = keys->entries.find(o.first);
+        if (it != keys->entries.end() && it->second.seq == o.second && !removedFromKeys(o.first)) {
+            addTo(o.first, it->second.key);
+        }
+    }
+    for (auto &a: added) {
+        addTo(a.first, a.second);
+    }
+}
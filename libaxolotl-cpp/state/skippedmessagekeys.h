@@ -0,0 +1,78 @@
+#ifndef SKIPPEDMESSAGEKEYS_H
+#define SKIPPEDMESSAGEKEYS_H
+
+#include "LocalStorageProtocol.pb.h"
+#include "byteutil.h"
+
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// Message keys of the messages skipped in the receiver chains, indexed by
+// (ratchet key, counter). While a SessionState is live they are kept here
+// instead of in the chains, and put back in them when it's serialized.
+// At most MAX_KEYS are kept per session, the oldest ones are evicted.
+//
+// Copies share the index: the changes made to one while it's shared are
+// kept aside and applied once it's the only one left (decrypting works
+// on a copy of the state that replaces the original if it succeeds).
+class SkippedMessageKeys
+{
+public:
+    typedef textsecure::SessionStructure::Chain::MessageKey MessageKey;
+    static const unsigned MAX_KEYS = 2000;
+
+    SkippedMessageKeys();
+    SkippedMessageKeys(const SkippedMessageKeys &copy);
+
+    bool contains(const ByteArray &ratchetKey, unsigned counter) const;
+    bool remove(const ByteArray &ratchetKey, unsigned counter, MessageKey *key);
+    void add(const ByteArray &ratchetKey, MessageKey *key);
+    void removeChain(const ByteArray &ratchetKey);
+
+    // Moves the keys out of the chains, or copies them back in (oldest first)
+    void load(textsecure::SessionStructure *structure);
+    void store(textsecure::SessionStructure *structure) const;
+
+private:
+    struct Id {
+        ByteArray ratchetKey;
+        unsigned counter;
+        bool operator==(const Id &other) const {
+            return counter == other.counter && ratchetKey == other.ratchetKey;
+        }
+    };
+    struct IdHash {
+        size_t operator()(const Id &id) const {
+            return std::hash<ByteArray>()(id.ratchetKey) ^ (id.counter * 0x9E3779B9u);
+        }
+    };
+    struct Entry {
+        MessageKey key;
+        uint64_t seq;
+    };
+    struct Keys {
+        std::unordered_map<Id, Entry, IdHash> entries;
+        // Insertion order, entries removed since are skipped
+        std::deque<std::pair<Id, uint64_t> > order;
+        uint64_t seq;
+    };
+
+    bool shared() const { return keys.use_count() > 1; }
+    bool removedFromKeys(const Id &id) const;
+    std::vector<std::pair<Id, MessageKey> >::iterator findAdded(const Id &id) const;
+    void insert(const Id &id, MessageKey *key) const;
+    void evict() const;
+    void settle() const;
+
+    mutable std::shared_ptr<Keys> keys;
+    // Changes made while shared
+    mutable std::vector<std::pair<Id, MessageKey> > added;
+    mutable std::vector<Id> removed;
+    mutable std::vector<ByteArray> removedChains;
+};
+
+#endif // SKIPPEDMESSAGEKEYS_H
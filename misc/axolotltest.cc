@@ -0,0 +1,378 @@
+/*
+ * Behaviour tests for the Axolotl sessions, group sender keys and stores:
+ * a failed decrypt must leave the session or sender key as it was, and
+ * sessions and sender key records keep a bounded number of skipped
+ * message keys and states, and the log and SQLite stores come back at
+ * their last complete commit after a torn write.
+ *
+ * Build: make axolotltest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "inmemoryaxolotlstore.h"
+#include "loggedaxolotlstore.h"
+#include "liteaxolotlstore.h"
+#include "keyhelper.h"
+#include "sessionbuilder.h"
+#include "sessioncipher.h"
+#include "prekeybundle.h"
+#include "prekeywhispermessage.h"
+#include "whispermessage.h"
+#include "whisperexception.h"
+#include "curve.h"
+#include "group_session_builder.h"
+#include "senderchainkey.h"
+#include "WhisperTextProtocol.pb.h"
+#include "axolotl_groups.h"
+
+static int failed = 0;
+static std::string tempDir;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failed++;
+	}
+}
+
+static std::shared_ptr < WhisperMessage > whisper(const ByteArray & m)
+{
+	return std::shared_ptr < WhisperMessage > (new WhisperMessage(m));
+}
+
+// Alice (1) and Bob (2) with a session both ways
+struct Pair {
+	std::shared_ptr < AxolotlStore > alice, bob;
+	std::unique_ptr < SessionCipher > toBob, toAlice;
+
+	Pair(AxolotlStore * a, AxolotlStore * b)
+		: alice(a), bob(b)
+	{
+		IdentityKeyPair aliceId = KeyHelper::generateIdentityKeyPair();
+		IdentityKeyPair bobId = KeyHelper::generateIdentityKeyPair();
+		alice->storeLocalData(1, aliceId);
+		bob->storeLocalData(2, bobId);
+
+		std::vector < PreKeyRecord > prekeys = KeyHelper::generatePreKeys(1, 1);
+		SignedPreKeyRecord signedPreKey = KeyHelper::generateSignedPreKey(bobId, 5);
+		bob->storePreKey(prekeys[0].getId(), prekeys[0]);
+		bob->storeSignedPreKey(5, signedPreKey);
+		PreKeyBundle bundle(2, 1, prekeys[0].getId(), prekeys[0].getKeyPair().getPublicKey(),
+			5, signedPreKey.getKeyPair().getPublicKey(), signedPreKey.getSignature(), bobId.getPublicKey());
+
+		SessionBuilder builder(alice, 2, 1);
+		builder.process(bundle);
+		toBob.reset(new SessionCipher(alice, 2, 1));
+		toAlice.reset(new SessionCipher(bob, 1, 1));
+
+		toAlice->decrypt(std::shared_ptr < PreKeyWhisperMessage > (
+			new PreKeyWhisperMessage(toBob->encrypt("hello")->serialize())));
+		toBob->decrypt(whisper(toAlice->encrypt("hello")->serialize()));
+	}
+};
+
+// Replays and tampered messages throw and change nothing
+static void testDecryptFailure()
+{
+	Pair p(new InMemoryAxolotlStore(), new InMemoryAxolotlStore());
+	ByteArray first = p.toBob->encrypt("one")->serialize();
+	ByteArray second = p.toBob->encrypt("two")->serialize();
+	check(p.toAlice->decrypt(whisper(second)) == "two", "Decrypt: out of order message");
+
+	ByteArray before = p.bob->loadSession(1, 1)->serialize();
+	ByteArray tampered = first;
+	tampered[tampered.size() - 1] ^= 1;
+	std::vector < ByteArray > bad = { second, tampered };
+	for (auto & m : bad) {
+		bool threw = false;
+		try {
+			p.toAlice->decrypt(whisper(m));
+		}
+		catch (WhisperException &e) {
+			threw = true;
+		}
+		check(threw, "Decrypt: bad message accepted");
+		check(p.bob->loadSession(1, 1)->serialize() == before, "Decrypt: failure changed the session");
+	}
+	check(p.toAlice->decrypt(whisper(first)) == "one", "Decrypt: skipped message lost after failures");
+}
+
+static bool decrypts(SessionCipher & cipher, const ByteArray & message, const std::string & text)
+{
+	try {
+		return cipher.decrypt(whisper(message)) == text;
+	}
+	catch (WhisperException &e) {
+		return false;
+	}
+}
+
+// Skipping 1499 and then 999 messages keeps the newest 2000 keys
+static void testSkippedKeyCap()
+{
+	Pair p(new InMemoryAxolotlStore(), new InMemoryAxolotlStore());
+	std::vector < ByteArray > first, second;
+	for (int i = 0; i < 1500; i++)
+		first.push_back(p.toBob->encrypt("first")->serialize());
+	check(decrypts(*p.toAlice, first.back(), "first"), "Skipped keys: first chain");
+
+	// New ratchet key, new receiving chain for Bob
+	check(decrypts(*p.toBob, p.toAlice->encrypt("back")->serialize(), "back"), "Skipped keys: reply");
+	for (int i = 0; i < 1000; i++)
+		second.push_back(p.toBob->encrypt("second")->serialize());
+	check(decrypts(*p.toAlice, second.back(), "second"), "Skipped keys: second chain");
+
+	// 1499 + 999 skipped, the 498 oldest are gone
+	check(!decrypts(*p.toAlice, first[497], "first"), "Skipped keys: evicted key kept");
+	check(decrypts(*p.toAlice, first[498], "first"), "Skipped keys: newer key evicted");
+	check(decrypts(*p.toAlice, second[0], "second"), "Skipped keys: second chain key evicted");
+}
+
+// A group sender: distribution message and messages signed with its key
+struct GroupSender {
+	ECKeyPair signingKey;
+	ByteArray seed;
+	int id;
+
+	GroupSender(int id)
+		: signingKey(Curve::generateKeyPair()), seed(KeyHelper::generateSenderKey()), id(id)
+	{ }
+
+	std::string distribution() {
+		textsecure::SenderKeyDistributionMessage d;
+		d.set_id(id);
+		d.set_iteration(0);
+		d.set_chainkey(seed);
+		d.set_signingkey(signingKey.getPublicKey().serialize());
+		return std::string(1, '\x33') + d.SerializeAsString();
+	}
+
+	// Body replaces the ciphertext, to send bad ones
+	std::string message(int iteration, const std::string & text, const std::string * body = NULL) {
+		SenderChainKey chainKey(0, seed);
+		while (chainKey.getIteration() < iteration)
+			chainKey = chainKey.getNext();
+		SenderMessageKey key = chainKey.getSenderMessageKey();
+		std::shared_ptr < AxolotlStore > none;
+		GroupCipher cipher(none, "");
+
+		textsecure::SenderKeyMessage m;
+		m.set_id(id);
+		m.set_iteration(iteration);
+		m.set_ciphertext(body ? *body : cipher.getCipherText(key.getIv(), key.getCipherKey(), text));
+		std::string signed_ = std::string(1, '\x33') + m.SerializeAsString();
+		return signed_ + Curve::calculateSignature(signingKey.getPrivateKey(), signed_);
+	}
+};
+
+static bool groupDecrypts(GroupCipher & cipher, const std::string & message, const std::string & text)
+{
+	try {
+		return cipher.decrypt(message) == text;
+	}
+	catch (WhisperException &e) {
+		return false;
+	}
+}
+
+// A bad body (signed, so it gets past the signature) changes nothing
+static void testGroupDecryptFailure()
+{
+	std::shared_ptr < AxolotlStore > store(new InMemoryAxolotlStore());
+	GroupSender sender(7);
+	GroupSessionBuilder(store).process("g@g.us", sender.distribution());
+	GroupCipher cipher(store, "g@g.us");
+
+	check(groupDecrypts(cipher, sender.message(3, "three"), "three"), "Group: out of order message");
+	ByteArray before = store->loadSenderKey("g@g.us")->serialize();
+
+	std::string shortBody(15, 'x'), badPadding(32, 0);
+	for (int iteration : { 1, 5 }) {
+		for (auto body : { &shortBody, &badPadding }) {
+			check(!groupDecrypts(cipher, sender.message(iteration, "", body), ""), "Group: bad message accepted");
+			check(store->loadSenderKey("g@g.us")->serialize() == before, "Group: failure changed the sender key");
+		}
+	}
+	check(groupDecrypts(cipher, sender.message(1, "one"), "one"), "Group: skipped key lost after failures");
+	check(groupDecrypts(cipher, sender.message(5, "five"), "five"), "Group: chain moved after failures");
+	check(!groupDecrypts(cipher, sender.message(1, "one"), "one"), "Group: replay accepted");
+}
+
+// Skipping to 1500 and then to 3000 keeps the newest 2000 keys
+static void testSenderKeyCap()
+{
+	std::shared_ptr < AxolotlStore > store(new InMemoryAxolotlStore());
+	GroupSender sender(9);
+	GroupSessionBuilder(store).process("g@g.us", sender.distribution());
+	GroupCipher cipher(store, "g@g.us");
+
+	check(groupDecrypts(cipher, sender.message(1500, "a"), "a"), "Sender key cap: first skip");
+	check(groupDecrypts(cipher, sender.message(3000, "b"), "b"), "Sender key cap: second skip");
+	// 1500 + 1499 skipped, 0 to 998 are gone
+	check(!groupDecrypts(cipher, sender.message(998, "c"), "c"), "Sender key cap: evicted key kept");
+	check(groupDecrypts(cipher, sender.message(999, "c"), "c"), "Sender key cap: newer key evicted");
+	check(groupDecrypts(cipher, sender.message(2999, "d"), "d"), "Sender key cap: newest key evicted");
+}
+
+// Only the newest 5 states are kept
+static void testSenderKeyStates()
+{
+	std::shared_ptr < AxolotlStore > store(new InMemoryAxolotlStore());
+	std::vector < GroupSender > senders;
+	for (int id = 1; id <= 7; id++) {
+		senders.push_back(GroupSender(id));
+		GroupSessionBuilder(store).process("g@g.us", senders.back().distribution());
+	}
+
+	SenderKeyRecord record(store->loadSenderKey("g@g.us")->serialize());
+	GroupCipher cipher(store, "g@g.us");
+	for (int id = 1; id <= 7; id++) {
+		bool kept = true;
+		try {
+			record.getSenderKeyState(id);
+		}
+		catch (WhisperException &e) {
+			kept = false;
+		}
+		check(kept == (id > 2), "Sender keys: wrong states kept");
+		check(groupDecrypts(cipher, senders[id - 1].message(0, "hi"), "hi") == (id > 2),
+			"Sender keys: wrong states decrypt");
+	}
+}
+
+static off_t fileSize(const std::string & path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+static void copyFile(const std::string & from, const std::string & to)
+{
+	std::ifstream in(from.c_str(), std::ios::binary);
+	std::ofstream out(to.c_str(), std::ios::binary | std::ios::trunc);
+	out << in.rdbuf();
+}
+
+// The last record cut short is dropped, and new ones go after the cut
+static void testLogReplay()
+{
+	std::string path = tempDir + "/log";
+	ByteArray committed;
+	uint64_t committedSize;
+	{
+		Pair p(new LoggedAxolotlStore(path), new InMemoryAxolotlStore());
+		LoggedAxolotlStore *log = static_cast < LoggedAxolotlStore * > (p.alice.get());
+		log->commit();
+		committed = p.alice->loadSession(2, 1)->serialize();
+		committedSize = log->logSize();
+		p.toBob->encrypt("torn");
+		log->commit();
+		check(p.alice->loadSession(2, 1)->serialize() != committed, "Log: session unchanged");
+	}
+	check(truncate(path.c_str(), fileSize(path) - 3) == 0, "Log: can't tear the log");
+	{
+		LoggedAxolotlStore log(path);
+		check(log.loadSession(2, 1)->serialize() == committed, "Log: torn record replayed");
+		check(log.logSize() == committedSize && fileSize(path) == (off_t)committedSize, "Log: torn record not cut off");
+		log.storePreKey(77, KeyHelper::generatePreKeys(77, 1)[0]);
+		log.commit();
+	}
+
+	// A write that fails halfway is cut off too, and written again
+	{
+		LoggedAxolotlStore log(path);
+		check(log.containsPreKey(77), "Log: record after the cut lost");
+		log.storePreKey(78, KeyHelper::generatePreKeys(78, 1)[0]);
+
+		struct rlimit old, limit;
+		getrlimit(RLIMIT_FSIZE, &old);
+		limit = old;
+		limit.rlim_cur = log.logSize() + 10;
+		signal(SIGXFSZ, SIG_IGN);
+		setrlimit(RLIMIT_FSIZE, &limit);
+		bool threw = false;
+		try {
+			log.commit();
+		}
+		catch (WhisperException &e) {
+			threw = true;
+		}
+		setrlimit(RLIMIT_FSIZE, &old);
+		check(threw, "Log: short write not reported");
+		check(fileSize(path) == (off_t)log.logSize(), "Log: short write left in the log");
+		log.commit();
+	}
+	{
+		LoggedAxolotlStore log(path);
+		check(log.containsPreKey(77) && log.containsPreKey(78), "Log: record lost after a short write");
+		check(log.loadSession(2, 1)->serialize() == committed, "Log: session lost after a short write");
+	}
+}
+
+// Copies of the database taken mid-transaction, and with the last
+// commit torn in the WAL, open at the last complete commit
+static void testLiteReplay()
+{
+	std::string path = tempDir + "/db", copy = tempDir + "/copy";
+	Pair p(new LiteAxolotlStore(path), new InMemoryAxolotlStore());
+	p.alice->commit();
+	ByteArray first = p.alice->loadSession(2, 1)->serialize();
+	p.toBob->encrypt("second");
+	p.alice->commit();
+	ByteArray second = p.alice->loadSession(2, 1)->serialize();
+	p.toBob->encrypt("uncommitted");
+	p.alice->storePreKey(79, KeyHelper::generatePreKeys(79, 1)[0]);
+
+	copyFile(path, copy);
+	copyFile(path + "-wal", copy + "-wal");
+	{
+		LiteAxolotlStore lite(copy);
+		check(lite.loadSession(2, 1)->serialize() == second, "SQLite: last commit lost");
+		check(!lite.containsPreKey(79), "SQLite: uncommitted change kept");
+	}
+
+	copyFile(path, copy);
+	copyFile(path + "-wal", copy + "-wal");
+	unlink((copy + "-shm").c_str());
+	check(truncate((copy + "-wal").c_str(), fileSize(copy + "-wal") - 3) == 0, "SQLite: can't tear the WAL");
+	{
+		LiteAxolotlStore lite(copy);
+		check(lite.loadSession(2, 1)->serialize() == first, "SQLite: torn commit replayed");
+	}
+}
+
+int main()
+{
+	char dir[] = "/tmp/axolotltest-XXXXXX";
+	if (!mkdtemp(dir)) {
+		printf("Can't create a temporary directory\n");
+		return 1;
+	}
+	tempDir = dir;
+
+	testDecryptFailure();
+	testSkippedKeyCap();
+	testGroupDecryptFailure();
+	testSenderKeyCap();
+	testSenderKeyStates();
+	testLogReplay();
+	testLiteReplay();
+
+	for (auto name : { "log", "log.new", "db", "db-wal", "db-shm", "copy", "copy-wal", "copy-shm" })
+		unlink((tempDir + "/" + name).c_str());
+	rmdir(dir);
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed != 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Benchmark for the FunXMPP dictionary lookup (lookupToken). Compares the
+ * old linear strcmp scan over the padded tables (kept in databuffer.cc
+ * when built with DICTBENCH) with the generated perfect hash, over the
+ * strings the encoder looks up when serializing a typical mix of stanzas
+ * (receipts, acks, messages, presences, chatstates and iqs). Then times
+ * the whole encoder on that mix with either lookup: building the stanzas
+ * and serialize_tree, like the connection does for every stanza it
+ * sends, and serialize_template for the ones sent from templates.
+ *
+ * Build: make dictbench
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "wadict.h"
+#include "wa_connection.h"
+#include "wa_templates.h"
+#include "databuffer.h"
+#include "tree.h"
+#include "wacommon.h"
+
+// In databuffer.cc, built with DICTBENCH
+extern bool dict_linear_lookup;
+
+// Strings looked up by DataBuffer::putString for each stanza (JIDs are
+// looked up whole first and then split in user and server)
+static std::vector < std::string > stanzaMix()
+{
+	const char *mix[] = {
+		// receipt
+		"receipt", "to", "34600111222@s.whatsapp.net", "34600111222", "s.whatsapp.net",
+		"id", "1455613213-17", "type", "read", "t", "1",
+		// ack
+		"ack", "class", "receipt", "type", "delivery", "id", "3EB0A1B2C3D4E5F6",
+		"to", "34600111222@s.whatsapp.net", "34600111222", "s.whatsapp.net",
+		// message + body
+		"message", "to", "34600111222@s.whatsapp.net", "34600111222", "s.whatsapp.net",
+		"type", "text", "id", "1455613213-18", "t", "1455613213", "body",
+		// encrypted message
+		"message", "to", "34600111222@s.whatsapp.net", "34600111222", "s.whatsapp.net",
+		"type", "text", "id", "1455613213-19", "t", "1455613213", "enc", "v", "2", "type", "msg",
+		// presence
+		"presence", "name", "John Doe", "type", "available",
+		// chatstate
+		"chatstate", "to", "34600111222@s.whatsapp.net", "34600111222", "s.whatsapp.net",
+		"composing",
+		// ping reply
+		"iq", "to", "s.whatsapp.net", "id", "1a2b", "type", "result",
+		// media iq
+		"iq", "id", "1c", "type", "set", "to", "s.whatsapp.net", "xmlns", "w:m",
+		"media", "type", "image", "hash", "kTSIuUxaE0oQyTfq5Xy3YkSfWyHhnKzmZbG5y5tnY1E=",
+		"size", "48211",
+	};
+	return std::vector < std::string > (mix, mix + sizeof(mix)/sizeof(mix[0]));
+}
+
+static const std::string jid = "34600111222@s.whatsapp.net";
+
+// Attributes in the order they go on the wire, as the connection does
+static Tree stanza(std::string tag, std::vector < std::string > at, const char *child = NULL)
+{
+	Tree t(tag);
+	for (unsigned int i = 0; i + 1 < at.size(); i += 2)
+		t.setAtr(at[i], at[i+1]);
+	if (child)
+		t.addChild(Tree(child));
+	return t;
+}
+
+// A templated stanza and its arguments
+struct Templated {
+	const StanzaShape & shape;
+	std::vector < std::string > args;
+
+	// The tree the template stands for
+	Tree tree() const {
+		std::vector < std::string > at;
+		for (unsigned int i = 0; i + 1 < shape.attributes.size(); i += 2) {
+			const std::string & v = shape.attributes[i+1];
+			if (v[0] != '$')
+				at.insert(at.end(), { shape.attributes[i], v });
+			else if (v.size() == 2 or args[v[1] - '0'].size())
+				at.insert(at.end(), { shape.attributes[i], args[v[1] - '0'] });
+		}
+		return stanza(shape.tag, at, shape.child);
+	}
+};
+
+// The ones the connection sends from templates, first in the mix
+static const std::vector < Templated > & templatedMix()
+{
+	static const std::vector < Templated > mix = {
+		{ receiptShape, {"1455613213-17", jid, "read"} },
+		{ receiptAckShape, {"3EB0A1B2C3D4E5F6", "delivery", jid, "", ""} },
+		{ composingShape, {jid} },
+		{ pongShape, {"1a2b", "s.whatsapp.net"} },
+	};
+	return mix;
+}
+
+// The same mix as the strings above, as trees
+static std::vector < Tree > stanzaTrees()
+{
+	std::vector < Tree > mix;
+	for (auto & t : templatedMix())
+		mix.push_back(t.tree());
+
+	Tree body("body");
+	body.setData("See you at eight, I'll bring the tickets");
+	Tree msg = stanza("message", {"to", jid, "type", "text", "id", "1455613213-18", "t", "1455613213"});
+	msg.addChild(body);
+	mix.push_back(msg);
+
+	Tree enc("enc", makeat({"v", "2", "type", "msg"}));
+	enc.setData(std::string(180, 0x5a));
+	Tree emsg = stanza("message", {"to", jid, "type", "text", "id", "1455613213-19", "t", "1455613213"});
+	emsg.addChild(enc);
+	mix.push_back(emsg);
+
+	mix.push_back(stanza("presence", {"name", "John Doe", "type", "available"}));
+
+	Tree media = stanza("iq", {"id", "1c", "type", "set", "to", "s.whatsapp.net", "xmlns", "w:m"});
+	media.addChild(stanza("media", {"type", "image", "hash", "kTSIuUxaE0oQyTfq5Xy3YkSfWyHhnKzmZbG5y5tnY1E=", "size", "48211"}));
+	mix.push_back(media);
+	return mix;
+}
+
+template < typename F >
+static double elapsed(F run, int rounds)
+{
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int r = 0; r < rounds; r++)
+		run();
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / rounds;
+}
+
+static unsigned short lookup(const std::string & s)
+{
+	return lookupToken(s.c_str(), s.size());
+}
+
+int main()
+{
+	std::vector < std::string > strs = stanzaMix();
+	for (auto & s : strs) {
+		dict_linear_lookup = true;
+		unsigned short linear = lookup(s);
+		dict_linear_lookup = false;
+		if (linear != lookup(s)) {
+			fprintf(stderr, "Mismatch for %s\n", s.c_str());
+			return 1;
+		}
+	}
+
+	unsigned sink = 0;
+	int rounds = 20000;
+	double t[2];
+	for (int linear = 0; linear < 2; linear++) {
+		dict_linear_lookup = linear;
+		t[linear] = elapsed([&] () {
+			for (auto & s : strs)
+				sink += lookup(s);
+		}, rounds) / strs.size();
+	}
+
+	printf("%u lookups per stanza mix, %d rounds\n", (unsigned)strs.size(), rounds);
+	printf("linear scan:  %8.1f ns/lookup\n", t[1]);
+	printf("perfect hash: %8.1f ns/lookup (%.1fx)\n", t[0], t[1] / t[0]);
+	printf("tables: %u bytes padded, %u bytes packed\n",
+		(unsigned)(WADICT_MAIN_SIZE * (37+1) + WADICT_SEC_SIZE * (28+1)),
+		(unsigned)(sizeof(dict_pool) + sizeof(main_dict_offset) + sizeof(sec_dict_offset)));
+
+	// The templates must give the same bytes as the trees (unencrypted
+	// frames, the room for the MAC is only filled in when sealed)
+	WhatsappConnection wc("34600000000", "", "bench");
+	const std::vector < Templated > & tmix = templatedMix();
+	std::vector < StanzaTemplate > templates;
+	for (auto & tm : tmix) {
+		Tree tt = stanza(tm.shape.tag, tm.shape.attributes, tm.shape.child);
+		templates.push_back(StanzaTemplate(tt));
+		Tree tree = tm.tree();
+		if (wc.serialize_tree(&tree, false).toString() != wc.serialize_template(templates.back(), tm.args.data(), false).toString()) {
+			fprintf(stderr, "Template mismatch for %s\n", tm.shape.tag);
+			return 1;
+		}
+	}
+
+	double all[2], trees, fromTemplates;
+	for (int linear = 0; linear < 2; linear++) {
+		dict_linear_lookup = linear;
+		all[linear] = elapsed([&] () {
+			for (auto & tree : stanzaTrees())
+				sink += wc.serialize_tree(&tree).size();
+		}, rounds);
+	}
+	dict_linear_lookup = false;
+	trees = elapsed([&] () {
+		for (auto & tm : tmix) {
+			Tree tree = tm.tree();
+			sink += wc.serialize_tree(&tree).size();
+		}
+	}, rounds);
+	fromTemplates = elapsed([&] () {
+		for (unsigned int i = 0; i < tmix.size(); i++)
+			sink += wc.serialize_template(templates[i], tmix[i].args.data()).size();
+	}, rounds);
+
+	unsigned int stanzas = stanzaTrees().size();
+	printf("\n%u stanzas per mix, built and serialized, %u of them templated\n", stanzas, (unsigned)tmix.size());
+	printf("serialize_tree, linear scan:  %8.1f ns/stanza\n", all[1] / stanzas);
+	printf("serialize_tree, perfect hash: %8.1f ns/stanza (%.1fx)\n", all[0] / stanzas, all[1] / all[0]);
+	printf("templated stanzas as trees:   %8.1f ns/stanza\n", trees / tmix.size());
+	printf("serialize_template:           %8.1f ns/stanza (%.1fx)\n", fromTemplates / tmix.size(), trees / fromTemplates);
+
+	return sink == 0xFFFFFFFF;
+}
@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+#
+# Generates stanzas.h from misc/stanzas.txt: a struct per stanza and a
+# decoder filling it from the token keyed attributes of a Tree.
+#
+# Usage: python misc/gen_stanzas.py misc/stanzas.txt misc/wadict.txt > stanzas.h
+
+import sys
+from gen_wadict import read_dicts
+
+CTYPES = { "string": "TreeString", "uint64": "unsigned long long" }
+
+def read_schema(fn):
+	stanzas = []
+	for line in open(fn).read().split("\n"):
+		if line.startswith("#") or line.strip() == "":
+			continue
+		w = line.split()
+		if w[0] == "stanza":
+			stanzas.append({ "tag": w[1], "name": w[2], "fields": [], "children": [] })
+		elif w[0] == "child":
+			stanzas[-1]["children"].append(w[1])
+		else:
+			if w[1] not in CTYPES:
+				raise Exception("Unknown type %s" % w[1])
+			stanzas[-1]["fields"].append((w[0], w[1]))
+	return stanzas
+
+def ident(s):
+	return "".join(c if c.isalnum() else "_" for c in s)
+
+def main():
+	stanzas = read_schema(sys.argv[1])
+	main_dict, sec_dict = read_dicts(sys.argv[2])
+
+	def token(s):
+		if s in main_dict[3:]:
+			return main_dict.index(s, 3)
+		if s in sec_dict:
+			return 0x100 + sec_dict.index(s)
+		raise Exception("%s is not a token" % s)
+
+	out = "\n// Typed decoders for the high volume stanzas\n"
+	out += "// Generated by misc/gen_stanzas.py from misc/stanzas.txt, do not edit!\n\n"
+	out += "#ifndef __STANZAS__H__\n#define __STANZAS__H__\n\n"
+	out += "#include \"tree.h\"\n\n"
+
+	out += "static inline unsigned long long stanzaUInt(const TreeString & s)\n{\n"
+	out += "\tunsigned long long r = 0;\n"
+	out += "\tfor (unsigned i = 0; i < s.len and s.ptr[i] >= '0' and s.ptr[i] <= '9'; i++)\n"
+	out += "\t\tr = r * 10 + (s.ptr[i] - '0');\n"
+	out += "\treturn r;\n}\n\n"
+
+	for st in stanzas:
+		fields, children = st["fields"], st["children"]
+		out += "// <%s>\n" % st["tag"]
+		out += "struct %s {\n" % st["name"]
+		for f, t in fields:
+			out += "\t%s %s;\n" % (CTYPES[t], ident(f))
+		for f, t in fields:
+			out += "\tbool has_%s;\n" % ident(f)
+		for c in children:
+			out += "\tbool %s;\n" % ident(c)
+		inits = ["%s(0)" % ident(f) for f, t in fields if t != "string"]
+		inits += ["has_%s(false)" % ident(f) for f, t in fields]
+		inits += ["%s(false)" % ident(c) for c in children]
+		out += "\n\t%s() : %s {}\n" % (st["name"], ", ".join(inits))
+		out += "};\n\n"
+
+		out += "static inline void decodeStanza(const Tree & tree, %s & s)\n{\n" % st["name"]
+		if fields:
+			out += "\tconst TreeAttribute *a = tree.getAttributeList();\n"
+			out += "\tfor (unsigned i = 0; i < tree.numAttributes(); i++) {\n"
+			out += "\t\tswitch (a[i].key_token) {\n"
+			for f, t in fields:
+				val = "a[i].value" if t == "string" else "stanzaUInt(a[i].value)"
+				out += "\t\tcase %d: // %s\n" % (token(f), f)
+				out += "\t\t\ts.%s = %s;\n" % (ident(f), val)
+				out += "\t\t\ts.has_%s = true;\n" % ident(f)
+				out += "\t\t\tbreak;\n"
+			out += "\t\t};\n\t}\n"
+		if children:
+			out += "\tfor (unsigned i = 0; i < tree.numChildren(); i++) {\n"
+			out += "\t\tswitch (tree.getChildTagToken(i)) {\n"
+			for c in children:
+				out += "\t\tcase %d: // %s\n" % (token(c), c)
+				out += "\t\t\ts.%s = true;\n" % ident(c)
+				out += "\t\t\tbreak;\n"
+			out += "\t\t};\n\t}\n"
+		out += "}\n\n"
+
+	out += "#endif\n\n"
+	sys.stdout.write(out)
+
+if __name__ == "__main__":
+	main()
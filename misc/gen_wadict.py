@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+#
+# Generates wadict.h from misc/wadict.txt:
+#  - All token strings packed in a single pool, indexed by offset tables
+#  - A perfect hash (hash and displace) mapping strings back to tokens
+#
+# Usage: python misc/gen_wadict.py misc/wadict.txt > wadict.h
+
+import sys
+
+HASH_SIZE = 1024   # Slots in the lookup table (power of two)
+BUCKETS = 256      # Displacement buckets (power of two)
+
+def fnv1a(s):
+	h = 2166136261
+	for c in bytearray(s.encode("utf-8")):
+		h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+	return h
+
+def mix(h):
+	h ^= h >> 16
+	h = (h * 0x85ebca6b) & 0xFFFFFFFF
+	h ^= h >> 13
+	h = (h * 0xc2b2ae35) & 0xFFFFFFFF
+	h ^= h >> 16
+	return h
+
+def read_dicts(fn):
+	dicts = {}
+	cur = None
+	for line in open(fn).read().split("\n"):
+		if line.startswith("#") or line == "":
+			continue
+		if line.startswith("["):
+			cur = dicts.setdefault(line.strip("[]"), [])
+		else:
+			cur.append("" if line == "%empty" else line)
+	return dicts["main"], dicts["secondary"]
+
+def build_hash(tokens):
+	# tokens: list of (string, token value), first occurrence wins
+	buckets = [[] for i in range(BUCKETS)]
+	for s, tok in tokens:
+		h = fnv1a(s)
+		buckets[h & (BUCKETS - 1)].append((s, tok, h))
+
+	table = [0] * HASH_SIZE
+	seeds = [0] * BUCKETS
+	for b in sorted(range(BUCKETS), key = lambda b: -len(buckets[b])):
+		if not buckets[b]:
+			continue
+		for seed in range(1, 0x10000):
+			slots = [mix(h ^ seed) & (HASH_SIZE - 1) for s, tok, h in buckets[b]]
+			if len(set(slots)) == len(slots) and all(table[x] == 0 for x in slots):
+				break
+		else:
+			raise Exception("Could not place bucket %d" % b)
+		seeds[b] = seed
+		for x, (s, tok, h) in zip(slots, buckets[b]):
+			table[x] = tok
+	return table, seeds
+
+def c_string(s):
+	return '"' + s.replace("\\", "\\\\").replace('"', '\\"') + '\\0"'
+
+def emit_array(ctype, name, values, perline = 12):
+	out = "static const %s %s[%d] = {\n" % (ctype, name, len(values))
+	for i in range(0, len(values), perline):
+		out += "\t" + ", ".join(str(v) for v in values[i:i+perline]) + ",\n"
+	return out + "};\n\n"
+
+def main():
+	main_dict, sec_dict = read_dicts(sys.argv[1])
+
+	pool, offsets = "", {}
+	def intern(s):
+		if s not in offsets:
+			offsets[s] = len(pool.encode("utf-8"))
+			return c_string(s)
+		return None
+
+	pool_lines = []
+	main_off, sec_off = [], []
+	for lst, offs in ((main_dict, main_off), (sec_dict, sec_off)):
+		for s in lst:
+			lit = intern(s)
+			if lit:
+				pool_lines.append(lit)
+				pool += s + "\0"
+			offs.append(offsets[s])
+
+	# Tokens 0-2 are reserved, the main dictionary takes precedence
+	tokens, seen = [], set()
+	for i, s in enumerate(main_dict):
+		if i >= 3 and s not in seen:
+			tokens.append((s, i))
+			seen.add(s)
+	for i, s in enumerate(sec_dict):
+		if s not in seen:
+			tokens.append((s, i + 0x100))
+			seen.add(s)
+	table, seeds = build_hash(tokens)
+
+	out = "\n// Static const tables to encode/decode whatsapp messages\n"
+	out += "// Generated by misc/gen_wadict.py from misc/wadict.txt, do not edit!\n\n"
+	out += "#define WADICT_MAIN_SIZE %d\n" % len(main_dict)
+	out += "#define WADICT_SEC_SIZE %d\n" % len(sec_dict)
+	out += "#define WADICT_HASH_SIZE %d\n" % HASH_SIZE
+	out += "#define WADICT_BUCKETS %d\n\n" % BUCKETS
+	out += "// All the strings, NUL terminated\n"
+	out += "static const char dict_pool[%d] =\n" % (len(pool.encode("utf-8")) + 1)
+	out += "\n".join("\t" + l for l in pool_lines) + ";\n\n"
+	out += "// Token to pool offset\n"
+	out += emit_array("unsigned short", "main_dict_offset", main_off)
+	out += emit_array("unsigned short", "sec_dict_offset", sec_off)
+	out += "// Perfect hash: slot = dict_mix(hash ^ seed[hash % buckets]) % size\n"
+	out += "// Slots hold the token (or 0x100 + extended token), 0 if empty\n"
+	out += emit_array("unsigned short", "dict_hash_seed", seeds, 16)
+	out += emit_array("unsigned short", "dict_hash_table", table, 16)
+	out += "static inline unsigned int dict_hash(const char *s, int len)\n{\n"
+	out += "\tunsigned int h = 2166136261u;\n"
+	out += "\tfor (int i = 0; i < len; i++)\n"
+	out += "\t\th = (h ^ (unsigned char)s[i]) * 16777619u;\n"
+	out += "\treturn h;\n}\n\n"
+	out += "static inline unsigned int dict_mix(unsigned int h)\n{\n"
+	out += "\th ^= h >> 16;\n\th *= 0x85ebca6bu;\n\th ^= h >> 13;\n"
+	out += "\th *= 0xc2b2ae35u;\n\th ^= h >> 16;\n\treturn h;\n}\n\n"
+
+	sys.stdout.write(out)
+
+if __name__ == "__main__":
+	main()
+
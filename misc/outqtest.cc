@@ -0,0 +1,191 @@
+/*
+ * Behaviour tests for the OutputQueue: the bytes reach the socket whole,
+ * frame after frame, FIFO within each class and sealed in wire order;
+ * control frames overtake pending bulk data and the other classes share
+ * the link by weight.
+ *
+ * Build: make outqtest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "outqueue.h"
+
+static int failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failed++;
+	}
+}
+
+// Class, sequence number and length, then the payload
+#define HEADER 5
+
+static DataBuffer makeFrame(int prio, int seq, int size)
+{
+	std::string f(HEADER + size, (char)seq);
+	f[0] = prio;
+	f[1] = seq >> 8;
+	f[2] = seq;
+	f[3] = size >> 8;
+	f[4] = size;
+	return DataBuffer(f.data(), f.size());
+}
+
+struct Frame {
+	int prio, seq, size;
+	bool intact;
+};
+
+// Splits the wire bytes back into frames
+static std::vector < Frame > parse(const std::string & wire)
+{
+	std::vector < Frame > frames;
+	size_t p = 0;
+	while (p + HEADER <= wire.size()) {
+		const unsigned char *h = (const unsigned char *)&wire[p];
+		Frame f = { h[0], (h[1] << 8) | h[2], (h[3] << 8) | h[4], true };
+		if (p + HEADER + f.size > wire.size())
+			f.intact = false;
+		for (int i = 0; i < f.size and f.intact; i++)
+			f.intact = (unsigned char)wire[p + HEADER + i] == (f.seq & 0xFF);
+		frames.push_back(f);
+		if (!f.intact)
+			return frames;
+		p += HEADER + f.size;
+	}
+	if (p != wire.size())
+		frames.push_back(Frame { -1, 0, 0, false });
+	return frames;
+}
+
+// A running keystream, like the connection's: it only decodes if the
+// frames were sealed in the order they hit the wire
+struct Stream {
+	unsigned long long pos = 0;
+	void apply(unsigned char *p, int len) {
+		for (int i = 0; i < len; i++, pos++)
+			p[i] ^= (pos * 131 + 7) & 0xFF;
+	}
+};
+
+// Takes up to len bytes off the queue, through copyOut or getIovec
+static std::string take(OutputQueue & q, int len, bool iovec)
+{
+	std::string out;
+	if (iovec) {
+		struct iovec iov[8];
+		int n = q.getIovec(iov, 1 + rand() % 8);
+		for (int i = 0; i < n and (int)out.size() < len; i++)
+			out.append((char *)iov[i].iov_base, std::min < int > (iov[i].iov_len, len - out.size()));
+	} else {
+		std::string buf(len, 0);
+		buf.resize(q.copyOut(&buf[0], len));
+		out = buf;
+	}
+	q.consume(out.size());
+	return out;
+}
+
+// Random frames of every class, taken in random chunks: every frame
+// arrives whole and sealed, in order within its class
+static void testStream(unsigned seed)
+{
+	srand(seed);
+	OutputQueue q;
+	Stream sealing, reading;
+	q.setSealer([&] (DataBuffer & f) { sealing.apply((unsigned char *)f.getPtr(), f.size()); });
+
+	std::string wire;
+	int seqs[OUT_PRIORITIES] = { 0 }, queued = 0;
+	for (int step = 0; step < 3000; step++) {
+		for (int i = rand() % 4; i > 0; i--) {
+			int prio = rand() % OUT_PRIORITIES;
+			int size = rand() % 8 ? rand() % 300 : rand() % 30000;
+			q.push(makeFrame(prio, seqs[prio]++, size), (OutPriority)prio);
+			queued += HEADER + size;
+		}
+		std::string got = take(q, 1 + rand() % 20000, rand() % 2);
+		queued -= got.size();
+		wire += got;
+		check(q.size() == queued, "Stream: wrong size");
+	}
+	while (q.size() > 0)
+		wire += take(q, 1 << 16, rand() % 2);
+	check(take(q, 100, false).empty() && take(q, 100, true).empty(), "Stream: bytes after the end");
+
+	reading.apply((unsigned char *)&wire[0], wire.size());
+	std::vector < Frame > frames = parse(wire);
+	int next[OUT_PRIORITIES] = { 0 };
+	for (auto & f : frames) {
+		if (!f.intact or f.prio < 0 or f.prio >= OUT_PRIORITIES or f.seq != next[f.prio]) {
+			check(false, "Stream: frame broken, or out of order");
+			return;
+		}
+		next[f.prio]++;
+	}
+	for (int i = 0; i < OUT_PRIORITIES; i++)
+		check(next[i] == seqs[i], "Stream: frames lost");
+}
+
+// A control frame pushed behind a lot of bulk data only waits for the
+// few frames already committed
+static void testControlFirst()
+{
+	OutputQueue q;
+	for (int i = 0; i < 64; i++)
+		q.push(makeFrame(OutBulk, i, 4096), OutBulk);
+	std::string wire = take(q, 100, false);
+	q.push(makeFrame(OutControl, 0, 10), OutControl);
+	while (q.size() > 0)
+		wire += take(q, 1000, true);
+
+	std::vector < Frame > frames = parse(wire);
+	size_t before = 0;
+	while (before < frames.size() and frames[before].prio != OutControl)
+		before++;
+	check(frames.size() == 65, "Control: frames lost");
+	check(before <= 5, "Control: waited behind bulk data");
+}
+
+// Backlogged receipts, chats and bulk share the link 8:4:1
+static void testWeights()
+{
+	OutputQueue q;
+	for (int i = 0; i < 400; i++)
+		for (int prio = OutReceipt; prio < OUT_PRIORITIES; prio++)
+			q.push(makeFrame(prio, i, 1024 - HEADER), (OutPriority)prio);
+
+	std::string wire;
+	while (wire.size() < 130 * 1024)
+		wire += take(q, 1024, false);
+	int count[OUT_PRIORITIES] = { 0 };
+	std::vector < Frame > frames = parse(wire);
+	for (size_t i = 0; i < 130; i++)
+		count[frames[i].prio]++;
+	check(count[OutReceipt] >= 72 && count[OutReceipt] <= 88, "Weights: receipts off");
+	check(count[OutChat] >= 36 && count[OutChat] <= 44, "Weights: chats off");
+	check(count[OutBulk] >= 8 && count[OutBulk] <= 12, "Weights: bulk off");
+
+	q.clear();
+	check(q.size() == 0 && take(q, 100, false).empty(), "Weights: clear left data");
+	q.push(makeFrame(OutBulk, 0, 4000), OutBulk);
+	check(take(q, 1 << 16, false).size() == 4005, "Weights: frame lost after clear");
+}
+
+int main()
+{
+	for (unsigned seed = 1; seed <= 10 and !failed; seed++)
+		testStream(seed);
+	testControlFirst();
+	testWeights();
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed != 0;
+}
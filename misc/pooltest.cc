@@ -0,0 +1,117 @@
+/*
+ * Behaviour tests for the CryptoPool: the jobs of one key run in the order
+ * they were posted, fenced jobs run after everything posted before them,
+ * and the pool runs the jobs left when destroyed. LockedAxolotlStore's
+ * commit waits for the record updates in flight.
+ *
+ * Build: make pooltest
+ */
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cryptopool.h"
+#include "inmemoryaxolotlstore.h"
+
+#define KEYS 64
+#define POSTERS 4
+#define JOBS 20000
+
+static int failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failed++;
+	}
+}
+
+// Posters share the keys, each key is posted to by a single thread
+static void testOrder()
+{
+	std::vector < int > last(KEYS, -1);
+	std::atomic < int > ran(0);
+	std::atomic < bool > ordered(true), fences(true);
+	{
+		CryptoPool pool(4);
+		std::vector < std::thread > posters;
+		for (int p = 0; p < POSTERS; p++) {
+			posters.push_back(std::thread([&, p] () {
+				for (int i = 0; i < JOBS; i++) {
+					int key = p + POSTERS * (i % (KEYS / POSTERS));
+					int seq = i / (KEYS / POSTERS);
+					pool.post(key, [&, key, seq] () {
+						if (last[key] != seq - 1)
+							ordered = false;
+						last[key] = seq;
+						ran++;
+					});
+				}
+			}));
+		}
+		for (auto & t : posters)
+			t.join();
+
+		// Every job posted before a fenced one has run by then
+		for (int key = 0; key < 8; key++) {
+			pool.postFenced(key, [&, key] () {
+				if (ran < POSTERS * JOBS + 2 * key)
+					fences = false;
+				ran++;
+			});
+			pool.post(key + 1, [&] () { ran++; });
+		}
+	}
+	check(ordered, "Order: jobs of a key out of order");
+	check(fences, "Order: fenced job ran early");
+	check(ran == POSTERS * JOBS + 16, "Order: jobs lost at destruction");
+}
+
+// Fenced jobs wait for slow jobs in other shards
+static void testFence()
+{
+	std::atomic < int > slow(0);
+	std::atomic < bool > waited(true);
+	{
+		CryptoPool pool(4);
+		for (int key = 0; key < 3; key++)
+			pool.post(key, [&] () {
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				slow++;
+			});
+		pool.postFenced(3, [&] () { waited = slow == 3; });
+	}
+	check(waited, "Fence: ran before the slow jobs");
+}
+
+// commit() waits for a record lock held by a worker
+static void testCommit()
+{
+	LockedAxolotlStore store(std::shared_ptr < AxolotlStore > (new InMemoryAxolotlStore()));
+	std::atomic < bool > updating(true), waited(false);
+	std::unique_lock < std::mutex > held(store.recordLock(42));
+	std::thread committer([&] () {
+		store.commit();
+		waited = !updating;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	updating = false;
+	held.unlock();
+	committer.join();
+	check(waited, "Commit: didn't wait for the record update");
+}
+
+int main()
+{
+	testOrder();
+	testFence();
+	testCommit();
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed != 0;
+}
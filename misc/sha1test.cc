@@ -0,0 +1,119 @@
+/*
+ * Known answer tests for the SHA-1 and HMAC-SHA1 behind the frame MACs:
+ * the FIPS 180 digests, the RFC 2202 HMAC vectors, and frames of every
+ * length around the block boundaries checked against KeyGenerator's HMAC.
+ *
+ * Build: make sha1test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "sha1.h"
+#include "keygen.h"
+
+static int failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failed++;
+	}
+}
+
+static std::string hex(const unsigned char *p, int len)
+{
+	std::string r;
+	char b[3];
+	for (int i = 0; i < len; i++) {
+		snprintf(b, sizeof(b), "%02x", p[i]);
+		r += b;
+	}
+	return r;
+}
+
+// Fed in uneven pieces, so that the block buffering is exercised too
+static void testDigests()
+{
+	struct { std::string msg; const char *digest; } v[] = {
+		{ "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+		{ "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+		{ std::string(1000000, 'a'), "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+	};
+	for (auto & t : v) {
+		SHA1Context ctx;
+		for (size_t p = 0, step = 1; p < t.msg.size(); p += step, step = step * 3 % 97 + 1)
+			ctx.update(&t.msg[p], std::min(step, t.msg.size() - p));
+		unsigned char d[20];
+		ctx.final(d);
+		check(hex(d, 20) == t.digest, "SHA-1: wrong digest");
+	}
+}
+
+// RFC 2202. frameMac appends the sequence number to the data, so the last
+// four bytes of each message go in as the sequence number.
+static void testRFC2202()
+{
+	struct { std::string key, msg; const char *mac; } v[] = {
+		{ std::string(20, 0x0b), "Hi There", "b617318655057264e28bc0b6fb378c8ef146be00" },
+		{ "Jefe", "what do ya want for nothing?", "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" },
+		{ std::string(20, 0xaa), std::string(50, 0xdd), "125d7342b9ac11cd91a39af48aa17b4f63f175d3" },
+		{ "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19",
+		  std::string(50, 0xcd), "4c9007f4026250c6bc8414f9bf50c86c2d7235da" },
+		{ std::string(20, 0x0c), "Test With Truncation", "4c1a03424b55e07fe7f27be1d58bb9324a9a5a04" },
+		{ std::string(80, 0xaa), "Test Using Larger Than Block-Size Key - Hash Key First",
+		  "aa4ae5e15272d00e95705637ce8a3b55ed402112" },
+		{ std::string(80, 0xaa), "Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data",
+		  "e8e99d0f45237d786d6bbaa7965c7808bbff1a91" },
+	};
+	for (auto & t : v) {
+		HMACSHA1 mac;
+		mac.setKey((const unsigned char *)t.key.data(), t.key.size());
+		const unsigned char *m = (const unsigned char *)t.msg.data();
+		int len = t.msg.size() - 4;
+		unsigned int seq = (m[len] << 24) | (m[len + 1] << 16) | (m[len + 2] << 8) | m[len + 3];
+		unsigned char out[20];
+		mac.frameMac(m, len, seq, out, 20);
+		check(hex(out, 20) == t.mac, "HMAC: wrong RFC 2202 MAC");
+	}
+}
+
+// Frames of every length up to a few blocks (data plus sequence number
+// hitting 55, 56 and 64 bytes among them), then random ones, against
+// KeyGenerator's HMAC over data || seq
+static void testFrames()
+{
+	srand(1);
+	for (int n = 0; n < 2000 and !failed; n++) {
+		int len = n < 300 ? n : rand() % 70000;
+		std::string key(20, 0), data(len + 4, 0);
+		for (auto & c : key)
+			c = rand();
+		for (auto & c : data)
+			c = rand();
+		unsigned int seq = n < 300 ? n : rand();
+		for (int i = 0; i < 4; i++)
+			data[len + i] = seq >> (24 - 8 * i);
+
+		HMACSHA1 mac;
+		mac.setKey((const unsigned char *)key.data(), key.size());
+		unsigned char out[4], ref[4];
+		mac.frameMac((const unsigned char *)data.data(), len, seq, out);
+		KeyGenerator::calc_hmac_v12((const unsigned char *)data.data(), len + 4, (const unsigned char *)key.data(), ref);
+		check(memcmp(out, ref, 4) == 0, "Frames: MAC mismatch");
+	}
+}
+
+int main()
+{
+	testDigests();
+	testRFC2202();
+	testFrames();
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed != 0;
+}
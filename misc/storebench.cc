@@ -0,0 +1,146 @@
+
+/*
+ * Benchmark for the Axolotl session stores: the in-memory store against
+ * the SQLite one and the append-only log, loading and storing the session
+ * of a set of contacts round robin (as a busy account deciphering messages
+ * would) and committing every batch of operations. Also times a cold load
+ * of every session from the database, a commit after each operation and
+ * the replay of the log.
+ *
+ * Build: make storebench
+ * Usage: storebench [database [contacts [rounds [batch]]]]
+ *        (the log goes next to the database, with .log appended)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <memory>
+
+#include "inmemoryaxolotlstore.h"
+#include "liteaxolotlstore.h"
+#include "loggedaxolotlstore.h"
+#include "keyhelper.h"
+#include "sessionbuilder.h"
+#include "prekeybundle.h"
+#include "whisperexception.h"
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// A real session, as Alice after processing Bob's bundle
+static std::string makeSession()
+{
+	std::shared_ptr<AxolotlStore> alice(new InMemoryAxolotlStore());
+	IdentityKeyPair aliceId = KeyHelper::generateIdentityKeyPair();
+	IdentityKeyPair bobId = KeyHelper::generateIdentityKeyPair();
+	alice->storeLocalData(KeyHelper::generateRegistrationId(), aliceId);
+
+	std::vector<PreKeyRecord> prekeys = KeyHelper::generatePreKeys(1, 1);
+	SignedPreKeyRecord signedPreKey = KeyHelper::generateSignedPreKey(bobId, 1);
+	PreKeyBundle bundle(KeyHelper::generateRegistrationId(), 1,
+		prekeys[0].getId(), prekeys[0].getKeyPair().getPublicKey(),
+		signedPreKey.getId(), signedPreKey.getKeyPair().getPublicKey(),
+		signedPreKey.getSignature(), bobId.getPublicKey());
+
+	SessionBuilder builder(alice, 2, 1);
+	builder.process(bundle);
+	return alice->loadSession(2, 1)->serialize();
+}
+
+// Loads and stores every contact's session, committing every batch ops
+static double bench(AxolotlStore & store, int contacts, int rounds, int batch)
+{
+	double t0 = now();
+	int ops = 0;
+	for (int r = 0; r < rounds; r++) {
+		for (int c = 0; c < contacts; c++) {
+			SessionRecord *record = store.loadSession(1000 + c, 1);
+			store.storeSession(1000 + c, 1, record);
+			if (++ops % batch == 0)
+				store.commit();
+		}
+	}
+	store.commit();
+	return (now() - t0) * 1e6 / ops;
+}
+
+static void removeDatabase(const std::string & path)
+{
+	unlink(path.c_str());
+	unlink((path + "-wal").c_str());
+	unlink((path + "-shm").c_str());
+}
+
+int main(int argc, char **argv)
+{
+	std::string path = argc > 1 ? argv[1] : "storebench.db";
+	std::string logpath = path + ".log";
+	int contacts = argc > 2 ? atoi(argv[2]) : 1000;
+	int rounds = argc > 3 ? atoi(argv[3]) : 20;
+	int batch = argc > 4 ? atoi(argv[4]) : 64;
+	if (contacts <= 0 or rounds <= 0 or batch <= 0) {
+		fprintf(stderr, "Usage: %s [database [contacts [rounds [batch]]]]\n", argv[0]);
+		return 1;
+	}
+
+	try {
+		SessionRecord session(makeSession());
+		removeDatabase(path);
+		unlink(logpath.c_str());
+
+		// Same starting point for all the stores
+		InMemoryAxolotlStore mem;
+		LiteAxolotlStore *lite = new LiteAxolotlStore(path);
+		LoggedAxolotlStore *logged = new LoggedAxolotlStore(logpath);
+		for (int c = 0; c < contacts; c++) {
+			mem.storeSession(1000 + c, 1, &session);
+			lite->storeSession(1000 + c, 1, &session);
+			logged->storeSession(1000 + c, 1, &session);
+		}
+		mem.commit();
+		lite->commit();
+		logged->commit();
+
+		double tm = bench(mem, contacts, rounds, batch);
+		double tl = bench(*lite, contacts, rounds, batch);
+		double tc = bench(*lite, contacts, 1, 1);
+		double tg = bench(*logged, contacts, rounds, batch);
+		unsigned long long logsize = logged->logSize();
+		delete lite;
+		delete logged;
+
+		double t0 = now();
+		LiteAxolotlStore cold(path);
+		for (int c = 0; c < contacts; c++)
+			cold.loadSession(1000 + c, 1);
+		double tload = (now() - t0) * 1e6 / contacts;
+
+		t0 = now();
+		LoggedAxolotlStore replayed(logpath);
+		double treplay = (now() - t0) * 1e6 / contacts;
+
+		printf("%d contacts, %d rounds, commit every %d ops, %u byte sessions\n",
+			contacts, rounds, batch, (unsigned)session.serialize().size());
+		printf("in memory:         %8.2f us/op\n", tm);
+		printf("sqlite:            %8.2f us/op\n", tl);
+		printf("sqlite, commit/op: %8.2f us/op\n", tc);
+		printf("sqlite, cold load: %8.2f us/session\n", tload);
+		printf("log:               %8.2f us/op\n", tg);
+		printf("log, replay:       %8.2f us/session (%llu bytes)\n", treplay, logsize);
+	}
+	catch (WhisperException &e) {
+		fprintf(stderr, "%s: %s\n", e.errorType().c_str(), e.errorMessage().c_str());
+		return 1;
+	}
+
+	removeDatabase(path);
+	unlink(logpath.c_str());
+	return 0;
+}
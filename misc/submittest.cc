@@ -0,0 +1,92 @@
+/*
+ * Stress test for the SubmitQueue. Several producers push while the
+ * consumer only drains when woken up, like the reactor: a push that
+ * returns true is the only wakeup. Every task must run, and no task may
+ * stay queued without a wakeup pending.
+ *
+ * Build: make submittest
+ */
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "submitqueue.h"
+
+#define PRODUCERS 4
+#define TASKS 2000
+#define ROUNDS 300
+
+static SubmitQueue queue;
+static std::mutex lock;
+static std::condition_variable cond;
+static bool woken;
+
+static void wake()
+{
+	std::lock_guard < std::mutex > l(lock);
+	woken = true;
+	cond.notify_one();
+}
+
+// Returns false if tasks were left queued with no wakeup coming
+static bool round(int r)
+{
+	std::atomic < int > ran(0);
+	std::vector < int > last(PRODUCERS, -1);
+	bool ordered = true;
+
+	std::vector < std::thread > producers;
+	for (int p = 0; p < PRODUCERS; p++) {
+		producers.push_back(std::thread([&, p] () {
+			for (int i = 0; i < TASKS; i++) {
+				// Runs on the consumer, tasks of one producer in order
+				if (queue.push([&, p, i] () { ordered = ordered and last[p] == i - 1; last[p] = i; ran++; }))
+					wake();
+			}
+		}));
+	}
+
+	while (ran < PRODUCERS * TASKS) {
+		std::unique_lock < std::mutex > l(lock);
+		if (!cond.wait_for(l, std::chrono::seconds(2), [] () { return woken; })) {
+			printf("Round %d: %d of %d tasks ran, %d queued, no wakeup\n",
+				r, ran.load(), PRODUCERS * TASKS, queue.size());
+			for (auto & t : producers)
+				t.join();
+			return false;
+		}
+		woken = false;
+		l.unlock();
+		// One drain has to empty the queue, or batches until it's empty
+		if (r % 2)
+			while (queue.size() > 0)
+				queue.drain(16);
+		else
+			queue.drain(1 << 20);
+	}
+
+	for (auto & t : producers)
+		t.join();
+	if (!ordered or queue.size() != 0) {
+		printf("Round %d: %s\n", r, ordered ? "tasks left" : "out of order");
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	for (int r = 0; r < ROUNDS; r++) {
+		if (!round(r)) {
+			printf("FAILED\n");
+			return 1;
+		}
+	}
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Behaviour tests for the TimerWheel: timers run once, at their deadline,
+ * in deadline order and then in the order they were added, whatever level
+ * of the wheel they were in. Checked against a plain list of deadlines.
+ *
+ * Build: make timertest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "timerwheel.h"
+
+static int failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failed++;
+	}
+}
+
+// Deadline and add order of the timers run so far
+typedef std::pair < time_t, int > Run;
+static std::vector < Run > ran;
+
+static TimerWheel::TimerId add(TimerWheel & w, time_t deadline, int seq)
+{
+	return w.add(deadline, [deadline, seq] () { ran.push_back(Run(deadline, seq)); });
+}
+
+// Past due ones, added latest first, run first and in deadline order
+static void testPastDue()
+{
+	TimerWheel w(1000);
+	ran.clear();
+	add(w, 1001, 0);
+	add(w, 999, 1);
+	add(w, 990, 2);
+	add(w, 995, 3);
+	add(w, 990, 4);
+	check(w.nextDeadline() == 990, "Past due: wrong next deadline");
+
+	w.advance(1000);
+	std::vector < Run > expected = { Run(990, 2), Run(990, 4), Run(995, 3), Run(999, 1) };
+	check(ran == expected, "Past due: wrong order");
+	check(w.size() == 1 && w.nextDeadline() == 1001, "Past due: future timer lost");
+	w.advance(1001);
+	check(ran.size() == 5 && w.size() == 0 && w.nextDeadline() == 0, "Past due: future timer not run");
+}
+
+// Callbacks cancel timers of the same second, and add past due ones
+static void testCallbacks()
+{
+	TimerWheel w(0);
+	ran.clear();
+	TimerWheel::TimerId victim = 0;
+	w.add(10, [&] () { ran.push_back(Run(10, 0)); check(w.cancel(victim), "Callbacks: can't cancel"); });
+	victim = add(w, 10, 1);
+	w.add(10, [&] () { ran.push_back(Run(10, 2)); add(w, 5, 3); add(w, 10, 4); });
+	add(w, 11, 5);
+
+	w.advance(10);
+	std::vector < Run > expected = { Run(10, 0), Run(10, 2), Run(5, 3), Run(10, 4) };
+	check(ran == expected, "Callbacks: wrong timers run");
+	check(!w.cancel(victim) && w.size() == 1, "Callbacks: cancelled timer kept");
+}
+
+// Random deadlines over every level and the overflow, advanced in random
+// steps, some cancelled
+static void testRandom(unsigned seed)
+{
+	srand(seed);
+	time_t now = rand() % 100000;
+	TimerWheel w(now);
+	std::map < int, std::pair < time_t, TimerWheel::TimerId > > pending;
+	ran.clear();
+	int seq = 0;
+
+	for (int step = 0; step < 500 and !failed; step++) {
+		int adds = rand() % 8;
+		for (int i = 0; i < adds; i++) {
+			static const time_t ranges[] = { 10, 64, 4096, 300000, 1000000 };
+			time_t deadline = now - 20 + rand() % ranges[rand() % 5];
+			pending[seq] = std::make_pair(deadline, add(w, deadline, seq));
+			seq++;
+		}
+		if (pending.size() and rand() % 4 == 0) {
+			auto it = pending.begin();
+			std::advance(it, rand() % pending.size());
+			check(w.cancel(it->second.second), "Random: can't cancel");
+			pending.erase(it);
+		}
+
+		time_t next = 0;
+		for (auto & p : pending)
+			if (next == 0 or p.second.first < next)
+				next = p.second.first;
+		check(w.nextDeadline() == next, "Random: wrong next deadline");
+
+		static const time_t steps[] = { 0, 1, 30, 5000, 100000 };
+		now += rand() % (steps[rand() % 5] + 1);
+		std::vector < Run > expected;
+		for (auto & p : pending)
+			if (p.second.first <= now)
+				expected.push_back(Run(p.second.first, p.first));
+		std::sort(expected.begin(), expected.end());
+		for (auto & r : expected)
+			pending.erase(r.second);
+
+		ran.clear();
+		w.advance(now);
+		check(ran == expected, "Random: wrong timers run, or out of order");
+		check(w.size() == pending.size(), "Random: wrong number of timers left");
+	}
+}
+
+int main()
+{
+	testPastDue();
+	testCallbacks();
+	for (unsigned seed = 1; seed <= 10 and !failed; seed++)
+		testRandom(seed);
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed != 0;
+}
@@ -0,0 +1,372 @@
+
+/*
+ * Round trip test for the tree encoder. Random trees are encoded with
+ * Tree::encode and with the previous recursive encoder (kept below as
+ * reference), the bytes must match. The result is then decoded back
+ * with read_tree (eagerly and lazily) and encoded again. Stanza templates are checked against
+ * the tree they stand for, with random slot values.
+ *
+ * Build: make treetest
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "wa_connection.h"
+#include "wa_templates.h"
+#include "databuffer.h"
+#include "tree.h"
+#include "wacommon.h"
+
+// Reference encoder, as it was before the two pass version (plus the
+// limit on packed strings, whose nibble count only has 7 bits)
+static void refPutInt(std::string & out, int value, int nbytes)
+{
+	for (int i = nbytes - 1; i >= 0; i--)
+		out += (char)((value >> (i << 3)) & 0xFF);
+}
+
+static void refListSize(std::string & out, int size)
+{
+	if (size == 0) {
+		refPutInt(out, 0, 1);
+	} else if (size < 256) {
+		refPutInt(out, 0xf8, 1);
+		refPutInt(out, size, 1);
+	} else {
+		refPutInt(out, 0xf9, 1);
+		refPutInt(out, size, 2);
+	}
+}
+
+static bool refNibbled(const std::string & s)
+{
+	for (auto c : s)
+		if (!((c >= '0' && c <= '9') || c == '-' || c == '.'))
+			return false;
+	return true;
+}
+
+static bool refHexed(const std::string & s)
+{
+	for (auto c : s)
+		if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F')))
+			return false;
+	return true;
+}
+
+static void refPutString(std::string & out, const std::string & s)
+{
+	unsigned short lu = lookupToken(s.c_str(), s.size());
+	if (lu >> 8)
+		refPutInt(out, (lu >> 8) + 236 - 1, 1);
+
+	if (lu != 0) {
+		refPutInt(out, lu & 0xFF, 1);
+	} else if (s.find('@') != std::string::npos) {
+		refPutInt(out, 250, 1);
+		refPutString(out, s.substr(0, s.find('@')));
+		refPutString(out, s.substr(s.find('@') + 1));
+	} else if (s.size() <= 254 && (refNibbled(s) || refHexed(s))) {
+		int numn = (s.size()+1)/2;
+		std::string o(numn, 0);
+		for (unsigned i = 0; i < s.size(); i++) {
+			unsigned char c;
+			if (s[i] >= '0' && s[i] <= '9') c = s[i]-'0';
+			else if (s[i] >= 'A' && s[i] <= 'F') c = s[i]-'A'+10;
+			else c = s[i]-'-'+10;
+			o[i/2] |= c << (4-4*(i&1));
+		}
+		if (s.size() % 2 != 0) {
+			numn |= 0x80;
+			o[o.size()-1] |= 0xf;
+		}
+		refPutInt(out, refHexed(s) ? 251 : 255, 1);
+		refPutInt(out, numn, 1);
+		out += o;
+	} else if (s.size() < 256) {
+		refPutInt(out, 252, 1);
+		refPutInt(out, s.size(), 1);
+		out += s;
+	} else {
+		refPutInt(out, 253, 1);
+		refPutInt(out, s.size(), 3);
+		out += s;
+	}
+}
+
+static std::string refWriteTree(const Tree & tree)
+{
+	std::string out;
+	std::map < std::string, std::string > attributes = tree.getAttributes();
+	std::vector < Tree > children = tree.getChildren();
+	std::string data = tree.getData();
+
+	int len = 1 + attributes.size() * 2;
+	if (children.size() != 0)
+		len++;
+	if (data.size() != 0)
+		len++;
+
+	refListSize(out, len);
+	if (tree.getTag() == "start")
+		refPutInt(out, 1, 1);
+	else
+		refPutString(out, tree.getTag());
+	for (auto & at : attributes) {
+		refPutString(out, at.first);
+		refPutString(out, at.second);
+	}
+
+	if (data.size() > 0) {
+		if (data.size() < 256) {
+			refPutInt(out, 0xfc, 1);
+			refPutInt(out, data.size(), 1);
+		} else {
+			refPutInt(out, 0xfd, 1);
+			refPutInt(out, data.size(), 3);
+		}
+		out += data;
+	}
+	if (children.size() > 0) {
+		refListSize(out, children.size());
+		for (auto & c : children)
+			out += refWriteTree(c);
+	}
+	return out;
+}
+
+// Random trees, covering tokens, JIDs, packed and raw strings
+static std::string randomString()
+{
+	static const char *pool[] = {
+		"message", "receipt", "id", "to", "type", "s.whatsapp.net", "g.us",
+		"notification", "participant", "text", "body", "enc", "media",
+		"unknown_tag", "hello world", "",
+	};
+	switch (rand() % 6) {
+	case 0:
+		return pool[rand() % (sizeof(pool) / sizeof(pool[0]))];
+	case 1:
+		return std::to_string(34600000000ULL + rand() % 1000000) + "@s.whatsapp.net";
+	case 2: {
+		std::string s;
+		int n = rand() % 300;
+		for (int i = 0; i < n; i++)
+			s += "0123456789-."[rand() % 12];
+		return s;
+	};
+	case 3: {
+		std::string s;
+		int n = rand() % 20;
+		for (int i = 0; i < n; i++)
+			s += "0123456789ABCDEF"[rand() % 16];
+		return s;
+	};
+	default: {
+		std::string s;
+		int n = (rand() % 8 == 0) ? rand() % 1000 : rand() % 30;
+		for (int i = 0; i < n; i++) {
+			char c = rand() % 256;
+			s += (c == '@') ? 'a' : c;  // A JID with an empty part doesn't round trip
+		}
+		return s;
+	};
+	}
+}
+
+static Tree randomTree(int depth)
+{
+	// The stream start is a bare tag with attributes
+	bool start = (depth == 0 and rand() % 10 == 0);
+	Tree t(start ? "start" : randomString());
+	// Sorted keys, the reference encoder walks them in map order
+	std::map < std::string, std::string > attrs;
+	int nattrs = rand() % 5;
+	for (int i = 0; i < nattrs; i++)
+		attrs[randomString()] = randomString();
+	t.setAttributes(attrs);
+
+	if (depth > 0 and rand() % 2) {
+		// Lists over 255 use a two byte size
+		int nchildren = (depth == 1 and rand() % 10 == 0) ? 300 : rand() % 5;
+		for (int i = 0; i < nchildren; i++)
+			t.addChild(randomTree(depth - 1));
+	}
+	// The format can't carry both children and data
+	if (!start and t.numChildren() == 0 and rand() % 3 == 0)
+		t.setData(randomString());
+	return t;
+}
+
+static std::string encode(const Tree & t)
+{
+	int size = t.encodedSize();
+	std::string out(size, 0);
+	DataWriter w(&out[0], size);
+	t.encode(&w);
+	if (w.size() != 0)
+		return "";
+	return out;
+}
+
+// A template filled with args must encode like the equivalent tree
+static bool checkTemplate(const StanzaShape & shape)
+{
+	const char *tag = shape.tag, *child = shape.child;
+	const std::vector < std::string > & at = shape.attributes;
+	Tree tt(tag);
+	for (unsigned i = 0; i < at.size(); i += 2)
+		tt.setAtr(at[i], at[i+1]);
+	if (child)
+		tt.addChild(Tree(child));
+	StanzaTemplate st(tt);
+
+	for (int r = 0; r < 200; r++) {
+		std::string args[10];
+		for (auto & a : args)
+			a = (rand() % 4) ? randomString() : "";
+
+		Tree t(tag);
+		for (unsigned i = 0; i < at.size(); i += 2) {
+			const std::string & v = at[i+1];
+			if (v[0] != '$')
+				t.setAtr(at[i], v);
+			else if (v.size() == 2 or args[v[1] - '0'].size())
+				t.setAtr(at[i], args[v[1] - '0']);
+		}
+		if (child)
+			t.addChild(Tree(child));
+
+		int size = st.encodedSize(args);
+		std::string out(size, 0);
+		DataWriter w(&out[0], size);
+		st.encode(&w, args);
+		if (w.size() != 0 or out != encode(t))
+			return false;
+	}
+	return true;
+}
+
+int main()
+{
+	WhatsappConnection wc("34600000000", "", "test");
+	srand(1);
+
+	int failed = 0;
+	for (int i = 0; i < 2000; i++) {
+		Tree t = randomTree(3);
+		std::string ref = refWriteTree(t);
+		std::string enc = encode(t);
+		if (enc != ref) {
+			printf("Tree %d: encoding mismatch (%u vs %u bytes)\n", i, (unsigned)enc.size(), (unsigned)ref.size());
+			failed++;
+			continue;
+		}
+
+		Tree back;
+		DataReader r(enc.c_str(), enc.size());
+		if (!wc.read_tree(&r, back) or r.size() != 0 or encode(back) != enc) {
+			printf("Tree %d: round trip mismatch\n", i);
+			failed++;
+			continue;
+		}
+
+		// Lazy read, expanded when encoded, directly or copied to another arena
+		Tree lazy, lazy2, parent("p");
+		DataReader rl(enc.c_str(), enc.size());
+		if (!wc.read_tree(&rl, lazy, true) or rl.size() != 0 or lazy.toString() != back.toString()) {
+			printf("Tree %d: lazy read mismatch\n", i);
+			failed++;
+			continue;
+		}
+		DataReader rl2(enc.c_str(), enc.size());
+		wc.read_tree(&rl2, lazy2, true);
+		parent.addChild(lazy2);
+		if (encode(parent.getChildren()[0]) != enc or encode(lazy2) != enc) {
+			printf("Tree %d: lazy round trip mismatch\n", i);
+			failed++;
+		}
+	}
+
+	// Packed strings with the odd flag and no bytes are empty
+	std::string odd("\xf8\x03\xfc\x01" "x\xfc\x01" "a\xff\x80", 10);
+	for (int lazy = 0; lazy < 2; lazy++) {
+		Tree t;
+		DataReader r(odd.c_str(), odd.size());
+		if (!wc.read_tree(&r, t, lazy) or r.size() != 0 or !t.hasAttribute("a") or t["a"] != "") {
+			printf("Empty packed string misread\n");
+			failed++;
+		}
+	}
+	DataReader rn("\xff\x80", 2), rh("\xfb\x80", 2);
+	if (rn.readString() != "" or rh.readString() != "") {
+		printf("Empty packed string misread\n");
+		failed++;
+	}
+
+	// A repeated key on the wire keeps the last value
+	std::string dup("\xf8\x05\xfc\x01" "x\xfc\x01" "a\xfc\x01" "1\xfc\x01" "a\xfc\x01" "2", 18);
+	for (int lazy = 0; lazy < 2; lazy++) {
+		Tree t;
+		DataReader r(dup.c_str(), dup.size());
+		if (!wc.read_tree(&r, t, lazy) or t["a"] != "2" or encode(t) != encode(Tree("x", makeat({"a", "2"})))) {
+			printf("Repeated attribute misread\n");
+			failed++;
+		}
+	}
+
+	// Copies and children are values: changing one changes nothing else
+	for (int lazy = 0; lazy < 2; lazy++) {
+		Tree orig("p", makeat({"a", "1"})), c("c");
+		c.setData("d");
+		orig.addChild(c);
+		Tree t;
+		std::string enc = encode(orig);
+		DataReader r(enc.c_str(), enc.size());
+		wc.read_tree(&r, t, lazy);
+
+		Tree copy = t;
+		copy.setAtr("a", "2");
+		copy.addChild(Tree("e"));
+		Tree child = t.getChildren()[0];
+		child.setData("x");
+		child.setAtr("b", "3");
+		Tree got;
+		copy.getChild("c", got);
+		got.setTag("f");
+		c.setData("y");
+		if (encode(t) != enc or encode(orig) != enc or copy["a"] != "2" or copy.numChildren() != 2 or copy.hasChild("f") or got.getTag() != "f") {
+			printf("Tree copy changed the original\n");
+			failed++;
+		}
+
+		Tree before = t;
+		t.setAtr("a", "3");
+		t.setChildren({});
+		if (encode(before) != enc or t.numChildren() != 0) {
+			printf("Tree change reached a copy\n");
+			failed++;
+		}
+	}
+
+	// The templates the connection sends, and one with every slot optional
+	for (auto shape : stanzaShapes) {
+		if (!checkTemplate(*shape)) {
+			printf("Template mismatch: %s\n", shape->tag);
+			failed++;
+		}
+	}
+	StanzaShape optional = { "x", {"a", "$0?", "b", "$1?", "c", "$2?", "d", "$3?", "e", "$4?", "f", "$5?", "g", "$6?", "h", "$7?"}, "y" };
+	if (!checkTemplate(optional)) {
+		printf("Template mismatch: %s\n", optional.tag);
+		failed++;
+	}
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed != 0;
+}
+
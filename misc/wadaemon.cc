@@ -0,0 +1,167 @@
+
+/*
+ * Sample daemon for the epoll reactor: logs in the accounts listed in a
+ * config file and prints the messages they receive (deciphered on a
+ * shared worker pool), reconnecting the ones that drop. The Axolotl keys
+ * and sessions of each account are kept in <phone>.db in the working
+ * directory. One account per line, empty lines and lines starting with #
+ * are skipped:
+ *
+ *   phone password [nickname]
+ *
+ * Build: make wadaemon
+ * Usage: wadaemon accounts.conf [server [port]]
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "wa_connection.h"
+#include "wa_constants.h"
+#include "message.h"
+#include "cryptopool.h"
+#include "wa_reactor.h"
+
+#define RECONNECT_DELAY 30
+
+struct Account {
+	std::string phone, password, nick;
+	WhatsappConnection *wc;
+	bool logged;
+};
+
+static WaReactor *reactor;
+static CryptoPool *pool;
+static std::map < WhatsappConnection *, Account * > accounts;
+static std::string server;
+static int port = WHATSAPP_DEFAULT_PORT;
+
+static void quit(int)
+{
+	reactor->stop();
+}
+
+static std::string pickServer()
+{
+	if (server.size())
+		return server;
+	return "e" + std::to_string(rand() % 9 + 1) + ".whatsapp.net";
+}
+
+static void connectAccount(Account * a)
+{
+	a->wc = new WhatsappConnection(a->phone, a->password, a->nick, a->phone + ".db");
+	a->logged = false;
+	a->wc->setCryptoPool(pool);
+	accounts[a->wc] = a;
+	if (!reactor->add(a->wc, pickServer(), port, WHATSAPP_VERSION)) {
+		printf("%s: unable to connect, retrying in %d seconds\n", a->phone.c_str(), RECONNECT_DELAY);
+		accounts.erase(a->wc);
+		delete a->wc;
+		a->wc = NULL;
+		reactor->getTimers().add(time(0) + RECONNECT_DELAY, [a] () { connectAccount(a); });
+	}
+}
+
+static bool processEvents(WhatsappConnection & c)
+{
+	WhatsappConnection *wc = &c;
+	Account *a = accounts.at(wc);
+
+	std::string reason;
+	WhatsappConnection::ErrorCode err = wc->getErrors(reason);
+	if (err != WhatsappConnection::errorNoError) {
+		printf("%s: %s\n", a->phone.c_str(), reason.c_str());
+		if (err == WhatsappConnection::errorAuth)
+			a->password.clear();  // Don't retry
+		return false;
+	}
+
+	if (!a->logged and wc->loginStatus() == 3) {
+		printf("%s: logged in\n", a->phone.c_str());
+		wc->setMyPresence("available", "");
+		a->logged = true;
+	}
+
+	while (Message *m = wc->getReceivedMessage()) {
+		if (m->type() == CHAT_MESSAGE) {
+			ChatMessage *cm = dynamic_cast<ChatMessage*>(m);
+			printf("%s: message from %s: %s\n", a->phone.c_str(), m->from.c_str(), cm->message.c_str());
+		}
+		else
+			printf("%s: message type %d from %s\n", a->phone.c_str(), m->type(), m->from.c_str());
+		delete m;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s accounts.conf [server [port]]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		server = argv[2];
+	if (argc > 3)
+		port = atoi(argv[3]);
+
+	std::vector < Account * > config;
+	std::ifstream conf(argv[1]);
+	std::string line;
+	while (std::getline(conf, line)) {
+		std::istringstream l(line);
+		Account *a = new Account();
+		if (line[0] == '#' or !(l >> a->phone >> a->password)) {
+			delete a;
+			continue;
+		}
+		l >> a->nick;
+		a->wc = NULL;
+		config.push_back(a);
+	}
+	if (config.empty()) {
+		fprintf(stderr, "No accounts in %s\n", argv[1]);
+		return 1;
+	}
+
+	// Shared by all the accounts, destroyed after them
+	CryptoPool p;
+	pool = &p;
+	WaReactor r;
+	reactor = &r;
+	signal(SIGINT, quit);
+	signal(SIGTERM, quit);
+	signal(SIGPIPE, SIG_IGN);
+
+	r.setEventHandler(processEvents);
+	r.setCloseHandler([] (WhatsappConnection & wc, const std::string & reason) {
+		Account *a = accounts.at(&wc);
+		accounts.erase(&wc);
+		printf("%s: disconnected (%s)\n", a->phone.c_str(), reason.c_str());
+		delete a->wc;
+		a->wc = NULL;
+		if (a->password.size())
+			reactor->getTimers().add(time(0) + RECONNECT_DELAY, [a] () { connectAccount(a); });
+	});
+
+	for (auto a : config)
+		connectAccount(a);
+	printf("Running %u connections\n", r.size());
+	r.run();
+
+	for (auto a : config) {
+		if (a->wc)
+			r.remove(a->wc);
+		delete a->wc;
+		delete a;
+	}
+	return 0;
+}
+
@@ -0,0 +1,151 @@
+
+#include <string.h>
+
+#include "outqueue.h"
+
+// Bytes committed ahead of the socket, frames pushed after that can still
+// go before the uncommitted ones
+#define COMMIT_AHEAD (16*1024)
+
+// Bytes per round of each class (control frames don't wait)
+static const int quantum[OUT_PRIORITIES] = { 0, 8*1024, 4*1024, 1024 };
+
+OutputQueue::OutputQueue()
+{
+	for (int i = 0; i < OUT_PRIORITIES; i++)
+		deficit[i] = 0;
+	turn = OutReceipt;
+	head_offset = 0;
+	committed = 0;
+	total = 0;
+}
+
+void OutputQueue::push(DataBuffer && frame, OutPriority prio)
+{
+	if (frame.size() == 0)
+		return;
+	push(std::make_shared < DataBuffer > (std::move(frame)), prio);
+}
+
+void OutputQueue::push(std::shared_ptr < DataBuffer > frame, OutPriority prio)
+{
+	if (frame->size() == 0)
+		return;
+	total += frame->size();
+	classes[prio].push_back(frame);
+}
+
+std::shared_ptr < DataBuffer > OutputQueue::nextFrame()
+{
+	int prio = -1;
+	if (!classes[OutControl].empty()) {
+		prio = OutControl;
+	} else {
+		int busy = 0;
+		for (int i = OutReceipt; i < OUT_PRIORITIES; i++)
+			if (!classes[i].empty())
+				busy++;
+		if (busy == 0)
+			return std::shared_ptr < DataBuffer > ();
+
+		while (prio < 0) {
+			auto & q = classes[turn];
+			if (q.empty()) {
+				deficit[turn] = 0;
+			} else if (busy == 1 or q.front()->size() <= deficit[turn]) {
+				// Alone it doesn't need to wait for its turn
+				deficit[turn] = (busy == 1) ? 0 : deficit[turn] - q.front()->size();
+				prio = turn;
+				break;
+			} else {
+				deficit[turn] += quantum[turn];
+			}
+			turn = (turn + 1 < OUT_PRIORITIES) ? turn + 1 : OutReceipt;
+		}
+	}
+
+	std::shared_ptr < DataBuffer > frame = classes[prio].front();
+	classes[prio].pop_front();
+	return frame;
+}
+
+void OutputQueue::commit(int bytes, int frames)
+{
+	while (committed < bytes and (int)segments.size() < frames) {
+		std::shared_ptr < DataBuffer > frame = nextFrame();
+		if (!frame)
+			break;
+		if (sealer)
+			sealer(*frame);
+		committed += frame->size();
+		segments.push_back(frame);
+	}
+}
+
+void OutputQueue::consume(int size)
+{
+	if (size > committed)
+		throw 0;
+
+	committed -= size;
+	total -= size;
+	while (size > 0) {
+		int left = segments.front()->size() - head_offset;
+		if (size < left) {
+			head_offset += size;
+			break;
+		}
+		size -= left;
+		head_offset = 0;
+		segments.pop_front();
+	}
+}
+
+void OutputQueue::clear()
+{
+	for (int i = 0; i < OUT_PRIORITIES; i++) {
+		classes[i].clear();
+		deficit[i] = 0;
+	}
+	segments.clear();
+	head_offset = 0;
+	committed = 0;
+	total = 0;
+}
+
+int OutputQueue::copyOut(void *data, int len)
+{
+	commit(len < COMMIT_AHEAD ? len : COMMIT_AHEAD, 1 << 30);
+
+	int copied = 0, offset = head_offset;
+	for (auto & seg : segments) {
+		if (copied >= len)
+			break;
+		int chunk = seg->size() - offset;
+		if (chunk > len - copied)
+			chunk = len - copied;
+		memcpy((char *)data + copied, (char *)seg->getPtr() + offset, chunk);
+		copied += chunk;
+		offset = 0;
+	}
+	return copied;
+}
+
+#ifndef _WIN32
+int OutputQueue::getIovec(struct iovec *iov, int iovcnt)
+{
+	commit(COMMIT_AHEAD, iovcnt);
+
+	int n = 0, offset = head_offset;
+	for (auto & seg : segments) {
+		if (n >= iovcnt)
+			break;
+		iov[n].iov_base = (char *)seg->getPtr() + offset;
+		iov[n].iov_len = seg->size() - offset;
+		offset = 0;
+		n++;
+	}
+	return n;
+}
+#endif
+
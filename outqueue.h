@@ -0,0 +1,58 @@
+
+#ifndef __OUTQUEUE__H__
+#define __OUTQUEUE__H__
+
+#include <deque>
+#include <memory>
+#include <functional>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#include "databuffer.h"
+
+// Classes of outgoing frames, in priority order
+enum OutPriority { OutControl, OutReceipt, OutChat, OutBulk, OUT_PRIORITIES };
+
+// Outgoing frames. Frames wait in a FIFO per class and are committed to
+// the wire a few at a time, as the socket asks for data, so a frame
+// pushed later can go ahead of pending bulk data. Control frames go
+// first, the other classes share the link by weight (deficit round robin
+// over bytes). Committing a frame runs the sealer on it (encryption),
+// which sees the frames in wire order. Frames are refcounted segments
+// consumed partially as the socket accepts bytes, never copied.
+class OutputQueue {
+public:
+	typedef std::function < void (DataBuffer & frame) > Sealer;
+private:
+	std::deque < std::shared_ptr < DataBuffer > > classes[OUT_PRIORITIES];
+	int deficit[OUT_PRIORITIES];
+	int turn;		/* Weighted class being served */
+	std::deque < std::shared_ptr < DataBuffer > > segments;	/* Committed */
+	int head_offset;	/* Bytes already sent from the first segment */
+	int committed, total;
+	Sealer sealer;
+
+	std::shared_ptr < DataBuffer > nextFrame();
+	void commit(int bytes, int frames);
+public:
+	OutputQueue();
+
+	void setSealer(Sealer s) { sealer = s; }
+
+	// The sealer modifies the frame, don't push the same one twice
+	void push(DataBuffer && frame, OutPriority prio = OutChat);
+	void push(std::shared_ptr < DataBuffer > frame, OutPriority prio = OutChat);
+	void consume(int size);
+	void clear();
+
+	int size() const { return total; }
+	int copyOut(void *data, int len);
+#ifndef _WIN32
+	int getIovec(struct iovec *iov, int iovcnt);
+#endif
+};
+
+#endif
+
@@ -0,0 +1,133 @@
+
+#include <string.h>
+
+#include "sha1.h"
+
+#define ROL(v, n)  (((v) << (n)) | ((v) >> (32 - (n))))
+
+SHA1Context::SHA1Context()
+{
+	h[0] = 0x67452301;
+	h[1] = 0xEFCDAB89;
+	h[2] = 0x98BADCFE;
+	h[3] = 0x10325476;
+	h[4] = 0xC3D2E1F0;
+	length = 0;
+	used = 0;
+}
+
+void SHA1Context::transform(const unsigned char *data)
+{
+	uint32_t w[80];
+	for (int i = 0; i < 16; i++)
+		w[i] = (data[i*4] << 24) | (data[i*4+1] << 16) | (data[i*4+2] << 8) | data[i*4+3];
+	for (int i = 16; i < 80; i++)
+		w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+	for (int i = 0; i < 80; i++) {
+		uint32_t f, k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		uint32_t t = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+void SHA1Context::update(const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	length += len;
+	if (used) {
+		size_t n = 64 - used < len ? 64 - used : len;
+		memcpy(&block[used], p, n);
+		used += n;
+		p += n;
+		len -= n;
+		if (used < 64)
+			return;
+		transform(block);
+		used = 0;
+	}
+	for (; len >= 64; p += 64, len -= 64)
+		transform(p);
+	memcpy(block, p, len);
+	used = len;
+}
+
+void SHA1Context::final(unsigned char *digest)
+{
+	uint64_t bits = length * 8;
+	unsigned char pad[72] = { 0x80 };
+	size_t padlen = (used < 56) ? 56 - used : 120 - used;
+	for (int i = 0; i < 8; i++)
+		pad[padlen + i] = bits >> (56 - 8*i);
+	update(pad, padlen + 8);
+
+	for (int i = 0; i < 20; i++)
+		digest[i] = h[i/4] >> (24 - 8*(i%4));
+}
+
+HMACSHA1::HMACSHA1()
+{
+}
+
+void HMACSHA1::setKey(const unsigned char *key, int keylen)
+{
+	unsigned char k[64], pad[64];
+	memset(k, 0, sizeof(k));
+	if (keylen > 64) {
+		SHA1Context kh;
+		kh.update(key, keylen);
+		kh.final(k);
+	}
+	else
+		memcpy(k, key, keylen);
+
+	inner = SHA1Context();
+	outer = SHA1Context();
+	for (int i = 0; i < 64; i++)
+		pad[i] = k[i] ^ 0x36;
+	inner.update(pad, 64);
+	for (int i = 0; i < 64; i++)
+		pad[i] = k[i] ^ 0x5c;
+	outer.update(pad, 64);
+}
+
+void HMACSHA1::frameMac(const unsigned char *data, int len, unsigned int seq, unsigned char *out, int outlen) const
+{
+	unsigned char s[4] = { (unsigned char)(seq >> 24), (unsigned char)(seq >> 16),
+	                       (unsigned char)(seq >> 8), (unsigned char)seq };
+	unsigned char digest[20];
+
+	SHA1Context ctx = inner;
+	ctx.update(data, len);
+	ctx.update(s, 4);
+	ctx.final(digest);
+
+	ctx = outer;
+	ctx.update(digest, 20);
+	ctx.final(digest);
+	memcpy(out, digest, outlen);
+}
+
@@ -0,0 +1,37 @@
+
+#ifndef __SHA1__H__
+#define __SHA1__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Incremental SHA-1. The running state can be copied, which lets the HMAC
+// below hash its key pads once and resume from there for every message.
+class SHA1Context {
+public:
+	SHA1Context();
+	void update(const void *data, size_t len);
+	void final(unsigned char *digest);
+
+private:
+	uint32_t h[5];
+	uint64_t length;
+	unsigned char block[64];
+	unsigned int used;
+	void transform(const unsigned char *data);
+};
+
+// HMAC-SHA1 with the inner/outer pad states precomputed for a fixed key
+class HMACSHA1 {
+public:
+	HMACSHA1();
+	void setKey(const unsigned char *key, int keylen);
+	// Frame MAC: HMAC(data || seq as 4 bytes big endian), truncated to outlen
+	void frameMac(const unsigned char *data, int len, unsigned int seq, unsigned char *out, int outlen = 4) const;
+
+private:
+	SHA1Context inner, outer;
+};
+
+#endif
+
@@ -0,0 +1,241 @@
+
+// Typed decoders for the high volume stanzas
+// Generated by misc/gen_stanzas.py from misc/stanzas.txt, do not edit!
+
+#ifndef __STANZAS__H__
+#define __STANZAS__H__
+
+#include "tree.h"
+
+static inline unsigned long long stanzaUInt(const TreeString & s)
+{
+	unsigned long long r = 0;
+	for (unsigned i = 0; i < s.len and s.ptr[i] >= '0' and s.ptr[i] <= '9'; i++)
+		r = r * 10 + (s.ptr[i] - '0');
+	return r;
+}
+
+// <message>
+struct MessageStanza {
+	TreeString from;
+	TreeString id;
+	TreeString type;
+	TreeString participant;
+	unsigned long long t;
+	bool has_from;
+	bool has_id;
+	bool has_type;
+	bool has_participant;
+	bool has_t;
+
+	MessageStanza() : t(0), has_from(false), has_id(false), has_type(false), has_participant(false), has_t(false) {}
+};
+
+static inline void decodeStanza(const Tree & tree, MessageStanza & s)
+{
+	const TreeAttribute *a = tree.getAttributeList();
+	for (unsigned i = 0; i < tree.numAttributes(); i++) {
+		switch (a[i].key_token) {
+		case 63: // from
+			s.from = a[i].value;
+			s.has_from = true;
+			break;
+		case 74: // id
+			s.id = a[i].value;
+			s.has_id = true;
+			break;
+		case 181: // type
+			s.type = a[i].value;
+			s.has_type = true;
+			break;
+		case 119: // participant
+			s.participant = a[i].value;
+			s.has_participant = true;
+			break;
+		case 174: // t
+			s.t = stanzaUInt(a[i].value);
+			s.has_t = true;
+			break;
+		};
+	}
+}
+
+// <receipt>
+struct ReceiptStanza {
+	TreeString from;
+	TreeString to;
+	TreeString id;
+	TreeString type;
+	TreeString participant;
+	unsigned long long t;
+	bool has_from;
+	bool has_to;
+	bool has_id;
+	bool has_type;
+	bool has_participant;
+	bool has_t;
+
+	ReceiptStanza() : t(0), has_from(false), has_to(false), has_id(false), has_type(false), has_participant(false), has_t(false) {}
+};
+
+static inline void decodeStanza(const Tree & tree, ReceiptStanza & s)
+{
+	const TreeAttribute *a = tree.getAttributeList();
+	for (unsigned i = 0; i < tree.numAttributes(); i++) {
+		switch (a[i].key_token) {
+		case 63: // from
+			s.from = a[i].value;
+			s.has_from = true;
+			break;
+		case 179: // to
+			s.to = a[i].value;
+			s.has_to = true;
+			break;
+		case 74: // id
+			s.id = a[i].value;
+			s.has_id = true;
+			break;
+		case 181: // type
+			s.type = a[i].value;
+			s.has_type = true;
+			break;
+		case 119: // participant
+			s.participant = a[i].value;
+			s.has_participant = true;
+			break;
+		case 174: // t
+			s.t = stanzaUInt(a[i].value);
+			s.has_t = true;
+			break;
+		};
+	}
+}
+
+// <ack>
+struct AckStanza {
+	TreeString id;
+	unsigned long long t;
+	bool has_id;
+	bool has_t;
+
+	AckStanza() : t(0), has_id(false), has_t(false) {}
+};
+
+static inline void decodeStanza(const Tree & tree, AckStanza & s)
+{
+	const TreeAttribute *a = tree.getAttributeList();
+	for (unsigned i = 0; i < tree.numAttributes(); i++) {
+		switch (a[i].key_token) {
+		case 74: // id
+			s.id = a[i].value;
+			s.has_id = true;
+			break;
+		case 174: // t
+			s.t = stanzaUInt(a[i].value);
+			s.has_t = true;
+			break;
+		};
+	}
+}
+
+// <presence>
+struct PresenceStanza {
+	TreeString from;
+	TreeString type;
+	TreeString last;
+	bool has_from;
+	bool has_type;
+	bool has_last;
+
+	PresenceStanza() : has_from(false), has_type(false), has_last(false) {}
+};
+
+static inline void decodeStanza(const Tree & tree, PresenceStanza & s)
+{
+	const TreeAttribute *a = tree.getAttributeList();
+	for (unsigned i = 0; i < tree.numAttributes(); i++) {
+		switch (a[i].key_token) {
+		case 63: // from
+			s.from = a[i].value;
+			s.has_from = true;
+			break;
+		case 181: // type
+			s.type = a[i].value;
+			s.has_type = true;
+			break;
+		case 88: // last
+			s.last = a[i].value;
+			s.has_last = true;
+			break;
+		};
+	}
+}
+
+// <chatstate>
+struct ChatstateStanza {
+	TreeString from;
+	bool has_from;
+	bool composing;
+	bool paused;
+
+	ChatstateStanza() : has_from(false), composing(false), paused(false) {}
+};
+
+static inline void decodeStanza(const Tree & tree, ChatstateStanza & s)
+{
+	const TreeAttribute *a = tree.getAttributeList();
+	for (unsigned i = 0; i < tree.numAttributes(); i++) {
+		switch (a[i].key_token) {
+		case 63: // from
+			s.from = a[i].value;
+			s.has_from = true;
+			break;
+		};
+	}
+	for (unsigned i = 0; i < tree.numChildren(); i++) {
+		switch (tree.getChildTagToken(i)) {
+		case 28: // composing
+			s.composing = true;
+			break;
+		case 122: // paused
+			s.paused = true;
+			break;
+		};
+	}
+}
+
+// <notification>
+struct NotificationStanza {
+	TreeString from;
+	TreeString id;
+	TreeString type;
+	bool has_from;
+	bool has_id;
+	bool has_type;
+
+	NotificationStanza() : has_from(false), has_id(false), has_type(false) {}
+};
+
+static inline void decodeStanza(const Tree & tree, NotificationStanza & s)
+{
+	const TreeAttribute *a = tree.getAttributeList();
+	for (unsigned i = 0; i < tree.numAttributes(); i++) {
+		switch (a[i].key_token) {
+		case 63: // from
+			s.from = a[i].value;
+			s.has_from = true;
+			break;
+		case 74: // id
+			s.id = a[i].value;
+			s.has_id = true;
+			break;
+		case 181: // type
+			s.type = a[i].value;
+			s.has_type = true;
+			break;
+		};
+	}
+}
+
+#endif
+
@@ -0,0 +1,89 @@
+
+#include <stddef.h>
+#include <thread>
+
+#include "submitqueue.h"
+
+SubmitQueue::SubmitQueue()
+{
+	stub.next.store(NULL, std::memory_order_relaxed);
+	head.store(&stub, std::memory_order_relaxed);
+	count.store(0, std::memory_order_relaxed);
+	tail = &stub;
+}
+
+SubmitQueue::~SubmitQueue()
+{
+	// Tasks left are dropped without running
+	Node *n;
+	while ((n = pop()) != NULL)
+		delete n;
+}
+
+void SubmitQueue::pushNode(Node * n)
+{
+	n->next.store(NULL, std::memory_order_relaxed);
+	Node *prev = head.exchange(n, std::memory_order_acq_rel);
+	// Between the exchange and this store the list is cut, pop waits
+	prev->next.store(n, std::memory_order_release);
+}
+
+bool SubmitQueue::push(Task task)
+{
+	Node *n = new Node();
+	n->task = std::move(task);
+	bool was_empty = (count.fetch_add(1, std::memory_order_acq_rel) == 0);
+	pushNode(n);
+	return was_empty;
+}
+
+SubmitQueue::Node *SubmitQueue::pop()
+{
+	Node *t = tail;
+	Node *next = t->next.load(std::memory_order_acquire);
+	if (t == &stub) {
+		if (next == NULL)
+			return NULL;
+		tail = next;
+		t = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next) {
+		tail = next;
+		return t;
+	}
+
+	// t is the last node, unless a push is half done
+	if (t != head.load(std::memory_order_acquire))
+		return NULL;
+	pushNode(&stub);
+	next = t->next.load(std::memory_order_acquire);
+	if (next) {
+		tail = next;
+		return t;
+	}
+	return NULL;
+}
+
+int SubmitQueue::drain(int max)
+{
+	int ran = 0;
+	while (ran < max) {
+		Node *n = pop();
+		if (n == NULL) {
+			// Counted but not linked yet: the push is a few instructions
+			// from done, and won't notify since the count isn't zero
+			if (size() == 0)
+				break;
+			std::this_thread::yield();
+			continue;
+		}
+		count.fetch_sub(1, std::memory_order_acq_rel);
+		Task task = std::move(n->task);
+		delete n;
+		task();
+		ran++;
+	}
+	return ran;
+}
+
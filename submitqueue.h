@@ -0,0 +1,44 @@
+
+#ifndef __SUBMITQUEUE__H__
+#define __SUBMITQUEUE__H__
+
+#include <atomic>
+#include <functional>
+
+// Lock-free multi producer, single consumer queue of tasks (intrusive
+// linked list with a stub node, producers only swap the head pointer).
+// Any thread pushes, only the thread owning the consumer end drains.
+class SubmitQueue {
+public:
+	typedef std::function < void () > Task;
+private:
+	struct Node {
+		Task task;
+		std::atomic < Node * > next;
+	};
+	std::atomic < Node * > head;
+	std::atomic < int > count;
+	Node *tail;
+	Node stub;
+
+	SubmitQueue(const SubmitQueue &);
+	SubmitQueue & operator=(const SubmitQueue &);
+
+	void pushNode(Node * n);
+	Node *pop();
+public:
+	SubmitQueue();
+	~SubmitQueue();
+
+	// Any thread, true if the queue was empty before
+	bool push(Task task);
+	// Consumer only, runs up to max tasks in order, returns how many.
+	// Fewer than max means it saw the queue empty, so the next push
+	// returns true.
+	int drain(int max);
+
+	int size() const { return count.load(std::memory_order_relaxed); }
+};
+
+#endif
+
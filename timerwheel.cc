@@ -0,0 +1,181 @@
+
+#include "timerwheel.h"
+
+TimerWheel::TimerWheel(time_t now)
+	: overflow(), expired(), current(now), last_id(0)
+{
+	for (int l = 0; l < LEVELS; l++)
+		for (int i = 0; i < SLOTS; i++)
+			slots[l][i] = Slot();
+}
+
+TimerWheel::~TimerWheel()
+{
+	for (auto & t : timers)
+		delete t.second;
+}
+
+void TimerWheel::insert(Timer * t)
+{
+	time_t d = t->deadline;
+
+	// The lowest level whose current block contains the deadline
+	Slot *slot = &overflow;
+	if (d < current)
+		slot = &expired;
+	else for (int l = 0; l < LEVELS; l++) {
+		int shift = SLOT_BITS * (l + 1);
+		if ((d >> shift) == (current >> shift)) {
+			slot = &slots[l][(d >> (SLOT_BITS * l)) & (SLOTS - 1)];
+			break;
+		}
+	}
+
+	// At the tail, but past due ones go after the last one not later
+	Timer *prev = slot->tail;
+	if (slot == &expired)
+		while (prev and prev->deadline > d)
+			prev = prev->prev;
+
+	t->slot = slot;
+	t->prev = prev;
+	t->next = prev ? prev->next : slot->head;
+	if (t->next)
+		t->next->prev = t;
+	else
+		slot->tail = t;
+	if (prev)
+		prev->next = t;
+	else
+		slot->head = t;
+}
+
+void TimerWheel::unlink(Timer * t)
+{
+	if (t->prev)
+		t->prev->next = t->next;
+	else
+		t->slot->head = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+	else
+		t->slot->tail = t->prev;
+}
+
+void TimerWheel::cascade(Slot * slot)
+{
+	Timer *t = detach(slot).head;
+	while (t) {
+		Timer *next = t->next;
+		insert(t);
+		t = next;
+	}
+}
+
+TimerWheel::TimerId TimerWheel::add(time_t deadline, Callback cb)
+{
+	Timer *t = new Timer();
+	t->id = ++last_id;
+	t->deadline = deadline;
+	t->cb = cb;
+	timers[t->id] = t;
+	insert(t);
+	return t->id;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+	auto it = timers.find(id);
+	if (it == timers.end())
+		return false;
+
+	unlink(it->second);
+	delete it->second;
+	timers.erase(it);
+	return true;
+}
+
+TimerWheel::Slot TimerWheel::detach(Slot * slot)
+{
+	Slot list = *slot;
+	*slot = Slot();
+	return list;
+}
+
+void TimerWheel::run(Slot due)
+{
+	// Callbacks may add or cancel timers, even the ones in this list
+	for (Timer *t = due.head; t; t = t->next)
+		t->slot = &due;
+
+	while (due.head) {
+		Timer *t = due.head;
+		unlink(t);
+		timers.erase(t->id);
+		Callback cb = std::move(t->cb);
+		delete t;
+		cb();
+	}
+}
+
+void TimerWheel::advance(time_t now)
+{
+	run(detach(&expired));
+
+	while (current <= now) {
+		if (timers.empty()) {
+			current = now + 1;
+			break;
+		}
+
+		Slot due = detach(&slots[0][current & (SLOTS - 1)]);
+		current++;
+
+		// Entering a new block, move its timers one level down
+		if ((current & ((1 << (SLOT_BITS * LEVELS)) - 1)) == 0)
+			cascade(&overflow);
+		for (int l = LEVELS - 1; l > 0; l--) {
+			if ((current & ((1 << (SLOT_BITS * l)) - 1)) == 0)
+				cascade(&slots[l][(current >> (SLOT_BITS * l)) & (SLOTS - 1)]);
+		}
+
+		// Timers added by the callbacks for a second already run go
+		// to expired
+		run(due);
+		run(detach(&expired));
+	}
+}
+
+time_t TimerWheel::nextDeadline() const
+{
+	if (timers.empty())
+		return 0;
+
+	if (expired.head)
+		return expired.head->deadline;
+
+	for (int i = current & (SLOTS - 1); i < SLOTS; i++)
+		if (slots[0][i].head)
+			return (current & ~(time_t)(SLOTS - 1)) + i;
+
+	// Upper levels hold several seconds per slot
+	const Timer *first = overflow.head;
+	for (int l = 1; l < LEVELS and first == overflow.head; l++) {
+		for (int i = ((current >> (SLOT_BITS * l)) & (SLOTS - 1)) + 1; i < SLOTS; i++) {
+			if (slots[l][i].head) {
+				first = slots[l][i].head;
+				break;
+			}
+		}
+	}
+
+	if (!first)  // Only the ones running now
+		return current;
+
+	time_t next = first->deadline;
+	for (const Timer *t = first; t; t = t->next)
+		if (t->deadline < next)
+			next = t->deadline;
+	return next;
+}
+
@@ -0,0 +1,63 @@
+
+#ifndef __TIMERWHEEL__H__
+#define __TIMERWHEEL__H__
+
+#include <functional>
+#include <unordered_map>
+#include <time.h>
+
+// Hierarchical timer wheel with one second ticks. Level 0 holds the
+// timers due in the current 64 second block, level 1 and 2 the ones in
+// the current 64^2 and 64^3 second blocks, which are moved down as time
+// enters their block. Adding, cancelling and running a timer are O(1),
+// advancing costs one slot per elapsed second. Slots are FIFO, so timers
+// with the same deadline run in the order they were added.
+class TimerWheel {
+public:
+	typedef std::function < void () > Callback;
+	typedef unsigned long long TimerId;
+private:
+	enum { LEVELS = 3, SLOT_BITS = 6, SLOTS = 1 << SLOT_BITS };
+	struct Timer;
+	struct Slot {
+		Timer *head, *tail;
+	};
+	struct Timer {
+		TimerId id;
+		time_t deadline;
+		Callback cb;
+		Timer *prev, *next;
+		Slot *slot;
+	};
+	Slot slots[LEVELS][SLOTS];
+	// Expired is kept in deadline order
+	Slot overflow, expired;
+	std::unordered_map < TimerId, Timer * > timers;
+	time_t current;     /* First second not run yet */
+	TimerId last_id;
+
+	TimerWheel(const TimerWheel &);
+	TimerWheel & operator=(const TimerWheel &);
+
+	void insert(Timer * t);
+	void unlink(Timer * t);
+	void cascade(Slot * slot);
+	Slot detach(Slot * slot);
+	void run(Slot due);
+public:
+	TimerWheel(time_t now);
+	~TimerWheel();
+
+	// Deadlines already passed run on the next advance call
+	TimerId add(time_t deadline, Callback cb);
+	bool cancel(TimerId id);
+	// Runs the timers due up to now, in deadline order
+	void advance(time_t now);
+	// Earliest deadline, 0 if there are no timers
+	time_t nextDeadline() const;
+
+	unsigned int size() const { return timers.size(); }
+};
+
+#endif
+
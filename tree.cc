@@ -1,98 +1,528 @@
 
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
 #include "tree.h"
 #include "databuffer.h"
 
+struct TreeNode {
+	TreeString tag, data;
+	unsigned short tag_token;
+	unsigned short nattributes, attributes_cap;
+	unsigned int nchildren, children_cap;
+	TreeAttribute *attributes;
+	TreeNode **children;
+	const char *pending;  // Undecoded children or data (lazy read)
+	unsigned int pending_len;
+};
+
+#define ARENA_ALIGN   8
+#define ARENA_MAX_CHUNK  (64*1024)
+
+TreeArena::TreeArena(size_t chunk_size)
+{
+	this->base = this->cur = NULL;
+	this->left = this->base_size = 0;
+	this->chunk_size = chunk_size;
+}
+
+TreeArena::~TreeArena()
+{
+	for (auto c : chunks)
+		free(c);
+	free(base);
+}
+
+void TreeArena::reset()
+{
+	for (auto c : chunks)
+		free(c);
+	chunks.clear();
+	cur = base;
+	left = base_size;
+	if (base_size)
+		chunk_size = base_size * 2;
+}
+
+void *TreeArena::alloc(size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (size > left) {
+		// Big blocks get their own chunk, the current one keeps going
+		if (size > chunk_size / 2) {
+			char *p = (char *)malloc(size);
+			chunks.push_back(p);
+			return p;
+		}
+		size_t csize = std::max(size, chunk_size);
+		cur = (char *)malloc(csize);
+		if (base == NULL) {
+			base = cur;
+			base_size = csize;
+		}
+		else
+			chunks.push_back(cur);
+		left = csize;
+		if (chunk_size < ARENA_MAX_CHUNK)
+			chunk_size *= 2;
+	}
+	void *ret = cur;
+	cur += size;
+	left -= size;
+	return ret;
+}
+
+const char *TreeArena::copy(const char *s, size_t len)
+{
+	char *p = (char *)alloc(len + 1);
+	memcpy(p, s, len);
+	p[len] = 0;
+	return p;
+}
+
+bool TreeString::operator==(const std::string & s) const
+{
+	return (s.size() == len and memcmp(s.data(), ptr, len) == 0);
+}
+
+bool TreeString::operator==(const char *s) const
+{
+	return (strlen(s) == len and memcmp(s, ptr, len) == 0);
+}
+
+static TreeNode *newNode(TreeArena * arena)
+{
+	return new (arena->alloc(sizeof(TreeNode))) TreeNode();
+}
+
+// Deep copy of a node into another arena (token strings are static)
+static TreeNode *copyNode(TreeArena * arena, const TreeNode * src)
+{
+	TreeNode *n = newNode(arena);
+	n->tag_token = src->tag_token;
+	n->tag = src->tag_token ? src->tag : TreeString(arena->copy(src->tag.ptr, src->tag.len), src->tag.len);
+	if (src->data.len)
+		n->data = TreeString(arena->copy(src->data.ptr, src->data.len), src->data.len);
+
+	if (src->nattributes) {
+		n->attributes = (TreeAttribute *)arena->alloc(src->nattributes * sizeof(TreeAttribute));
+		n->nattributes = n->attributes_cap = src->nattributes;
+		for (unsigned i = 0; i < src->nattributes; i++) {
+			const TreeAttribute & a = src->attributes[i];
+			n->attributes[i].key_token = a.key_token;
+			n->attributes[i].key = a.key_token ? a.key : TreeString(arena->copy(a.key.ptr, a.key.len), a.key.len);
+			n->attributes[i].value = TreeString(arena->copy(a.value.ptr, a.value.len), a.value.len);
+		}
+	}
+	if (src->pending) {
+		n->pending = arena->copy(src->pending, src->pending_len);
+		n->pending_len = src->pending_len;
+	}
+	if (src->nchildren) {
+		n->children = (TreeNode **)arena->alloc(src->nchildren * sizeof(TreeNode *));
+		n->nchildren = n->children_cap = src->nchildren;
+		for (unsigned i = 0; i < src->nchildren; i++)
+			n->children[i] = copyNode(arena, src->children[i]);
+	}
+	return n;
+}
+
+// Own copy of a shared node, for the Tree about to change it. Strings are
+// never changed in place and children never in their parent, so they
+// stay shared; only the arrays the setters write to are copied.
+static TreeNode *cloneNode(TreeArena * arena, const TreeNode * src)
+{
+	TreeNode *n = newNode(arena);
+	*n = *src;
+	n->attributes_cap = n->nattributes;
+	n->attributes = NULL;
+	if (src->nattributes) {
+		n->attributes = (TreeAttribute *)arena->alloc(src->nattributes * sizeof(TreeAttribute));
+		memcpy(n->attributes, src->attributes, src->nattributes * sizeof(TreeAttribute));
+	}
+	n->children_cap = n->nchildren;
+	n->children = NULL;
+	if (src->nchildren) {
+		n->children = (TreeNode **)arena->alloc(src->nchildren * sizeof(TreeNode *));
+		memcpy(n->children, src->children, src->nchildren * sizeof(TreeNode *));
+	}
+	return n;
+}
+
+static const TreeAttribute *findAttribute(const TreeNode * n, const std::string & at)
+{
+	if (n == NULL)
+		return NULL;
+	for (unsigned i = 0; i < n->nattributes; i++) {
+		if (n->attributes[i].key == at)
+			return &n->attributes[i];
+	}
+	return NULL;
+}
+
+Tree::Tree(const std::shared_ptr < TreeArena > & arena, TreeNode * node, bool owned)
+	: arena(arena), node(node), owned(owned)
+{
+}
+
+Tree::Tree(const std::shared_ptr < TreeArena > & arena)
+	: arena(arena), node(NULL), owned(false)
+{
+}
+
 Tree::Tree(std::string tag)
+	: node(NULL), owned(false)
 {
-	this->tag = tag;
+	if (tag.size())
+		setTag(tag);
 }
 
 Tree::Tree(std::string tag, std::map < std::string, std::string > attributes)
+	: node(NULL), owned(false)
+{
+	setTag(tag);
+	setAttributes(attributes);
+}
+
+// Copies share the node, neither may change it in place from now on
+Tree::Tree(const Tree & other)
+	: arena(other.arena), node(other.node), owned(false)
+{
+	other.owned = false;
+}
+
+Tree::Tree(Tree && other) noexcept
+	: arena(std::move(other.arena)), node(other.node), owned(other.owned)
+{
+	other.node = NULL;
+	other.owned = false;
+}
+
+Tree & Tree::operator=(const Tree & other)
+{
+	if (this != &other) {
+		arena = other.arena;
+		node = other.node;
+		owned = other.owned = false;
+	}
+	return *this;
+}
+
+Tree & Tree::operator=(Tree && other) noexcept
 {
-	this->tag = tag;
-	this->attributes = attributes;
+	if (this != &other) {
+		arena = std::move(other.arena);
+		node = other.node;
+		owned = other.owned;
+		other.node = NULL;
+		other.owned = false;
+	}
+	return *this;
 }
 
 Tree::~Tree()
 {
 }
 
+// The node to change, our own (copied first if somebody else sees it)
+TreeNode *Tree::getNode()
+{
+	if (arena == nullptr)
+		arena = std::make_shared < TreeArena > ();
+	if (node == NULL) {
+		node = newNode(arena.get());
+		owned = true;
+	}
+	expand();
+	if (!owned) {
+		node = cloneNode(arena.get(), node);
+		owned = true;
+	}
+	return node;
+}
+
+void Tree::expand() const
+{
+	if (node and node->pending) {
+		// Checked when skipped, so this can't throw. Children stay lazy.
+		// Whoever shares the node sees the same content, only decoded.
+		DataReader r(node->pending, node->pending_len, true);
+		node->pending = NULL;
+		Tree(arena, node, true).readContent(&r, true);
+	}
+}
+
+TreeString Tree::copyString(const std::string & s, unsigned short token)
+{
+	if (token)
+		return TreeString(tokenString(token), s.size());
+	return TreeString(getArena()->copy(s.c_str(), s.size()), s.size());
+}
+
+void Tree::appendAttribute(TreeString key, unsigned short key_token, TreeString value)
+{
+	TreeNode *n = getNode();
+	if (n->nattributes == n->attributes_cap) {
+		unsigned cap = n->attributes_cap ? n->attributes_cap * 2 : 4;
+		TreeAttribute *a = (TreeAttribute *)arena->alloc(cap * sizeof(TreeAttribute));
+		if (n->nattributes)
+			memcpy(a, n->attributes, n->nattributes * sizeof(TreeAttribute));
+		n->attributes = a;
+		n->attributes_cap = cap;
+	}
+	TreeAttribute & a = n->attributes[n->nattributes++];
+	a.key = key;
+	a.key_token = key_token;
+	a.value = value;
+}
+
+void Tree::appendChild(TreeNode * child)
+{
+	TreeNode *n = getNode();
+	if (n->nchildren == n->children_cap) {
+		unsigned cap = n->children_cap ? n->children_cap * 2 : 4;
+		TreeNode **c = (TreeNode **)arena->alloc(cap * sizeof(TreeNode *));
+		if (n->nchildren)
+			memcpy(c, n->children, n->nchildren * sizeof(TreeNode *));
+		n->children = c;
+		n->children_cap = cap;
+	}
+	n->children[n->nchildren++] = child;
+}
+
 void Tree::addChild(Tree t)
 {
-	children.push_back(t);
+	getNode();
+	if (t.node == NULL)
+		appendChild(newNode(arena.get()));
+	else if (t.arena == arena)
+		appendChild(t.node);
+	else
+		appendChild(copyNode(arena.get(), t.node));
+}
+
+void Tree::setTag(std::string tag)
+{
+	TreeNode *n = getNode();
+	n->tag_token = lookupToken(tag.c_str(), tag.size());
+	n->tag = copyString(tag, n->tag_token);
+}
+
+void Tree::setAtr(const std::string & at, const std::string & val)
+{
+	TreeAttribute *a = (TreeAttribute *)findAttribute(getNode(), at);
+	TreeString v(arena->copy(val.c_str(), val.size()), val.size());
+	if (a) {
+		a->value = v;
+	} else {
+		unsigned short tok = lookupToken(at.c_str(), at.size());
+		appendAttribute(copyString(at, tok), tok, v);
+	}
 }
 
 void Tree::setAttributes(std::map < std::string, std::string > attributes)
 {
-	this->attributes = attributes;
+	getNode()->nattributes = 0;
+	for (auto & at : attributes)
+		setAtr(at.first, at.second);
+}
+
+void Tree::readTag(DataReader * data)
+{
+	TreeNode *n = getNode();
+	n->tag_token = data->readString(arena.get(), n->tag);
+	// Dictionary words sent as raw strings still get their token
+	if (n->tag_token == 0)
+		n->tag_token = lookupToken(n->tag.ptr, n->tag.len);
 }
 
-void Tree::readAttributes(DataBuffer * data, int size)
+void Tree::readAttributes(DataReader * data, int size)
 {
 	int count = (size - 2 + (size % 2)) / 2;
-	while (count--) {
-		std::string key = data->readString();
-		std::string value = data->readString();
-		attributes[key] = value;
+	TreeNode *n = getNode();
+	if (count > 0 and n->attributes_cap < n->nattributes + count) {
+		TreeAttribute *a = (TreeAttribute *)arena->alloc((n->nattributes + count) * sizeof(TreeAttribute));
+		if (n->nattributes)
+			memcpy(a, n->attributes, n->nattributes * sizeof(TreeAttribute));
+		n->attributes = a;
+		n->attributes_cap = n->nattributes + count;
+	}
+	while (count-- > 0) {
+		TreeString key, value;
+		unsigned short tok = data->readString(arena.get(), key);
+		if (tok == 0)
+			tok = lookupToken(key.ptr, key.len);
+		data->readString(arena.get(), value);
+
+		// A repeated key keeps the last value, as with the attribute map
+		TreeAttribute *a = NULL;
+		for (unsigned i = 0; i < n->nattributes and a == NULL; i++) {
+			TreeAttribute & b = n->attributes[i];
+			if (tok ? b.key_token == tok : (b.key_token == 0 and b.key.len == key.len and memcmp(b.key.ptr, key.ptr, key.len) == 0))
+				a = &b;
+		}
+		if (a)
+			a->value = value;
+		else
+			appendAttribute(key, tok, value);
 	}
 }
 
-void Tree::writeAttributes(DataBuffer * data)
+void Tree::readData(DataReader * data)
 {
-	for (std::map < std::string, std::string >::iterator iter = attributes.begin(); iter != attributes.end(); iter++) {
-		data->putString(iter->first);
-		data->putString(iter->second);
+	TreeNode *n = getNode();
+	data->readString(arena.get(), n->data);
+}
+
+bool Tree::read(DataReader * data, bool lazy)
+{
+	int lsize = data->readListSize();
+	int type = data->getInt(1);
+	if (type == 1) {
+		data->skip(1);
+		setTag("start");
+		readAttributes(data, lsize);
+		return true;
+	} else if (type == 2) {
+		data->skip(1);
+		return false;
+	}
+
+	readTag(data);
+	readAttributes(data, lsize);
+
+	if ((lsize & 1) == 1)
+		return true;
+
+	if (lazy) {
+		const unsigned char *p = data->getPtr();
+		data->skipContent();
+		TreeNode *n = getNode();
+		n->pending_len = data->getPtr() - p;
+		n->pending = data->borrows() ? (const char *)p : arena->copy((const char *)p, n->pending_len);
+	} else {
+		readContent(data, false);
+	}
+	return true;
+}
+
+void Tree::readContent(DataReader * data, bool lazy)
+{
+	if (data->isList()) {
+		/* Children go to the same arena, so adding them is just linking */
+		int size = data->readListSize();
+		while (size--) {
+			Tree child(arena);
+			if (child.read(data, lazy))
+				addChild(child);
+		}
+	} else {
+		readData(data);
 	}
 }
 
 void Tree::setData(const std::string d)
 {
-	data = d;
+	TreeNode *n = getNode();
+	n->data = TreeString(arena->copy(d.c_str(), d.size()), d.size());
 }
 
 void Tree::setChildren(std::vector < Tree > c)
 {
-	children = c;
+	getNode()->nchildren = 0;
+	for (auto & t : c)
+		addChild(t);
+}
+
+std::string Tree::getData() const
+{
+	expand();
+	return node ? node->data.str() : "";
+}
+
+std::string Tree::getTag() const
+{
+	return node ? node->tag.str() : "";
+}
+
+unsigned short Tree::getTagToken() const
+{
+	return node ? node->tag_token : 0;
 }
 
 std::vector < Tree > Tree::getChildren() const
 {
-	return children;
+	std::vector < Tree > ret;
+	expand();
+	if (node) {
+		ret.reserve(node->nchildren);
+		for (unsigned i = 0; i < node->nchildren; i++)
+			ret.push_back(Tree(arena, node->children[i]));
+	}
+	return ret;
+}
+
+unsigned short Tree::getChildTagToken(unsigned int i) const
+{
+	expand();
+	return node ? node->children[i]->tag_token : 0;
+}
+
+const TreeAttribute *Tree::getAttributeList() const
+{
+	return node ? node->attributes : NULL;
 }
 
-std::map < std::string, std::string > &Tree::getAttributes()
+unsigned int Tree::numChildren() const
 {
-	return attributes;
+	expand();
+	return node ? node->nchildren : 0;
+}
+
+std::map < std::string, std::string > Tree::getAttributes() const
+{
+	std::map < std::string, std::string > ret;
+	for (unsigned i = 0; node and i < node->nattributes; i++)
+		ret[node->attributes[i].key.str()] = node->attributes[i].value.str();
+	return ret;
+}
+
+unsigned int Tree::numAttributes() const
+{
+	return node ? node->nattributes : 0;
 }
 
 bool Tree::hasAttributeValue(std::string at, std::string val) const
 {
-	if (hasAttribute(at)) {
-		return (attributes.at(at) == val);
-	}
-	return false;
+	const TreeAttribute *a = findAttribute(node, at);
+	return (a and a->value == val);
 }
 
 bool Tree::hasAttribute(const std::string & at) const
 {
-	return (attributes.find(at) != attributes.end());
+	return (findAttribute(node, at) != NULL);
 }
 
 std::string Tree::getAtr(const std::string & at) const
 {
-	if (hasAttribute(at))
-		return (attributes.at(at));
+	const TreeAttribute *a = findAttribute(node, at);
+	if (a)
+		return a->value.str();
 	return "";
 }
 
 bool Tree::getChild(std::string tag, Tree & t) const
 {
-	for (unsigned int i = 0; i < children.size(); i++) {
-		if (children[i].getTag() == tag) {
-			t = children[i];
+	expand();
+	for (unsigned int i = 0; node and i < node->nchildren; i++) {
+		Tree c(arena, node->children[i]);
+		if (node->children[i]->tag == tag) {
+			t = c;
 			return true;
 		}
-		if (children[i].getChild(tag, t))
+		if (c.getChild(tag, t))
 			return true;
 	}
 	return false;
@@ -100,15 +530,272 @@ bool Tree::getChild(std::string tag, Tree & t) const
 
 bool Tree::hasChild(std::string tag) const
 {
-	for (unsigned int i = 0; i < children.size(); i++) {
-		if (children[i].getTag() == tag)
+	expand();
+	for (unsigned int i = 0; node and i < node->nchildren; i++) {
+		if (node->children[i]->tag == tag)
 			return true;
-		if (children[i].hasChild(tag))
+		if (Tree(arena, node->children[i]).hasChild(tag))
 			return true;
 	}
 	return false;
 }
 
+// Wire encoding. Both passes walk the tree with an explicit stack, so deep
+// or wide trees don't recurse and the output is written just once.
+static const TreeNode empty_node = TreeNode();
+
+static int nodeListSize(const TreeNode * n)
+{
+	int len = 1 + n->nattributes * 2;
+	if (n->nchildren)
+		len++;
+	if (n->data.len)
+		len++;
+	return len;
+}
+
+static bool isStartTag(const TreeNode * n)
+{
+	return (n->tag == "start");
+}
+
+static int nodeSize(const TreeNode * n)
+{
+	int size = DataWriter::listSizeSize(nodeListSize(n));
+	if (isStartTag(n))
+		size += 1;
+	else if (n->tag_token)
+		size += DataWriter::tokenSize(n->tag_token);
+	else
+		size += DataWriter::stringSize(n->tag.ptr, n->tag.len);
+
+	for (unsigned i = 0; i < n->nattributes; i++) {
+		const TreeAttribute & a = n->attributes[i];
+		if (a.key_token)
+			size += DataWriter::tokenSize(a.key_token);
+		else
+			size += DataWriter::stringSize(a.key.ptr, a.key.len);
+		size += DataWriter::stringSize(a.value.ptr, a.value.len);
+	}
+
+	if (n->data.len)
+		size += DataWriter::rawStringSize(n->data.len);
+	if (n->nchildren)
+		size += DataWriter::listSizeSize(n->nchildren);
+	return size;
+}
+
+static void encodeNode(const TreeNode * n, DataWriter * w)
+{
+	w->writeListSize(nodeListSize(n));
+	if (isStartTag(n))
+		w->putInt(1, 1);
+	else if (n->tag_token)
+		w->putToken(n->tag_token);
+	else
+		w->putString(n->tag.ptr, n->tag.len);
+
+	for (unsigned i = 0; i < n->nattributes; i++) {
+		const TreeAttribute & a = n->attributes[i];
+		if (a.key_token)
+			w->putToken(a.key_token);
+		else
+			w->putString(a.key.ptr, a.key.len);
+		w->putString(a.value.ptr, a.value.len);
+	}
+
+	if (n->data.len)
+		w->putRawString(n->data.ptr, n->data.len);
+	if (n->nchildren)
+		w->writeListSize(n->nchildren);
+}
+
+int Tree::encodedSize() const
+{
+	int size = 0;
+	std::vector < const TreeNode * > stack(1, node ? node : &empty_node);
+	while (!stack.empty()) {
+		const TreeNode *n = stack.back();
+		stack.pop_back();
+		if (n->pending)
+			Tree(arena, const_cast < TreeNode * > (n)).expand();
+		size += nodeSize(n);
+		stack.insert(stack.end(), n->children, n->children + n->nchildren);
+	}
+	return size;
+}
+
+void Tree::encode(DataWriter * w) const
+{
+	// Preorder: children are pushed reversed so the first one pops first
+	std::vector < const TreeNode * > stack(1, node ? node : &empty_node);
+	while (!stack.empty()) {
+		const TreeNode *n = stack.back();
+		stack.pop_back();
+		if (n->pending)
+			Tree(arena, const_cast < TreeNode * > (n)).expand();
+		encodeNode(n, w);
+		for (unsigned i = n->nchildren; i > 0; i--)
+			stack.push_back(n->children[i - 1]);
+	}
+}
+
+StanzaTemplate::StanzaTemplate(const Tree & t)
+{
+	const_size = 0;
+	build(t.node ? t.node : &empty_node);
+}
+
+unsigned char *StanzaTemplate::appendBytes(int size, bool constant)
+{
+	unsigned int off = bytes.size();
+	bytes.resize(off + size);
+	if (constant) {
+		const_size += size;
+		if (!ops.empty() and ops.back().kind == OpBytes and ops.back().off + ops.back().len == off)
+			ops.back().len += size;
+		else
+			ops.push_back({OpBytes, 0, 0, off, (unsigned)size, 0});
+	}
+	return (unsigned char *)&bytes[off];
+}
+
+void StanzaTemplate::appendString(const TreeString & s, unsigned short token)
+{
+	int size = token ? DataWriter::tokenSize(token) : DataWriter::stringSize(s.ptr, s.len);
+	DataWriter w(appendBytes(size), size);
+	if (token)
+		w.putToken(token);
+	else
+		w.putString(s.ptr, s.len);
+}
+
+// Slot number for "$N" and "$N?" values, -1 for constants
+static int templateSlot(const TreeString & v, bool & optional)
+{
+	if (v.len < 2 or v.len > 3 or v.ptr[0] != '$' or v.ptr[1] < '0' or v.ptr[1] > '9')
+		return -1;
+	if (v.len == 3 and v.ptr[2] != '?')
+		return -1;
+	optional = (v.len == 3);
+	return v.ptr[1] - '0';
+}
+
+// Templates are a handful of nodes, plain recursion is fine here
+void StanzaTemplate::build(const TreeNode * n)
+{
+	// Optional attributes make the list size depend on the arguments
+	int count = nodeListSize(n);
+	unsigned int mask = 0;
+	for (unsigned i = 0; i < n->nattributes; i++) {
+		bool optional = false;
+		int slot = templateSlot(n->attributes[i].value, optional);
+		if (slot >= 0 and optional) {
+			mask |= (1 << slot);
+			count -= 2;
+		}
+	}
+	if (mask) {
+		ops.push_back({OpListSize, 0, (unsigned short)count, 0, 0, mask});
+	} else {
+		int size = DataWriter::listSizeSize(count);
+		DataWriter(appendBytes(size), size).writeListSize(count);
+	}
+
+	if (isStartTag(n))
+		*appendBytes(1) = 1;
+	else
+		appendString(n->tag, n->tag_token);
+
+	for (unsigned i = 0; i < n->nattributes; i++) {
+		const TreeAttribute & a = n->attributes[i];
+		bool optional = false;
+		int slot = templateSlot(a.value, optional);
+		if (slot < 0) {
+			appendString(a.key, a.key_token);
+			appendString(a.value, 0);
+		} else if (!optional) {
+			appendString(a.key, a.key_token);
+			ops.push_back({OpValue, (unsigned short)slot, 0, 0, 0, 0});
+		} else {
+			// The key is only copied if the attribute is present
+			int size = a.key_token ? DataWriter::tokenSize(a.key_token) : DataWriter::stringSize(a.key.ptr, a.key.len);
+			unsigned int off = bytes.size();
+			DataWriter w(appendBytes(size, false), size);
+			if (a.key_token)
+				w.putToken(a.key_token);
+			else
+				w.putString(a.key.ptr, a.key.len);
+			ops.push_back({OpOptional, (unsigned short)slot, 0, off, (unsigned)size, 0});
+		}
+	}
+
+	if (n->data.len) {
+		int size = DataWriter::rawStringSize(n->data.len);
+		DataWriter(appendBytes(size), size).putRawString(n->data.ptr, n->data.len);
+	}
+	if (n->nchildren) {
+		int size = DataWriter::listSizeSize(n->nchildren);
+		DataWriter(appendBytes(size), size).writeListSize(n->nchildren);
+	}
+	for (unsigned i = 0; i < n->nchildren; i++)
+		build(n->children[i]);
+}
+
+static int optionalCount(unsigned int mask, const std::string * args)
+{
+	int count = 0;
+	for (int i = 0; mask; i++, mask >>= 1)
+		if ((mask & 1) and args[i].size())
+			count++;
+	return count;
+}
+
+int StanzaTemplate::encodedSize(const std::string * args) const
+{
+	int size = const_size;
+	for (auto & op : ops) {
+		switch (op.kind) {
+		case OpValue:
+			size += DataWriter::stringSize(args[op.arg].c_str(), args[op.arg].size());
+			break;
+		case OpOptional:
+			if (args[op.arg].size())
+				size += op.len + DataWriter::stringSize(args[op.arg].c_str(), args[op.arg].size());
+			break;
+		case OpListSize:
+			size += DataWriter::listSizeSize(op.count + 2 * optionalCount(op.mask, args));
+			break;
+		default:
+			break;
+		};
+	}
+	return size;
+}
+
+void StanzaTemplate::encode(DataWriter * w, const std::string * args) const
+{
+	for (auto & op : ops) {
+		switch (op.kind) {
+		case OpBytes:
+			w->putData(&bytes[op.off], op.len);
+			break;
+		case OpValue:
+			w->putString(args[op.arg].c_str(), args[op.arg].size());
+			break;
+		case OpOptional:
+			if (args[op.arg].size()) {
+				w->putData(&bytes[op.off], op.len);
+				w->putString(args[op.arg].c_str(), args[op.arg].size());
+			}
+			break;
+		case OpListSize:
+			w->writeListSize(op.count + 2 * optionalCount(op.mask, args));
+			break;
+		};
+	}
+}
+
 std::string Tree::escapeStrings(std::string s) {
 	std::string ret;
 	for (auto c: s) {
@@ -124,21 +811,20 @@ std::string Tree::escapeStrings(std::string s) {
 	return ret;
 }
 
-std::string Tree::toString(int sp)
+std::string Tree::toString(int sp) const
 {
 	std::string ret;
 	std::string spacing(sp, ' ');
-	ret += spacing + "Tag: " + tag + "\n";
-	for (std::map < std::string, std::string >::iterator iter = attributes.begin(); iter != attributes.end(); iter++) {
-		ret += spacing + "at[" + iter->first + "]=" + iter->second + "\n";
+	ret += spacing + "Tag: " + getTag() + "\n";
+	for (unsigned i = 0; node and i < node->nattributes; i++) {
+		ret += spacing + "at[" + node->attributes[i].key.str() + "]=" + node->attributes[i].value.str() + "\n";
 	}
-	std::string piece = data.substr(0,10) + " ...";
+	std::string piece = getData().substr(0,10) + " ...";
 	ret += spacing + "Data: " + escapeStrings(piece) + "\n";
 
-	for (unsigned int i = 0; i < children.size(); i++) {
-		ret += children[i].toString(sp + 1);
+	for (auto & c : getChildren()) {
+		ret += c.toString(sp + 1);
 	}
 	return ret;
 }
 
-
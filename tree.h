@@ -5,45 +5,145 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
 
-class DataBuffer;
+class DataReader;
+class DataWriter;
 
+// Bump allocator for the nodes and strings of a tree. Nothing is freed
+// individually, the whole arena goes away with the last Tree using it
+// (or is reset for reuse, keeping its first chunk).
+class TreeArena {
+private:
+	std::vector < char * > chunks;
+	char *base, *cur;
+	size_t left, chunk_size, base_size;
+
+	TreeArena(const TreeArena &);
+	TreeArena & operator=(const TreeArena &);
+public:
+	TreeArena(size_t chunk_size = 256);
+	~TreeArena();
+
+	void *alloc(size_t size);
+	const char *copy(const char *s, size_t len);
+	void reset();
+};
+
+// Non-owning string, points to the arena or to the token dictionary
+struct TreeString {
+	const char *ptr;
+	unsigned int len;
+
+	TreeString() : ptr(""), len(0) {}
+	TreeString(const char *p, unsigned int l) : ptr(p), len(l) {}
+	std::string str() const { return std::string(ptr, len); }
+	bool operator==(const std::string & s) const;
+	bool operator==(const char *s) const;
+};
+
+struct TreeAttribute {
+	TreeString key, value;
+	unsigned short key_token;
+};
+
+struct TreeNode;
+
+// Handle to a node in an arena. Tags and attribute keys keep their token
+// (0 if not in the dictionary), attributes are a flat array.
+// Trees are still values: copies and children share the node until one
+// of them is changed, which then gets a node of its own (children stay
+// shared). Adding a child from another arena copies it into ours. A lazy
+// read only decodes tag and attributes, the children or data bytes are
+// kept and decoded on first access.
 class Tree {
+	friend class StanzaTemplate;
 private:
-	std::map < std::string, std::string > attributes;
-	std::vector < Tree > children;
-	std::string tag, data;
+	std::shared_ptr < TreeArena > arena;
+	TreeNode *node;
+	mutable bool owned;   // No other Tree or parent sees node
+
+	Tree(const std::shared_ptr < TreeArena > & arena, TreeNode * node, bool owned = false);
+	TreeNode *getNode();
+	TreeString copyString(const std::string & s, unsigned short token);
+	void appendAttribute(TreeString key, unsigned short key_token, TreeString value);
+	void appendChild(TreeNode * child);
+	void readContent(DataReader * data, bool lazy);
+	void expand() const;
 public:
 	Tree(std::string tag = "");
 	Tree(std::string tag, std::map < std::string, std::string > attributes);
+	explicit Tree(const std::shared_ptr < TreeArena > & arena);
+	Tree(const Tree & other);
+	Tree(Tree && other) noexcept;
+	Tree & operator=(const Tree & other);
+	Tree & operator=(Tree && other) noexcept;
 	~Tree();
 
-	std::string getData() const { return data; }
-	std::string getTag() const { return tag; }
+	const std::shared_ptr < TreeArena > & getArena() const { return arena; }
+
+	std::string getData() const;
+	std::string getTag() const;
+	unsigned short getTagToken() const;
 	std::vector < Tree > getChildren() const;
+	unsigned int numChildren() const;
+	unsigned short getChildTagToken(unsigned int i) const;
+	const TreeAttribute *getAttributeList() const;
 	bool getChild(std::string tag, Tree & t) const;
-	std::map < std::string, std::string > &getAttributes();
+	std::map < std::string, std::string > getAttributes() const;
+	unsigned int numAttributes() const;
 	std::string getAtr(const std::string & at) const;
 	std::string operator[](const std::string & at) const { return getAtr(at); }
-	std::string & operator[](const std::string & at) { return attributes[at]; }
 
-	void setTag(std::string tag) { this->tag = tag; }
+	void setTag(std::string tag);
+	void setAtr(const std::string & at, const std::string & val);
 	void setAttributes(std::map < std::string, std::string > attributes);
 	void setData(const std::string d);
 	void setChildren(std::vector < Tree > c);
 	void addChild(Tree t);
 
-	void readAttributes(DataBuffer * data, int size);
-	void writeAttributes(DataBuffer * data);
+	void readTag(DataReader * data);
+	void readAttributes(DataReader * data, int size);
+	void readData(DataReader * data);
+	bool read(DataReader * data, bool lazy = false);
+
+	int encodedSize() const;
+	void encode(DataWriter * data) const;
 
 	bool hasAttributeValue(std::string at, std::string val) const;
 	bool hasAttribute(const std::string & at) const;
 	bool hasChild(std::string tag) const;
 
-	std::string toString(int sp = 0);
+	std::string toString(int sp = 0) const;
 
 	static std::string escapeStrings(std::string);
 };
 
+// Stanza of fixed shape encoded once, so that sending it is a copy of the
+// constant bytes plus the encoding of a few values. Attribute values "$0"
+// to "$9" are slots filled with the arguments at encoding time, a "$N?"
+// slot drops the whole attribute if its argument is empty.
+class StanzaTemplate {
+private:
+	enum OpKind { OpBytes, OpValue, OpOptional, OpListSize };
+	struct Op {
+		OpKind kind;
+		unsigned short arg, count;
+		unsigned int off, len, mask;
+	};
+	std::string bytes;
+	std::vector < Op > ops;
+	int const_size;
+
+	unsigned char *appendBytes(int size, bool constant = true);
+	void appendString(const TreeString & s, unsigned short token);
+	void build(const TreeNode * n);
+public:
+	StanzaTemplate(const Tree & t);
+
+	int encodedSize(const std::string * args) const;
+	void encode(DataWriter * w, const std::string * args) const;
+};
+
 #endif
 
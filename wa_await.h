@@ -0,0 +1,104 @@
+
+#ifndef __WA_AWAIT__H__
+#define __WA_AWAIT__H__
+
+// Awaitable iq requests for C++20 coroutines. The plugin itself builds
+// as C++11, this header is only for embedders built with coroutines:
+//
+//   WaTask flow(WhatsappConnection & c) {
+//       std::vector < std::string > numbers = {"+34600111222"};
+//       IqReply r = co_await awaitSync(c, numbers);
+//       if (r.ok()) ...
+//   }
+//
+// Build the arguments before the co_await: GCC 12 rejects braced lists
+// inside the expression.
+//
+// Nothing runs in the background: a suspended coroutine is resumed from
+// receiveCallback when the reply arrives, or from hasDataToSend when it
+// times out. Coroutines still waiting when the connection is destroyed
+// are never resumed.
+
+#if __cplusplus < 202002L
+#error "wa_await.h needs C++20"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "wa_connection.h"
+
+struct IqReply {
+	IqStatus status;
+	Tree iq;        // Empty on timeout
+
+	bool ok() const { return status == IqResult; }
+};
+
+// Sends the request through "start" on suspension and resumes the
+// coroutine with the reply
+class IqAwaiter {
+private:
+	std::function < void (IqCallback) > start;
+	IqReply reply;
+public:
+	IqAwaiter(std::function < void (IqCallback) > start) : start(start) {}
+
+	bool await_ready() const { return false; }
+	void await_suspend(std::coroutine_handle <> h) {
+		start([this, h] (IqStatus status, Tree & iq) {
+			reply.status = status;
+			reply.iq = iq;
+			h.resume();
+		});
+	}
+	IqReply await_resume() { return reply; }
+};
+
+// Fire and forget coroutine, runs until its first co_await
+struct WaTask {
+	struct promise_type {
+		WaTask get_return_object() { return WaTask(); }
+		std::suspend_never initial_suspend() { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+// The reply carries the <sync> result (getSyncResult isn't filled)
+inline IqAwaiter awaitSync(WhatsappConnection & c, std::vector < std::string > clist)
+{
+	return IqAwaiter([&c, clist] (IqCallback cb) { c.syncContacts(clist, cb); });
+}
+
+// Keys are stored as usual before the coroutine resumes
+inline IqAwaiter awaitKeys(WhatsappConnection & c, std::string jid)
+{
+	return IqAwaiter([&c, jid] (IqCallback cb) { c.sendGetCipherKeysFromUser(jid, cb); });
+}
+
+// Resumes once the image is uploaded and its message sent, with the
+// upload slot reply (<media> or <duplicate>), or when the request fails
+inline IqAwaiter awaitImageUpload(WhatsappConnection & c, std::string mid, std::string to,
+	int w, int h, unsigned int size, std::string fp)
+{
+	return IqAwaiter([&c, mid, to, w, h, size, fp] (IqCallback cb) {
+		c.sendImage(mid, to, w, h, size, fp.c_str(), cb);
+	});
+}
+
+inline IqAwaiter awaitPreview(WhatsappConnection & c, std::string user)
+{
+	return IqAwaiter([&c, user] (IqCallback cb) { c.queryPreview(user, cb); });
+}
+
+inline IqAwaiter awaitGroups(WhatsappConnection & c)
+{
+	return IqAwaiter([&c] (IqCallback cb) { c.updateGroups(cb); });
+}
+
+#endif
+
@@ -5,23 +5,40 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
+#include <unordered_map>
 #include <memory>
+#include <mutex>
 #include <time.h>
 #include <stdint.h>
 #include "wacommon.h"
 #include "databuffer.h"
+#include "outqueue.h"
+#include "sha1.h"
+#include "dispatcher.h"
+#include "submitqueue.h"
 #include "contacts.h"
 #include "inmemoryaxolotlstore.h"
+#include "loggedaxolotlstore.h"
 #include "axolotl_groups.h"
-//#include "liteaxolotlstore.h"
+#include "liteaxolotlstore.h"
 
 class SessionCipher;
+class CryptoPool;
+class LockedAxolotlStore;
 
 class ChatMessage;
 class ImageMessage;
 class Message;
 class RC4Decoder;
 class Tree;
+class StanzaTemplate;
+struct MessageStanza;
+struct ReceiptStanza;
+struct AckStanza;
+struct PresenceStanza;
+struct ChatstateStanza;
+struct NotificationStanza;
 
 struct t_fileupload {
 	std::string to, from;
@@ -33,6 +50,9 @@ struct t_fileupload {
 	std::string msgid;
 	bool uploading;
 	int totalsize;
+	/* sendImage's callback and the upload slot reply, for when it's done */
+	IqCallback done;
+	Tree slot;
 };
 
 enum ReceptionType { rSent, rDelivered, rRead };
@@ -43,6 +63,9 @@ struct t_message_reception {
 	std::string from;
 };
 
+// Server ack (rSent) and receipts of a sent message
+typedef std::function < void (const std::string & id, ReceptionType type) > DeliveryCallback;
+
 class WhatsappConnection {
 	friend class ChatMessage;
 	friend class ImageMessage;
@@ -60,13 +83,16 @@ private:
 	/* Current dissection classes */
 	RC4Decoder * in, *out;
 	unsigned char session_key[20*4]; // V1.4 update
-	unsigned int frame_seq;
-	DataBuffer inbuffer, outbuffer;
+	unsigned int frame_seq, in_seq;
+	HMACSHA1 out_mac, in_mac;
+	DataBuffer inbuffer;
+	InflateBuffer inflater;
+	std::vector < std::shared_ptr < TreeArena > > arena_pool;
+	OutputQueue outbuffer;
 	DataBuffer sslbuffer, sslbuffer_in;
 	std::string challenge_data, challenge_response;
 	std::string phone, password;
 	SessionStatus conn_status;
-	time_t last_keepalive;
 
 	/* State stuff */
 	unsigned int msgcounter, iqid;
@@ -95,18 +121,79 @@ private:
 
 	/* Contacts & msg */
 	std::map < std::string, Contact > contacts;
-	std::vector < Message * >recv_messages;
-	std::vector < Message * >queue_messages;
+	std::deque < Message * >recv_messages;
+	/* Outgoing messages by id, owned until delivered. The ones waiting to
+	   be (re)sent (retries == 0) are also in queue_messages, in order. */
+	std::unordered_map < std::string, Message * > sent_messages;
+	std::deque < Message * >queue_messages;
+	void queueMessage(Message * msg);
+	void cancelMessage(const std::string & id);
 	std::vector < std::string > user_changes, user_icons, user_typing;
 
 	/* Reception queue */
-	std::vector < t_message_reception > received_messages;
+	std::deque < t_message_reception > received_messages;
+
+	/* Stanza handlers (wa_stanzas.cc and wa_iq.cc) */
+	StanzaDispatcher dispatcher;
+	void registerStanzaHandlers();
+	void registerIqHandlers();
+	void handleChallenge(Tree & tl);
+	void handleSuccess(Tree & tl);
+	void handleFailure(Tree & tl);
+	void handleCall(Tree & tl);
+	void handleMessage(const MessageStanza & s, Tree & tl);
+	void handleReceipt(const ReceiptStanza & s);
+	void handleAck(const AckStanza & s);
+	void handlePresence(const PresenceStanza & s);
+	void handleChatstate(const ChatstateStanza & s);
+	void handleNotification(const NotificationStanza & s);
+	void handleIqPicture(Tree & tl, Tree & t);
+	void handleIqMedia(int rid, Tree & t);
+	void handleIqDuplicate(int rid, Tree & t);
+	void handleIqStatus(Tree & tl, Tree & t);
+	void handleIqGroups(Tree & tl, Tree & t);
+	void handleIqLists(Tree & tl, Tree & t);
+	void handleIqPrivacy(Tree & tl, Tree & t);
+	void handleIqSync(Tree & tl, Tree & t);
+	void handleIqKeys(Tree & tl, Tree & t);
+
+	/* Keepalives, iq timeouts and prekey refills */
+	TimerWheel timers;
+	TimerWheel::TimerId keepalive_timer, prekey_timer;
+	void scheduleKeepalive();
+	void schedulePrekeyRefill();
+
+	/* Receipts for incoming messages, coalesced per chat until the end
+	   of the round (or the batching delay) */
+	std::unordered_map < std::string, std::vector < std::string > > pending_receipts;
+	std::vector < std::string > receipt_order;
+	unsigned int receipt_batch;
+	int receipt_delay;
+	TimerWheel::TimerId receipt_timer;
+	void queueReceipt(const std::string & to, const std::string & id);
+	void flushReceipts(const std::string & to);
+	void flushReceipts();
+
+	/* Requests waiting for a reply */
+	IqTable pending_iqs;
+	void expectIq(const std::string & id, IqCallback cb);
+
+	/* Work submitted from other threads, and messages whose status
+	   somebody wants to know */
+	SubmitQueue submissions;
+	std::function < void () > submit_notify;
+	std::unordered_map < std::string, DeliveryCallback > delivery_callbacks;
+	void drainSubmissions();
+	bool commitStore();
+	void trackDelivery(const std::string & id, DeliveryCallback cb);
+	void notifyDelivery(const std::string & id, ReceptionType type);
 
 	void processIncomingData();
 	void processSSLIncomingData();
-	DataBuffer serialize_tree(Tree * tree, bool crypt = true);
+	void encryptFrame(unsigned char *data, int len, unsigned char *mac);
+	void sealFrame(DataBuffer & frame);
 	DataBuffer write_tree(Tree * tree);
-	bool parse_tree(DataBuffer * data, Tree & t);
+	bool parse_tree(DataReader * data, Tree & t);
 
 	/* Upload */
 	std::vector < t_fileupload > uploadfile_queue;
@@ -131,7 +218,18 @@ private:
 	SessionCipher *getSessionCipher(uint64_t recepient);
 	GroupCipher *getGroupCipher(std::string recepient);
 	void sendMessageRetry(const std::string &from, const std::string &part, const std::string &msgid, unsigned long long t);
-	void sendGetCipherKeysFromUser(std::string jid);
+
+	/* Decryption on a CryptoPool, the results come back through submit */
+	struct CipheredMessage;
+	struct CryptoLink;
+	CryptoPool *crypto_pool;
+	std::shared_ptr<LockedAxolotlStore> crypto_store;
+	std::shared_ptr<CryptoLink> crypto_link;
+	void decipherAsync(std::string from, std::string id, std::string author, unsigned long long time,
+		Tree & enc, std::string mtype, std::string receipt_to);
+	static void decipher(std::shared_ptr<LockedAxolotlStore> store, CipheredMessage & cm);
+	void receiveDeciphered(const CipheredMessage & cm);
+	std::unique_lock<std::mutex> lockRecord(uint64_t key);
 
 	void protobufIncomingMessage(std::string mtype, std::string jid, unsigned long long time,
 		std::string id, std::string author, std::string plaintext, Tree & enc);
@@ -146,10 +244,8 @@ private:
 	void doPong(std::string id, std::string from);
 	void subscribePresence(std::string user);
 	void getLast(std::string user);
-	void queryPreview(std::string user);
 	void queryFullSize(std::string user);
 	void gotTyping(std::string who, std::string tstat);
-	void updateGroups();
 	void updateBlists();
 	void queryStatuses();
 
@@ -158,6 +254,7 @@ private:
 	void sendInitial();
 	void notifyError(ErrorCode err, const std::string & reason);
 	DataBuffer generateResponse(std::string from, std::string type, std::string id);
+	DataBuffer generateAck(std::string id, std::string type, std::string to, std::string from, std::string participant);
 	std::string generateUploadPOST(t_fileupload * fu);
 	void processUploadQueue();
 
@@ -167,8 +264,12 @@ private:
 	std::string tohex(uint64_t);
 
 public:
-	bool read_tree(DataBuffer * data, Tree & tt);
+	bool read_tree(DataReader * data, Tree & t, bool lazy = false);
+	DataBuffer serialize_tree(Tree * tree, bool crypt = true);
+	DataBuffer serialize_template(const StanzaTemplate & st, const std::string * args, bool crypt = true);
 
+	/* The Axolotl store is a SQLite database at axolotldb, or an append
+	 * only log if the name ends in .log (in memory if empty) */
 	WhatsappConnection(std::string phone, std::string password, std::string nick, std::string axolotldb = "");
 	~WhatsappConnection();
 
@@ -176,11 +277,50 @@ public:
 
 	std::string getPhone() const { return phone; }
 
+	/* Extra handlers can be registered here, and per handler stats read */
+	StanzaDispatcher & getDispatcher() { return dispatcher; }
+
+	/* Thread safe. The work runs in the thread running the connection
+	   the next time it pumps (receiveCallback or hasDataToSend), and so
+	   do the callbacks. The notify function (set before other threads
+	   submit) is called by the submitter when the queue was empty, to
+	   wake that thread up. */
+	void submit(std::function < void (WhatsappConnection &) > work);
+	void submitChat(std::string msgid, std::string to, std::string message, DeliveryCallback cb = DeliveryCallback());
+	void submitGroupChat(std::string msgid, std::string to, std::string message, DeliveryCallback cb = DeliveryCallback());
+	void submitImage(std::string mid, std::string to, int w, int h, unsigned int size, std::string fp, IqCallback cb = IqCallback());
+	void setSubmitNotify(std::function < void () > notify) { submit_notify = notify; }
+
+	/* Deciphers incoming messages on the pool's workers rather than
+	   inline, the messages and receipts follow once they're done (with
+	   the submit notify). Set it before login, the pool has to outlive
+	   the connection. */
+	void setCryptoPool(CryptoPool * pool);
+
+	/* Message receipts to the same chat go out as one stanza, up to
+	   max_ids each. They are sent at the end of every input round, or
+	   delay seconds after the first one if delay > 0. 1 sends them one
+	   by one. */
+	void setReceiptBatching(unsigned int max_ids, int delay = 0);
+
+	/* Requests completed through the callback, with the reply iq (or on
+	   error or timeout). Without one the reply is handled internally. */
+	void queryPreview(std::string user, IqCallback cb = IqCallback());
+	void updateGroups(IqCallback cb = IqCallback());
+	void sendGetCipherKeysFromUser(std::string jid, IqCallback cb = IqCallback());
+
 	void doLogin(std::string, bool);
 	void receiveCallback(const char *data, int len);
 	int sendCallback(char *data, int len);
+#ifndef _WIN32
+	int sendCallback(struct iovec *iov, int iovcnt);
+#endif
 	void sentCallback(int len);
 	bool hasDataToSend();
+	/* When the timers need to run next (0 if never), hasDataToSend or
+	   runTimers run them */
+	time_t getNextDeadline() const { return timers.nextDeadline(); }
+	void runTimers();
 
 	ErrorCode getErrors(std::string & reason);
 
@@ -194,7 +334,7 @@ public:
 	std::string getMessageId();
 	void addContacts(std::vector < std::string > clist);
 	void contactsUpdate();
-	std::string syncContacts(std::vector < std::string > clist);
+	std::string syncContacts(std::vector < std::string > clist, IqCallback cb = IqCallback());
 	bool getSyncResult(std::string, std::vector<std::string>&);
 
 	void sendChat(std::string msgid, std::string to, std::string message);
@@ -226,7 +366,9 @@ public:
 	{
 		return ((int)conn_status) - 1;
 	}
-	int sendImage(std::string mid, std::string to, int w, int h, unsigned int size, const char *fp);
+	/* The callback runs once the image is uploaded and its message sent,
+	   or as soon as the upload request fails */
+	int sendImage(std::string mid, std::string to, int w, int h, unsigned int size, const char *fp, IqCallback cb = IqCallback());
 	void sendVCard(const std::string msgid, const std::string to, const std::string name, const std::string vcard);
 
 	int sendSSLCallback(char *buffer, int maxbytes);
@@ -0,0 +1,240 @@
+
+/*
+ * Handlers for iq stanzas, dispatched by the tag of their children and
+ * by their xmlns.
+ */
+
+#include "databuffer.h"
+#include "tree.h"
+#include "contacts.h"
+#include "message.h"
+#include "wa_connection.h"
+#include "wa_util.h"
+#include "wacommon.h"
+
+#include "sessioncipher.h"
+#include "whisperexception.h"
+
+std::string utf8_decode(std::string in);
+
+static uint64_t num2int64(std::string s) {
+	uint64_t ret = 0;
+	for (auto c: s) {
+		ret = ret << 8;
+		ret |= (unsigned char)c;
+	}
+	return ret;
+}
+
+void WhatsappConnection::registerIqHandlers()
+{
+	/* Children handlers first, then the callback of the request if any */
+	dispatcher.addTagHandler("iq", [this] (Tree & iq, Tree &) {
+		dispatcher.dispatchIq(iq);
+		pending_iqs.complete(iq);
+	});
+
+	/* Replies to our queries (iq type="result" from someone) */
+	typedef void (WhatsappConnection::*IqHandler)(Tree &, Tree &);
+	auto result = [this] (IqHandler h) {
+		return [this, h] (Tree & iq, Tree & t) {
+			if (iq.hasAttributeValue("type", "result") and iq.hasAttribute("from"))
+				(this->*h)(iq, t);
+		};
+	};
+	dispatcher.addIqHandler("picture", result(&WhatsappConnection::handleIqPicture));
+	dispatcher.addIqHandler("group", result(&WhatsappConnection::handleIqPicture));
+	dispatcher.addIqHandler("status", result(&WhatsappConnection::handleIqStatus));
+	dispatcher.addIqHandler("groups", result(&WhatsappConnection::handleIqGroups));
+	dispatcher.addIqHandler("lists", result(&WhatsappConnection::handleIqLists));
+	dispatcher.addIqHandler("privacy", result(&WhatsappConnection::handleIqPrivacy));
+	dispatcher.addIqHandler("list", result(&WhatsappConnection::handleIqKeys));
+
+	dispatcher.addXmlnsHandler("urn:xmpp:ping", [this] (Tree & iq, Tree &) {
+		if (iq.hasAttribute("from") and iq.hasAttribute("id"))
+			this->doPong(iq["id"], iq["from"]);
+	});
+}
+
+// Picture of a contact or group
+void WhatsappConnection::handleIqPicture(Tree & tl, Tree & t)
+{
+	if (t.hasAttributeValue("type", "preview"))
+		this->addPreviewPicture(tl["from"], t.getData());
+	if (t.hasAttributeValue("type", "image"))
+		this->addFullsizePicture(tl["from"], t.getData());
+}
+
+// Replies to sendImage, media and sync replies are routed by iq id
+void WhatsappConnection::handleIqMedia(int rid, Tree & t)
+{
+	for (unsigned int j = 0; j < uploadfile_queue.size(); j++) {
+		if (uploadfile_queue[j].rid == rid) {
+			/* Queue to upload the file */
+			uploadfile_queue[j].uploadurl = t["url"];
+			uploadfile_queue[j].ip = t["ip"];
+			std::string host = uploadfile_queue[j].uploadurl.substr(8);	/* Remove https:// */
+			for (unsigned int i = 0; i < host.size(); i++)
+				if (host[i] == '/')
+					host = host.substr(0, i);
+			uploadfile_queue[j].host = host;
+
+			this->processUploadQueue();
+			break;
+		}
+	}
+}
+
+void WhatsappConnection::handleIqDuplicate(int rid, Tree & t)
+{
+	for (unsigned int j = 0; j < uploadfile_queue.size(); j++) {
+		if (uploadfile_queue[j].rid == rid) {
+			/* Generate a fake JSON and process directly */
+			std::string json = "{\"name\":\"" + uploadfile_queue[j].file + "\"," "\"url\":\"" + t["url"] + "\"," "\"size\":\"" + t["size"] + "\"," "\"mimetype\":\"" + t["mimetype"] + "\"," "\"filehash\":\"" + t["filehash"] + "\"," "\"type\":\"" + t["type"] + "\"," "\"width\":\"" + t["width"] + "\"," "\"height\":\"" + t["height"] + "\"}";
+
+			uploadfile_queue[j].uploading = true;
+			this->updateFileUpload(json);
+			break;
+		}
+	}
+}
+
+// Status result
+void WhatsappConnection::handleIqStatus(Tree & tl, Tree & t)
+{
+	std::vector < Tree > childs = t.getChildren();
+	for (unsigned int j = 0; j < childs.size(); j++) {
+		if (childs[j].getTag() == "user") {
+			std::string user = getusername(childs[j]["jid"]);
+			contacts[user].status = utf8_decode(childs[j].getData());
+		}
+	}
+}
+
+void WhatsappConnection::handleIqGroups(Tree & tl, Tree & t)
+{
+	std::vector < Tree > cgroups = t.getChildren();
+	for (auto & g : cgroups) {
+		if (g.getTag() != "group") continue;
+		bool rep = groups.find(getusername(g["id"])) != groups.end();
+		if (not rep) {
+			unsigned long long subjt = 0, creat = 0;
+			if (g.hasAttribute("s_t"))
+				subjt = std::stoull(g["s_t"]);
+			if (g.hasAttribute("creation"))
+				creat = std::stoull(g["creation"]);
+
+			Group ng(
+				getusername(g["id"]), g["subject"], subjt, 
+				getusername(g["s_o"]),
+				getusername(g["creator"]), creat
+			);
+			for (auto & pa: g.getChildren()) {
+				if (pa.getTag() != "participant") continue;
+				ng.participants.push_back(
+					Group::Participant(getusername(pa["jid"]), pa["type"])
+				);
+			}
+
+			groups.insert(	
+				std::pair < std::string, Group > (
+					getusername(g["id"]),
+					ng
+				)
+			);
+		}
+	}
+	groups_updated = true;
+}
+
+void WhatsappConnection::handleIqLists(Tree & tl, Tree & t)
+{
+	// For every blist, add it to the blist vector
+	std::vector < Tree > clists = t.getChildren();
+	for (unsigned int k = 0; k < clists.size(); k++) {
+		if (clists[k].hasAttribute("id")) {
+			BList bl(clists[k]["id"], clists[k]["name"]);
+			std::vector < Tree > parts = clists[k].getChildren();
+			for (unsigned int l = 0; l < parts.size(); l++) {
+				if (parts[l].getTag() == "recipient" && parts[l]["jid"] != "")
+					bl.dests.push_back(parts[l]["jid"]);
+			}
+		}
+	}
+	blists_updated = true;
+}
+
+void WhatsappConnection::handleIqPrivacy(Tree & tl, Tree & t)
+{
+	for (auto & ct : t.getChildren()) {
+		if (ct.hasAttributeValue("name","last"))
+			this->show_last_seen = ct["value"];
+		if (ct.hasAttributeValue("name","status"))
+			this->show_status_msg = ct["value"];
+		if (ct.hasAttributeValue("name","profile"))
+			this->show_profile_pic = ct["value"];
+	}
+}
+
+void WhatsappConnection::handleIqSync(Tree & tl, Tree & t)
+{
+	std::vector <std::string> ct_in, ct_out, ct_invalid;
+	for (auto & tt: t.getChildren()) {
+		for (auto & user: tt.getChildren()) {
+			if (user.getTag() != "user") continue;
+			if (tt.getTag() == "in")
+				ct_in.push_back(getusername(user["jid"]));
+			if (tt.getTag() == "out")
+				ct_out.push_back(getusername(user["jid"]));
+			if (tt.getTag() == "invalid")
+				ct_invalid.push_back(getusername(user["jid"]));
+		}
+	}
+	sync_result[tl["id"]] = ct_in;
+}
+
+// Prekey bundles of other users
+void WhatsappConnection::handleIqKeys(Tree & tl, Tree & t)
+{
+	for (auto & tt: t.getChildren()) {
+		if (tt.getTag() == "user") {
+			// Read subchild
+			Tree tident, treg, tskey, tkey;
+			if (tt.getChild("identity", tident) and tt.getChild("registration", treg) and 
+				tt.getChild("skey", tskey) and tt.getChild("skey", tkey)) {
+
+				IdentityKey identityKey(DjbECPublicKey(tident.getData()));
+				uint64_t registrationId = num2int64(treg.getData());
+
+				Tree tid, tvalue, tsig;
+
+				tkey.getChild("id", tid);
+				tkey.getChild("value", tvalue);
+				uint64_t preKeyId = num2int64(tid.getData());
+				DjbECPublicKey preKeyPublic(tvalue.getData());
+
+				tskey.getChild("id", tid);
+				tskey.getChild("value", tvalue);
+				tskey.getChild("signature", tsig);
+				uint64_t skeyId = num2int64(tid.getData());
+				DjbECPublicKey signedKey(tvalue.getData());
+				std::string signedSignature = tsig.getData();
+
+				PreKeyBundle bundle(registrationId, 1, preKeyId, preKeyPublic, skeyId, signedKey, signedSignature, identityKey);
+				uint64_t recepientId = JidAsInt(tt["jid"]);
+				SessionBuilder *sessionBuilder = new SessionBuilder(axolotlStore, recepientId, 1);
+
+				try {
+					std::unique_lock<std::mutex> l = lockRecord(recepientId);
+					sessionBuilder->process(bundle);
+				}
+				catch (WhisperException &e) {
+					DEBUG_PRINT("Axolotl exception (parse user key list iq reply): "
+						<< e.errorType() << " " << e.errorMessage());
+				}
+
+			}
+		}
+	}
+}
+
@@ -73,6 +73,7 @@ extern "C" {
 }
 #else
 #include <unistd.h>
+#include <sys/uio.h>
 #define sys_read  read
 #define sys_write write
 #define sys_close close
@@ -102,7 +103,8 @@ typedef struct {
 	PurpleAccount *account;
 	int fd;			/* File descriptor of the socket */
 	guint rh, wh;		/* Read/write handlers */
-	guint timer;        /* Keep alive timer */
+	guint timer;        /* Timer for the next protocol deadline */
+	time_t timer_deadline;
 	int connected;		/* Connection status */
 	WhatsappConnection *waAPI;		/* Pointer to the C++ class which actually implements the protocol */
 	int conv_id;		/* Combo id counter */
@@ -113,6 +115,7 @@ typedef struct {
 } whatsapp_connection;
 
 static void waprpl_check_output(PurpleConnection * gc);
+static void waprpl_schedule_timer(PurpleConnection * gc);
 static void waprpl_process_incoming_events(PurpleConnection * gc);
 static void waprpl_insert_contacts(PurpleConnection * gc);
 static void waprpl_chat_join(PurpleConnection * gc, GHashTable * data);
@@ -714,14 +717,24 @@ static void waprpl_output_cb(gpointer data, gint source, PurpleInputCondition co
 	PurpleConnection *gc = (PurpleConnection*)data;
 	whatsapp_connection *wconn = (whatsapp_connection*)purple_connection_get_protocol_data(gc);
 
-	char tempbuff[16*1024];
 	int ret;
 	do {
+#ifdef _WIN32
+		char tempbuff[16*1024];
 		int datatosend = wconn->waAPI->sendCallback(tempbuff, sizeof(tempbuff));
 		if (datatosend == 0)
 			break;
 
 		ret = sys_write(wconn->fd, tempbuff, datatosend);
+#else
+		/* Write the queued frames straight from the output queue */
+		struct iovec iov[64];
+		int iovcnt = wconn->waAPI->sendCallback(iov, 64);
+		if (iovcnt == 0)
+			break;
+
+		ret = writev(wconn->fd, iov, iovcnt);
+#endif
 
 		if (ret > 0) {
 			wconn->waAPI->sentCallback(ret);
@@ -788,13 +801,36 @@ static void waprpl_check_output(PurpleConnection * gc)
 	check_ssl_requests(purple_connection_get_account(gc));
 	
 	waprpl_check_complete_uploads(gc);
+
+	waprpl_schedule_timer(gc);
 }
 
 static gboolean wa_timer_cb(gpointer data) {
 	PurpleConnection * gc = (PurpleConnection*)data;
-	waprpl_check_output(gc);
+	whatsapp_connection *wconn = (whatsapp_connection*)purple_connection_get_protocol_data(gc);
+	wconn->timer = 0;
+	waprpl_check_output(gc);	/* Runs the timers and schedules the next one */
 
-	return TRUE;
+	return FALSE;
+}
+
+/* Sleeps until the next protocol deadline (keepalive, timeout, prekey refill) */
+static void waprpl_schedule_timer(PurpleConnection * gc)
+{
+	whatsapp_connection *wconn = (whatsapp_connection*)purple_connection_get_protocol_data(gc);
+	time_t next = wconn->waAPI->getNextDeadline();
+	if (wconn->timer && next == wconn->timer_deadline)
+		return;
+
+	if (wconn->timer)
+		purple_timeout_remove(wconn->timer);
+	wconn->timer = 0;
+	wconn->timer_deadline = next;
+
+	if (next) {
+		time_t now = time(NULL);
+		wconn->timer = purple_timeout_add_seconds(next > now ? next - now : 0, wa_timer_cb, gc);
+	}
 }
 
 static void waprpl_connect_cb(gpointer data, gint source, const gchar * error_message)
@@ -814,7 +850,6 @@ static void waprpl_connect_cb(gpointer data, gint source, const gchar * error_me
 		wconn->fd = source;
 		wconn->waAPI->doLogin(resource, send_ciphered);
 		wconn->rh = purple_input_add(wconn->fd, PURPLE_INPUT_READ, waprpl_input_cb, gc);
-		wconn->timer = purple_timeout_add_seconds(20, wa_timer_cb, gc);
 
 		waprpl_check_output(gc);
 	}
@@ -835,6 +870,7 @@ static void waprpl_login(PurpleAccount * acct)
 	wconn->rh = 0;
 	wconn->wh = 0;
 	wconn->timer = 0;
+	wconn->timer_deadline = 0;
 	wconn->connected = 0;
 	wconn->conv_id = 1;
 	wconn->gsc = 0;
@@ -845,7 +881,16 @@ static void waprpl_login(PurpleAccount * acct)
 	const char *password = purple_account_get_password(acct);
 	const char *nickname = purple_account_get_string(acct, "nick", "");
 
-	wconn->waAPI = new WhatsappConnection(username, password, nickname);
+	/* Axolotl keys and sessions are kept in ~/.purple/whatsapp/<phone>.db */
+	char *dbdir = g_build_filename(purple_user_dir(), "whatsapp", NULL);
+	purple_build_dir(dbdir, 0700);
+	char *dbname = g_strdup_printf("%s.db", username);
+	char *dbfile = g_build_filename(dbdir, dbname, NULL);
+
+	wconn->waAPI = new WhatsappConnection(username, password, nickname, dbfile);
+	g_free(dbfile);
+	g_free(dbname);
+	g_free(dbdir);
 	purple_connection_set_protocol_data(gc, wconn);
 
 	const char *hostname = purple_account_get_string(acct, "server", "");
@@ -0,0 +1,299 @@
+
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "wa_reactor.h"
+#include "wa_connection.h"
+
+#define MAX_EVENTS  256
+#define MAX_IOVEC    64
+
+WaReactor::WaReactor()
+	: timers(time(0)), running(false)
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		throw std::runtime_error(std::string("Can't create the epoll instance: ") + strerror(errno));
+	wakefd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakefd < 0) {
+		int err = errno;
+		::close(epfd);
+		throw std::runtime_error(std::string("Can't create the wakeup eventfd: ") + strerror(err));
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+}
+
+WaReactor::~WaReactor()
+{
+	for (auto & c : conns) {
+		::close(c.second->fd);
+		delete c.second;
+	}
+	for (auto c : closed)
+		delete c;
+	::close(wakefd);
+	::close(epfd);
+}
+
+bool WaReactor::add(WhatsappConnection * wc, const std::string & host, int port,
+	const std::string & resource, bool send_ciphered)
+{
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0)
+		return false;
+
+	int fd = -1;
+	bool connected = false;
+	for (struct addrinfo *ai = res; ai and fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			connected = true;
+		else if (errno != EINPROGRESS) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	if (fd < 0)
+		return false;
+
+	Conn *c = new Conn();
+	c->wc = wc;
+	c->fd = fd;
+	c->connected = false;
+	c->writing = true;  // Connect completion
+	c->resource = resource;
+	c->send_ciphered = send_ciphered;
+	c->wakeup = 0;
+	c->wakeup_timer = 0;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT;
+	ev.data.ptr = c;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		::close(fd);
+		delete c;
+		return false;
+	}
+	conns[wc] = c;
+
+	// Submitting threads queue a pump for this connection, the first one
+	// after a drain wakes the loop up
+	wc->setSubmitNotify([this, wc] () {
+		bool wake = wakeups.push([this, wc] () {
+			auto it = conns.find(wc);
+			if (it != conns.end())
+				pump(it->second);
+		});
+		if (wake) {
+			uint64_t one = 1;
+			if (write(wakefd, &one, sizeof(one)) < 0) {}
+		}
+	});
+
+	if (connected)
+		handle(c, EPOLLOUT);
+	return true;
+}
+
+void WaReactor::remove(WhatsappConnection * wc)
+{
+	auto it = conns.find(wc);
+	if (it != conns.end())
+		drop(it->second);
+}
+
+void WaReactor::drop(Conn * c)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	::close(c->fd);
+	c->fd = -1;
+	if (c->wakeup_timer)
+		timers.cancel(c->wakeup_timer);
+	conns.erase(c->wc);
+
+	// Events for it may still be pending in this round
+	closed.push_back(c);
+}
+
+void WaReactor::close(Conn * c, const std::string & reason)
+{
+	WhatsappConnection *wc = c->wc;
+	drop(c);
+	if (on_close)
+		on_close(*wc, reason);
+}
+
+void WaReactor::handle(Conn * c, unsigned int events)
+{
+	if (!c->connected) {
+		if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+			return;
+
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		if (err) {
+			close(c, std::string("Unable to connect: ") + strerror(err));
+			return;
+		}
+		c->connected = true;
+		c->wc->doLogin(c->resource, c->send_ciphered);
+	}
+	else if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+		std::string reason;
+		if (!readAll(c, reason)) {
+			close(c, reason);
+			return;
+		}
+	}
+
+	pump(c);
+}
+
+void WaReactor::pump(Conn * c)
+{
+	if (!c->connected)
+		return;
+
+	// Runs the due timers and the submissions before the handler looks
+	c->wc->hasDataToSend();
+	if (on_event and !on_event(*c->wc)) {
+		close(c, "Closed by the event handler");
+		return;
+	}
+
+	std::string reason;
+	if (!writeAll(c, reason)) {
+		close(c, reason);
+		return;
+	}
+	schedule(c);
+}
+
+bool WaReactor::readAll(Conn * c, std::string & reason)
+{
+	char buffer[16*1024];
+	while (1) {
+		int ret = read(c->fd, buffer, sizeof(buffer));
+		if (ret > 0)
+			c->wc->receiveCallback(buffer, ret);
+		else if (ret == 0) {
+			reason = "Server closed the connection";
+			return false;
+		}
+		else if (errno == EAGAIN or errno == EWOULDBLOCK)
+			return true;
+		else if (errno != EINTR) {
+			reason = std::string("Lost connection with server (in): ") + strerror(errno);
+			return false;
+		}
+	}
+}
+
+bool WaReactor::writeAll(Conn * c, std::string & reason)
+{
+	while (c->wc->hasDataToSend()) {
+		struct iovec iov[MAX_IOVEC];
+		int iovcnt = c->wc->sendCallback(iov, MAX_IOVEC);
+		if (iovcnt == 0)
+			break;
+
+		int ret = writev(c->fd, iov, iovcnt);
+		if (ret > 0)
+			c->wc->sentCallback(ret);
+		else if (ret < 0 and (errno == EAGAIN or errno == EWOULDBLOCK))
+			break;
+		else if (ret < 0 and errno != EINTR) {
+			reason = std::string("Lost connection with server (out): ") + strerror(errno);
+			return false;
+		}
+	}
+
+	// Only watch for output while there is something to write
+	bool writing = c->wc->hasDataToSend();
+	if (writing != c->writing) {
+		struct epoll_event ev;
+		ev.events = writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+		c->writing = writing;
+	}
+	return true;
+}
+
+void WaReactor::schedule(Conn * c)
+{
+	time_t deadline = c->wc->getNextDeadline();
+	if (deadline == c->wakeup)
+		return;
+
+	if (c->wakeup_timer)
+		timers.cancel(c->wakeup_timer);
+	c->wakeup = deadline;
+	c->wakeup_timer = 0;
+	if (deadline)
+		c->wakeup_timer = timers.add(deadline, [this, c] () {
+			c->wakeup = 0;
+			c->wakeup_timer = 0;
+			pump(c);
+		});
+}
+
+void WaReactor::poll(int maxwait)
+{
+	time_t now = time(0);
+	time_t next = timers.nextDeadline();
+	int timeout = maxwait;
+	if (next) {
+		int t = next > now ? std::min(next - now, (time_t)3600) * 1000 : 0;
+		if (timeout < 0 or t < timeout)
+			timeout = t;
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+	for (int i = 0; i < n; i++) {
+		Conn *c = (Conn *)events[i].data.ptr;
+		if (c == NULL) {
+			uint64_t count;
+			if (read(wakefd, &count, sizeof(count)) < 0) {}
+			while (wakeups.size() > 0)
+				wakeups.drain(MAX_EVENTS);
+		}
+		else if (c->fd >= 0)
+			handle(c, events[i].events);
+	}
+
+	timers.advance(time(0));
+
+	for (auto c : closed)
+		delete c;
+	closed.clear();
+}
+
+void WaReactor::run()
+{
+	running = true;
+	while (running)
+		poll();
+}
+
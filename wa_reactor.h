@@ -0,0 +1,90 @@
+
+#ifndef __WA_REACTOR__H__
+#define __WA_REACTOR__H__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "timerwheel.h"
+#include "submitqueue.h"
+
+class WhatsappConnection;
+
+// Runs many connections from a single thread with epoll, without
+// libpurple or glib (Linux only). Sockets are non-blocking, the
+// connections keep their own in/out buffers and the reactor keeps one
+// wakeup per connection (at its next timer deadline) in a shared wheel,
+// so an idle connection costs nothing per loop.
+//
+// Submissions from other threads (WhatsappConnection::submit) wake the
+// loop up through an eventfd, so the reactor has to outlive them.
+class WaReactor {
+public:
+	// Called after the connection did some work (read, timers or
+	// submissions), to collect messages and events. Returning false
+	// closes the connection.
+	typedef std::function < bool (WhatsappConnection &) > EventHandler;
+	// The connection was closed, by the peer, an error or the handler
+	typedef std::function < void (WhatsappConnection &, const std::string & reason) > CloseHandler;
+private:
+	struct Conn {
+		WhatsappConnection *wc;
+		int fd;
+		bool connected;     // The non-blocking connect finished
+		bool writing;       // Waiting for EPOLLOUT
+		std::string resource;
+		bool send_ciphered;
+		time_t wakeup;
+		TimerWheel::TimerId wakeup_timer;
+	};
+	int epfd, wakefd;
+	TimerWheel timers;
+	SubmitQueue wakeups;
+	std::unordered_map < WhatsappConnection *, Conn * > conns;
+	std::vector < Conn * > closed;   // Freed at the end of the round
+	EventHandler on_event;
+	CloseHandler on_close;
+	std::atomic < bool > running;
+
+	WaReactor(const WaReactor &);
+	WaReactor & operator=(const WaReactor &);
+
+	void handle(Conn * c, unsigned int events);
+	void pump(Conn * c);
+	bool readAll(Conn * c, std::string & reason);
+	bool writeAll(Conn * c, std::string & reason);
+	void schedule(Conn * c);
+	void drop(Conn * c);
+	void close(Conn * c, const std::string & reason);
+public:
+	// Throws runtime_error if epoll or the eventfd can't be set up
+	WaReactor();
+	~WaReactor();
+
+	void setEventHandler(EventHandler h) { on_event = h; }
+	void setCloseHandler(CloseHandler h) { on_close = h; }
+
+	// Connects and logs in, the reactor doesn't own the connection. The
+	// host name is resolved here (blocking). False if it can't start.
+	bool add(WhatsappConnection * wc, const std::string & host, int port,
+		const std::string & resource, bool send_ciphered = false);
+	// Closes the socket without calling the close handler
+	void remove(WhatsappConnection * wc);
+
+	// The wheel the connection wakeups live in, for host timers
+	TimerWheel & getTimers() { return timers; }
+
+	// Waits for events and runs them, up to maxwait ms (-1 forever)
+	void poll(int maxwait = -1);
+	// Polls until stop is called (from the handlers or a signal handler)
+	void run();
+	void stop() { running = false; }
+
+	unsigned int size() const { return conns.size(); }
+};
+
+#endif
+
@@ -0,0 +1,253 @@
+
+/*
+ * Handlers for the top level stanzas, registered on the connection's
+ * dispatcher. The iq handlers live in wa_iq.cc.
+ */
+
+#include <assert.h>
+
+#include "rc4.h"
+#include "keygen.h"
+#include "databuffer.h"
+#include "tree.h"
+#include "stanzas.h"
+#include "contacts.h"
+#include "message.h"
+#include "wa_connection.h"
+#include "wa_util.h"
+#include "wacommon.h"
+
+void WhatsappConnection::registerStanzaHandlers()
+{
+	dispatcher.addTagHandler("challenge", [this] (Tree & t, Tree &) { handleChallenge(t); });
+	dispatcher.addTagHandler("success", [this] (Tree & t, Tree &) { handleSuccess(t); });
+	dispatcher.addTagHandler("failure", [this] (Tree & t, Tree &) { handleFailure(t); });
+	dispatcher.addTagHandler("call", [this] (Tree & t, Tree &) { handleCall(t); });
+
+	/* The high volume ones are decoded into the structs from stanzas.h */
+	dispatcher.addTagHandler("message", [this] (Tree & t, Tree &) {
+		MessageStanza s;
+		decodeStanza(t, s);
+		handleMessage(s, t);
+	});
+	dispatcher.addTagHandler("receipt", [this] (Tree & t, Tree &) {
+		ReceiptStanza s;
+		decodeStanza(t, s);
+		handleReceipt(s);
+	});
+	dispatcher.addTagHandler("ack", [this] (Tree & t, Tree &) {
+		AckStanza s;
+		decodeStanza(t, s);
+		handleAck(s);
+	});
+	dispatcher.addTagHandler("presence", [this] (Tree & t, Tree &) {
+		PresenceStanza s;
+		decodeStanza(t, s);
+		handlePresence(s);
+	});
+	dispatcher.addTagHandler("chatstate", [this] (Tree & t, Tree &) {
+		ChatstateStanza s;
+		decodeStanza(t, s);
+		handleChatstate(s);
+	});
+	dispatcher.addTagHandler("notification", [this] (Tree & t, Tree &) {
+		NotificationStanza s;
+		decodeStanza(t, s);
+		handleNotification(s);
+	});
+}
+
+void WhatsappConnection::handleChallenge(Tree & tl)
+{
+	/* Generate a session key using the challege & the password */
+	assert(conn_status == SessionWaitingChallenge);
+
+	KeyGenerator::generateKeysV14(password, tl.getData().c_str(), tl.getData().size(), (char *)this->session_key);
+
+	in  = new RC4Decoder(&session_key[20*2], 20, 768);
+	out = new RC4Decoder(&session_key[20*0], 20, 768);
+	out_mac.setKey(&session_key[20*1], 20);
+	in_mac.setKey(&session_key[20*3], 20);
+	in_seq = 0;
+
+	conn_status = SessionWaitingAuthOK;
+	challenge_data = tl.getData();
+
+	this->sendResponse();
+}
+
+void WhatsappConnection::handleSuccess(Tree & tl)
+{
+	/* Notifies the success of the auth */
+	conn_status = SessionConnected;
+	if (tl.hasAttribute("status"))
+		this->account_status = tl["status"];
+	if (tl.hasAttribute("kind"))
+		this->account_type = tl["kind"];
+	if (tl.hasAttribute("expiration"))
+		this->account_expiration = tl["expiration"];
+	if (tl.hasAttribute("creation"))
+		this->account_creation = tl["creation"];
+
+	this->notifyMyPresence();
+	this->scheduleKeepalive();
+	this->updatePrivacy();
+	this->sendInitial();  // Seems to trigger an error IQ response
+	this->updateGroups();
+	this->updateBlists();
+
+	if (axolotlStore->countPreKeys() == 0)
+		this->sendEncrypt(true);
+
+	DEBUG_PRINT("Logged in!!!");
+}
+
+void WhatsappConnection::handleFailure(Tree & tl)
+{
+	std::string reason = "unknown";
+	if (tl.hasChild("not-authorized"))
+		reason = "not-authorized";
+
+	if (conn_status == SessionWaitingAuthOK)
+		this->notifyError(errorAuth, reason);
+	else
+		this->notifyError(errorUnknown, reason);
+}
+
+void WhatsappConnection::handleCall(Tree & tl)
+{
+	if (tl.hasAttribute("notify")) {
+		unsigned long long time = 0;
+		if (tl.hasAttribute("t"))
+			time = std::stoull(tl["t"]);
+		std::string from = tl["from"];
+		std::string id = tl["id"];
+
+		this->receiveMessage(CallMessage(this, from, time, id));
+	}
+	DataBuffer reply = generateResponse(tl["from"], "", tl["id"]);
+	outbuffer.push(std::move(reply), OutReceipt);
+}
+
+void WhatsappConnection::handleNotification(const NotificationStanza & s)
+{
+	DataBuffer reply = generateResponse(s.from.str(), s.type.str(), s.id.str());
+	outbuffer.push(std::move(reply), OutReceipt);
+
+	if (s.type == "participant" || s.type == "owner" || s.type == "w:gp2") {
+		/* If the nofitication comes from a group, assume we have to reload groups ;) */
+		updateGroups();
+	}
+
+	if (s.type == "encrypt") {
+		// Push some more keys?
+		this->sendEncrypt(false);
+	}
+
+	if (s.type == "picture") {
+		/* Picture update */
+		this->queryPreview(s.from.str());
+	}
+}
+
+void WhatsappConnection::handleAck(const AckStanza & s)
+{
+	std::string id = s.id.str();
+	received_messages.push_back( {id, rSent, s.t, ""} );
+	notifyDelivery(id, rSent);
+}
+
+void WhatsappConnection::handleReceipt(const ReceiptStanza & s)
+{
+	std::string id = s.id.str();
+	std::string type = s.type.str();
+	if (type == "") type = "delivery";
+
+	// Optional fields are left out when empty
+	outbuffer.push(generateAck(id, type, s.from.str(), s.to.str(), s.participant.str()), OutReceipt);
+
+	// Add reception package to queue or retry it, once delivered our
+	// copy of the message is no longer needed
+	if (type == "read") {
+		received_messages.push_back( {id, rRead, s.t, } );
+		cancelMessage(id);
+		notifyDelivery(id, rRead);
+	}
+	else if (type == "delivery") {
+		received_messages.push_back( {id, rDelivered, s.t, } );
+		cancelMessage(id);
+		notifyDelivery(id, rDelivered);
+	}
+	else if (type == "retry")
+		this->retryMessage(id);
+}
+
+void WhatsappConnection::handleChatstate(const ChatstateStanza & s)
+{
+	if (s.composing)
+		this->gotTyping(s.from.str(), "composing");
+	if (s.paused)
+		this->gotTyping(s.from.str(), "paused");
+}
+
+void WhatsappConnection::handlePresence(const PresenceStanza & s)
+{
+	/* Receives the presence of the user, for v14 type is optional */
+	if (s.has_from)
+		this->notifyPresence(s.from.str(), s.type.str(), s.last.str());
+}
+
+void WhatsappConnection::handleMessage(const MessageStanza & s, Tree & tl)
+{
+	/* Receives a message! */
+	DEBUG_PRINT("Received message stanza...");
+	bool donotreply = false;
+	if (s.has_from and (s.type == "text" or s.type == "media")) {
+		unsigned long long time = s.t;
+		std::string from = s.from.str();
+		std::string id = s.id.str();
+		std::string author = s.participant.str();
+
+		if (isbroadcast(from))
+			from = author;
+
+		Tree t;
+		if (tl.getChild("body", t)) {
+			this->receiveMessage(ChatMessage(this, from, time, id, t.getData(), author));
+		}
+		if (tl.getChild("enc", t)) {
+			if (crypto_pool) {
+				/* Answered once deciphered */
+				decipherAsync(from, id, author, time, t, s.type.str(), s.from.str());
+				donotreply = true;
+			}
+			else if (!this->receiveCipheredMessage(from, id, author, time, t, s.type.str()))
+				donotreply = true;
+		}
+		if (tl.getChild("media", t)) {
+			if (t.hasAttributeValue("type", "image")) {
+				this->receiveMessage(ImageMessage(this, from, time, id, author, 
+					t["url"], t["caption"], t["ip"], std::stoi(t["width"]), std::stoi(t["height"]),
+					std::stoi(t["size"]), t["encoding"], t["filehash"], t["mimetype"],
+					t.getData()));
+			} else if (t.hasAttributeValue("type", "location")) {
+				this->receiveMessage(LocationMessage(this, from, time, id, author, str2dbl(t["latitude"]), str2dbl(t["longitude"]), t["name"], t.getData()));
+			} else if (t.hasAttributeValue("type", "audio")) {
+				this->receiveMessage(SoundMessage(this, from, time, id, author, t["url"], t["caption"], t["filehash"], t["mimetype"]));
+			} else if (t.hasAttributeValue("type", "video")) {
+				this->receiveMessage(VideoMessage(this, from, time, id, author, t["url"], t["caption"], t["filehash"], t["mimetype"]));
+			} else if (t.hasAttributeValue("type", "vcard")) {
+				Tree vc;
+				if (t.getChild("vcard", vc))
+					this->receiveMessage(VCardMessage(this, from, time, id, author, t["name"], vc.getData()));
+			}
+		}
+	} else if (s.type == "notification" and s.has_from) {
+		/* If the nofitication comes from a group, assume we have to reload groups ;) */
+		updateGroups();
+	}
+	/* Generate response for the messages */
+	if (s.has_type and s.has_from and not donotreply) //FIXME
+		queueReceipt(s.from.str(), s.id.str());
+}
+
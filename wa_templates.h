@@ -0,0 +1,37 @@
+
+#ifndef __WA_TEMPLATES__H__
+#define __WA_TEMPLATES__H__
+
+#include <string>
+#include <vector>
+
+// Stanzas sent from a StanzaTemplate: attributes in the order they go on
+// the wire ("$N" and "$N?" are the slots) and an optional empty child.
+// treetest checks every one of them against the tree encoder.
+struct StanzaShape {
+	const char *tag;
+	std::vector < std::string > attributes;
+	const char *child;
+};
+
+// receipt: id, to, type
+static const StanzaShape receiptShape = { "receipt",
+	{"id", "$0", "t", "1", "to", "$1", "type", "$2"}, NULL };
+
+// ack for a receipt: id, type, to, from, participant (the last three optional)
+static const StanzaShape receiptAckShape = { "ack",
+	{"class", "receipt", "id", "$0", "type", "$1", "to", "$2?", "from", "$3?", "participant", "$4?"}, NULL };
+
+// ping reply: id, to
+static const StanzaShape pongShape = { "iq",
+	{"id", "$0", "to", "$1", "type", "result"}, NULL };
+
+// chatstate: to
+static const StanzaShape composingShape = { "chatstate", {"to", "$0"}, "composing" };
+static const StanzaShape pausedShape = { "chatstate", {"to", "$0"}, "paused" };
+
+static const StanzaShape * const stanzaShapes[] = {
+	&receiptShape, &receiptAckShape, &pongShape, &composingShape, &pausedShape
+};
+
+#endif
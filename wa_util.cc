@@ -268,6 +268,9 @@ int PKCS5_PBKDF2_HMAC_SHA256(const char *pass, int passlen, const unsigned char
 	return PKCS5_PBKDF2_HMAC_HASH(pass, passlen, salt, saltlen, iter, keylen, out, "sha256", 32);
 }
 
+#endif
+
+/* Used by libaxolotl, with OpenSSL or the replacements above */
 void HMAC_SHA256(const unsigned char *text, int text_len, const unsigned char *key, int key_len, unsigned char *digest)
 {
 	unsigned char SHA256_Key[4096], AppendBuf2[4096], szReport[4096];
@@ -302,8 +305,6 @@ void HMAC_SHA256(const unsigned char *text, int text_len, const unsigned char *k
 	delete[]AppendBuf1;
 }
 
-#endif
-
 /* MIME type, copied from mxit */
 #define		MIME_TYPE_OCTETSTREAM	"application/octet-stream"
 #define		ARRAY_SIZE( x )		( sizeof( x ) / sizeof( x[0] ) )
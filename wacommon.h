@@ -6,6 +6,7 @@
 #include <map>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <sstream>
 #include <locale>
 
@@ -27,6 +28,24 @@ static std::string getusername(std::string user)
 		return user;
 }
 
+static int isbroadcast(const std::string user)
+{
+	return (user.find("@broadcast") != std::string::npos);
+}
+
+// Group numbers are a bit tricky! I wish I stored them as strings...
+static uint64_t JidAsInt(const std::string & s) {
+	std::string id = s.substr(0, s.find("@"));
+	std::string onlynums;
+	for (auto c: id)
+		if (c >= '0' && c <= '9')
+			onlynums += c;
+	
+	// This is fucking disgusting :D
+	onlynums = onlynums.substr(0, 19);
+	return std::stoull(onlynums);
+}
+
 static std::map<std::string, std::string> makeat(std::vector <std::string> v) {
 	std::map<std::string, std::string> ret;
 	for (unsigned i = 0; i < v.size(); i+= 2)
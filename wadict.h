@@ -1,79 +1,664 @@
 
 // Static const tables to encode/decode whatsapp messages
+// Generated by misc/gen_wadict.py from misc/wadict.txt, do not edit!
 
-static const char main_dict[236][37+1] = {
-	"", "", "", "account", "ack", "action", "active", "add", "after",
-	"all", "allow", "apple", "audio", "auth", "author", "available",
-	"bad-protocol", "bad-request", "before", "bits", "body", "broadcast",
-	"cancel", "category", "challenge", "chat", "clean", "code",
-	"composing", "config", "contacts", "count", "create", "creation", "debug",
-	"default", "delete", "delivery", "delta", "deny", "digest", "dirty",
-	"duplicate", "elapsed", "enable", "encoding", "encrypt", "error", "event",
-	"expiration", "expired", "fail", "failure", "false", "favorites", "feature",
-	"features", "feature-not-implemented", "field", "file", "filehash", "first",
-	"free", "from", "g.us", "gcm", "get", "google", "group", "groups", "groups_v2",
-	"http://etherx.jabber.org/streams", "http://jabber.org/protocol/chatstates",
-	"ib", "id", "image", "img", "index", "internal-server-error", "ip", "iq",
-	"item-not-found", "item", "jabber:iq:last", "jabber:iq:privacy", "jabber:x:event",
-	"jid", "kind", "last", "leave", "list", "max", "mechanism", "media", "message_acks",
-	"message", "method", "microsoft", "mimetype", "missing", "modify", "msg",
-	"mute", "name", "nokia", "none", "not-acceptable", "not-allowed", "not-authorized",
-	"notification", "notify", "off", "offline", "order", "owner", "owning", "p_o",
-	"p_t", "paid", "participant", "participants", "participating", "paused", "picture",
-	"pin", "ping", "pkmsg", "platform", "port", "presence", "preview", "probe", "prop",
-	"props", "qcount", "query", "raw", "read", "readreceipts", "reason", "receipt",
-	"relay", "remote-server-timeout", "remove", "request", "required", "resource-constraint",
-	"resource", "response", "result", "retry", "rim", "s_o", "s_t", "s.us", "s.whatsapp.net",
-	"seconds", "server-error", "server", "service-unavailable", "set", "show", "silent",
-	"size", "skmsg", "stat", "state", "status", "stream:error", "stream:features", "subject",
-	"subscribe", "success", "sync", "t", "text", "timeout", "timestamp", "tizen",
-	"to", "true", "type", "unavailable", "unsubscribe", "upgrade", "uri", "url",
-	"urn:ietf:params:xml:ns:xmpp-sasl", "urn:ietf:params:xml:ns:xmpp-stanzas",
-	"urn:ietf:params:xml:ns:xmpp-streams", "urn:xmpp:ping", "urn:xmpp:whatsapp:account",
-	"urn:xmpp:whatsapp:dirty", "urn:xmpp:whatsapp:mms", "urn:xmpp:whatsapp:push",
-	"urn:xmpp:whatsapp", "user", "user-not-found", "v", "value", "version", "voip",
-	"w:g", "w:p:r", "w:p", "w:profile:picture", "w", "wait", "WAUTH-2", "xmlns:stream",
-	"xmlns", "1", "chatstate", "crypto", "phash", "enc", "class", "off_cnt", "w:g2",
-	"promote", "demote", "creator", "background", "backoff", "chunked", "context", "full",
-	"in", "interactive", "out", "registration", "sid", "urn:xmpp:whatsapp:sync",
-	"flt", "s16", "u8"
+#define WADICT_MAIN_SIZE 236
+#define WADICT_SEC_SIZE 263
+#define WADICT_HASH_SIZE 1024
+#define WADICT_BUCKETS 256
+
+// All the strings, NUL terminated
+static const char dict_pool[4388] =
+	"\0"
+	"account\0"
+	"ack\0"
+	"action\0"
+	"active\0"
+	"add\0"
+	"after\0"
+	"all\0"
+	"allow\0"
+	"apple\0"
+	"audio\0"
+	"auth\0"
+	"author\0"
+	"available\0"
+	"bad-protocol\0"
+	"bad-request\0"
+	"before\0"
+	"bits\0"
+	"body\0"
+	"broadcast\0"
+	"cancel\0"
+	"category\0"
+	"challenge\0"
+	"chat\0"
+	"clean\0"
+	"code\0"
+	"composing\0"
+	"config\0"
+	"contacts\0"
+	"count\0"
+	"create\0"
+	"creation\0"
+	"debug\0"
+	"default\0"
+	"delete\0"
+	"delivery\0"
+	"delta\0"
+	"deny\0"
+	"digest\0"
+	"dirty\0"
+	"duplicate\0"
+	"elapsed\0"
+	"enable\0"
+	"encoding\0"
+	"encrypt\0"
+	"error\0"
+	"event\0"
+	"expiration\0"
+	"expired\0"
+	"fail\0"
+	"failure\0"
+	"false\0"
+	"favorites\0"
+	"feature\0"
+	"features\0"
+	"feature-not-implemented\0"
+	"field\0"
+	"file\0"
+	"filehash\0"
+	"first\0"
+	"free\0"
+	"from\0"
+	"g.us\0"
+	"gcm\0"
+	"get\0"
+	"google\0"
+	"group\0"
+	"groups\0"
+	"groups_v2\0"
+	"http://etherx.jabber.org/streams\0"
+	"http://jabber.org/protocol/chatstates\0"
+	"ib\0"
+	"id\0"
+	"image\0"
+	"img\0"
+	"index\0"
+	"internal-server-error\0"
+	"ip\0"
+	"iq\0"
+	"item-not-found\0"
+	"item\0"
+	"jabber:iq:last\0"
+	"jabber:iq:privacy\0"
+	"jabber:x:event\0"
+	"jid\0"
+	"kind\0"
+	"last\0"
+	"leave\0"
+	"list\0"
+	"max\0"
+	"mechanism\0"
+	"media\0"
+	"message_acks\0"
+	"message\0"
+	"method\0"
+	"microsoft\0"
+	"mimetype\0"
+	"missing\0"
+	"modify\0"
+	"msg\0"
+	"mute\0"
+	"name\0"
+	"nokia\0"
+	"none\0"
+	"not-acceptable\0"
+	"not-allowed\0"
+	"not-authorized\0"
+	"notification\0"
+	"notify\0"
+	"off\0"
+	"offline\0"
+	"order\0"
+	"owner\0"
+	"owning\0"
+	"p_o\0"
+	"p_t\0"
+	"paid\0"
+	"participant\0"
+	"participants\0"
+	"participating\0"
+	"paused\0"
+	"picture\0"
+	"pin\0"
+	"ping\0"
+	"pkmsg\0"
+	"platform\0"
+	"port\0"
+	"presence\0"
+	"preview\0"
+	"probe\0"
+	"prop\0"
+	"props\0"
+	"qcount\0"
+	"query\0"
+	"raw\0"
+	"read\0"
+	"readreceipts\0"
+	"reason\0"
+	"receipt\0"
+	"relay\0"
+	"remote-server-timeout\0"
+	"remove\0"
+	"request\0"
+	"required\0"
+	"resource-constraint\0"
+	"resource\0"
+	"response\0"
+	"result\0"
+	"retry\0"
+	"rim\0"
+	"s_o\0"
+	"s_t\0"
+	"s.us\0"
+	"s.whatsapp.net\0"
+	"seconds\0"
+	"server-error\0"
+	"server\0"
+	"service-unavailable\0"
+	"set\0"
+	"show\0"
+	"silent\0"
+	"size\0"
+	"skmsg\0"
+	"stat\0"
+	"state\0"
+	"status\0"
+	"stream:error\0"
+	"stream:features\0"
+	"subject\0"
+	"subscribe\0"
+	"success\0"
+	"sync\0"
+	"t\0"
+	"text\0"
+	"timeout\0"
+	"timestamp\0"
+	"tizen\0"
+	"to\0"
+	"true\0"
+	"type\0"
+	"unavailable\0"
+	"unsubscribe\0"
+	"upgrade\0"
+	"uri\0"
+	"url\0"
+	"urn:ietf:params:xml:ns:xmpp-sasl\0"
+	"urn:ietf:params:xml:ns:xmpp-stanzas\0"
+	"urn:ietf:params:xml:ns:xmpp-streams\0"
+	"urn:xmpp:ping\0"
+	"urn:xmpp:whatsapp:account\0"
+	"urn:xmpp:whatsapp:dirty\0"
+	"urn:xmpp:whatsapp:mms\0"
+	"urn:xmpp:whatsapp:push\0"
+	"urn:xmpp:whatsapp\0"
+	"user\0"
+	"user-not-found\0"
+	"v\0"
+	"value\0"
+	"version\0"
+	"voip\0"
+	"w:g\0"
+	"w:p:r\0"
+	"w:p\0"
+	"w:profile:picture\0"
+	"w\0"
+	"wait\0"
+	"WAUTH-2\0"
+	"xmlns:stream\0"
+	"xmlns\0"
+	"1\0"
+	"chatstate\0"
+	"crypto\0"
+	"phash\0"
+	"enc\0"
+	"class\0"
+	"off_cnt\0"
+	"w:g2\0"
+	"promote\0"
+	"demote\0"
+	"creator\0"
+	"background\0"
+	"backoff\0"
+	"chunked\0"
+	"context\0"
+	"full\0"
+	"in\0"
+	"interactive\0"
+	"out\0"
+	"registration\0"
+	"sid\0"
+	"urn:xmpp:whatsapp:sync\0"
+	"flt\0"
+	"s16\0"
+	"u8\0"
+	"adpcm\0"
+	"amrnb\0"
+	"amrwb\0"
+	"mp3\0"
+	"pcm\0"
+	"qcelp\0"
+	"wma\0"
+	"h263\0"
+	"h264\0"
+	"jpeg\0"
+	"mpeg4\0"
+	"wmv\0"
+	"audio/3gpp\0"
+	"audio/aac\0"
+	"audio/amr\0"
+	"audio/mp4\0"
+	"audio/mpeg\0"
+	"audio/ogg\0"
+	"audio/qcelp\0"
+	"audio/wav\0"
+	"audio/webm\0"
+	"audio/x-caf\0"
+	"audio/x-ms-wma\0"
+	"image/gif\0"
+	"image/jpeg\0"
+	"image/png\0"
+	"video/3gpp\0"
+	"video/avi\0"
+	"video/mp4\0"
+	"video/mpeg\0"
+	"video/quicktime\0"
+	"video/x-flv\0"
+	"video/x-ms-asf\0"
+	"302\0"
+	"400\0"
+	"401\0"
+	"402\0"
+	"403\0"
+	"404\0"
+	"405\0"
+	"406\0"
+	"407\0"
+	"409\0"
+	"410\0"
+	"500\0"
+	"501\0"
+	"503\0"
+	"504\0"
+	"abitrate\0"
+	"acodec\0"
+	"app_uptime\0"
+	"asampfmt\0"
+	"asampfreq\0"
+	"clear\0"
+	"conflict\0"
+	"conn_no_nna\0"
+	"cost\0"
+	"currency\0"
+	"duration\0"
+	"extend\0"
+	"fps\0"
+	"g_notify\0"
+	"g_sound\0"
+	"gone\0"
+	"google_play\0"
+	"hash\0"
+	"height\0"
+	"invalid\0"
+	"jid-malformed\0"
+	"latitude\0"
+	"lc\0"
+	"lg\0"
+	"live\0"
+	"location\0"
+	"log\0"
+	"longitude\0"
+	"max_groups\0"
+	"max_participants\0"
+	"max_subject\0"
+	"mode\0"
+	"napi_version\0"
+	"normalize\0"
+	"orighash\0"
+	"origin\0"
+	"passive\0"
+	"password\0"
+	"played\0"
+	"policy-violation\0"
+	"pop_mean_time\0"
+	"pop_plus_minus\0"
+	"price\0"
+	"pricing\0"
+	"redeem\0"
+	"Replaced by new connection\0"
+	"resume\0"
+	"signature\0"
+	"sound\0"
+	"source\0"
+	"system-shutdown\0"
+	"username\0"
+	"vbitrate\0"
+	"vcard\0"
+	"vcodec\0"
+	"video\0"
+	"width\0"
+	"xml-not-well-formed\0"
+	"checkmarks\0"
+	"image_max_edge\0"
+	"image_max_kbytes\0"
+	"image_quality\0"
+	"ka\0"
+	"ka_grow\0"
+	"ka_shrink\0"
+	"newmedia\0"
+	"library\0"
+	"caption\0"
+	"forward\0"
+	"c0\0"
+	"c1\0"
+	"c2\0"
+	"c3\0"
+	"clock_skew\0"
+	"cts\0"
+	"k0\0"
+	"k1\0"
+	"login_rtt\0"
+	"m_id\0"
+	"nna_msg_rtt\0"
+	"nna_no_off_count\0"
+	"nna_offline_ratio\0"
+	"nna_push_rtt\0"
+	"no_nna_con_count\0"
+	"off_msg_rtt\0"
+	"on_msg_rtt\0"
+	"stat_name\0"
+	"sts\0"
+	"suspect_conn\0"
+	"lists\0"
+	"self\0"
+	"qr\0"
+	"web\0"
+	"w:b\0"
+	"recipient\0"
+	"w:stats\0"
+	"forbidden\0"
+	"max_list_recipients\0"
+	"en-AU\0"
+	"en-GB\0"
+	"es-MX\0"
+	"pt-PT\0"
+	"zh-Hans\0"
+	"zh-Hant\0"
+	"relayelection\0"
+	"relaylatency\0"
+	"interruption\0"
+	"Bell.caf\0"
+	"Boing.caf\0"
+	"Glass.caf\0"
+	"Harp.caf\0"
+	"TimePassing.caf\0"
+	"Tri-tone.caf\0"
+	"Xylophone.caf\0"
+	"aurora.m4r\0"
+	"bamboo.m4r\0"
+	"chord.m4r\0"
+	"circles.m4r\0"
+	"complete.m4r\0"
+	"hello.m4r\0"
+	"input.m4r\0"
+	"keys.m4r\0"
+	"note.m4r\0"
+	"popcorn.m4r\0"
+	"pulse.m4r\0"
+	"synth.m4r\0"
+	"Apex.m4r\0"
+	"Beacon.m4r\0"
+	"Bulletin.m4r\0"
+	"By The Seaside.m4r\0"
+	"Chimes.m4r\0"
+	"Circuit.m4r\0"
+	"Constellation.m4r\0"
+	"Cosmic.m4r\0"
+	"Crystals.m4r\0"
+	"Hillside.m4r\0"
+	"Illuminate.m4r\0"
+	"Night Owl.m4r\0"
+	"Opening.m4r\0"
+	"Playtime.m4r\0"
+	"Presto.m4r\0"
+	"Radar.m4r\0"
+	"Radiate.m4r\0"
+	"Ripples.m4r\0"
+	"Sencha.m4r\0"
+	"Signal.m4r\0"
+	"Silk.m4r\0"
+	"Slow Rise.m4r\0"
+	"Stargaze.m4r\0"
+	"Summit.m4r\0"
+	"Twinkle.m4r\0"
+	"Uplift.m4r\0"
+	"Waves.m4r\0"
+	"eligible\0"
+	"planned\0"
+	"current\0"
+	"future\0"
+	"disable\0"
+	"expire\0"
+	"start\0"
+	"stop\0"
+	"accuracy\0"
+	"speed\0"
+	"bearing\0"
+	"recording\0"
+	"key\0"
+	"identity\0"
+	"w:gp2\0"
+	"admin\0"
+	"locked\0"
+	"unlocked\0"
+	"new\0"
+	"battery\0"
+	"archive\0"
+	"adm\0"
+	"plaintext_size\0"
+	"plaintext_disabled\0"
+	"plaintext_reenable_threshold\0"
+	"compressed_size\0"
+	"delivered\0"
+	"everyone\0"
+	"transport\0"
+	"mspes\0"
+	"e2e_groups\0"
+	"e2e_images\0"
+	"encr_media\0"
+	"encrypt_v2\0"
+	"encrypt_image\0"
+	"encrypt_sends_push\0"
+	"force_long_connect\0"
+	"audio_opus\0"
+	"video_max_edge\0"
+	"call-id\0"
+	"call\0"
+	"preaccept\0"
+	"accept\0"
+	"offer\0"
+	"reject\0"
+	"busy\0"
+	"te\0"
+	"terminate\0"
+	"begin\0"
+	"end\0"
+	"opus\0"
+	"rtt\0"
+	"token\0"
+	"priority\0"
+	"p2p\0"
+	"rate\0"
+	"amr\0"
+	"ptt\0"
+	"srtp\0"
+	"os\0"
+	"browser\0"
+	"encrypt_group_gen2\0";
+
+// Token to pool offset
+static const unsigned short main_dict_offset[236] = {
+	0, 0, 0, 1, 9, 13, 20, 27, 31, 37, 41, 47,
+	53, 59, 64, 71, 81, 94, 106, 113, 118, 123, 133, 140,
+	149, 159, 164, 170, 175, 185, 192, 201, 207, 214, 223, 229,
+	237, 244, 253, 259, 264, 271, 277, 287, 295, 302, 311, 319,
+	325, 331, 342, 350, 355, 363, 369, 379, 387, 396, 420, 426,
+	431, 440, 446, 451, 456, 461, 465, 469, 476, 482, 489, 499,
+	532, 570, 573, 576, 582, 586, 592, 614, 617, 620, 635, 640,
+	655, 673, 688, 692, 697, 702, 708, 713, 717, 727, 733, 746,
+	754, 761, 771, 780, 788, 795, 799, 804, 809, 815, 820, 835,
+	847, 862, 875, 882, 886, 894, 900, 906, 913, 917, 921, 926,
+	938, 951, 965, 972, 980, 984, 989, 995, 1004, 1009, 1018, 1026,
+	1032, 1037, 1043, 1050, 1056, 1060, 1065, 1078, 1085, 1093, 1099, 1121,
+	1128, 1136, 1145, 1165, 1174, 1183, 1190, 1196, 1200, 1204, 1208, 1213,
+	1228, 1236, 1249, 1256, 1276, 1280, 1285, 1292, 1297, 1303, 1308, 1314,
+	1321, 1334, 1350, 1358, 1368, 1376, 1381, 1383, 1388, 1396, 1406, 1412,
+	1415, 1420, 1425, 1437, 1449, 1457, 1461, 1465, 1498, 1534, 1570, 1584,
+	1610, 1634, 1656, 1679, 1697, 1702, 1717, 1719, 1725, 1733, 1738, 1742,
+	1748, 1752, 1770, 1772, 1777, 1785, 1798, 1804, 1806, 1816, 1823, 1829,
+	1833, 1839, 1847, 1852, 1860, 1867, 1875, 1886, 1894, 1902, 1910, 1915,
+	1918, 1930, 1934, 1947, 1951, 1974, 1978, 1982,
+};
+
+static const unsigned short sec_dict_offset[263] = {
+	1985, 1991, 1997, 2003, 2007, 2011, 2017, 2021, 2026, 2031, 2036, 2042,
+	2046, 2057, 2067, 2077, 2087, 2098, 2108, 2120, 2130, 2141, 2153, 2168,
+	2178, 2189, 2199, 2210, 2220, 2230, 2241, 2257, 2269, 2284, 2288, 2292,
+	2296, 2300, 2304, 2308, 2312, 2316, 2320, 2324, 2328, 2332, 2336, 2340,
+	2344, 2353, 2360, 2371, 2380, 2390, 2396, 2405, 2417, 2422, 2431, 2440,
+	2447, 2451, 2460, 2468, 2473, 2485, 2490, 2497, 2505, 2519, 2528, 2531,
+	2534, 2539, 2548, 2552, 2562, 2573, 2590, 2602, 2607, 2620, 2630, 2639,
+	2646, 2654, 2663, 2670, 2687, 2701, 2716, 2722, 2730, 2737, 2764, 2771,
+	2781, 2787, 2794, 2810, 2819, 2828, 2834, 2841, 2847, 2853, 2873, 2884,
+	2899, 2916, 2930, 2933, 2941, 2951, 2960, 2968, 2976, 2984, 2987, 2990,
+	2993, 2996, 3007, 3011, 3014, 3017, 3027, 3032, 3044, 3061, 3079, 3092,
+	3109, 3121, 3132, 3142, 3146, 3159, 3165, 3170, 3173, 3177, 3181, 3191,
+	3199, 3209, 3229, 3235, 3241, 3247, 3253, 3261, 3269, 3283, 3296, 3309,
+	3318, 3328, 3338, 3347, 3363, 3376, 3390, 3401, 3412, 3422, 3434, 3447,
+	3457, 3467, 3476, 3485, 3497, 3507, 3517, 3526, 3537, 3550, 3569, 3580,
+	3592, 3610, 3621, 3634, 3647, 3662, 3676, 3688, 3701, 3712, 3722, 3734,
+	3746, 3757, 3768, 3777, 3791, 3804, 3815, 3827, 3838, 3848, 3857, 3865,
+	3873, 3880, 3888, 3895, 3901, 3906, 3915, 3921, 3929, 3939, 3943, 3952,
+	3958, 3964, 3971, 3980, 3984, 3992, 4000, 4004, 4019, 4038, 4067, 4083,
+	4093, 4102, 4112, 4118, 4129, 4140, 4151, 4162, 4176, 4195, 4214, 4225,
+	4240, 4248, 4253, 4263, 4270, 4276, 4283, 4288, 4291, 4301, 4307, 4311,
+	4316, 4320, 4326, 4335, 4339, 4344, 4348, 4352, 4357, 4360, 4368,
 };
 
-static const char sec_dict[263][28+1] = {
-	"adpcm", "amrnb", "amrwb", "mp3", "pcm", "qcelp", "wma", "h263",
-	"h264", "jpeg", "mpeg4", "wmv", "audio/3gpp", "audio/aac", "audio/amr",
-	"audio/mp4", "audio/mpeg", "audio/ogg", "audio/qcelp", "audio/wav", "audio/webm",
-	"audio/x-caf", "audio/x-ms-wma", "image/gif", "image/jpeg", "image/png", "video/3gpp",
-	"video/avi", "video/mp4", "video/mpeg", "video/quicktime", "video/x-flv", "video/x-ms-asf",
-	"302", "400", "401", "402", "403", "404", "405", "406", "407", "409", "410", "500",
-	"501", "503", "504", "abitrate", "acodec", "app_uptime", "asampfmt", "asampfreq",
-	"clear", "conflict", "conn_no_nna", "cost", "currency", "duration", "extend",
-	"fps", "g_notify", "g_sound", "gone", "google_play", "hash", "height", "invalid",
-	"jid-malformed", "latitude", "lc", "lg", "live", "location", "log", "longitude", "max_groups",
-	"max_participants", "max_subject", "mode", "napi_version", "normalize", "orighash",
-	"origin", "passive", "password", "played", "policy-violation", "pop_mean_time", "pop_plus_minus",
-	"price", "pricing", "redeem", "Replaced by new connection", "resume", "signature", "sound",
-	"source", "system-shutdown", "username", "vbitrate", "vcard", "vcodec", "video", "width",
-	"xml-not-well-formed", "checkmarks", "image_max_edge", "image_max_kbytes", "image_quality",
-	"ka", "ka_grow", "ka_shrink", "newmedia", "library", "caption", "forward", "c0", "c1", "c2",
-	"c3", "clock_skew", "cts", "k0", "k1", "login_rtt", "m_id", "nna_msg_rtt", "nna_no_off_count",
-	"nna_offline_ratio", "nna_push_rtt", "no_nna_con_count", "off_msg_rtt", "on_msg_rtt", "stat_name",
-	"sts", "suspect_conn", "lists", "self", "qr", "web", "w:b", "recipient", "w:stats", "forbidden",
-	"max_list_recipients", "en-AU", "en-GB", "es-MX", "pt-PT", "zh-Hans", "zh-Hant", "relayelection",
-	"relaylatency", "interruption", "Bell.caf", "Boing.caf", "Glass.caf", "Harp.caf", "TimePassing.caf",
-	"Tri-tone.caf", "Xylophone.caf", "aurora.m4r", "bamboo.m4r", "chord.m4r", "circles.m4r", "complete.m4r",
-	"hello.m4r", "input.m4r", "keys.m4r", "note.m4r", "popcorn.m4r", "pulse.m4r", "synth.m4r",
-	"Apex.m4r", "Beacon.m4r", "Bulletin.m4r", "By The Seaside.m4r", "Chimes.m4r", "Circuit.m4r", "Constellation.m4r",
-	"Cosmic.m4r", "Crystals.m4r", "Hillside.m4r", "Illuminate.m4r", "Night Owl.m4r", "Opening.m4r",
-	"Playtime.m4r", "Presto.m4r", "Radar.m4r", "Radiate.m4r", "Ripples.m4r", "Sencha.m4r", "Signal.m4r",
-	"Silk.m4r", "Slow Rise.m4r", "Stargaze.m4r", "Summit.m4r", "Twinkle.m4r", "Uplift.m4r", "Waves.m4r",
-	"eligible", "planned", "current", "future", "disable", "expire", "start", "stop", "accuracy", "speed",
-	"bearing", "recording", "key", "identity", "w:gp2", "admin", "locked", "unlocked", "new", "battery",
-	"archive", "adm", "plaintext_size", "plaintext_disabled", "plaintext_reenable_threshold", "compressed_size",
-	"delivered", "everyone", "transport", "mspes", "e2e_groups", "e2e_images", "encr_media", "encrypt_v2",
-	"encrypt_image", "encrypt_sends_push", "force_long_connect", "audio_opus", "video_max_edge", "call-id",
-	"call", "preaccept", "accept", "offer", "reject", "busy", "te", "terminate", "begin", "end", "opus",
-	"rtt", "token", "priority", "p2p", "rate", "amr", "ptt", "srtp", "os", "browser", "encrypt_group_gen2"
+// Perfect hash: slot = dict_mix(hash ^ seed[hash % buckets]) % size
+// Slots hold the token (or 0x100 + extended token), 0 if empty
+static const unsigned short dict_hash_seed[256] = {
+	1, 1, 2, 1, 1, 2, 0, 1, 0, 1, 1, 4, 1, 1, 0, 1,
+	1, 1, 1, 1, 2, 0, 1, 1, 4, 1, 3, 2, 1, 0, 1, 1,
+	1, 7, 1, 1, 1, 2, 1, 2, 3, 2, 2, 2, 0, 1, 2, 1,
+	2, 1, 2, 2, 0, 0, 3, 0, 2, 2, 3, 1, 1, 1, 1, 2,
+	1, 1, 1, 1, 2, 1, 1, 1, 2, 1, 1, 3, 2, 4, 1, 1,
+	2, 1, 1, 0, 1, 1, 3, 1, 1, 0, 1, 0, 1, 1, 1, 1,
+	1, 0, 1, 3, 2, 1, 0, 1, 1, 1, 2, 1, 1, 1, 1, 1,
+	3, 3, 0, 2, 1, 1, 2, 3, 7, 2, 1, 1, 1, 0, 1, 2,
+	1, 1, 1, 2, 2, 4, 3, 1, 2, 5, 0, 0, 1, 2, 1, 3,
+	1, 1, 6, 3, 4, 3, 1, 1, 1, 1, 11, 4, 2, 1, 1, 5,
+	1, 1, 9, 1, 1, 2, 5, 0, 3, 4, 1, 1, 0, 1, 1, 1,
+	2, 1, 1, 1, 0, 6, 0, 1, 2, 1, 3, 1, 1, 0, 0, 3,
+	1, 4, 1, 0, 5, 2, 2, 1, 3, 2, 1, 1, 4, 0, 2, 1,
+	1, 1, 5, 2, 1, 0, 1, 3, 1, 1, 1, 1, 7, 3, 2, 1,
+	2, 0, 0, 2, 1, 1, 3, 1, 1, 0, 1, 1, 2, 4, 1, 1,
+	4, 1, 2, 1, 1, 1, 2, 0, 1, 3, 1, 3, 1, 2, 0, 2,
 };
 
+static const unsigned short dict_hash_table[1024] = {
+	122, 0, 141, 413, 0, 0, 0, 0, 301, 0, 200, 0, 0, 71, 148, 0,
+	0, 429, 217, 383, 408, 395, 0, 0, 377, 0, 494, 104, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 300, 0, 201, 0, 0, 0, 295, 0, 0, 0, 33,
+	0, 304, 0, 284, 202, 0, 457, 0, 0, 448, 24, 0, 192, 0, 215, 264,
+	0, 407, 0, 311, 0, 0, 0, 508, 0, 3, 0, 0, 194, 223, 0, 386,
+	0, 0, 0, 0, 0, 0, 370, 193, 0, 485, 0, 389, 0, 381, 397, 0,
+	392, 0, 136, 0, 0, 0, 125, 0, 86, 0, 0, 0, 0, 0, 0, 0,
+	391, 131, 290, 0, 312, 46, 49, 0, 0, 198, 0, 0, 85, 0, 222, 219,
+	468, 0, 482, 0, 436, 22, 0, 417, 291, 0, 191, 399, 0, 134, 99, 0,
+	0, 491, 0, 0, 12, 68, 434, 92, 0, 364, 262, 0, 0, 117, 326, 330,
+	0, 0, 0, 50, 0, 171, 260, 208, 281, 30, 318, 0, 211, 0, 140, 0,
+	23, 54, 115, 0, 335, 180, 17, 190, 518, 0, 0, 178, 188, 283, 0, 287,
+	207, 513, 0, 328, 0, 309, 25, 26, 0, 52, 0, 458, 0, 205, 0, 0,
+	0, 342, 507, 0, 70, 411, 0, 313, 495, 449, 0, 0, 0, 456, 13, 118,
+	277, 0, 421, 0, 36, 0, 362, 212, 0, 0, 393, 149, 0, 0, 355, 0,
+	213, 0, 444, 0, 0, 0, 64, 0, 0, 60, 0, 0, 0, 439, 0, 63,
+	0, 0, 268, 0, 0, 0, 0, 4, 174, 422, 0, 0, 0, 348, 0, 0,
+	0, 132, 0, 0, 0, 0, 435, 0, 465, 297, 0, 419, 279, 0, 0, 0,
+	0, 0, 154, 0, 329, 0, 498, 224, 0, 166, 221, 0, 269, 266, 276, 0,
+	0, 263, 347, 464, 0, 272, 428, 0, 0, 0, 0, 96, 0, 0, 379, 0,
+	0, 107, 127, 0, 90, 0, 0, 343, 0, 0, 0, 0, 0, 470, 42, 16,
+	497, 473, 0, 51, 0, 0, 41, 0, 0, 0, 0, 0, 15, 0, 0, 496,
+	144, 0, 184, 0, 338, 0, 137, 0, 0, 459, 487, 128, 67, 0, 0, 0,
+	44, 0, 503, 0, 0, 447, 0, 0, 110, 0, 0, 47, 225, 516, 430, 282,
+	510, 87, 440, 0, 231, 0, 0, 0, 0, 0, 0, 0, 0, 0, 18, 316,
+	350, 83, 323, 0, 185, 0, 0, 0, 0, 0, 0, 426, 0, 120, 0, 0,
+	406, 232, 0, 517, 0, 197, 512, 0, 414, 0, 0, 373, 204, 0, 0, 80,
+	27, 0, 0, 0, 195, 0, 463, 442, 62, 480, 0, 0, 0, 0, 113, 38,
+	270, 0, 66, 0, 0, 0, 0, 0, 103, 0, 34, 75, 476, 0, 81, 0,
+	135, 0, 321, 363, 0, 31, 0, 416, 35, 0, 0, 488, 368, 0, 451, 0,
+	0, 0, 6, 0, 0, 0, 390, 369, 467, 0, 0, 410, 28, 0, 367, 327,
+	0, 0, 155, 515, 349, 0, 0, 0, 302, 72, 322, 0, 437, 106, 0, 0,
+	0, 0, 431, 0, 0, 258, 0, 0, 0, 337, 157, 0, 39, 160, 0, 0,
+	353, 84, 0, 0, 179, 102, 307, 0, 273, 0, 0, 493, 0, 227, 0, 469,
+	162, 387, 0, 420, 43, 298, 0, 230, 0, 0, 0, 0, 403, 0, 98, 100,
+	0, 0, 14, 0, 486, 0, 288, 275, 324, 0, 0, 334, 78, 478, 69, 0,
+	133, 332, 319, 0, 0, 0, 167, 267, 504, 21, 357, 0, 0, 0, 365, 0,
+	0, 0, 0, 296, 0, 0, 170, 475, 109, 0, 0, 0, 235, 402, 0, 0,
+	0, 0, 168, 0, 0, 0, 382, 341, 0, 7, 220, 453, 366, 0, 423, 336,
+	0, 501, 0, 111, 0, 95, 490, 0, 0, 209, 0, 181, 0, 294, 0, 0,
+	0, 0, 48, 427, 0, 380, 303, 0, 0, 88, 0, 483, 509, 0, 0, 450,
+	0, 123, 443, 0, 0, 0, 45, 0, 0, 189, 0, 0, 0, 89, 0, 0,
+	234, 394, 11, 82, 0, 0, 0, 164, 0, 97, 0, 0, 299, 0, 265, 400,
+	0, 0, 19, 0, 142, 0, 0, 0, 0, 445, 0, 344, 425, 76, 514, 0,
+	0, 119, 79, 0, 484, 0, 158, 0, 0, 37, 124, 278, 306, 0, 0, 511,
+	0, 0, 159, 0, 226, 0, 0, 333, 0, 10, 499, 0, 176, 455, 0, 0,
+	0, 502, 0, 0, 130, 0, 0, 0, 0, 206, 0, 0, 0, 0, 0, 59,
+	216, 418, 259, 0, 0, 340, 274, 163, 0, 359, 0, 433, 0, 0, 187, 0,
+	375, 0, 0, 0, 0, 360, 56, 161, 505, 105, 404, 0, 292, 40, 0, 0,
+	0, 55, 477, 351, 0, 0, 462, 489, 0, 472, 57, 293, 0, 0, 385, 218,
+	9, 0, 492, 183, 61, 0, 0, 0, 0, 0, 314, 500, 0, 0, 0, 0,
+	0, 0, 93, 0, 405, 233, 0, 289, 0, 280, 0, 29, 0, 77, 0, 354,
+	461, 0, 199, 101, 0, 58, 376, 0, 126, 0, 471, 409, 0, 0, 0, 398,
+	0, 0, 0, 139, 286, 401, 228, 466, 412, 0, 0, 210, 0, 0, 0, 129,
+	0, 378, 384, 0, 229, 0, 0, 0, 53, 0, 165, 388, 0, 305, 0, 147,
+	121, 0, 143, 0, 0, 372, 0, 0, 325, 0, 0, 0, 0, 460, 114, 310,
+	358, 256, 145, 0, 0, 0, 257, 0, 0, 0, 0, 153, 346, 0, 0, 0,
+	196, 441, 186, 65, 0, 177, 73, 112, 151, 0, 0, 506, 156, 308, 108, 0,
+	474, 175, 0, 169, 0, 446, 317, 0, 0, 94, 5, 0, 116, 152, 261, 0,
+	0, 452, 91, 0, 0, 374, 0, 214, 0, 0, 0, 0, 424, 0, 0, 315,
+	0, 0, 0, 0, 432, 74, 0, 0, 339, 172, 0, 0, 8, 0, 150, 0,
+	138, 0, 345, 0, 438, 0, 479, 20, 352, 356, 0, 0, 415, 0, 0, 0,
+	0, 0, 0, 0, 331, 146, 481, 0, 203, 271, 454, 0, 285, 0, 0, 0,
+	371, 320, 0, 0, 0, 32, 0, 0, 0, 173, 182, 361, 396, 0, 0, 0,
+};
+
+static inline unsigned int dict_hash(const char *s, int len)
+{
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < len; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619u;
+	return h;
+}
+
+static inline unsigned int dict_mix(unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
 
@@ -30,6 +30,8 @@
 #include "wa_connection.h"
 #include "wa_util.h"
 #include "wa_constants.h"
+#include "wa_templates.h"
+#include "cryptopool.h"
 
 #include "AxolotlMessages.pb.h"
 #include "keyhelper.h"
@@ -40,22 +42,42 @@
 #include "axolotl_groups.h"
 #include "group_session_builder.h"
 
-static int isbroadcast(const std::string user)
+
+
+/* Pre-encoded stanzas, the shapes are in wa_templates.h */
+static Tree templateTree(const StanzaShape & shape)
 {
-	return (user.find("@broadcast") != std::string::npos);
+	Tree t(shape.tag);
+	for (unsigned int i = 0; i + 1 < shape.attributes.size(); i += 2)
+		t.setAtr(shape.attributes[i], shape.attributes[i+1]);
+	if (shape.child)
+		t.addChild(Tree(shape.child));
+	return t;
 }
 
-// Group numbers are a bit tricky! I wish I stored them as strings...
-static uint64_t JidAsInt(const std::string & s) {
-	std::string id = s.substr(0, s.find("@"));
-	std::string onlynums;
-	for (auto c: id)
-		if (c >= '0' && c <= '9')
-			onlynums += c;
-	
-	// This is fucking disgusting :D
-	onlynums = onlynums.substr(0, 19);
-	return std::stoull(onlynums);
+static const StanzaTemplate & receiptTemplate()
+{
+	static const StanzaTemplate st(templateTree(receiptShape));
+	return st;
+}
+
+static const StanzaTemplate & receiptAckTemplate()
+{
+	static const StanzaTemplate st(templateTree(receiptAckShape));
+	return st;
+}
+
+static const StanzaTemplate & pongTemplate()
+{
+	static const StanzaTemplate st(templateTree(pongShape));
+	return st;
+}
+
+static const StanzaTemplate & chatstateTemplate(bool composing)
+{
+	static const StanzaTemplate stc(templateTree(composingShape));
+	static const StanzaTemplate stp(templateTree(pausedShape));
+	return composing ? stc : stp;
 }
 
 DataBuffer WhatsappConnection::generateResponse(std::string from, std::string type, std::string id)
@@ -64,9 +86,14 @@ DataBuffer WhatsappConnection::generateResponse(std::string from, std::string ty
 		if (sendRead) type = "read";
 		else type = "delivery";
 	}
-	Tree mes("receipt", makeat({"to", from, "id", id, "type", type, "t", std::to_string(1)}));
+	const std::string args[] = { id, from, type };
+	return serialize_template(receiptTemplate(), args);
+}
 
-	return serialize_tree(&mes);
+DataBuffer WhatsappConnection::generateAck(std::string id, std::string type, std::string to, std::string from, std::string participant)
+{
+	const std::string args[] = { id, type, to, from, participant };
+	return serialize_template(receiptAckTemplate(), args);
 }
 
 std::string WhatsappConnection::tohex(uint64_t n) {
@@ -80,6 +107,26 @@ std::string WhatsappConnection::tohex(uint64_t n) {
 	return ret;
 }
 
+// Frame arenas kept around for reuse
+#define MAX_ARENA_POOL 8
+
+// Seconds to wait for an iq reply
+#define IQ_TIMEOUT 60
+
+#define KEEPALIVE_INTERVAL 30
+
+// Prekeys are refilled under this count, a while after using one
+#define PREKEY_MIN 10
+#define PREKEY_REFILL_DELAY 60
+
+// Submissions run per pump, and how long a delivery callback waits for
+// the read receipt
+#define SUBMIT_BATCH 1024
+#define DELIVERY_TRACK_TIME (24*60*60)
+
+// Message ids per coalesced receipt
+#define RECEIPT_BATCH 64
+
 #define adjustId(id) numToBytesZPadded(id, 3)
 static std::string numToBytesZPadded(uint64_t n, unsigned int padding) {
 	std::string ret;
@@ -91,21 +138,18 @@ static std::string numToBytesZPadded(uint64_t n, unsigned int padding) {
 		ret = '\0' + ret;
 	return ret;
 }
-static uint64_t num2int64(std::string s) {
-	uint64_t ret = 0;
-	for (auto c: s) {
-		ret = ret << 8;
-		ret |= (unsigned char)c;
-	}
-	return ret;
-}
 
 std::string WhatsappConnection::getNextIqId() {
 	return tohex(++iqid);
 }
 
+void WhatsappConnection::expectIq(const std::string & id, IqCallback cb)
+{
+	pending_iqs.add(id, time(0) + IQ_TIMEOUT, cb);
+}
+
 /* Send image transaction */
-int WhatsappConnection::sendImage(std::string mid, std::string to, int w, int h, unsigned int size, const char *fp)
+int WhatsappConnection::sendImage(std::string mid, std::string to, int w, int h, unsigned int size, const char *fp, IqCallback cb)
 {
 	/* Type can be: audio/image/video */
 	std::string siqid = getNextIqId();
@@ -125,13 +169,54 @@ int WhatsappConnection::sendImage(std::string mid, std::string to, int w, int h,
 	fu.thumbnail = getpreview(fp);
 	fu.msgid = mid;
 	uploadfile_queue.push_back(fu);
-	outbuffer = outbuffer + serialize_tree(&req);
+
+	/* The reply tells where to upload it, or that it's already there.
+	   The callback waits for the upload unless there's nothing to upload */
+	int rid = iqid;
+	expectIq(siqid, [this, rid, cb] (IqStatus status, Tree & reply) {
+		Tree t;
+		bool media = status == IqResult and reply.getChild("media", t);
+		bool duplicate = !media and status == IqResult and reply.getChild("duplicate", t);
+		if (!media and !duplicate) {
+			if (cb)
+				cb(status, reply);
+			return;
+		}
+
+		for (auto & fu : uploadfile_queue)
+			if (fu.rid == rid) {
+				fu.done = cb;
+				fu.slot = reply;
+			}
+		if (media)
+			this->handleIqMedia(rid, t);
+		else
+			this->handleIqDuplicate(rid, t);
+	});
+	outbuffer.push(serialize_tree(&req));
 
 	return iqid;
 }
 
+/* A message on its way to the crypto workers, and back */
+struct WhatsappConnection::CipheredMessage {
+	std::string from, id, author, mtype, receipt_to;
+	std::string type, mediatype, data;
+	unsigned long long time;
+	std::string plaintext;
+	bool ok;
+};
+
+/* Tells the workers whether the connection is still around */
+struct WhatsappConnection::CryptoLink {
+	std::mutex lock;
+	WhatsappConnection *conn;
+};
+
 WhatsappConnection::WhatsappConnection(std::string phonenum, std::string password, std::string nickname, std::string axolotldb)
+	: timers(time(0)), pending_iqs(timers)
 {
+	outbuffer.setSealer([this] (DataBuffer & frame) { this->sealFrame(frame); });
 	this->phone = phonenum;
 	this->password = password;
 	this->in = NULL;
@@ -147,12 +232,30 @@ WhatsappConnection::WhatsappConnection(std::string phonenum, std::string passwor
 	this->blists_updated = false;
 	this->sslstatus = 0;
 	this->frame_seq = 0;
+	this->in_seq = 0;
 	this->sendRead = true;
-	this->last_keepalive = 0;
-
-	// Create in memory temp database!
-	//this->axolotlStore.reset(new LiteAxolotlStore(axolotldb));
-	this->axolotlStore.reset(new InMemoryAxolotlStore());
+	this->keepalive_timer = 0;
+	this->prekey_timer = 0;
+	this->crypto_pool = NULL;
+	this->receipt_batch = RECEIPT_BATCH;
+	this->receipt_delay = 0;
+	this->receipt_timer = 0;
+
+	// Keys and sessions live in a database if we got one, in memory otherwise
+	if (axolotldb.size()) {
+		try {
+			if (axolotldb.size() > 4 and axolotldb.compare(axolotldb.size() - 4, 4, ".log") == 0)
+				this->axolotlStore.reset(new LoggedAxolotlStore(axolotldb));
+			else
+				this->axolotlStore.reset(new LiteAxolotlStore(axolotldb));
+		}
+		catch (WhisperException &e) {
+			DEBUG_PRINT("Axolotl exception (" << axolotldb << "): "
+				<< e.errorType() << " " << e.errorMessage());
+		}
+	}
+	if (!this->axolotlStore)
+		this->axolotlStore.reset(new InMemoryAxolotlStore());
 
 	/* Trim password spaces */
 	while (password.size() > 0 and password[0] == ' ')
@@ -162,10 +265,18 @@ WhatsappConnection::WhatsappConnection(std::string phonenum, std::string passwor
 
 	/* Remove non-numbers from phone */
 	phone.erase(std::remove_if(phone.begin(), phone.end(), [](char ch){return !isdigit(ch);}), phone.end());
+
+	registerStanzaHandlers();
+	registerIqHandlers();
 }
 
 WhatsappConnection::~WhatsappConnection()
 {
+	/* Workers still deciphering drop their results */
+	if (crypto_link) {
+		std::lock_guard < std::mutex > l(crypto_link->lock);
+		crypto_link->conn = NULL;
+	}
 	if (this->in)
 		delete this->in;
 	if (this->out)
@@ -173,12 +284,16 @@ WhatsappConnection::~WhatsappConnection()
 	for (unsigned int i = 0; i < recv_messages.size(); i++) {
 		delete recv_messages[i];
 	}
+	for (auto & m : sent_messages)
+		delete m.second;
 }
 
 std::string WhatsappConnection::saveAxolotlDatabase()
 {
-	// Serialize the database
-	//return axolotlStore->serialize();
+	// A database store is already saved
+	commitStore();
+	if (InMemoryAxolotlStore *mem = dynamic_cast<InMemoryAxolotlStore*>(axolotlStore.get()))
+		return mem->serialize();
 	return "";
 }
 
@@ -194,14 +309,17 @@ bool WhatsappConnection::groupsUpdated()
 	return r;
 }
 
-void WhatsappConnection::updateGroups()
+void WhatsappConnection::updateGroups(IqCallback cb)
 {
 	/* Get the group list */
 	groups.clear();
 	{
-		Tree req("iq", makeat({"id", getNextIqId(), "type", "get", "to", "g.us", "xmlns", "w:g2"}));
+		std::string id = getNextIqId();
+		Tree req("iq", makeat({"id", id, "type", "get", "to", "g.us", "xmlns", "w:g2"}));
 		req.addChild(Tree("participating"));
-		outbuffer = outbuffer + serialize_tree(&req);
+		if (cb)
+			expectIq(id, cb);
+		outbuffer.push(serialize_tree(&req));
 	}
 }
 
@@ -212,7 +330,7 @@ void WhatsappConnection::manageParticipant(std::string group, std::string partic
 	Tree req("iq", makeat({"id", getNextIqId(), "type", "set", "to", group + "@g.us", "xmlns", "w:g2"}));
 	req.addChild(iq);
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req));
 }
 
 void WhatsappConnection::leaveGroup(std::string group)
@@ -222,7 +340,7 @@ void WhatsappConnection::leaveGroup(std::string group)
 	Tree req("iq", makeat({"id", getNextIqId(), "type", "set", "to", "g.us", "xmlns", "w:g2"}));
 	req.addChild(iq);
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req));
 }
 
 void WhatsappConnection::addGroup(std::string subject)
@@ -231,7 +349,7 @@ void WhatsappConnection::addGroup(std::string subject)
 	Tree create("create", makeat({"subject", subject}));
 	req.addChild(create);
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req));
 }
 
 void WhatsappConnection::updateBlists()
@@ -246,7 +364,7 @@ void WhatsappConnection::updateBlists()
 	));
 	req.addChild(Tree("lists"));
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req));
 }
 
 bool WhatsappConnection::blistsUpdated()
@@ -268,7 +386,7 @@ void WhatsappConnection::deleteBlist(std::string id)
 	del.addChild(Tree("list", makeat({"id", id + "@broadcast"})));
 	req.addChild(del);
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req));
 }
 
 void WhatsappConnection::doLogin(std::string resource, bool send_ciphered)
@@ -277,29 +395,28 @@ void WhatsappConnection::doLogin(std::string resource, bool send_ciphered)
 	this->resource = resource;
 
 	/* Send stream init */
-	DataBuffer first;
 	error_queue.clear();
+	outbuffer.clear();
 
 	{
-		first.addData("WA\1\6", 4);
+		outbuffer.push(DataBuffer("WA\1\6", 4), OutControl);
 		Tree t("start", makeat({"resource",resource, "to",whatsappserver}));
-		first = first + serialize_tree(&t, false);
+		outbuffer.push(serialize_tree(&t, false), OutControl);
 	}
 
 	/* Send features */
 	{
 		Tree p("stream:features");
-		first = first + serialize_tree(&p, false);
+		outbuffer.push(serialize_tree(&p, false), OutControl);
 	}
 
 	/* Send auth request */
 	{
 		Tree t("auth", makeat({"mechanism","WAUTH-2", "user",phone}));
-		first = first + serialize_tree(&t, false);
+		outbuffer.push(serialize_tree(&t, false), OutControl);
 	}
 
 	conn_status = SessionWaitingChallenge;
-	outbuffer = first;
 }
 
 void WhatsappConnection::receiveCallback(const char *data, int len)
@@ -307,36 +424,197 @@ void WhatsappConnection::receiveCallback(const char *data, int len)
 	if (data != NULL and len > 0)
 		inbuffer.addData(data, len);
 	this->processIncomingData();
+	this->drainSubmissions();
+	this->commitStore();
+	if (receipt_delay <= 0)
+		this->flushReceipts();
 }
 
 int WhatsappConnection::sendCallback(char *data, int len)
 {
-	int minlen = outbuffer.size();
-	if (minlen > len)
-		minlen = len;
+	return outbuffer.copyOut(data, len);
+}
 
-	memcpy(data, outbuffer.getPtr(), minlen);
-	return minlen;
+#ifndef _WIN32
+int WhatsappConnection::sendCallback(struct iovec *iov, int iovcnt)
+{
+	return outbuffer.getIovec(iov, iovcnt);
 }
+#endif
 
 bool WhatsappConnection::hasDataToSend()
 {
-	// Check whether we need to send a keepalive
-	if (time(0) - last_keepalive > 30) {
-		last_keepalive = time(0);
-		if (conn_status == SessionConnected)
-			notifyMyPresence();
+	drainSubmissions();
+	runTimers();
+	commitStore();
+	if (receipt_delay <= 0)
+		flushReceipts();
+
+	return outbuffer.size() != 0 or submissions.size() != 0;
+}
+
+void WhatsappConnection::drainSubmissions()
+{
+	submissions.drain(SUBMIT_BATCH);
+}
+
+/* The store throws when it can't write (disk full, database locked),
+   which is reported as a connection error */
+bool WhatsappConnection::commitStore()
+{
+	try {
+		axolotlStore->commit();
+		return true;
+	}
+	catch (WhisperException &e) {
+		notifyError(errorUnknown, "Can't save the encryption keys: " + e.errorMessage());
+		return false;
 	}
+}
 
-	// Retry messages in the queue
-	processMsgQueue();
+void WhatsappConnection::submit(std::function < void (WhatsappConnection &) > work)
+{
+	if (submissions.push([this, work] () { work(*this); }) and submit_notify)
+		submit_notify();
+}
 
-	return outbuffer.size() != 0;
+void WhatsappConnection::submitChat(std::string msgid, std::string to, std::string message, DeliveryCallback cb)
+{
+	submit([msgid, to, message, cb] (WhatsappConnection & c) {
+		c.trackDelivery(msgid, cb);
+		c.sendChat(msgid, to, message);
+	});
+}
+
+void WhatsappConnection::submitGroupChat(std::string msgid, std::string to, std::string message, DeliveryCallback cb)
+{
+	submit([msgid, to, message, cb] (WhatsappConnection & c) {
+		c.trackDelivery(msgid, cb);
+		c.sendGroupChat(msgid, to, message);
+	});
+}
+
+void WhatsappConnection::submitImage(std::string mid, std::string to, int w, int h, unsigned int size, std::string fp, IqCallback cb)
+{
+	submit([mid, to, w, h, size, fp, cb] (WhatsappConnection & c) {
+		c.sendImage(mid, to, w, h, size, fp.c_str(), cb);
+	});
+}
+
+void WhatsappConnection::trackDelivery(const std::string & id, DeliveryCallback cb)
+{
+	if (!cb)
+		return;
+	delivery_callbacks[id] = cb;
+	timers.add(time(0) + DELIVERY_TRACK_TIME, [this, id] () { delivery_callbacks.erase(id); });
+}
+
+void WhatsappConnection::notifyDelivery(const std::string & id, ReceptionType type)
+{
+	auto it = delivery_callbacks.find(id);
+	if (it == delivery_callbacks.end())
+		return;
+
+	// Read is the last one we'll get
+	DeliveryCallback cb = it->second;
+	if (type == rRead)
+		delivery_callbacks.erase(it);
+	cb(id, type);
+}
+
+void WhatsappConnection::setReceiptBatching(unsigned int max_ids, int delay)
+{
+	flushReceipts();
+	receipt_batch = max_ids ? max_ids : 1;
+	receipt_delay = delay;
+}
+
+void WhatsappConnection::queueReceipt(const std::string & to, const std::string & id)
+{
+	auto r = pending_receipts.emplace(to, std::vector < std::string > ());
+	if (r.second)
+		receipt_order.push_back(to);
+	std::vector < std::string > & ids = r.first->second;
+	ids.push_back(id);
+
+	if (ids.size() >= receipt_batch)
+		flushReceipts(to);
+	else if (receipt_delay > 0 and receipt_timer == 0)
+		receipt_timer = timers.add(time(0) + receipt_delay, [this] () {
+			receipt_timer = 0;
+			flushReceipts();
+		});
+}
+
+// The first id goes in the receipt, the rest in its list
+void WhatsappConnection::flushReceipts(const std::string & to)
+{
+	auto it = pending_receipts.find(to);
+	if (it == pending_receipts.end() or it->second.empty())
+		return;
+
+	// Only acknowledge what the store keeps
+	if (!commitStore())
+		return;
+
+	std::vector < std::string > & ids = it->second;
+	if (ids.size() == 1)
+		outbuffer.push(generateResponse(to, "", ids[0]), OutReceipt);
+	else {
+		Tree receipt("receipt", makeat({"id", ids[0], "t", "1", "to", to, "type", sendRead ? "read" : "delivery"}));
+		Tree list("list");
+		for (unsigned int i = 1; i < ids.size(); i++)
+			list.addChild(Tree("item", makeat({"id", ids[i]})));
+		receipt.addChild(list);
+		outbuffer.push(serialize_tree(&receipt), OutReceipt);
+	}
+	ids.clear();
+}
+
+void WhatsappConnection::flushReceipts()
+{
+	if (receipt_timer) {
+		timers.cancel(receipt_timer);
+		receipt_timer = 0;
+	}
+	for (auto & to : receipt_order)
+		flushReceipts(to);
+	receipt_order.clear();
+	pending_receipts.clear();
+}
+
+void WhatsappConnection::runTimers()
+{
+	timers.advance(time(0));
+}
+
+void WhatsappConnection::scheduleKeepalive()
+{
+	timers.cancel(keepalive_timer);
+	keepalive_timer = timers.add(time(0) + KEEPALIVE_INTERVAL, [this] () {
+		keepalive_timer = 0;
+		if (conn_status == SessionConnected) {
+			notifyMyPresence();
+			scheduleKeepalive();
+		}
+	});
+}
+
+void WhatsappConnection::schedulePrekeyRefill()
+{
+	if (prekey_timer)
+		return;
+
+	prekey_timer = timers.add(time(0) + PREKEY_REFILL_DELAY, [this] () {
+		prekey_timer = 0;
+		if (conn_status == SessionConnected and axolotlStore->countPreKeys() < PREKEY_MIN)
+			sendEncrypt(false);
+	});
 }
 
 void WhatsappConnection::sentCallback(int len)
 {
-	outbuffer.popData(len);
+	outbuffer.consume(len);
 }
 
 int WhatsappConnection::sendSSLCallback(char *buffer, int maxbytes)
@@ -420,7 +698,7 @@ int WhatsappConnection::uploadComplete(int rid) {
 void WhatsappConnection::subscribePresence(std::string user)
 {
 	Tree request("presence", makeat({"type", "subscribe", "to", user}));
-	outbuffer = outbuffer + serialize_tree(&request);
+	outbuffer.push(serialize_tree(&request));
 }
 
 void WhatsappConnection::queryStatuses()
@@ -434,10 +712,10 @@ void WhatsappConnection::queryStatuses()
 	}
 	req.addChild(stat);
 	
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req));
 }
 
-std::string WhatsappConnection::syncContacts(std::vector < std::string > clist)
+std::string WhatsappConnection::syncContacts(std::vector < std::string > clist, IqCallback cb)
 {
 	std::string uid = getNextIqId();
 	Tree req("iq", makeat({"id", uid, "type", "get", "xmlns", "urn:xmpp:whatsapp:sync"}));
@@ -449,7 +727,17 @@ std::string WhatsappConnection::syncContacts(std::vector < std::string > clist)
 	}
 	req.addChild(sync);
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	/* Without a callback the result waits for getSyncResult */
+	if (cb)
+		expectIq(uid, cb);
+	else
+		expectIq(uid, [this] (IqStatus status, Tree & reply) {
+			Tree t;
+			if (status == IqResult and reply.getChild("sync", t))
+				this->handleIqSync(reply, t);
+		});
+
+	outbuffer.push(serialize_tree(&req), OutBulk);
 	return uid;
 }
 
@@ -473,14 +761,8 @@ void WhatsappConnection::gotTyping(std::string who, std::string tstat)
 
 void WhatsappConnection::notifyTyping(std::string who, int status)
 {
-	std::string s = "paused";
-	if (status == 1)
-		s = "composing";
-
-	Tree mes("chatstate", makeat({"to", who + "@" + whatsappserver}));
-	mes.addChild(Tree(s));
-
-	outbuffer = outbuffer + serialize_tree(&mes);
+	const std::string args[] = { who + "@" + whatsappserver };
+	outbuffer.push(serialize_template(chatstateTemplate(status == 1), args));
 }
 
 void WhatsappConnection::account_info(unsigned long long &creation, unsigned long long &freeexp, std::string & status)
@@ -490,12 +772,15 @@ void WhatsappConnection::account_info(unsigned long long &creation, unsigned lon
 	status = account_status;
 }
 
-void WhatsappConnection::queryPreview(std::string user)
+void WhatsappConnection::queryPreview(std::string user, IqCallback cb)
 {
-	Tree req("iq", makeat({"id", getNextIqId(), "type", "get", "to", user, "xmlns", "w:profile:picture"}));
+	std::string id = getNextIqId();
+	Tree req("iq", makeat({"id", id, "type", "get", "to", user, "xmlns", "w:profile:picture"}));
 	req.addChild(Tree("picture", makeat({"type", "preview"})));
+	if (cb)
+		expectIq(id, cb);
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req));
 }
 
 void WhatsappConnection::queryFullSize(std::string user)
@@ -503,7 +788,7 @@ void WhatsappConnection::queryFullSize(std::string user)
 	Tree req("iq", makeat({"id", getNextIqId(), "type", "get", "to", user, "xmlns", "w:profile:picture"}));
 	req.addChild(Tree("picture"));
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req));
 }
 
 void WhatsappConnection::send_avatar(const std::string & avatar, const std::string & avatarp)
@@ -515,28 +800,18 @@ void WhatsappConnection::send_avatar(const std::string & avatar, const std::stri
 	req.addChild(pic);
 	req.addChild(prev);
 
-	outbuffer = outbuffer + serialize_tree(&req);
+	outbuffer.push(serialize_tree(&req), OutBulk);
 }
 
 bool WhatsappConnection::queryReceivedMessage(std::string & msgid, int & type, unsigned long long & t, std::string & sender)
 {
 	if (received_messages.size() == 0) return false;
 
-	// Remove messages in the queue on read or delivered successfully
-	if (type == rRead || type == rDelivered) {
-		for (auto msg: queue_messages) {
-			if (msg->id == msgid) {
-				msg->retries = -1;
-				break;
-			}
-		}
-	}
-
-	msgid = received_messages[0].id;
-	type = received_messages[0].type;
-	t = received_messages[0].t;
-	sender = received_messages[0].from;
-	received_messages.erase(received_messages.begin());
+	msgid = received_messages.front().id;
+	type = received_messages.front().type;
+	t = received_messages.front().t;
+	sender = received_messages.front().from;
+	received_messages.pop_front();
 
 	return true;
 }
@@ -550,18 +825,43 @@ std::string WhatsappConnection::getMessageId()
 }
 
 
-void WhatsappConnection::retryMessage(std::string id) {
-	// Look for the message in the queue and resend it on the plain :D
-	for (auto msg: queue_messages) {
-		if (msg->id == id) {
-			msg->axolotl = false;
-			msg->retries = 0;
+void WhatsappConnection::queueMessage(Message * msg)
+{
+	auto it = sent_messages.find(msg->id);
+	if (it != sent_messages.end()) {
+		// Same id sent again, the old one is forgotten
+		cancelMessage(msg->id);
+	}
+	sent_messages[msg->id] = msg;
+	queue_messages.push_back(msg);
+}
 
-			// Re-query user keys just in case they've changed
-			sendGetCipherKeysFromUser(msg->from);
+void WhatsappConnection::cancelMessage(const std::string & id)
+{
+	auto it = sent_messages.find(id);
+	if (it == sent_messages.end())
+		return;
 
-			break;
-		}
+	Message *msg = it->second;
+	sent_messages.erase(it);
+	// Still queued ones are freed by processMsgQueue
+	if (msg->retries == 0)
+		msg->retries = -1;
+	else
+		delete msg;
+}
+
+void WhatsappConnection::retryMessage(std::string id) {
+	// Look for the message in the queue and resend it on the plain :D
+	auto it = sent_messages.find(id);
+	if (it != sent_messages.end() and it->second->retries > 0) {
+		Message *msg = it->second;
+		msg->axolotl = false;
+		msg->retries = 0;
+		queue_messages.push_back(msg);
+
+		// Re-query user keys just in case they've changed
+		sendGetCipherKeysFromUser(msg->from);
 	}
 
 	// Process the message queue
@@ -569,9 +869,14 @@ void WhatsappConnection::retryMessage(std::string id) {
 }
 
 void WhatsappConnection::processMsgQueue() {
-	for (auto msg: queue_messages) {
-		if (msg->retries != 0) continue;
-		// Only processing messages that haven't been processed!
+	// Only messages that haven't been processed are queued
+	while (!queue_messages.empty()) {
+		Message *msg = queue_messages.front();
+		queue_messages.pop_front();
+		if (msg->retries < 0) {
+			delete msg;
+			continue;
+		}
 
 		DataBuffer buf;
 		if (msg->axolotl && this->send_ciphered) {
@@ -589,7 +894,9 @@ void WhatsappConnection::processMsgQueue() {
 				ChatMessage * txtmsg = dynamic_cast<ChatMessage*>(msg);
 				if (txtmsg) {
 					SessionCipher *cipher = getSessionCipher(recepientId);
+					std::unique_lock<std::mutex> l = lockRecord(recepientId);
 					std::shared_ptr<CiphertextMessage> ciphertext(cipher->encrypt(txtmsg->getProtoBuf().c_str()));
+					l.unlock();
 
 					CipheredChatMessage cmsg(
 						this, msg->from, msg->t, msg->id, ciphertext->serialize(), txtmsg->author, 
@@ -608,16 +915,13 @@ void WhatsappConnection::processMsgQueue() {
 			msg->retries = -1;
 		}
 
-		outbuffer = outbuffer + buf;
-	}
+		outbuffer.push(std::move(buf));
 
-	// Clean up messages that are no longer needed
-	auto it = queue_messages.begin();
-	while (it != queue_messages.end()) {
-		if ((*it)->retries < 0)
-			it = queue_messages.erase(it);
-		else
-			it++;
+		// Messages that are no longer needed, the rest wait for a receipt
+		if (msg->retries < 0) {
+			sent_messages.erase(msg->id);
+			delete msg;
+		}
 	}
 }
 
@@ -626,12 +930,12 @@ void WhatsappConnection::sendVCard(const std::string msgid, const std::string to
 	VCardMessage msg(this, to, time(NULL), msgid, nickname, name, vcard);
 	DataBuffer buf = msg.serialize();
 
-	outbuffer = outbuffer + buf;
+	outbuffer.push(std::move(buf));
 }
 
 void WhatsappConnection::sendChat(std::string msgid, std::string to, std::string message)
 {
-	queue_messages.push_back(new ChatMessage(this, to, time(NULL), msgid, message, nickname));
+	queueMessage(new ChatMessage(this, to, time(NULL), msgid, message, nickname));
 
 	processMsgQueue();
 }
@@ -642,7 +946,7 @@ void WhatsappConnection::sendGroupChat(std::string msgid, std::string to, std::s
 	msg.server = "g.us";
 	DataBuffer buf = msg.serialize();
 
-	outbuffer = outbuffer + buf;
+	outbuffer.push(std::move(buf));
 }
 
 void WhatsappConnection::addContacts(std::vector < std::string > clist)
@@ -794,12 +1098,16 @@ void WhatsappConnection::updateFileUpload(std::string json)
 	std::string mimetype = query_field(work, "mimetype");
 
 	std::string to, thumb, ip, mid;
+	IqCallback done;
+	Tree slot;
 	for (unsigned int j = 0; j < uploadfile_queue.size(); j++)
 		if (uploadfile_queue[j].uploading and uploadfile_queue[j].hash == filehash) {
 			to = uploadfile_queue[j].to;
 			thumb = uploadfile_queue[j].thumbnail;
 			ip = uploadfile_queue[j].ip;
 			mid = uploadfile_queue[j].msgid;
+			done = uploadfile_queue[j].done;
+			slot = uploadfile_queue[j].slot;
 			uploadfile_queue.erase(uploadfile_queue.begin() + j);
 			break;
 		}
@@ -810,7 +1118,10 @@ void WhatsappConnection::updateFileUpload(std::string json)
 
 	DataBuffer buf = msg.serialize();
 
-	outbuffer = outbuffer + buf;
+	outbuffer.push(std::move(buf));
+
+	if (done)
+		done(IqResult, slot);
 }
 
 /* Quick and dirty way to parse the HTTP responses */
@@ -853,6 +1164,14 @@ void WhatsappConnection::processSSLIncomingData()
 	return;
 abortStatus:
 	sslstatus = 0;
+	/* The upload stays queued as before, but whoever waits for it hears */
+	for (auto & fu : uploadfile_queue)
+		if (fu.uploading and fu.done) {
+			IqCallback done = std::move(fu.done);
+			fu.done = IqCallback();
+			done(IqError, fu.slot);
+			break;
+		}
 	processUploadQueue();
 	return;
 }
@@ -926,19 +1245,28 @@ void WhatsappConnection::processUploadQueue()
 	}
 }
 
+
+
+
+
+
+
+
 void WhatsappConnection::processIncomingData()
 {
 	/* Parse the data and create as many Trees as possible */
 	std::vector < Tree > treelist;
 	if (inbuffer.size() >= 3) {
-		/* Consume as many trees as possible */
+		/* Consume as many trees as possible, drop the parsed bytes at once */
+		DataReader reader(inbuffer.getPtr(), inbuffer.size());
 		bool ok;
 		do {
 			Tree t;
-			ok = parse_tree(&inbuffer, t);
+			ok = parse_tree(&reader, t);
 			if (ok)
 				treelist.push_back(t);
-		} while (ok and inbuffer.size() >= 3);
+		} while (ok and reader.size() >= 3);
+		inbuffer.popData(reader.consumed());
 	}
 
 	/* Now process the tree list! */
@@ -946,379 +1274,150 @@ void WhatsappConnection::processIncomingData()
 	for (auto & tl : treelist) {
 		DEBUG_PRINT( "Tree read:\n" );
 		DEBUG_PRINT( tl.toString() );
-		if (tl.getTag() == "challenge") {
-			/* Generate a session key using the challege & the password */
-			assert(conn_status == SessionWaitingChallenge);
-
-			KeyGenerator::generateKeysV14(password, tl.getData().c_str(), tl.getData().size(), (char *)this->session_key);
-
-			in  = new RC4Decoder(&session_key[20*2], 20, 768);
-			out = new RC4Decoder(&session_key[20*0], 20, 768);
-
-			conn_status = SessionWaitingAuthOK;
-			challenge_data = tl.getData();
-
-			this->sendResponse();
-		} else if (tl.getTag() == "success") {
-			/* Notifies the success of the auth */
-			conn_status = SessionConnected;
-			if (tl.hasAttribute("status"))
-				this->account_status = tl["status"];
-			if (tl.hasAttribute("kind"))
-				this->account_type = tl["kind"];
-			if (tl.hasAttribute("expiration"))
-				this->account_expiration = tl["expiration"];
-			if (tl.hasAttribute("creation"))
-				this->account_creation = tl["creation"];
-
-			this->notifyMyPresence();
-			this->updatePrivacy();
-			this->sendInitial();  // Seems to trigger an error IQ response
-			this->updateGroups();
-			this->updateBlists();
-
-			if (axolotlStore->countPreKeys() == 0)
-				this->sendEncrypt(true);
-
-			DEBUG_PRINT("Logged in!!!");
-		} else if (tl.getTag() == "failure") {
-			std::string reason = "unknown";
-			if (tl.hasChild("not-authorized"))
-				reason = "not-authorized";
-
-			if (conn_status == SessionWaitingAuthOK)
-				this->notifyError(errorAuth, reason);
-			else
-				this->notifyError(errorUnknown, reason);
-		} else if (tl.getTag() == "notification") {
-			DataBuffer reply = generateResponse( tl["from"], tl["type"], tl["id"] );
-			outbuffer = outbuffer + reply;
-			
-			if (tl.hasAttributeValue("type", "participant") || 
-				tl.hasAttributeValue("type", "owner") ||
-				tl.hasAttributeValue("type", "w:gp2") ) {
-				/* If the nofitication comes from a group, assume we have to reload groups ;) */
-				updateGroups();
-			}
-
-			if (tl.hasAttributeValue("type", "encrypt")) {
-				// Push some more keys?
-				this->sendEncrypt(false);
-			}
-
-			if (tl.hasAttributeValue("type", "picture")) {
-				/* Picture update */
-				this->queryPreview(tl["from"]);
-			}
-		} else if (tl.getTag() == "ack") {
-			std::string id = tl["id"];
-			unsigned long long t = 0;
-			if (tl.hasAttribute("t"))
-				t = std::stoull(tl["t"]);
-			received_messages.push_back( {id, rSent, t, ""} );
-
-		} else if (tl.getTag() == "receipt") {
-			std::string id = tl["id"];
-			std::string type = tl["type"];
-			if (type == "") type = "delivery";
-			std::string from = tl["from"];
-			std::string to = tl["to"];
-			std::string participant = tl["participant"];
-			unsigned long long t = 0;
-			if (tl.hasAttribute("t"))
-				t = std::stoull(tl["t"]);
-			
-			Tree mes("ack", makeat({"class", "receipt", "type", type, "id", id}));
-
-			// Add optional fields
-			if (from != "") mes["to"] = from;
-			if (to != "") mes["from"] = to;
-			if (participant != "") mes["participant"] = participant;
-
-			outbuffer = outbuffer + serialize_tree(&mes);
-
-			// Add reception package to queue or retry it
-			std::string who = getusername(participant.size() ? participant : from);
-			if (type == "read")
-				received_messages.push_back( {id, rRead, t, } );
-			else if (type == "delivery")
-				received_messages.push_back( {id, rDelivered, t, } );
-			else if (type == "retry")
-				this->retryMessage(id);
-		} else if (tl.getTag() == "chatstate") {
-			if (tl.hasChild("composing"))
-				this->gotTyping(tl["from"], "composing");
-			if (tl.hasChild("paused"))
-				this->gotTyping(tl["from"], "paused");
-			
-		} else if (tl.getTag() == "message") {
-			/* Receives a message! */
-			DEBUG_PRINT("Received message stanza...");
-			bool donotreply = false;
-			if (tl.hasAttribute("from") and
-				(tl.hasAttributeValue("type", "text") or tl.hasAttributeValue("type", "media"))) {
-				unsigned long long time = 0;
-				if (tl.hasAttribute("t"))
-					time = std::stoull(tl["t"]);
-				std::string from = tl["from"];
-				std::string id = tl["id"];
-				std::string author = tl["participant"];
-
-				if (isbroadcast(from))
-					from = author;
-
-				Tree t;
-				if (tl.getChild("body", t)) {
-					this->receiveMessage(ChatMessage(this, from, time, id, t.getData(), author));
-				}
-				if (tl.getChild("enc", t)) {
-					if (!this->receiveCipheredMessage(from, id, author, time, t, tl["type"]))
-						donotreply = true;
-				}
-				if (tl.getChild("media", t)) {
-					if (t.hasAttributeValue("type", "image")) {
-						this->receiveMessage(ImageMessage(this, from, time, id, author, 
-							t["url"], t["caption"], t["ip"], std::stoi(t["width"]), std::stoi(t["height"]),
-							std::stoi(t["size"]), t["encoding"], t["filehash"], t["mimetype"],
-							t.getData()));
-					} else if (t.hasAttributeValue("type", "location")) {
-						this->receiveMessage(LocationMessage(this, from, time, id, author, str2dbl(t["latitude"]), str2dbl(t["longitude"]), t["name"], t.getData()));
-					} else if (t.hasAttributeValue("type", "audio")) {
-						this->receiveMessage(SoundMessage(this, from, time, id, author, t["url"], t["caption"], t["filehash"], t["mimetype"]));
-					} else if (t.hasAttributeValue("type", "video")) {
-						this->receiveMessage(VideoMessage(this, from, time, id, author, t["url"], t["caption"], t["filehash"], t["mimetype"]));
-					} else if (t.hasAttributeValue("type", "vcard")) {
-						Tree vc;
-						if (t.getChild("vcard", vc))
-							this->receiveMessage(VCardMessage(this, from, time, id, author, t["name"], vc.getData()));
-					}
-				}
-			} else if (tl.hasAttributeValue("type", "notification") and tl.hasAttribute("from")) {
-				/* If the nofitication comes from a group, assume we have to reload groups ;) */
-				updateGroups();
-			}
-			/* Generate response for the messages */
-			if (tl.hasAttribute("type") and tl.hasAttribute("from") and not donotreply) { //FIXME
-				DataBuffer reply = generateResponse(tl["from"], "", tl["id"]);
-				outbuffer = outbuffer + reply;
-			}
-		} else if (tl.getTag() == "call") {
-			if (tl.hasAttribute("notify")) {
-				unsigned long long time = 0;
-				if (tl.hasAttribute("t"))
-					time = std::stoull(tl["t"]);
-				std::string from = tl["from"];
-				std::string id = tl["id"];
-
-				this->receiveMessage(CallMessage(this, from, time, id));
-			}
-			DataBuffer reply = generateResponse(tl["from"], "", tl["id"]);
-			outbuffer = outbuffer + reply;
-		} else if (tl.getTag() == "presence") {
-			/* Receives the presence of the user, for v14 type is optional */
-			if (tl.hasAttribute("from")) {
-				this->notifyPresence(tl["from"], tl["type"], tl["last"]);
-			}
-		} else if (tl.getTag() == "iq") {
-			/* Receives the presence of the user */
-			if (tl.hasAttributeValue("type", "result") and tl.hasAttribute("from")) {
-				Tree t;
-				if (tl.getChild("picture", t)) {
-					if (t.hasAttributeValue("type", "preview"))
-						this->addPreviewPicture(tl["from"], t.getData());
-					if (t.hasAttributeValue("type", "image"))
-						this->addFullsizePicture(tl["from"], t.getData());
-				}
-				if (tl.getChild("media", t)) {
-					for (unsigned int j = 0; j < uploadfile_queue.size(); j++) {
-						if (tohex(uploadfile_queue[j].rid) == tl["id"]) {
-							/* Queue to upload the file */
-							uploadfile_queue[j].uploadurl = t["url"];
-							uploadfile_queue[j].ip = t["ip"];
-							std::string host = uploadfile_queue[j].uploadurl.substr(8);	/* Remove https:// */
-							for (unsigned int i = 0; i < host.size(); i++)
-								if (host[i] == '/')
-									host = host.substr(0, i);
-							uploadfile_queue[j].host = host;
-
-							this->processUploadQueue();
-							break;
-						}
-					}
-				}
+		dispatcher.dispatch(tl);
+	}
 
-				if (tl.getChild("duplicate", t)) {
-					for (unsigned int j = 0; j < uploadfile_queue.size(); j++) {
-						if (tohex(uploadfile_queue[j].rid) == tl["id"]) {
-							/* Generate a fake JSON and process directly */
-							std::string json = "{\"name\":\"" + uploadfile_queue[j].file + "\"," "\"url\":\"" + t["url"] + "\"," "\"size\":\"" + t["size"] + "\"," "\"mimetype\":\"" + t["mimetype"] + "\"," "\"filehash\":\"" + t["filehash"] + "\"," "\"type\":\"" + t["type"] + "\"," "\"width\":\"" + t["width"] + "\"," "\"height\":\"" + t["height"] + "\"}";
+	/* Keep the arenas nobody else holds for the next frames */
+	for (auto & tl : treelist) {
+		std::shared_ptr < TreeArena > arena = tl.getArena();
+		tl = Tree();
+		if (arena.use_count() == 1 and arena_pool.size() < MAX_ARENA_POOL) {
+			arena->reset();
+			arena_pool.push_back(arena);
+		}
+	}
+}
 
-							uploadfile_queue[j].uploading = true;
-							this->updateFileUpload(json);
-							break;
-						}
-					}
-				}
+bool WhatsappConnection::receiveCipheredMessage(std::string from, std::string id,
+	std::string author, unsigned long long time, Tree enc, std::string mtype) {
 
-				// Status result
-				if (tl.getChild("status", t)) {
-					std::vector < Tree > childs = t.getChildren();
-					for (unsigned int j = 0; j < childs.size(); j++) {
-						if (childs[j].getTag() == "user") {
-							std::string user = getusername(childs[j]["jid"]);
-							contacts[user].status = utf8_decode(childs[j].getData());
-						}
-					}
-				}
+	if (enc["type"] == "pkmsg")
+		return this->parsePreKeyWhisperMessage(from, id, author, time, enc, mtype);
+	else if (enc["type"] == "skmsg")
+		return this->parseGroupWhisperMessage(from, id, author, time, enc, mtype);
+	else
+		return this->parseWhisperMessage(from, id, author, time, enc, mtype);
+}
 
-				std::vector < Tree > childs = tl.getChildren();
-				for (unsigned int j = 0; j < childs.size(); j++) {
-					if (childs[j].getTag() == "groups") {
-						std::vector < Tree > cgroups = childs[j].getChildren();
-						for (auto & g : cgroups) {
-							if (g.getTag() != "group") continue;
-							bool rep = groups.find(getusername(g["id"])) != groups.end();
-							if (not rep) {
-								unsigned long long subjt = 0, creat = 0;
-								if (g.hasAttribute("s_t"))
-									subjt = std::stoull(g["s_t"]);
-								if (g.hasAttribute("creation"))
-									creat = std::stoull(g["creation"]);
-
-								Group ng(
-									getusername(g["id"]), g["subject"], subjt, 
-									getusername(g["s_o"]),
-									getusername(g["creator"]), creat
-								);
-								for (auto & pa: g.getChildren()) {
-									if (pa.getTag() != "participant") continue;
-									ng.participants.push_back(
-										Group::Participant(getusername(pa["jid"]), pa["type"])
-									);
-								}
-
-								groups.insert(	
-									std::pair < std::string, Group > (
-										getusername(g["id"]),
-										ng
-									)
-								);
-							}
-						}
-						groups_updated = true;
-					} else if (childs[j].getTag() == "add") {
-						//groups_updated = true;
-					} else if (childs[j].getTag() == "lists") {
-						// For every blist, add it to the blist vector
-						std::vector < Tree > clists = childs[j].getChildren();
-						for (unsigned int k = 0; k < clists.size(); k++) {
-							if (clists[k].hasAttribute("id")) {
-								BList bl(clists[k]["id"], clists[k]["name"]);
-								std::vector < Tree > parts = clists[k].getChildren();
-								for (unsigned int l = 0; l < parts.size(); l++) {
-									if (parts[l].getTag() == "recipient" && parts[l]["jid"] != "")
-										bl.dests.push_back(parts[l]["jid"]);
-								}
-							}
-						}
-						blists_updated = true;
-					}
-				}
+void WhatsappConnection::setCryptoPool(CryptoPool * pool)
+{
+	crypto_pool = pool;
+	if (!pool or crypto_store)
+		return;
 
-				if (tl.getChild("group", t)) {
-					if (t.hasAttributeValue("type", "preview"))
-						this->addPreviewPicture(tl["from"], t.getData());
-					if (t.hasAttributeValue("type", "image"))
-						this->addFullsizePicture(tl["from"], t.getData());
-				}
+	/* The store is shared with the workers from now on */
+	crypto_store.reset(new LockedAxolotlStore(axolotlStore));
+	axolotlStore = crypto_store;
+	for (auto & c : cipherHash)
+		delete c.second;
+	for (auto & c : gcipherHash)
+		delete c.second;
+	cipherHash.clear();
+	gcipherHash.clear();
+
+	crypto_link.reset(new CryptoLink());
+	crypto_link->conn = this;
+}
+
+std::unique_lock<std::mutex> WhatsappConnection::lockRecord(uint64_t key)
+{
+	if (!crypto_store)
+		return std::unique_lock<std::mutex>();
+	return std::unique_lock<std::mutex>(crypto_store->recordLock(key));
+}
+
+void WhatsappConnection::decipherAsync(std::string from, std::string id, std::string author,
+	unsigned long long time, Tree & enc, std::string mtype, std::string receipt_to)
+{
+	std::shared_ptr<CipheredMessage> cm(new CipheredMessage());
+	cm->from = from;
+	cm->id = id;
+	cm->author = author;
+	cm->mtype = mtype;
+	cm->receipt_to = receipt_to;
+	cm->type = enc["type"];
+	cm->mediatype = enc["mediatype"];
+	cm->data = enc.getData();
+	cm->time = time;
+
+	std::shared_ptr<LockedAxolotlStore> store = crypto_store;
+	std::shared_ptr<CryptoLink> link = crypto_link;
+	CryptoPool::Job job = [store, link, cm] () {
+		decipher(store, *cm);
+
+		std::lock_guard < std::mutex > l(link->lock);
+		if (link->conn)
+			link->conn->submit([cm] (WhatsappConnection & c) { c.receiveDeciphered(*cm); });
+	};
+
+	/* Sharded by chat. Group messages also wait for the ones before
+	   them, which may carry their sender key */
+	if (cm->type == "skmsg")
+		crypto_pool->postFenced(JidAsInt(from), job);
+	else
+		crypto_pool->post(JidAsInt(from), job);
+}
 
-				if (tl.getChild("privacy", t)) {
-					for (auto & ct : t.getChildren()) {
-						if (ct.hasAttributeValue("name","last"))
-							this->show_last_seen = ct["value"];
-						if (ct.hasAttributeValue("name","status"))
-							this->show_status_msg = ct["value"];
-						if (ct.hasAttributeValue("name","profile"))
-							this->show_profile_pic = ct["value"];
-					}
-				}
+/* Runs on a worker: the store is all it touches */
+void WhatsappConnection::decipher(std::shared_ptr<LockedAxolotlStore> store, CipheredMessage & cm)
+{
+	cm.ok = false;
+	try {
+		uint64_t recepientId = JidAsInt(cm.from);
+		std::unique_lock < std::mutex > l(store->recordLock(recepientId));
+		if (cm.type == "skmsg") {
+			GroupCipher cipher(store, cm.from);
+			cm.plaintext = cipher.decrypt(cm.data);
+		}
+		else {
+			SessionCipher cipher(store, recepientId, 1);
+			if (cm.type == "pkmsg")
+				cm.plaintext = cipher.decrypt(std::shared_ptr<PreKeyWhisperMessage>(new PreKeyWhisperMessage(cm.data)));
+			else
+				cm.plaintext = cipher.decrypt(std::shared_ptr<WhisperMessage>(new WhisperMessage(cm.data)));
+		}
+		l.unlock();
 
-				if (tl.getChild("sync", t)) {
-					std::vector <std::string> ct_in, ct_out, ct_invalid;
-					for (auto & tt: t.getChildren()) {
-						for (auto & user: tt.getChildren()) {
-							if (user.getTag() != "user") continue;
-							if (tt.getTag() == "in")
-								ct_in.push_back(getusername(user["jid"]));
-							if (tt.getTag() == "out")
-								ct_out.push_back(getusername(user["jid"]));
-							if (tt.getTag() == "invalid")
-								ct_invalid.push_back(getusername(user["jid"]));
-						}
-					}
-					sync_result[tl["id"]] = ct_in;
-				}
+		if (cm.type == "pkmsg") {
+			// Parse any sender key bundled
+			wapurple::AxolotlMessage pbuf;
+			pbuf.ParseFromString(cm.plaintext);
 
-				if (tl.getChild("list", t)) {
-					for (auto & tt: t.getChildren()) {
-						if (tt.getTag() == "user") {
-							// Read subchild
-							Tree tident, treg, tskey, tkey;
-							if (tt.getChild("identity", tident) and tt.getChild("registration", treg) and 
-								tt.getChild("skey", tskey) and tt.getChild("skey", tkey)) {
-
-								IdentityKey identityKey(DjbECPublicKey(tident.getData()));
-								uint64_t registrationId = num2int64(treg.getData());
-
-								Tree tid, tvalue, tsig;
-
-								tkey.getChild("id", tid);
-								tkey.getChild("value", tvalue);
-								uint64_t preKeyId = num2int64(tid.getData());
-								DjbECPublicKey preKeyPublic(tvalue.getData());
-
-								tskey.getChild("id", tid);
-								tskey.getChild("value", tvalue);
-								tskey.getChild("signature", tsig);
-								uint64_t skeyId = num2int64(tid.getData());
-								DjbECPublicKey signedKey(tvalue.getData());
-								std::string signedSignature = tsig.getData();
-
-								PreKeyBundle bundle(registrationId, 1, preKeyId, preKeyPublic, skeyId, signedKey, signedSignature, identityKey);
-								uint64_t recepientId = JidAsInt(tt["jid"]);
-								SessionBuilder *sessionBuilder = new SessionBuilder(axolotlStore, recepientId, 1);
-
-								try {
-									sessionBuilder->process(bundle);
-								}
-								catch (WhisperException &e) {
-									DEBUG_PRINT("Axolotl exception (parse user key list iq reply): "
-										<< e.errorType() << " " << e.errorMessage());
-								}
-
-							}
-						}
-					}
-				}
+			if (pbuf.has_senderkeydistributionmessage()) {
+				std::string gid = pbuf.senderkeydistributionmessage().groupid();
+				std::string skd = pbuf.senderkeydistributionmessage().axolotlsenderkeydistributionmessage();
 
-			}
-			if (tl.hasAttribute("from") and tl.hasAttribute("id") and 
-				tl.hasAttributeValue("xmlns","urn:xmpp:ping")) {
-				this->doPong(tl["id"], tl["from"]);
+				std::lock_guard < std::mutex > gl(store->recordLock(JidAsInt(gid)));
+				GroupSessionBuilder gs(store);
+				gs.process(gid, skd);
 			}
 		}
+		cm.ok = true;
+	}
+	catch (WhisperException &e) {
+		DEBUG_PRINT("Axolotl exception (decipher): "
+			<< e.errorType() << " " << e.errorMessage());
+	}
+	catch (std::exception &e) {
+		DEBUG_PRINT("Cannot decipher message from " << cm.from << ": " << e.what());
 	}
 }
 
-bool WhatsappConnection::receiveCipheredMessage(std::string from, std::string id,
-	std::string author, unsigned long long time, Tree enc, std::string mtype) {
+void WhatsappConnection::receiveDeciphered(const CipheredMessage & cm)
+{
+	if (!cm.ok) {
+		sendMessageRetry(cm.from, cm.type == "msg" ? "" : cm.author, cm.id, cm.time);
+		return;
+	}
 
-	if (enc["type"] == "pkmsg")
-		return this->parsePreKeyWhisperMessage(from, id, author, time, enc, mtype);
-	else if (enc["type"] == "skmsg")
-		return this->parseGroupWhisperMessage(from, id, author, time, enc, mtype);
-	else
-		return this->parseWhisperMessage(from, id, author, time, enc, mtype);
+	// It used one of our prekeys
+	if (cm.type == "pkmsg")
+		schedulePrekeyRefill();
+
+	Tree enc("enc", makeat({"mediatype", cm.mediatype}));
+	this->protobufIncomingMessage(cm.mtype, cm.from, cm.time, cm.id, cm.author, cm.plaintext, enc);
+
+	queueReceipt(cm.receipt_to, cm.id);
 }
 
 void WhatsappConnection::sendEncrypt(bool fresh)
@@ -1383,14 +1482,14 @@ void WhatsappConnection::sendEncrypt(bool fresh)
 	// STORE
 	axolotlStore->storeSignedPreKey(signedPreKey.getId(), signedPreKey);
 
-	outbuffer = outbuffer + serialize_tree(&iq);
+	outbuffer.push(serialize_tree(&iq), OutBulk);
 }
 
 void WhatsappConnection::sendMessageRetry(const std::string &from, const std::string &part, const std::string &msgid, unsigned long long t)
 {
 	Tree resp("receipt", makeat({"to", from, "id", msgid, "type", "retry", "t", std::to_string(time(0))}));
 	if (part != "")
-		resp["participant"] = part;
+		resp.setAtr("participant", part);
 
 	Tree registrationNode("registration");
 	uint64_t registrationId = axolotlStore->getLocalRegistrationId();
@@ -1400,7 +1499,7 @@ void WhatsappConnection::sendMessageRetry(const std::string &from, const std::st
 	Tree retryNode("retry", makeat({"count", "1", "id", msgid, "v", "1", "t", std::to_string(t)}));
 	resp.addChild(retryNode);
 
-	outbuffer = outbuffer + serialize_tree(&resp);
+	outbuffer.push(serialize_tree(&resp), OutReceipt);
 }
 
 SessionCipher *WhatsappConnection::getSessionCipher(uint64_t recepient) {
@@ -1442,6 +1541,9 @@ bool WhatsappConnection::parsePreKeyWhisperMessage(std::string jid, std::string
 		SessionCipher *cipher = getSessionCipher(recepientId);
 		std::string plaintext = cipher->decrypt(message);
 
+		// It used one of our prekeys
+		schedulePrekeyRefill();
+
 		this->protobufIncomingMessage(mtype, jid, time, id, author, plaintext, enc);
 
 		// Try to parse any sender key
@@ -1506,14 +1608,17 @@ bool WhatsappConnection::parseGroupWhisperMessage(std::string jid, std::string i
 }
 
 
-void WhatsappConnection::sendGetCipherKeysFromUser(std::string jid) {
-	Tree iq("iq", makeat({"id", getNextIqId(), "type", "get", "to", whatsappserver, "xmlns", "encrypt"}));
+void WhatsappConnection::sendGetCipherKeysFromUser(std::string jid, IqCallback cb) {
+	std::string id = getNextIqId();
+	Tree iq("iq", makeat({"id", id, "type", "get", "to", whatsappserver, "xmlns", "encrypt"}));
 	Tree kn("key");
 	Tree un("user", makeat({"jid", jid + "@" + whatsappserver}));
 	kn.addChild(un);
 	iq.addChild(kn);
+	if (cb)
+		expectIq(id, cb);
 
-	outbuffer = outbuffer + serialize_tree(&iq);
+	outbuffer.push(serialize_tree(&iq));
 }
 
 
@@ -1523,57 +1628,72 @@ DataBuffer WhatsappConnection::serialize_tree(Tree * tree, bool crypt)
 {
 	DEBUG_PRINT( tree->toString() );
 
-	DataBuffer data = write_tree(tree);
-	if (data.size() >= 1024*1024) {
-		std::cerr << "Skipping huge tree! " << data.size() << std::endl;
+	int size = tree->encodedSize();
+	int fsize = size + (crypt ? 4 : 0);
+	if (fsize > MAX_FRAME_SIZE) {
+		std::cerr << "Skipping huge tree! " << size << std::endl;
 		return DataBuffer();
 	}
-	unsigned char flag = 0;
-	if (crypt) {
-		data = data.encodedBuffer(this->out, &this->session_key[20*1], true, this->frame_seq++);
-		flag = 0x80;
+
+	/* Header, payload and room for the MAC go in one go. Encrypted frames
+	   are sealed in place when outbuffer puts them on the wire, so the
+	   RC4 stream and frame_seq follow the wire order */
+	DataBuffer ret;
+	unsigned char *frame = ret.reserveData(3 + fsize);
+	DataWriter w(frame, 3 + fsize);
+	w.putInt((crypt ? 0x80 : 0) | (fsize >> 16), 1);
+	w.putInt(fsize, 2);
+	tree->encode(&w);
+	return ret;
+}
+
+DataBuffer WhatsappConnection::serialize_template(const StanzaTemplate & st, const std::string * args, bool crypt)
+{
+	/* Same framing as serialize_tree, the payload is the filled template */
+	int size = st.encodedSize(args);
+	int fsize = size + (crypt ? 4 : 0);
+	if (fsize > MAX_FRAME_SIZE) {
+		std::cerr << "Skipping huge stanza! " << size << std::endl;
+		return DataBuffer();
 	}
 
 	DataBuffer ret;
-	ret.putInt(flag | (data.size() >> 16), 1);
-	ret.putInt(data.size(), 2);
-	ret = ret + data;
+	unsigned char *frame = ret.reserveData(3 + fsize);
+	DataWriter w(frame, 3 + fsize);
+	w.putInt((crypt ? 0x80 : 0) | (fsize >> 16), 1);
+	w.putInt(fsize, 2);
+	st.encode(&w, args);
 	return ret;
 }
 
-DataBuffer WhatsappConnection::write_tree(Tree * tree)
+/* Encrypts a frame built with crypt, the stream header and plain frames
+   are left alone */
+void WhatsappConnection::sealFrame(DataBuffer & frame)
 {
-	DataBuffer bout;
-	int len = 1;
-
-	if (tree->getAttributes().size() != 0)
-		len += tree->getAttributes().size() * 2;
-	if (tree->getChildren().size() != 0)
-		len++;
-	if (tree->getData().size() != 0)
-		len++;
-
-	bout.writeListSize(len);
-	if (tree->getTag() == "start")
-		bout.putInt(1, 1);
-	else
-		bout.putString(tree->getTag());
-	tree->writeAttributes(&bout);
+	unsigned char *p = (unsigned char *)frame.getPtr();
+	if (frame.size() < 7 or !(p[0] & 0x80))
+		return;
+	encryptFrame(&p[3], frame.size() - 7, &p[frame.size() - 4]);
+}
 
-	if (tree->getData().size() > 0)
-		bout.putRawString(tree->getData());
-	if (tree->getChildren().size() > 0) {
-		bout.writeListSize(tree->getChildren().size());
+/* RC4 the data in place and write its 4 byte MAC */
+void WhatsappConnection::encryptFrame(unsigned char *data, int len, unsigned char *mac)
+{
+	this->out->cipher(data, len);
+	out_mac.frameMac(data, len, this->frame_seq++, mac);
+}
 
-		for (unsigned int i = 0; i < tree->getChildren().size(); i++) {
-			DataBuffer tt = write_tree(&tree->getChildren()[i]);
-			bout = bout + tt;
-		}
-	}
+DataBuffer WhatsappConnection::write_tree(Tree * tree)
+{
+	/* Size the whole tree first, then encode it in place */
+	int size = tree->encodedSize();
+	DataBuffer bout;
+	DataWriter w(bout.reserveData(size), size);
+	tree->encode(&w);
 	return bout;
 }
 
-bool WhatsappConnection::parse_tree(DataBuffer * data, Tree & t)
+bool WhatsappConnection::parse_tree(DataReader * data, Tree & t)
 {
 	int flag = data->getInt(1);
 	int bflag = (flag & 0xF0) >> 4;
@@ -1581,71 +1701,57 @@ bool WhatsappConnection::parse_tree(DataBuffer * data, Tree & t)
 	if (bsize > data->size() - 3)
 		return false; /* Next message incomplete, return consumed data */
 
-	data->popData(3);
+	data->skip(3);
+	DataReader frame(data->getPtr(), bsize);
+	data->skip(bsize);
+
+	/* The whole frame decodes into one arena, freed with its last Tree.
+	   Only tags and attributes of the stanza are decoded here, the rest
+	   is decoded on first access (most stanzas never look at it) */
+	std::shared_ptr < TreeArena > arena;
+	if (arena_pool.size()) {
+		arena = arena_pool.back();
+		arena_pool.pop_back();
+	}
+	else
+		arena = std::make_shared < TreeArena > (std::max(bsize + 256, 4096));
+	t = Tree(arena);
 
 	if (bflag & 8) {
-		/* Decode data, buffer conversion */
-		if (this->in != NULL) {
-			DataBuffer *decoded_data = data->decodedBuffer(this->in, bsize, false);
-
-			bool res;
-			if (bflag & 4) {
-				DataBuffer *decomp_data = decoded_data->decompressedBuffer();
-				if (decomp_data != NULL) {
-					res = read_tree(decomp_data, t);
-					delete decomp_data;
-				}
-				else
-					res = false;
-			} else {
-				res = read_tree(decoded_data, t);
-			}
-			delete decoded_data;
+		if (this->in == NULL or bsize < 4)
+			return false;
 
-			data->popData(bsize);	/* Pop data unencrypted for next parsing! */
-			return res;
-		} else {
-			data->popData(bsize);
+		/* Check the MAC and decrypt in place, inbuffer is ours */
+		unsigned char *payload = (unsigned char *)frame.getPtr();
+		int psize = bsize - 4;
+		unsigned char mac[4];
+		in_mac.frameMac(payload, psize, this->in_seq++, mac);
+		if (memcmp(mac, &payload[psize], 4) != 0) {
+			this->notifyError(errorUnknown, "Invalid frame MAC");
 			return false;
 		}
-	} else {
-		return read_tree(data, t);
-	}
-}
-
-bool WhatsappConnection::read_tree(DataBuffer * data, Tree & tt)
-{
-	int lsize = data->readListSize();
-	int type = data->getInt(1);
-	if (type == 1) {
-		data->popData(1);
-		Tree t;
-		t.readAttributes(data, lsize);
-		t.setTag("start");
-		tt = t;
-		return true;
-	} else if (type == 2) {
-		data->popData(1);
-		return false;
-	}
+		this->in->cipher(payload, psize);
 
-	Tree t;
-	t.setTag(data->readString());
-	t.readAttributes(data, lsize);
-
-	if ((lsize & 1) == 1) {
-		tt = t;
-		return true;
-	}
+		if (bflag & 4) {
+			int isize = inflater.inflate(payload, psize);
+			if (isize < 0) {
+				this->notifyError(errorUnknown, "Invalid compressed frame");
+				return false;
+			}
+			DataReader plain(inflater.getPtr(), isize);
+			return read_tree(&plain, t, true);
+		}
 
-	if (data->isList()) {
-		t.setChildren(data->readList(this));
+		DataReader plain(payload, psize);
+		return read_tree(&plain, t, true);
 	} else {
-		t.setData(data->readString());
+		return read_tree(&frame, t, true);
 	}
+}
 
-	tt = t;
-	return true;
+bool WhatsappConnection::read_tree(DataReader * data, Tree & t, bool lazy)
+{
+	return t.read(data, lazy);
 }
 
 static int isgroup(const std::string user)
@@ -1728,7 +1834,7 @@ void WhatsappConnection::notifyMyPresence()
 	/* Send the nickname and the current status */
 	Tree pres("presence", makeat({"name", nickname, "type", mypresence}));
 
-	outbuffer = outbuffer + serialize_tree(&pres);
+	outbuffer.push(serialize_tree(&pres));
 }
 
 void WhatsappConnection::sendInitial()
@@ -1737,7 +1843,7 @@ void WhatsappConnection::sendInitial()
 	Tree iq("iq", makeat({"id", getNextIqId(), "type", "get", "to", whatsappserver, "xmlns", "urn:xmpp:whatsapp:push"}));
 	iq.addChild(conf);	
 
-	outbuffer = outbuffer + serialize_tree(&iq);
+	outbuffer.push(serialize_tree(&iq));
 }
 
 void WhatsappConnection::notifyMyMessage()
@@ -1749,7 +1855,7 @@ void WhatsappConnection::notifyMyMessage()
 	Tree mes("iq", makeat({"to", whatsappserver, "type", "set", "id", getNextIqId(), "xmlns", "status"}));
 	mes.addChild(status);
 
-	outbuffer = outbuffer + serialize_tree(&mes);
+	outbuffer.push(serialize_tree(&mes));
 }
 
 void WhatsappConnection::updatePrivacy(
@@ -1766,7 +1872,7 @@ void WhatsappConnection::updatePrivacy(
 	priv.addChild(last); priv.addChild(profile); priv.addChild(status);
 	mes.addChild(priv);
 
-	outbuffer = outbuffer + serialize_tree(&mes);
+	outbuffer.push(serialize_tree(&mes));
 }
 
 void WhatsappConnection::queryPrivacy(
@@ -1785,7 +1891,7 @@ void WhatsappConnection::updatePrivacy() {
 	Tree mes("iq", makeat({"to", whatsappserver, "type", "get", "id", getNextIqId(), "xmlns", "privacy"}));
 	mes.addChild(Tree("privacy"));
 
-	outbuffer = outbuffer + serialize_tree(&mes);
+	outbuffer.push(serialize_tree(&mes));
 }
 
 
@@ -1807,8 +1913,8 @@ WhatsappConnection::ErrorCode WhatsappConnection::getErrors(std::string & reason
 Message* WhatsappConnection::getReceivedMessage()
 {
 	if (recv_messages.size()) {
-		Message * ret = recv_messages[0];
-		recv_messages.erase(recv_messages.begin() + 0);
+		Message * ret = recv_messages.front();
+		recv_messages.pop_front();
 		return ret;
 	}
 	return NULL;
@@ -1908,8 +2014,8 @@ bool WhatsappConnection::query_avatar(std::string user, std::string & icon)
 
 void WhatsappConnection::doPong(std::string id, std::string from)
 {
-	Tree t("iq", makeat({"to",from, "id", id, "type","result"}));
-	outbuffer = outbuffer + serialize_tree(&t);
+	const std::string args[] = { id, from };
+	outbuffer.push(serialize_template(pongTemplate(), args), OutControl);
 }
 
 void WhatsappConnection::sendResponse()
@@ -1919,12 +2025,13 @@ void WhatsappConnection::sendResponse()
 	std::string response = phone + challenge_data + std::to_string(time(NULL)) +
 		std::string("000\000000\000", 8) + resource + std::string("\000Samsung\000GalaxyS3\000JLS36C", 24);
 
-	DataBuffer eresponse(response.c_str(), response.size());
-	eresponse = eresponse.encodedBuffer(this->out, &this->session_key[20*1], false, this->frame_seq++);
-	response = eresponse.toString();
-	t.setData(response);
+	/* The MAC goes first here */
+	std::string eresponse(4 + response.size(), 0);
+	memcpy(&eresponse[4], response.c_str(), response.size());
+	encryptFrame((unsigned char *)&eresponse[4], response.size(), (unsigned char *)&eresponse[0]);
+	t.setData(eresponse);
 
-	outbuffer = outbuffer + serialize_tree(&t, false);
+	outbuffer.push(serialize_tree(&t, false), OutControl);
 }
 
 std::string WhatsappConnection::decodeImage(std::string payload, std::string iv, std::string aeskey) {